@@ -4,6 +4,7 @@
 */
 
 #include "soa/gc/gc_lock.h"
+#include "jml/compiler/compiler.h"
 #include "jml/arch/tick_counter.h"
 #include "jml/arch/spinlock.h"
 #include "jml/arch/futex.h"
@@ -13,10 +14,15 @@
 #include <boost/interprocess/sync/named_mutex.hpp>
 #include <boost/interprocess/sync/scoped_lock.hpp>
 #include <boost/static_assert.hpp>
+#include <stdlib.h>
 #include <sys/mman.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <atomic>
+#include <condition_variable>
 #include <iostream>
+#include <mutex>
+#include <thread>
 
 using namespace std;
 using namespace ML;
@@ -154,6 +160,20 @@ struct GcLockBase::DeferredList {
         deferred3.swap(other.deferred3);
     }
 
+    /** Move all the entries of other at the end of this list. */
+    void append(DeferredList & other)
+    {
+        deferred1.insert(deferred1.end(),
+                         other.deferred1.begin(), other.deferred1.end());
+        deferred2.insert(deferred2.end(),
+                         other.deferred2.begin(), other.deferred2.end());
+        deferred3.insert(deferred3.end(),
+                         other.deferred3.begin(), other.deferred3.end());
+        other.deferred1.clear();
+        other.deferred2.clear();
+        other.deferred3.clear();
+    }
+
     std::vector<DeferredEntry1> deferred1;
     std::vector<DeferredEntry2> deferred2;
     std::vector<DeferredEntry3> deferred3;
@@ -222,18 +242,148 @@ struct GcLockBase::DeferredList {
     }
 };
 
+/// Work deferred by a single thread, all for the same epoch
+struct GcLockBase::DeferBuffer {
+    DeferBuffer(uint64_t lockId)
+        : lockId(lockId), epoch(0), abandoned(false), pending(false)
+    {
+    }
+
+    uint64_t lockId;               ///< Deferred::id of the owning lock
+    ML::Spinlock lock;
+    int32_t epoch;
+    DeferredList list;
+    std::atomic<bool> abandoned;   ///< owning thread is done with it
+    std::atomic<bool> pending;     ///< list is not empty
+};
+
 struct GcLockBase::Deferred {
+    Deferred()
+        : id(++lastId), numPendingBuffers(0), reclaiming(false),
+          reclaimWakeup(false), reclaimShutdown(false), reclaimDelay(0.0)
+    {
+    }
+
+    /// Unique identifier of the lock, since the thread specific entries of
+    /// a destroyed lock can be found again by a lock created at the same
+    /// address.
+    uint64_t id;
+    static std::atomic<uint64_t> lastId;
+
     mutable ML::Spinlock lock;
     std::map<int32_t, DeferredList *> entries;
     std::vector<DeferredList *> spares;
 
+    /// Buffers of the threads that deferred work, with the number of those
+    /// that are not empty, so that runDefers can skip looking at them.
+    std::vector<std::shared_ptr<DeferBuffer> > buffers;
+    std::atomic<int> numPendingBuffers;
+
+    /// Reclamation thread
+    std::atomic<bool> reclaiming;
+    std::atomic<bool> reclaimWakeup;
+    std::atomic<bool> reclaimShutdown;
+    double reclaimDelay;
+    std::mutex reclaimMutex;
+    std::mutex reclaimPassMutex;   ///< held while running deferred work
+    std::condition_variable reclaimCond;
+    std::unique_ptr<std::thread> reclaimThread;
+
     bool empty() const
     {
         boost::lock_guard<ML::Spinlock> guard(lock);
         return entries.empty();
     }
+
+    void wakeReclaimer()
+    {
+        if (!reclaimWakeup.exchange(true))
+            reclaimCond.notify_one();
+    }
 };
 
+std::atomic<uint64_t> GcLockBase::Deferred::lastId(0);
+
+/// Count of the threads in a critical section for RC_SLOTS
+struct GcLockBase::ReaderSlots {
+    enum { NumSlots = 128 };
+
+    /// Threads in each epoch, like Data::in.  Threads are given slots in
+    /// turn so that they only share one when there are more than NumSlots.
+    struct Slot {
+        std::atomic<int32_t> in[2];
+    } JML_ALIGNED(64);
+
+    ReaderSlots()
+        : nextSlot(0), waiters(0), exits(0)
+    {
+        for (unsigned i = 0;  i < NumSlots;  ++i) {
+            slots[i].in[0] = 0;
+            slots[i].in[1] = 0;
+        }
+    }
+
+    Slot slots[NumSlots];
+    std::atomic<unsigned> nextSlot;
+    std::mutex advanceMutex;       ///< held while summing to move epochs on
+
+    /// Writers waiting for readers to exit, which readers only read unless
+    /// there are some, and the futex they wait on.
+    volatile int waiters JML_ALIGNED(64);
+    volatile int exits;
+
+    Slot & get(ThreadGcInfoEntry & entry)
+    {
+        if (JML_UNLIKELY(entry.slot == -1))
+            entry.slot = nextSlot++ % NumSlots;
+        return slots[entry.slot];
+    }
+
+    /** Called once out of a critical section, or after moving the epoch
+        on, so that waiting writers look at the slots again.
+    */
+    void wakeWriters()
+    {
+        if (JML_UNLIKELY(waiters)) {
+            ML::atomic_inc(exits);
+            futex_wake(exits);
+        }
+    }
+
+    /** Wait until the writer's condition on the slots holds.  A writer
+        counts itself as waiting before looking at the slots, so that a
+        reader either exits before and is seen, or sees it and wakes it.
+    */
+    template<typename Condition>
+    void waitForReaders(Condition condition)
+    {
+        ML::atomic_inc(waiters);
+        Call_Guard guard([&] () { ML::atomic_dec(waiters); });
+
+        for (;;) {
+            int seen = exits;
+            if (condition())
+                return;
+            // Another writer may have been summing; look again shortly
+            futex_wait(exits, seen, 0.001);
+        }
+    }
+
+    /** Number of threads in the epochs of the given parity. */
+    int64_t count(int parity) const
+    {
+        int64_t result = 0;
+        for (unsigned i = 0;  i < NumSlots;  ++i)
+            result += slots[i].in[parity];
+        return result;
+    }
+};
+
+/** With RC_SLOTS, number of pieces of work a thread defers between two
+    attempts at running deferred work.
+*/
+enum { DeferBatchSize = 64 };
+
 std::string
 GcLockBase::ThreadGcInfoEntry::
 print() const
@@ -328,19 +478,65 @@ print() const
 }
 
 GcLockBase::
-GcLockBase()
+GcLockBase(ReaderCount readerCount)
+    : slots(0)
 {
     deferred = new Deferred();
+
+    if (readerCount == RC_SLOTS) {
+        // new doesn't honour the alignment of the slots
+        void * mem;
+        int res = posix_memalign(&mem, 64, sizeof(ReaderSlots));
+        if (res != 0)
+            throw ML::Exception(res, "posix_memalign");
+        slots = new (mem) ReaderSlots();
+    }
 }
 
 GcLockBase::
 ~GcLockBase()
 {
+    // Derived classes stop it in finishDeferred(), while data is valid
+    ExcAssert(!deferred->reclaimThread);
+
+    // Make the work still held by threads show up in the dump below
+    {
+        std::vector<std::shared_ptr<DeferBuffer> > buffers;
+        {
+            boost::lock_guard<ML::Spinlock> guard(deferred->lock);
+            buffers.swap(deferred->buffers);
+        }
+        for (auto & buffer: buffers) {
+            boost::lock_guard<ML::Spinlock> guard(buffer->lock);
+            if (buffer->pending)
+                publishDeferBuffer(*buffer, true /* force */);
+        }
+    }
+
     if (!deferred->empty()) {
         dump();
     }
 
     delete deferred;
+
+    if (slots) {
+        slots->~ReaderSlots();
+        free(slots);
+    }
+}
+
+void
+GcLockBase::
+finishDeferred()
+{
+    stopReclamationThread();
+
+    // Nothing else will move the epochs on.  With no reader left, the
+    // second advance makes all the deferred work visible.
+    if (slots) {
+        advanceEpoch();
+        runDefers();
+    }
 }
 
 bool
@@ -375,7 +571,10 @@ updateData(Data & oldValue, Data & newValue, RunDefer runDefer)
         // anything that was waiting for it to be visible and run any
         // deferred handlers.
         futex_wake(data->visibleEpoch);
-        if (runDefer) {
+        if (deferred->reclaiming.load(std::memory_order_relaxed)) {
+            deferred->wakeReclaimer();
+        }
+        else if (runDefer) {
             runDefers();
         }
     }
@@ -387,10 +586,15 @@ void
 GcLockBase::
 runDefers()
 {
+    if (slots)
+        advanceEpoch();
+
     std::vector<DeferredList *> toRun;
     {
         boost::lock_guard<ML::Spinlock> guard(deferred->lock);
         toRun = checkDefers();
+        if (deferred->numPendingBuffers.load(std::memory_order_relaxed))
+            collectDeferBuffers(toRun);
     }
 
     for (unsigned i = 0;  i < toRun.size();  ++i) {
@@ -399,6 +603,103 @@ runDefers()
     }
 }
 
+void
+GcLockBase::
+collectDeferBuffers(std::vector<DeferredList *> & toRun)
+{
+    auto & buffers = deferred->buffers;
+
+    for (auto it = buffers.begin();  it != buffers.end();  /* no inc */) {
+        DeferBuffer & buffer = **it;
+
+        // Nothing is added to a buffer once it has been abandoned
+        if (!buffer.pending) {
+            if (buffer.abandoned)
+                it = buffers.erase(it);
+            else ++it;
+            continue;
+        }
+
+        // Lock order is buffer then deferred, so we can only try here.  A
+        // buffer that is busy will be looked at on the next call.
+        if (!buffer.lock.try_lock()) {
+            ++it;
+            continue;
+        }
+
+        if (buffer.pending
+            && compareEpochs(buffer.epoch, data->visibleEpoch) <= 0) {
+            DeferredList * list = new DeferredList();
+            list->swap(buffer.list);
+            toRun.push_back(list);
+            buffer.pending = false;
+            --deferred->numPendingBuffers;
+        }
+
+        bool remove = buffer.abandoned && !buffer.pending;
+        buffer.lock.unlock();
+
+        if (remove)
+            it = buffers.erase(it);
+        else ++it;
+    }
+}
+
+GcLockBase::DeferBuffer &
+GcLockBase::
+getDeferBuffer(ThreadGcInfoEntry & entry)
+{
+    if (!entry.deferBuffer || entry.deferBuffer->lockId != deferred->id) {
+        if (entry.deferBuffer)
+            releaseDeferBuffer(*entry.deferBuffer);
+        entry.deferBuffer = std::make_shared<DeferBuffer>(deferred->id);
+        boost::lock_guard<ML::Spinlock> guard(deferred->lock);
+        deferred->buffers.push_back(entry.deferBuffer);
+    }
+
+    return *entry.deferBuffer;
+}
+
+GcLockBase::DeferredList *
+GcLockBase::
+publishDeferBuffer(DeferBuffer & buffer, bool force)
+{
+    DeferredList * toRun = 0;
+
+    {
+        boost::lock_guard<ML::Spinlock> guard(deferred->lock);
+
+        // If the epoch is over then nothing can still see the objects
+        if (!force && !deferred->reclaiming
+            && compareEpochs(buffer.epoch, data->visibleEpoch) <= 0) {
+            toRun = new DeferredList();
+            toRun->swap(buffer.list);
+        }
+        else {
+            auto epochIt = deferred->entries.insert
+                (make_pair(buffer.epoch, (DeferredList *)0)).first;
+            if (epochIt->second == 0) {
+                epochIt->second = new DeferredList();
+                epochIt->second->swap(buffer.list);
+            }
+            else epochIt->second->append(buffer.list);
+        }
+
+        buffer.pending = false;
+        --deferred->numPendingBuffers;
+    }
+
+    return toRun;
+}
+
+void
+GcLockBase::
+releaseDeferBuffer(DeferBuffer & buffer)
+{
+    boost::lock_guard<ML::Spinlock> guard(buffer.lock);
+    buffer.abandoned = true;
+}
+
 std::vector<GcLockBase::DeferredList *>
 GcLockBase::
 checkDefers()
@@ -439,6 +740,27 @@ enterCS(ThreadGcInfoEntry * entry, RunDefer runDefer)
         
     ExcAssertEqual(entry->inEpoch, -1);
 
+    if (slots) {
+        ReaderSlots::Slot & slot = slots->get(*entry);
+
+        for (;;) {
+            int32_t epoch = data->epoch;
+
+            // Count ourselves in before checking the epoch again, so that a
+            // writer that moves it on either sees us or is seen by us.
+            slot.in[epoch & 1].fetch_add(1);
+            if (JML_LIKELY(!data->exclusive && data->epoch == epoch)) {
+                entry->inEpoch = epoch & 1;
+                return;
+            }
+
+            slot.in[epoch & 1].fetch_sub(1);
+            slots->wakeWriters();
+            if (data->exclusive)
+                futex_wait(data->exclusive, 1);
+        }
+    }
+
 #if 0 // later...
     // Be optimistic...
     int optimisticEpoch = data->epoch;
@@ -488,6 +810,15 @@ exitCS(ThreadGcInfoEntry * entry, RunDefer runDefer /* = true */)
 
     ExcCheck(entry->inEpoch == 0 || entry->inEpoch == 1,
             "Invalid inEpoch");
+
+    // Writers notice when the epoch ends
+    if (slots) {
+        slots->slots[entry->slot].in[entry->inEpoch].fetch_sub(1);
+        slots->wakeWriters();
+        entry->inEpoch = -1;
+        return;
+    }
+
     // Fast path
     if (__sync_fetch_and_add(data->in + entry->inEpoch, -1) > 1) {
         entry->inEpoch = -1;
@@ -516,6 +847,31 @@ enterCSExclusive(ThreadGcInfoEntry * entry)
 {
     ExcAssertEqual(entry->inEpoch, -1);
 
+    if (slots) {
+        for (;;) {
+            Data current = *data;
+            if (current.exclusive) {
+                futex_wait(data->exclusive, 1);
+                continue;
+            }
+
+            // Not through updateData, which would count the readers
+            Data newValue = current;
+            newValue.exclusive = 1;
+            if (ML::cmp_xchg(data->q, current.q, newValue.q))
+                break;
+        }
+
+        // Readers back off once they see the flag; wait for the others
+        slots->waitForReaders([&] ()
+            {
+                return slots->count(0) + slots->count(1) == 0;
+            });
+
+        entry->inEpoch = data->epoch & 1;
+        return;
+    }
+
     Data current = *data, newValue;
 
     for (;;) {
@@ -639,6 +995,18 @@ visibleBarrier()
         throw ML::Exception("visibleBarrier called in critical section will "
                             "deadlock");
 
+    // Anything visible now is in an epoch up to the current one
+    if (slots) {
+        int32_t startEpoch = data->epoch;
+        slots->waitForReaders([&] ()
+            {
+                advanceEpoch();
+                return compareEpochs<int32_t>(data->visibleEpoch,
+                                              startEpoch) >= 0;
+            });
+        return;
+    }
+
     Data current = *data;
     int startEpoch = data->epoch;
     //int startVisible = data.visibleEpoch;
@@ -701,13 +1069,25 @@ deferBarrier()
         
         ML::atomic_add(lock, -1);
         
-        futex_wait(lock, -1);
+        // Readers don't run deferred work with RC_SLOTS
+        if (slots) {
+            while (*(volatile int *)&lock == -1) {
+                visibleBarrier();
+                runDefers();
+            }
+        }
+        else futex_wait(lock, -1);
     }
 
     // If certain threads aren't allowed to execute deferred work
     // then it's possible that not all deferred work will have been executed.
     // To be sure, we run any leftover work.
     runDefers();
+
+    // The reclamation thread may still be running work it took earlier
+    if (deferred->reclaiming) {
+        std::lock_guard<std::mutex> guard(deferred->reclaimPassMutex);
+    }
 }
 
 /** Helper function to call an arbitrary boost::function passed through with a void * */
@@ -750,65 +1130,97 @@ doDefer(void (fn) (Args...), Args... args)
     //
     // If there are threads in the current epoch (irrespective of the old
     // epoch) then we need to wait until the current epoch is done.
+    //
+    // With RC_SLOTS, the readers can't be counted here; any of them could be
+    // in the current epoch so the work waits for it to end.  The barrier
+    // makes sure that a reader of a later epoch started after the objects
+    // were unlinked.
+
+    if (slots)
+        ML::memory_barrier();
 
     Data current = *data;
 
     int32_t newestVisibleEpoch = current.epoch;
-    if (current.inCurrent() == 0) --newestVisibleEpoch;
+    if (!slots && current.inCurrent() == 0) --newestVisibleEpoch;
 
 #if 1
     // Nothing is in a critical section; we can run it inline
-    if (current.inCurrent() + current.inOld() == 0) {
+    if (!slots && current.inCurrent() + current.inOld() == 0) {
         fn(std::forward<Args>(args)...);
         return;
     }
 #endif
 
+    DeferredList * expired = 0;
+    bool buffered = false;
+    bool flush = false;
+
     for (int i = 0; i == 0; ++i) {
-        // Lock the deferred structure
-        boost::lock_guard<ML::Spinlock> guard(deferred->lock);
+        // Lock the buffer of this thread, which is only contended by threads
+        // collecting expired work
+        DeferBuffer & buffer = getDeferBuffer(getEntry());
+        boost::lock_guard<ML::Spinlock> guard(buffer.lock);
 
 #if 1
-        // Get back to current again
-        current = *data;
-
-        // Find the oldest live epoch
-        int oldestLiveEpoch = -1;
-        if (current.inOld() > 0)
-            oldestLiveEpoch = current.epoch - 1;
-        else if (current.inCurrent() > 0)
-            oldestLiveEpoch = current.epoch;
-    
-        if (oldestLiveEpoch == -1 || 
-                compareEpochs(oldestLiveEpoch, newestVisibleEpoch) > 0)
-        {
-            // Nothing in a critical section so we can run it now and exit
-            break;
+        if (!slots) {
+            // Get back to current again
+            current = *data;
+
+            // Find the oldest live epoch
+            int oldestLiveEpoch = -1;
+            if (current.inOld() > 0)
+                oldestLiveEpoch = current.epoch - 1;
+            else if (current.inCurrent() > 0)
+                oldestLiveEpoch = current.epoch;
+
+            if (oldestLiveEpoch == -1 ||
+                    compareEpochs(oldestLiveEpoch, newestVisibleEpoch) > 0)
+            {
+                // Nothing in a critical section so we can run it now and exit
+                break;
+            }
+
+            // Nothing is in a critical section; we can run it inline
+            if (current.inCurrent() + current.inOld() == 0)
+                break;
         }
-    
-        // Nothing is in a critical section; we can run it inline
-        if (current.inCurrent() + current.inOld() == 0)
-            break;
 #endif
 
-        // OK, get the deferred list
-        auto epochIt
-            = deferred->entries.insert
-            (make_pair(newestVisibleEpoch, (DeferredList *)0)).first;
-        if (epochIt->second == 0) {
-            // Create a new list
-            epochIt->second = new DeferredList();
+        // A buffer only holds work for a single epoch; publish the previous
+        // batch when moving on to a new one.
+        if (buffer.pending && buffer.epoch != newestVisibleEpoch)
+            expired = publishDeferBuffer(buffer);
+
+        if (!buffer.pending) {
+            buffer.epoch = newestVisibleEpoch;
+            buffer.pending = true;
+            ++deferred->numPendingBuffers;
         }
-        
-        DeferredList & list = *epochIt->second;
-        list.addDeferred(newestVisibleEpoch, fn, std::forward<Args>(args)...);
 
-        // TODO: we only need to do this if the newestVisibleEpoch has
-        // changed since we last calculated it...
-        //checkDefers();
+        buffer.list.addDeferred(newestVisibleEpoch, fn,
+                                std::forward<Args>(args)...);
+        buffered = true;
 
-        return;
+        // Nothing else moves the epochs on with RC_SLOTS
+        flush = slots && buffer.list.size() % DeferBatchSize == 0;
+    }
+
+    // Deferred work may defer more work, so it can't run with the buffer
+    // locked
+    if (expired) {
+        expired->runAll();
+        delete expired;
     }
+
+    if (flush) {
+        if (deferred->reclaiming)
+            deferred->wakeReclaimer();
+        else runDefers();
+    }
+
+    if (buffered)
+        return;
     
     // If we got here we can run it straight away
     fn(std::forward<Args>(args)...);
@@ -836,13 +1248,110 @@ defer(void (work) (void *, void *, void *), void * arg1, void * arg2, void * arg
     doDefer(work, arg1, arg2, arg3);
 }
 
+void
+GcLockBase::
+startReclamationThread(double maxDelay)
+{
+    if (deferred->reclaimThread)
+        throw ML::Exception("reclamation thread already started");
+
+    deferred->reclaimDelay = maxDelay;
+    deferred->reclaimShutdown = false;
+    deferred->reclaiming = true;
+    deferred->reclaimThread.reset
+        (new std::thread(std::bind(&GcLockBase::runReclamationThread,
+                                   this)));
+}
+
+void
+GcLockBase::
+stopReclamationThread()
+{
+    if (!deferred->reclaimThread)
+        return;
+
+    {
+        std::lock_guard<std::mutex> guard(deferred->reclaimMutex);
+        deferred->reclaimShutdown = true;
+    }
+    deferred->reclaimCond.notify_all();
+
+    deferred->reclaimThread->join();
+    deferred->reclaimThread.reset();
+    deferred->reclaiming = false;
+
+    // Don't leave behind the work of the last epochs
+    runDefers();
+}
+
+void
+GcLockBase::
+runReclamationThread()
+{
+    auto delay = std::chrono::microseconds
+        (int64_t(deferred->reclaimDelay * 1000000.0));
+
+    while (!deferred->reclaimShutdown) {
+        {
+            std::unique_lock<std::mutex> guard(deferred->reclaimMutex);
+            deferred->reclaimCond.wait_for(guard, delay, [&] ()
+                {
+                    return deferred->reclaimWakeup.load()
+                        || deferred->reclaimShutdown.load();
+                });
+            deferred->reclaimWakeup = false;
+        }
+
+        std::lock_guard<std::mutex> guard(deferred->reclaimPassMutex);
+        runDefers();
+    }
+}
+
+bool
+GcLockBase::
+advanceEpoch()
+{
+    std::unique_lock<std::mutex> guard(slots->advanceMutex, std::try_to_lock);
+    if (!guard)
+        return false;
+
+    Data current = *data;
+    int32_t epoch = current.epoch;
+
+    // The previous advance left no reader in epoch - 2.  A reader that
+    // counts itself in epoch - 1 from now on read the epoch before it
+    // moved on, and will see that it changed and back off; so once the sum
+    // is zero, nothing is left in epoch - 1.
+    if (slots->count((epoch - 1) & 1) != 0)
+        return false;
+
+    // Work deferred up to epoch - 1 can now run, and the parity of the old
+    // epoch is free for the new one.  Only the exclusive flag can change
+    // under us.
+    for (;;) {
+        Data newValue = current;
+        newValue.epoch = epoch + 1;
+        newValue.visibleEpoch = epoch - 1;
+        if (ML::cmp_xchg(data->q, current.q, newValue.q)) {
+            slots->wakeWriters();
+            return true;
+        }
+        ExcAssertEqual(current.epoch, epoch);
+    }
+}
+
 void
 GcLockBase::
 dump()
 {
     Data current = *data;
-    cerr << "epoch " << current.epoch << " in " << current.inCurrent()
-         << " in-1 " << current.inOld() << " vis " << current.visibleEpoch
+    int in = current.inCurrent(), inOld = current.inOld();
+    if (slots) {
+        in = slots->count(current.epoch & 1);
+        inOld = slots->count((current.epoch - 1) & 1);
+    }
+    cerr << "epoch " << current.epoch << " in " << in
+         << " in-1 " << inOld << " vis " << current.visibleEpoch
          << " excl " << current.exclusive << endl;
     cerr << "deferred: ";
     {
@@ -854,6 +1363,9 @@ dump()
             cerr << " " << it->first << " (" << it->second->size()
                  << " entries)";
         }
+
+        cerr << "; " << deferred->numPendingBuffers << " of "
+             << deferred->buffers.size() << " thread buffers pending";
     }
     cerr << endl;
 }
@@ -864,15 +1376,20 @@ dump()
 /*****************************************************************************/
 
 GcLock::
-GcLock()
+GcLock(ReaderCount readerCount)
+    : GcLockBase(readerCount)
 {
+    // With RC_SLOTS, work is deferred to the current epoch, which is not
+    // over yet
+    if (readerCount == RC_SLOTS)
+        localData.visibleEpoch = localData.epoch - 1;
     data = &localData;
 }
 
 GcLock::
 ~GcLock()
 {
-    // Nothing to cleanup.
+    finishDeferred();
 }
 
 void
@@ -947,6 +1464,8 @@ SharedGcLock(GcOpen, const string& name) :
 SharedGcLock::
 ~SharedGcLock()
 {
+    finishDeferred();
+
     munmap(addr, GcLockFileSize);
     close(fd);
 }
@@ -15,6 +15,7 @@
 #include "jml/arch/atomic_ops.h"
 #include "jml/arch/thread_specific.h"
 #include <vector>
+#include <memory>
 #include <iostream>
 
 #if GC_LOCK_DEBUG
@@ -57,6 +58,10 @@ extern int32_t SpeculativeThreshold;
 
 struct GcLockBase : public boost::noncopyable {
 
+private:
+    struct DeferBuffer;
+    struct ReaderSlots;
+
 public:
 
     /** Enum for type safe specification of whether or not we run deferrals on
@@ -68,12 +73,32 @@ public:
         RD_YES = 1      ///< Potentially run deferred work on this call
     };
 
+    /** How the threads in a critical section are counted.
+
+        With RC_SHARED, every entry and exit of a critical section updates
+        the shared data word, which keeps the bookkeeping exact but bounces
+        its cache line between all the reading cores.
+
+        With RC_SLOTS, each thread counts itself in a slot of its own
+        cache line, and it is up to the writers (defer, visibleBarrier,
+        deferBarrier and the reclamation thread) to sum the slots to move
+        the epochs on.  Readers then never write to shared memory, but
+        deferred work is always delayed until a writer notices that its
+        epoch has ended; it is best used with startReclamationThread.
+        Slots are local to the process, so SharedGcLock is always
+        RC_SHARED.
+    */
+    enum ReaderCount {
+        RC_SHARED = 0,  ///< Count readers in the shared data word
+        RC_SLOTS = 1    ///< Count readers in per-thread slots
+    };
+
     /// A thread's bookkeeping info about each GC area
     struct ThreadGcInfoEntry {
         ThreadGcInfoEntry()
             : inEpoch(-1), readLocked(0), writeLocked(0),
               specLocked(0), specUnlocked(0),
-              owner(0)
+              owner(0), slot(-1)
         {
         }
 
@@ -90,7 +115,12 @@ public:
                 unlockShared(RD_YES);
                 specUnlocked = 0;
             }
-           
+
+            /* Work deferred by this thread stays in its buffer until it
+             * can be run by another thread.
+             */
+            if (deferBuffer)
+                releaseDeferBuffer(*deferBuffer);
         } 
 
 
@@ -103,6 +133,13 @@ public:
 
         GcLockBase *owner;
 
+        /// Reader slot of the thread when the lock is RC_SLOTS
+        int slot;
+
+        /// Work deferred by this thread and not yet published to the lock.
+        /// Shared with the lock, which may outlive the thread or not.
+        std::shared_ptr<DeferBuffer> deferBuffer;
+
         void init(const GcLockBase * const self) {
             if (!owner) 
                 owner = const_cast<GcLockBase *>(self);
@@ -272,7 +309,7 @@ public:
         //return *gcInfo.get(info);
     }
 
-    GcLockBase();
+    GcLockBase(ReaderCount readerCount = RC_SHARED);
 
     virtual ~GcLockBase();
 
@@ -515,6 +552,16 @@ public:
     */
     void deferBarrier();
 
+    /** Run the given work once no critical section that could have seen the
+        objects it refers to is still active.
+
+        The work is first kept in a buffer private to the calling thread,
+        which is published to the lock in a single batch once the epoch
+        moves on, so that concurrent writers do not contend on a shared
+        structure.  Work whose epoch has ended is picked up from those
+        buffers by whichever thread runs the deferred work, so that
+        publishing is never a prerequisite for reclamation.
+    */
     void defer(boost::function<void ()> work);
 
     typedef void (WorkFn1) (void *);
@@ -554,11 +601,31 @@ public:
         this->defer(bound);
     }
 
+    /** Run the deferred work in a dedicated thread instead of in the
+        threads that leave a critical section, which then never execute
+        deferred work, whatever their RunDefer argument.  The thread wakes
+        up whenever an epoch ends, or every maxDelay seconds should the
+        wakeup be missed.
+    */
+    void startReclamationThread(double maxDelay = 0.01);
+
+    /** Stop the reclamation thread, after which deferred work is executed
+        in the threads leaving a critical section again.  Automatically
+        called on destruction.
+    */
+    void stopReclamationThread();
+
     void dump();
 
 protected:
     Data* data;
 
+    /** Stop the reclamation thread and, with RC_SLOTS, run the work that
+        no critical section can still see.  Called by the destructor of
+        derived classes, while data is still valid.
+    */
+    void finishDeferred();
+
 private:
     struct Deferred;
     struct DeferredList;
@@ -566,6 +633,7 @@ private:
     GcInfo gcInfo;
 
     Deferred * deferred;   ///< Deferred workloads (hidden structure)
+    ReaderSlots * slots;   ///< Reader counts with RC_SLOTS; null otherwise
 
     /** Update with the new value after first checking that the current
         value is the same as the old value.  Returns true if it
@@ -586,6 +654,33 @@ private:
         called with deferred locked.
     */
     std::vector<DeferredList *> checkDefers();
+
+    /** Take the work of the per-thread buffers whose epoch has ended.  Must
+        be called with deferred locked.
+    */
+    void collectDeferBuffers(std::vector<DeferredList *> & toRun);
+
+    /** Buffer of the calling thread, created on first use. */
+    DeferBuffer & getDeferBuffer(ThreadGcInfoEntry & entry);
+
+    /** Move the content of a buffer to the deferred structure.  If its
+        epoch has already ended, the content is instead returned, to be run
+        by the caller once the buffer is unlocked, unless "force" is set.
+        Must be called with the buffer locked.
+    */
+    DeferredList * publishDeferBuffer(DeferBuffer & buffer,
+                                      bool force = false);
+
+    /** Called when the thread owning a buffer exits. */
+    static void releaseDeferBuffer(DeferBuffer & buffer);
+
+    void runReclamationThread();
+
+    /** With RC_SLOTS, end the old epoch if no slot counts a reader in it
+        anymore, and start a new one.  Returns false if the epoch could not
+        be moved on, or if another thread was already doing it.
+    */
+    bool advanceEpoch();
 };
 
 
@@ -597,7 +692,7 @@ private:
 
 struct GcLock : public GcLockBase
 {
-    GcLock();
+    GcLock(ReaderCount readerCount = RC_SHARED);
     virtual ~GcLock();
 
     virtual void unlink();
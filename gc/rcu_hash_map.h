@@ -0,0 +1,442 @@
+/* rcu_hash_map.h                                                  -*- C++ -*-
+   Copyright (c) 2015 Datacratic.  All rights reserved.
+
+   Concurrent hash map whose readers are protected by a GcLock.
+*/
+
+#ifndef __mmap__rcu_hash_map_h__
+#define __mmap__rcu_hash_map_h__
+
+#include "gc_lock.h"
+#include "rcu_protected.h"
+#include "jml/arch/spinlock.h"
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+namespace Datacratic {
+
+
+/*****************************************************************************/
+/* RCU HASH MAP                                                              */
+/*****************************************************************************/
+
+/** Hash map for large, read-mostly tables, where an update only copies the
+    entry that it changes rather than the whole table as with
+    RcuProtected<std::unordered_map>.
+
+    Readers never lock: they walk a bucket within a shared critical section
+    of the GcLock.  Writers lock the bucket of their key only, and never
+    modify an entry that may be seen: setting a key replaces its entry, and
+    the old entry is deleted once no reader can still see it.
+
+    The table doubles in size once it holds more entries than buckets.  The
+    buckets are then moved to the new table a batch at a time by the
+    writers that come along, so that no single write pays for the whole
+    table; meanwhile, the buckets that have moved are looked up in the new
+    table.  The old table is deleted once all its buckets have moved and no
+    reader can still see it.  Moving copies the entries, so keys and values
+    must be copy constructible.
+
+    Nothing may be using the map anymore when it is destroyed.
+*/
+
+template<typename Key, typename Value,
+         typename Hash = std::hash<Key>,
+         typename Equal = std::equal_to<Key> >
+struct RcuHashMap {
+
+    RcuHashMap(GcLock & lock, size_t initialBuckets = 16)
+        : lock(&lock), numEntries(0)
+    {
+        size_t size = 1;
+        while (size < initialBuckets)
+            size *= 2;
+        current = new Table(size);
+    }
+
+    ~RcuHashMap()
+    {
+        // A table being moved only holds the entries that it didn't give
+        // away, and entries removed earlier have been deferred already
+        Table * table = current;
+        while (table) {
+            Table * next = table->next;
+            delete table;
+            table = next;
+        }
+    }
+
+    size_t size() const
+    {
+        return numEntries;
+    }
+
+    bool empty() const
+    {
+        return numEntries == 0;
+    }
+
+    /** Number of buckets of the newest table. */
+    size_t bucketCount() const
+    {
+        GcLock::SharedGuard guard(*lock);
+
+        const Table * table = current.load(std::memory_order_acquire);
+        const Table * next = table->next.load(std::memory_order_acquire);
+        return next ? next->size : table->size;
+    }
+
+    /** Value of the key, or null if absent.  The value stays valid while
+        the result, which holds a critical section, is alive.
+    */
+    RcuLocked<const Value> find(const Key & key) const
+    {
+        RcuLocked<const Value> result(nullptr, lock);
+        const Node * node = findNode(key);
+        if (node)
+            result.ptr = &node->value;
+        return result;
+    }
+
+    /** Copy the value of the key into value.  Returns false if absent. */
+    bool get(const Key & key, Value & value) const
+    {
+        GcLock::SharedGuard guard(*lock);
+
+        const Node * node = findNode(key);
+        if (!node)
+            return false;
+        value = node->value;
+        return true;
+    }
+
+    bool count(const Key & key) const
+    {
+        GcLock::SharedGuard guard(*lock);
+
+        return findNode(key) != nullptr;
+    }
+
+    /** Call fn(key, value) on each entry.  The entries that are present for
+        the whole call are seen exactly once; those added or removed during
+        the call may or may not be seen.
+    */
+    template<typename Fn>
+    void forEach(const Fn & fn) const
+    {
+        GcLock::SharedGuard guard(*lock);
+
+        const Table * table = current.load(std::memory_order_acquire);
+        for (size_t i = 0;  i < table->size;  ++i)
+            forEachInBucket(table, i, fn);
+    }
+
+    /** Add the key if it is absent.  Returns false, leaving the map
+        unchanged, if it is present.
+    */
+    bool insert(const Key & key, const Value & value)
+    {
+        size_t hash = hashOf(key);
+        GcLock::SharedGuard guard(*lock);
+
+        {
+            Bucket & bucket = lockBucket(hash);
+            std::lock_guard<ML::Spinlock> bucketGuard(bucket.lock,
+                                                      std::adopt_lock);
+            if (findLink(bucket, hash, key))
+                return false;
+            pushFront(bucket, new Node(hash, key, value));
+        }
+
+        ++numEntries;
+        afterWrite();
+        return true;
+    }
+
+    /** Add the key or replace its value.  Returns true if it was absent. */
+    bool set(const Key & key, const Value & value)
+    {
+        size_t hash = hashOf(key);
+        GcLock::SharedGuard guard(*lock);
+
+        Node * replaced = nullptr;
+        {
+            Bucket & bucket = lockBucket(hash);
+            std::lock_guard<ML::Spinlock> bucketGuard(bucket.lock,
+                                                      std::adopt_lock);
+            std::atomic<Node *> * link = findLink(bucket, hash, key);
+            if (link) {
+                replaced = link->load(std::memory_order_relaxed);
+                Node * node = new Node(hash, key, value);
+                node->next.store(replaced->next.load(std::memory_order_relaxed),
+                                 std::memory_order_relaxed);
+                link->store(node, std::memory_order_release);
+            }
+            else pushFront(bucket, new Node(hash, key, value));
+        }
+
+        // Deferred work may use the map, so it isn't done under the lock
+        if (replaced) {
+            lock->deferDelete(replaced);
+        }
+        else {
+            ++numEntries;
+        }
+
+        afterWrite();
+        return !replaced;
+    }
+
+    /** Remove the key.  Returns false if it was absent. */
+    bool erase(const Key & key)
+    {
+        size_t hash = hashOf(key);
+        GcLock::SharedGuard guard(*lock);
+
+        Node * removed = nullptr;
+        {
+            Bucket & bucket = lockBucket(hash);
+            std::lock_guard<ML::Spinlock> bucketGuard(bucket.lock,
+                                                      std::adopt_lock);
+            std::atomic<Node *> * link = findLink(bucket, hash, key);
+            if (!link)
+                return false;
+            removed = link->load(std::memory_order_relaxed);
+            // Readers on the removed entry carry on with the rest
+            link->store(removed->next.load(std::memory_order_relaxed),
+                        std::memory_order_release);
+        }
+
+        lock->deferDelete(removed);
+        --numEntries;
+        afterWrite();
+        return true;
+    }
+
+private:
+    /// Number of buckets moved to the new table by each write while
+    /// resizing
+    enum { MoveBatchSize = 64 };
+
+    struct Node {
+        Node(size_t hash, const Key & key, const Value & value)
+            : hash(hash), key(key), value(value), next(nullptr)
+        {
+        }
+
+        const size_t hash;
+        const Key key;
+        const Value value;
+        std::atomic<Node *> next;
+    };
+
+    struct Bucket {
+        Bucket()
+            : head(nullptr), moved(false)
+        {
+        }
+
+        std::atomic<Node *> head;
+        std::atomic<bool> moved;     ///< entries are in the next table
+        ML::Spinlock lock;           ///< held by writers
+    };
+
+    struct Table {
+        Table(size_t size)
+            : size(size), buckets(new Bucket[size]), next(nullptr),
+              resizing(false), nextToMove(0), numMoved(0)
+        {
+        }
+
+        ~Table()
+        {
+            for (size_t i = 0;  i < size;  ++i) {
+                Node * node = buckets[i].head;
+                while (node) {
+                    Node * next = node->next;
+                    delete node;
+                    node = next;
+                }
+            }
+        }
+
+        Bucket & bucket(size_t hash)
+        {
+            return buckets[hash & (size - 1)];
+        }
+
+        const Bucket & bucket(size_t hash) const
+        {
+            return buckets[hash & (size - 1)];
+        }
+
+        const size_t size;
+        std::unique_ptr<Bucket[]> buckets;
+
+        /// Table twice as large that the buckets are moving to
+        std::atomic<Table *> next;
+        std::atomic<bool> resizing;
+        std::atomic<size_t> nextToMove;
+        std::atomic<size_t> numMoved;
+    };
+
+    GcLock * lock;
+    std::atomic<Table *> current;    ///< oldest table still in use
+    std::atomic<size_t> numEntries;
+    Hash hasher;
+    Equal equal;
+
+    /** Hash of a key, with its bits mixed so that the low ones, which
+        select the bucket, depend on all of them.
+    */
+    size_t hashOf(const Key & key) const
+    {
+        uint64_t hash = hasher(key);
+        hash *= 0x9e3779b97f4a7c15ULL;
+        return hash ^ (hash >> 32);
+    }
+
+    /** Must be called in a critical section. */
+    const Node * findNode(const Key & key) const
+    {
+        size_t hash = hashOf(key);
+
+        const Table * table = current.load(std::memory_order_acquire);
+        const Bucket * bucket = &table->bucket(hash);
+        while (bucket->moved.load(std::memory_order_acquire)) {
+            table = table->next.load(std::memory_order_acquire);
+            bucket = &table->bucket(hash);
+        }
+
+        for (const Node * node = bucket->head.load(std::memory_order_acquire);
+             node;  node = node->next.load(std::memory_order_acquire)) {
+            if (node->hash == hash && equal(node->key, key))
+                return node;
+        }
+
+        return nullptr;
+    }
+
+    template<typename Fn>
+    void forEachInBucket(const Table * table, size_t index,
+                         const Fn & fn) const
+    {
+        const Bucket & bucket = table->buckets[index];
+
+        // A bucket is split in two when moving to a table twice as large
+        if (bucket.moved.load(std::memory_order_acquire)) {
+            const Table * next = table->next.load(std::memory_order_acquire);
+            forEachInBucket(next, index, fn);
+            forEachInBucket(next, index + table->size, fn);
+            return;
+        }
+
+        for (const Node * node = bucket.head.load(std::memory_order_acquire);
+             node;  node = node->next.load(std::memory_order_acquire))
+            fn(node->key, node->value);
+    }
+
+    /** Lock the bucket of the given hash in the table where its entries
+        are.  Must be called in a critical section.
+    */
+    Bucket & lockBucket(size_t hash)
+    {
+        Table * table = current.load(std::memory_order_acquire);
+        for (;;) {
+            Bucket & bucket = table->bucket(hash);
+            bucket.lock.lock();
+            if (!bucket.moved.load(std::memory_order_relaxed))
+                return bucket;
+            bucket.lock.unlock();
+            table = table->next.load(std::memory_order_acquire);
+        }
+    }
+
+    /** Link to the entry of the key in a locked bucket, or null. */
+    std::atomic<Node *> *
+    findLink(Bucket & bucket, size_t hash, const Key & key)
+    {
+        std::atomic<Node *> * link = &bucket.head;
+        for (Node * node = link->load(std::memory_order_relaxed);
+             node;  node = link->load(std::memory_order_relaxed)) {
+            if (node->hash == hash && equal(node->key, key))
+                return link;
+            link = &node->next;
+        }
+        return nullptr;
+    }
+
+    /** Publish a new entry in a locked bucket. */
+    static void pushFront(Bucket & bucket, Node * node)
+    {
+        node->next.store(bucket.head.load(std::memory_order_relaxed),
+                         std::memory_order_relaxed);
+        bucket.head.store(node, std::memory_order_release);
+    }
+
+    /** Start or continue resizing.  Must be called in a critical section. */
+    void afterWrite()
+    {
+        Table * table = current.load(std::memory_order_acquire);
+
+        if (!table->next.load(std::memory_order_acquire)) {
+            if (numEntries.load(std::memory_order_relaxed) <= table->size
+                || table->resizing.exchange(true))
+                return;
+            table->next.store(new Table(table->size * 2),
+                              std::memory_order_release);
+        }
+
+        moveBuckets(table);
+    }
+
+    void moveBuckets(Table * table)
+    {
+        Table * next = table->next.load(std::memory_order_acquire);
+
+        for (unsigned i = 0;  i < MoveBatchSize;  ++i) {
+            size_t index = table->nextToMove++;
+            if (index >= table->size)
+                return;
+
+            moveBucket(table->buckets[index], next);
+
+            if (++table->numMoved == table->size) {
+                // Everything is in the new table, which now takes over
+                current.store(next, std::memory_order_release);
+                lock->deferDelete(table);
+                return;
+            }
+        }
+    }
+
+    /** Copy the entries of a bucket to the next table, where they are
+        looked up from now on.  The entries themselves are left for the
+        readers that are still on them.
+    */
+    void moveBucket(Bucket & bucket, Table * next)
+    {
+        std::lock_guard<ML::Spinlock> guard(bucket.lock);
+
+        for (Node * node = bucket.head.load(std::memory_order_relaxed);
+             node;  node = node->next.load(std::memory_order_relaxed)) {
+            // The next table doesn't start resizing before this one is done,
+            // so its buckets can't have moved
+            Bucket & to = next->bucket(node->hash);
+            std::lock_guard<ML::Spinlock> toGuard(to.lock);
+            pushFront(to, new Node(node->hash, node->key, node->value));
+        }
+
+        bucket.moved.store(true, std::memory_order_release);
+    }
+
+    // Don't allow copy semantics
+    RcuHashMap(const RcuHashMap & other);
+    void operator = (const RcuHashMap & other);
+};
+
+} // namespace Datacratic
+
+#endif /* __mmap__rcu_hash_map_h__ */
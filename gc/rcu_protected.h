@@ -151,22 +151,31 @@ struct RcuProtected {
 
     JML_IMPLEMENT_OPERATOR_BOOL(val);
 
+    // The value is only read once in the critical section, as it could
+    // otherwise be replaced and deleted before the section is entered.
+
     RcuLocked<T> operator () ()
     {
         //ExcAssert(lock);
-        return RcuLocked<T>(val, lock);
+        RcuLocked<T> result(nullptr, lock);
+        result.ptr = val;
+        return result;
     }
 
     RcuLocked<const T> operator () () const
     {
         //ExcAssert(lock);
-        return RcuLocked<const T>(val, lock);
+        RcuLocked<const T> result(nullptr, lock);
+        result.ptr = val;
+        return result;
     }
 
     RcuLocked<const T> getImmutable() const
     {
         //ExcAssert(lock);
-        return RcuLocked<const T>(val, lock);
+        RcuLocked<const T> result(nullptr, lock);
+        result.ptr = val;
+        return result;
     }
 
     T * unsafePtr() const
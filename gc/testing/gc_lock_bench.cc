@@ -0,0 +1,123 @@
+/* gc_lock_bench.cc
+   Copyright (c) 2015 Datacratic.  All rights reserved.
+
+   Throughput of the read side critical sections of GcLock as the number of
+   reading threads grows, with the readers counted in the shared data word
+   or in per-thread slots.  A writer replaces the value read all along, and
+   a reclamation thread runs the deferred work in both cases.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "soa/gc/gc_lock.h"
+
+using namespace std;
+using namespace Datacratic;
+
+
+namespace {
+
+volatile uint64_t sink;
+
+const char * readerCountName(GcLock::ReaderCount readerCount)
+{
+    switch (readerCount) {
+    case GcLock::RC_SHARED: return "shared";
+    case GcLock::RC_SLOTS: return "slots";
+    }
+
+    return "unknown";
+}
+
+/* Millions of critical sections entered per second by nThreads readers */
+double benchReaders(GcLock::ReaderCount readerCount, int nThreads,
+                    double seconds)
+{
+    GcLock lock(readerCount);
+    lock.startReclamationThread();
+
+    atomic<int *> value(new int(0));
+    atomic<bool> finished(false);
+    atomic<uint64_t> total(0);
+
+    auto readerThread = [&] () {
+        uint64_t n = 0;
+        uint64_t sum = 0;
+        while (!finished.load(memory_order_relaxed)) {
+            for (int i = 0; i < 64; i++) {
+                GcLock::SharedGuard guard(lock, GcLock::RD_NO);
+                sum += *value.load(memory_order_acquire);
+            }
+            n += 64;
+        }
+        total += n;
+        sink = sum;
+    };
+
+    /* replaces the value every 100us */
+    auto writerThread = [&] () {
+        while (!finished) {
+            int * oldValue = value;
+            value = new int(*oldValue + 1);
+            lock.deferDelete(oldValue);
+            this_thread::sleep_for(chrono::microseconds(100));
+        }
+    };
+
+    vector<thread> threads;
+    for (int i = 0; i < nThreads; i++) {
+        threads.emplace_back(readerThread);
+    }
+    thread writer(writerThread);
+
+    auto start = chrono::steady_clock::now();
+    this_thread::sleep_for(chrono::duration<double>(seconds));
+    finished = true;
+    for (thread & th: threads) {
+        th.join();
+    }
+    auto elapsed = chrono::duration<double>(chrono::steady_clock::now()
+                                            - start).count();
+    writer.join();
+
+    lock.deferBarrier();
+    delete value;
+
+    return total / elapsed / 1000000.0;
+}
+
+} // file scope
+
+
+int main(int argc, char ** argv)
+{
+    double seconds = argc > 1 ? atof(argv[1]) : 0.5;
+
+    vector<GcLock::ReaderCount> readerCounts = {
+        GcLock::RC_SHARED, GcLock::RC_SLOTS
+    };
+
+    ::printf("%8s", "threads");
+    for (GcLock::ReaderCount readerCount: readerCounts) {
+        ::printf(" %16s", readerCountName(readerCount));
+    }
+    ::printf("   (million critical sections/s)\n");
+
+    for (int nThreads: { 1, 2, 4, 8, 16, 32, 48, 64 }) {
+        ::printf("%8d", nThreads);
+        for (GcLock::ReaderCount readerCount: readerCounts) {
+            double rate = benchReaders(readerCount, nThreads, seconds);
+            ::printf(" %16.2f", rate);
+            ::fflush(stdout);
+        }
+        ::printf("\n");
+    }
+
+    return 0;
+}
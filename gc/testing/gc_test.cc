@@ -21,6 +21,7 @@
 #include <boost/bind.hpp>
 #include <iostream>
 #include <atomic>
+#include <thread>
 
 #include <boost/thread.hpp>
 #include <boost/thread/barrier.hpp>
@@ -612,6 +613,140 @@ BOOST_AUTO_TEST_CASE ( test_gc_deferred_contention )
 }
 
 
+BOOST_AUTO_TEST_CASE ( test_gc_deferred_reclamation_thread )
+{
+    cerr << "testing contended deferred GcLock with a reclamation thread"
+         << endl;
+
+    int nthreads = 8;
+    int nblocks = 2;
+
+    TestBase<GcLock> test(nthreads, nblocks);
+    test.gc.startReclamationThread();
+    test.run(boost::bind(&TestBase<GcLock>::allocThreadDefer, &test, _1));
+    test.gc.stopReclamationThread();
+}
+
+BOOST_AUTO_TEST_CASE ( test_reclamation_thread )
+{
+    GcLock gc;
+    gc.startReclamationThread(0.001);
+    BOOST_CHECK_THROW(gc.startReclamationThread(), ML::Exception);
+
+    std::atomic<int> numRun(0);
+    std::thread::id runBy;
+    auto work = [&] ()
+        {
+            runBy = std::this_thread::get_id();
+            numRun++;
+        };
+
+    // Work deferred by several threads in the same epoch is buffered per
+    // thread and run by the reclamation thread once the epoch is over
+    gc.lockShared();
+    boost::thread_group tg;
+    for (unsigned i = 0;  i < 4;  ++i) {
+        tg.create_thread([&] ()
+            {
+                for (unsigned j = 0;  j < 100;  ++j)
+                    gc.defer(work);
+            });
+    }
+    tg.join_all();
+    BOOST_CHECK_EQUAL(numRun, 0);
+
+    gc.unlockShared(0, GcLock::RD_YES);
+    for (unsigned i = 0;  i < 1000 && numRun < 400;  ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    BOOST_CHECK_EQUAL(numRun, 400);
+    BOOST_CHECK(runBy != std::this_thread::get_id());
+
+    // Nothing is left behind when stopping
+    gc.lockShared();
+    gc.defer(work);
+    gc.unlockShared();
+    gc.stopReclamationThread();
+    BOOST_CHECK_EQUAL(numRun, 401);
+}
+
+/** GcLock counting its readers in per-thread slots */
+struct SlotGcLock : public GcLock {
+    SlotGcLock()
+        : GcLock(RC_SLOTS)
+    {
+    }
+};
+
+BOOST_AUTO_TEST_CASE ( test_reader_slots )
+{
+    SlotGcLock gc;
+
+    // Readers never run deferred work, and barriers wait for them
+    std::atomic<int> numRun(0);
+    std::atomic<bool> barrierDone(false);
+    gc.lockShared();
+    gc.defer([&] () { numRun++; });
+    std::thread barrierThread([&] ()
+        {
+            gc.visibleBarrier();
+            barrierDone = true;
+        });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    BOOST_CHECK(!barrierDone);
+    gc.unlockShared(0, GcLock::RD_YES);
+    barrierThread.join();
+    BOOST_CHECK_EQUAL(numRun, 0);
+
+    gc.deferBarrier();
+    BOOST_CHECK_EQUAL(numRun, 1);
+
+    // Readers wait for the exclusive lock
+    std::atomic<bool> sharedDone(false);
+    gc.lockExclusive();
+    std::thread sharedThread([&] ()
+        {
+            GcLock::SharedGuard guard(gc);
+            sharedDone = true;
+        });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    BOOST_CHECK(!sharedDone);
+    gc.unlockExclusive();
+    sharedThread.join();
+    BOOST_CHECK(sharedDone);
+
+    // Work still pending is run when the lock goes away
+    {
+        SlotGcLock gc2;
+        gc2.defer([&] () { numRun++; });
+    }
+    BOOST_CHECK_EQUAL(numRun, 2);
+}
+
+BOOST_AUTO_TEST_CASE ( test_reader_slots_sync )
+{
+    cerr << "testing synchronized GcLock with reader slots" << endl;
+
+    int nthreads = 8;
+    int nblocks = 2;
+
+    TestBase<SlotGcLock> test(nthreads, nblocks);
+    test.run(boost::bind(&TestBase<SlotGcLock>::allocThreadSync, &test, _1));
+}
+
+BOOST_AUTO_TEST_CASE ( test_reader_slots_deferred )
+{
+    cerr << "testing deferred GcLock with reader slots" << endl;
+
+    int nthreads = 8;
+    int nblocks = 2;
+
+    TestBase<SlotGcLock> test(nthreads, nblocks);
+    test.gc.startReclamationThread();
+    test.run(boost::bind(&TestBase<SlotGcLock>::allocThreadDefer, &test, _1));
+    test.gc.stopReclamationThread();
+}
+
 #if 1
 
 BOOST_AUTO_TEST_CASE ( test_gc_sync )
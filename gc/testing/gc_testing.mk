@@ -9,3 +9,6 @@
 $(eval $(call test,gc_test,gc,boost))
 $(eval $(call test,rcu_protected_test,gc,boost timed))
 
+$(eval $(call program,gc_lock_bench,gc))
+$(eval $(call test,rcu_hash_map_test,gc,boost))
+$(eval $(call program,rcu_hash_map_bench,gc))
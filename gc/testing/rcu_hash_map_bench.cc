@@ -0,0 +1,181 @@
+/* rcu_hash_map_bench.cc
+   Copyright (c) 2015 Datacratic.  All rights reserved.
+
+   Lookups and updates of a large table with RcuHashMap, compared to a
+   copy-on-write std::unordered_map in an RcuProtected.
+
+   Usage: rcu_hash_map_bench [entries] [reader threads] [seconds]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "soa/gc/rcu_hash_map.h"
+#include "soa/gc/rcu_protected.h"
+
+using namespace std;
+using namespace Datacratic;
+
+
+namespace {
+
+volatile uint64_t sink;
+
+typedef unordered_map<uint64_t, uint64_t> StdMap;
+
+/* The two maps behind the same interface */
+
+struct HashMapTable {
+    HashMapTable(GcLock & lock, uint64_t numEntries)
+        : map(lock)
+    {
+        for (uint64_t i = 0; i < numEntries; i++) {
+            map.insert(i, i);
+        }
+    }
+
+    uint64_t lookup(uint64_t key)
+    {
+        uint64_t value = 0;
+        map.get(key, value);
+        return value;
+    }
+
+    void update(uint64_t key, uint64_t value)
+    {
+        map.set(key, value);
+    }
+
+    RcuHashMap<uint64_t, uint64_t> map;
+};
+
+struct CopyOnWriteTable {
+    CopyOnWriteTable(GcLock & lock, uint64_t numEntries)
+        : map(lock)
+    {
+        for (uint64_t i = 0; i < numEntries; i++) {
+            map.unsafePtr()->insert(make_pair(i, i));
+        }
+    }
+
+    uint64_t lookup(uint64_t key)
+    {
+        auto locked = map();
+        auto it = locked->find(key);
+        return it == locked->end() ? 0 : it->second;
+    }
+
+    void update(uint64_t key, uint64_t value)
+    {
+        for (;;) {
+            auto current = map();
+            std::auto_ptr<StdMap> newMap(new StdMap(*current));
+            (*newMap)[key] = value;
+            if (map.cmp_xchg(current, newMap)) {
+                return;
+            }
+        }
+    }
+
+    RcuProtected<StdMap> map;
+};
+
+struct Result {
+    double lookupsPerSecond;
+    double updatesPerSecond;
+};
+
+/* Lookups by nReaders threads while a writer updates as fast as it can */
+template<typename Table>
+Result bench(uint64_t numEntries, int nReaders, double seconds)
+{
+    GcLock lock;
+    lock.startReclamationThread();
+    Result result;
+
+    {
+        Table table(lock, numEntries);
+
+        atomic<bool> finished(false);
+        atomic<uint64_t> numLookups(0), numUpdates(0);
+
+        auto readerThread = [&] (int seed) {
+            mt19937_64 rng(seed);
+            uint64_t n = 0, sum = 0;
+            while (!finished.load(memory_order_relaxed)) {
+                sum += table.lookup(rng() % numEntries);
+                n++;
+            }
+            numLookups += n;
+            sink = sum;
+        };
+
+        auto writerThread = [&] () {
+            mt19937_64 rng(0);
+            uint64_t n = 0;
+            while (!finished.load(memory_order_relaxed)) {
+                table.update(rng() % numEntries, n);
+                n++;
+            }
+            numUpdates = n;
+        };
+
+        vector<thread> threads;
+        for (int i = 0; i < nReaders; i++) {
+            threads.emplace_back(readerThread, i + 1);
+        }
+        threads.emplace_back(writerThread);
+
+        auto start = chrono::steady_clock::now();
+        this_thread::sleep_for(chrono::duration<double>(seconds));
+        finished = true;
+        for (thread & th: threads) {
+            th.join();
+        }
+        double elapsed = chrono::duration<double>(chrono::steady_clock::now()
+                                                  - start).count();
+
+        result.lookupsPerSecond = numLookups / elapsed;
+        result.updatesPerSecond = numUpdates / elapsed;
+    }
+
+    lock.stopReclamationThread();
+    lock.deferBarrier();
+
+    return result;
+}
+
+void print(const char * name, const Result & result)
+{
+    ::printf("%-24s %16.0f %16.1f\n",
+             name, result.lookupsPerSecond, result.updatesPerSecond);
+}
+
+} // file scope
+
+
+int main(int argc, char ** argv)
+{
+    uint64_t numEntries = argc > 1 ? atoll(argv[1]) : 1000000;
+    int nReaders = argc > 2 ? atoi(argv[2]) : 4;
+    double seconds = argc > 3 ? atof(argv[3]) : 2.0;
+
+    ::printf("%lu entries, %d readers and 1 writer\n\n",
+             (unsigned long)numEntries, nReaders);
+    ::printf("%-24s %16s %16s\n", "", "lookups/s", "updates/s");
+
+    print("RcuHashMap",
+          bench<HashMapTable>(numEntries, nReaders, seconds));
+    print("RcuProtected<StdMap>",
+          bench<CopyOnWriteTable>(numEntries, nReaders, seconds));
+
+    return 0;
+}
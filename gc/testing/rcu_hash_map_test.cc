@@ -0,0 +1,172 @@
+/* rcu_hash_map_test.cc
+   Copyright (c) 2015 Datacratic.  All rights reserved.
+
+   Tests for RcuHashMap.
+*/
+
+#define BOOST_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+
+#include "soa/gc/rcu_hash_map.h"
+#include <boost/test/unit_test.hpp>
+#include <atomic>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+
+using namespace std;
+using namespace Datacratic;
+
+
+BOOST_AUTO_TEST_CASE( test_rcu_hash_map_vs_reference )
+{
+    GcLock lock;
+    RcuHashMap<int, string> map(lock, 4);
+    unordered_map<int, string> reference;
+
+    BOOST_CHECK(map.empty());
+    BOOST_CHECK(!map.find(1));
+
+    // Random operations over a growing key range, so that the table goes
+    // through several resizes with operations in between
+    mt19937 rng(1234);
+    for (int i = 0;  i < 100000;  ++i) {
+        int key = rng() % (i / 10 + 10);
+        string value = to_string(rng());
+
+        switch (rng() % 4) {
+        case 0:
+            BOOST_REQUIRE_EQUAL(map.insert(key, value),
+                                reference.insert(make_pair(key, value)).second);
+            break;
+        case 1:
+            BOOST_REQUIRE_EQUAL(map.set(key, value), !reference.count(key));
+            reference[key] = value;
+            break;
+        case 2:
+            BOOST_REQUIRE_EQUAL(map.erase(key), reference.erase(key) == 1);
+            break;
+        case 3: {
+            auto found = map.find(key);
+            auto it = reference.find(key);
+            BOOST_REQUIRE_EQUAL((bool)found, it != reference.end());
+            if (found)
+                BOOST_REQUIRE_EQUAL(*found, it->second);
+            break;
+        }
+        }
+
+        BOOST_REQUIRE_EQUAL(map.size(), reference.size());
+    }
+
+    BOOST_CHECK_GE(map.bucketCount(), reference.size());
+
+    std::map<int, string> seen;
+    map.forEach([&] (int key, const string & value)
+        {
+            BOOST_CHECK(seen.insert(make_pair(key, value)).second);
+        });
+    BOOST_CHECK_EQUAL(seen.size(), reference.size());
+    for (auto & entry: reference) {
+        string value;
+        BOOST_REQUIRE(map.get(entry.first, value));
+        BOOST_CHECK_EQUAL(value, entry.second);
+        BOOST_CHECK_EQUAL(seen[entry.first], entry.second);
+    }
+}
+
+/* Readers check that the value of each key they find is consistent with
+ * the key while writers update, remove and re-add keys, and the table
+ * grows. */
+BOOST_AUTO_TEST_CASE( test_rcu_hash_map_concurrent )
+{
+    typedef RcuHashMap<uint64_t, vector<uint64_t> > Map;
+
+    GcLock lock;
+    Map map(lock);
+
+    int nWriters = 4;
+    int nReaders = 4;
+    uint64_t keysPerWriter = 20000;
+
+    atomic<bool> finished(false);
+    atomic<uint64_t> numErrors(0), numFound(0);
+
+    auto readerThread = [&] ()
+        {
+            mt19937 rng(random_device{}());
+            while (!finished) {
+                uint64_t key = rng() % (nWriters * keysPerWriter);
+                auto found = map.find(key);
+                if (!found)
+                    continue;
+                ++numFound;
+                for (uint64_t value: *found) {
+                    if (value % (nWriters * keysPerWriter) != key)
+                        ++numErrors;
+                }
+            }
+        };
+
+    // Each writer has its own keys, so that it knows the expected result
+    auto writerThread = [&] (int writer)
+        {
+            uint64_t first = writer * keysPerWriter;
+            for (int round = 0;  round < 3;  ++round) {
+                for (uint64_t key = first;  key < first + keysPerWriter;
+                     ++key) {
+                    vector<uint64_t> value(4, key + round * nWriters
+                                           * keysPerWriter);
+                    if (round == 0) {
+                        if (!map.insert(key, value))
+                            ++numErrors;
+                    }
+                    else if (map.set(key, value)) {
+                        ++numErrors;
+                    }
+                }
+                for (uint64_t key = first;  key < first + keysPerWriter;
+                     key += 3) {
+                    if (!map.erase(key) || map.count(key))
+                        ++numErrors;
+                    if (round < 2 && !map.insert(key, { key }))
+                        ++numErrors;
+                }
+            }
+        };
+
+    vector<thread> readers, writers;
+    for (int i = 0;  i < nReaders;  ++i)
+        readers.emplace_back(readerThread);
+    for (int i = 0;  i < nWriters;  ++i)
+        writers.emplace_back(writerThread, i);
+
+    for (auto & th: writers)
+        th.join();
+    finished = true;
+    for (auto & th: readers)
+        th.join();
+
+    BOOST_CHECK_EQUAL(numErrors, 0);
+    BOOST_CHECK_GT(numFound, 0);
+
+    // Keys that are multiples of 3 from the start of each range were
+    // removed in the last round
+    uint64_t expected = nWriters * (keysPerWriter - (keysPerWriter + 2) / 3);
+    BOOST_CHECK_EQUAL(map.size(), expected);
+
+    uint64_t numSeen = 0;
+    map.forEach([&] (uint64_t key, const vector<uint64_t> & value)
+        {
+            ++numSeen;
+            BOOST_CHECK_EQUAL(value.at(0),
+                              key + 2 * nWriters * keysPerWriter);
+        });
+    BOOST_CHECK_EQUAL(numSeen, expected);
+
+    lock.deferBarrier();
+}
@@ -79,6 +79,19 @@ logMessage(const std::string & channel,
     ringBuffer.push(std::move(message));
 }
 
+void
+WorkerThreadOutput::
+logMessageData(const std::string & channel,
+               const char * contents, size_t length)
+{
+    Message message;
+    message.type    = MT_LOG;
+    message.channel = channel;
+    message.contents.assign(contents, length);
+
+    ringBuffer.push(std::move(message));
+}
+
 #if 0
 void
 WorkerThreadOutput::
@@ -125,6 +138,12 @@ clearStats()
     duty.clear();
 }
 
+void
+WorkerThreadOutput::
+implementIdle()
+{
+}
+
 void
 WorkerThreadOutput::
 runLogThread()
@@ -143,8 +162,10 @@ runLogThread()
         bool found = ringBuffer.tryPop(msg, 0.5);
         duty.notifyAfterSleep();
 
-        if (!found)
+        if (!found) {
+            implementIdle();
             continue;
+        }
 
         switch (msg.type) {
 
@@ -187,13 +208,24 @@ CompressingOutput::
 CompressingOutput(size_t ringBufferSize,
                   Compressor::FlushLevel flushLevel)
     : WorkerThreadOutput(ringBufferSize),
-      compressorFlushLevel(flushLevel)
+      compressorFlushLevel(flushLevel),
+      compressionLevel(-1),
+      numCompressionThreads(0),
+      blockSize(1024 * 1024),
+      maxBlockAge(1.0),
+      seekable(false),
+      shutdownCompression(false),
+      blocksSubmitted(0),
+      blocksWritten(0),
+      sinkOffset(0),
+      indexValid(true)
 {
 }
 
 CompressingOutput::
 ~CompressingOutput()
 {
+    stopCompressionThreads();
 }
 
 void
@@ -205,9 +237,20 @@ open(std::shared_ptr<Sink> sink,
     if (compressor)
         throw ML::Exception("can't open compressor without closing the "
                             "previous one");
-    compressor.reset(Compressor::create(compression, compressionLevel));
+    if (seekable && !SeekableLogIndex::supportsCompression(compression))
+        throw ML::Exception("seekable logs need zstd compression, which "
+                            "skips the index; not " + compression);
+    compressor.reset(Compressor::create(compression, compressionLevel,
+                                        dictionary));
 
     this->sink = sink;
+    this->compression = compression;
+    this->compressionLevel = compressionLevel;
+
+    index = SeekableLogIndex();
+    index.compression = compression;
+    sinkOffset = 0;
+    indexValid = true;
 
     onData = std::bind(&Sink::write,
                        sink,
@@ -221,10 +264,62 @@ closeCompressor()
 {
     if (!compressor)
         return;
-    compressor->finish(onData);
+    if (blockMode()) {
+        // Each block is already a finished stream
+        submitBlock();
+        waitForBlocks();
+
+        if (seekable && indexValid) {
+            std::string serialized = index.serialize();
+            onData(serialized.data(), serialized.size());
+        }
+        else if (seekable)
+            cerr << "warning: not writing the index of a seekable log "
+                 << "after a failed write" << endl;
+    }
+    else compressor->finish(onData);
     compressor.reset();
 }
 
+void
+CompressingOutput::
+setDictionary(std::shared_ptr<const CompressionDictionary> dict)
+{
+    // Once the worker thread is up, it's the one that opens compressors
+    if (logThread)
+        pushOperation([=] () { this->dictionary = dict; });
+    else dictionary = dict;
+}
+
+void
+CompressingOutput::
+setParallelCompression(int numThreads, size_t blockSize, double maxBlockAge)
+{
+    if (compressor)
+        throw ML::Exception("can't change parallel compression with an "
+                            "open compressor");
+    if (numThreads < 0 || (numThreads && blockSize == 0))
+        throw ML::Exception("invalid parallel compression parameters");
+
+    stopCompressionThreads();
+
+    this->numCompressionThreads = numThreads;
+    this->blockSize = blockSize;
+    this->maxBlockAge = maxBlockAge;
+
+    startCompressionThreads();
+}
+
+void
+CompressingOutput::
+setSeekable(bool seekable)
+{
+    if (compressor)
+        throw ML::Exception("can't change seekability with an open "
+                            "compressor");
+    this->seekable = seekable;
+}
+
 void
 CompressingOutput::
 implementLogMessage(const std::string & channel,
@@ -236,6 +331,32 @@ implementLogMessage(const std::string & channel,
     if (onFileWrite) 
         onFileWrite(channel, channel.size() + message.size() + 2);
 
+    if (blockMode()) {
+        Date now = Date::now();
+
+        if (!currentBlock) {
+            currentBlock.reset(new Block());
+            currentBlock->compression = compression;
+            currentBlock->compressionLevel = compressionLevel;
+            currentBlock->dictionary = dictionary;
+            currentBlock->input.reserve(blockSize + blockSize / 8);
+            currentBlock->started = now;
+        }
+
+        std::string & input = currentBlock->input;
+        input.append(channel);
+        input.push_back('\t');
+        input.append(message);
+        input.push_back('\n');
+        currentBlock->latest = now;
+        currentBlock->numRecords += 1;
+
+        if (input.size() >= blockSize
+            || now.secondsSince(currentBlock->started) >= maxBlockAge)
+            submitBlock();
+        return;
+    }
+
     char buf[channel.size() + message.size() + 2];
     memcpy(buf, channel.c_str(), channel.size());
     buf[channel.size()] = '\t';
@@ -249,4 +370,267 @@ implementLogMessage(const std::string & channel,
     compressor->flush(compressorFlushLevel, onData);
 }
 
+void
+CompressingOutput::
+implementIdle()
+{
+    if (currentBlock
+        && Date::now().secondsSince(currentBlock->started) >= maxBlockAge)
+        submitBlock();
+}
+
+void
+CompressingOutput::
+startCompressionThreads()
+{
+    shutdownCompression = false;
+    for (int i = 0;  i < numCompressionThreads;  ++i)
+        compressionThreads.create_thread([=] ()
+                                         {
+                                             this->runCompressionThread();
+                                         });
+}
+
+void
+CompressingOutput::
+stopCompressionThreads()
+{
+    {
+        std::unique_lock<std::mutex> guard(blockLock);
+        shutdownCompression = true;
+        blockCond.notify_all();
+    }
+
+    compressionThreads.join_all();
+}
+
+void
+CompressingOutput::
+runCompressionThread()
+{
+    for (;;) {
+        std::shared_ptr<Block> block;
+
+        {
+            std::unique_lock<std::mutex> guard(blockLock);
+            blockCond.wait(guard, [&] ()
+                           {
+                               return shutdownCompression
+                                   || !toCompress.empty();
+                           });
+            if (toCompress.empty())
+                return;
+            block = toCompress.front();
+            toCompress.pop_front();
+        }
+
+        compressBlock(*block);
+        writeCompletedBlocks();
+    }
+}
+
+void
+CompressingOutput::
+compressBlock(Block & block)
+{
+    Date started = Date::now();
+    bool error = false;
+
+    try {
+        auto onOutput = [&] (const char * data, size_t len) -> size_t
+            {
+                block.output.append(data, len);
+                return len;
+            };
+
+        std::unique_ptr<Compressor> blockCompressor
+            (Compressor::create(block.compression,
+                                block.compressionLevel,
+                                block.dictionary));
+        blockCompressor->compress(block.input.data(),
+                                  block.input.size(),
+                                  onOutput);
+        blockCompressor->finish(onOutput);
+    } catch (const std::exception & exc) {
+        cerr << "warning: log block compression threw exception: "
+             << exc.what() << endl;
+        block.output.clear();
+        error = true;
+    }
+
+    {
+        std::unique_lock<std::mutex> guard(blockLock);
+        double queueDelay = started.secondsSince(block.queued);
+        blockStats.blocks += 1;
+        blockStats.errors += error;
+        blockStats.bytesIn += block.input.size();
+        blockStats.bytesOut += block.output.size();
+        blockStats.queueDelay += queueDelay;
+        blockStats.maxQueueDelay
+            = std::max(blockStats.maxQueueDelay, queueDelay);
+        block.done = true;
+    }
+
+    // Release the memory now rather than once it's written
+    std::string().swap(block.input);
+}
+
+void
+CompressingOutput::
+submitBlock()
+{
+    if (!currentBlock)
+        return;
+
+    std::shared_ptr<Block> block = currentBlock;
+    currentBlock.reset();
+
+    std::unique_lock<std::mutex> guard(blockLock);
+
+    if (numCompressionThreads) {
+        // Bound the memory in use by waiting for blocks to get written
+        size_t maxInFlight = 4 * numCompressionThreads;
+        blockCond.wait(guard, [&] ()
+                       {
+                           return blocksSubmitted - blocksWritten
+                               < maxInFlight;
+                       });
+    }
+
+    block->queued = Date::now();
+    ++blocksSubmitted;
+    blockStats.maxInFlight = std::max<uint64_t>(blockStats.maxInFlight,
+                                                blocksSubmitted
+                                                - blocksWritten);
+    toWrite.push_back(block);
+
+    if (!numCompressionThreads) {
+        // Seekable, but with nothing to compress it on but this thread
+        guard.unlock();
+        compressBlock(*block);
+        writeCompletedBlocks();
+        return;
+    }
+
+    toCompress.push_back(block);
+    blockCond.notify_all();
+}
+
+void
+CompressingOutput::
+writeCompletedBlocks()
+{
+    // Only one thread writes at a time, and it writes every block that is
+    // ready, so a block finished while another thread is writing still
+    // gets written by the thread that finished it.
+    std::unique_lock<std::mutex> writeGuard(writeLock);
+
+    for (;;) {
+        std::shared_ptr<Block> block;
+
+        {
+            std::unique_lock<std::mutex> guard(blockLock);
+            if (toWrite.empty() || !toWrite.front()->done)
+                return;
+            block = toWrite.front();
+            toWrite.pop_front();
+        }
+
+        size_t size = block->output.size();
+        size_t done = 0;
+
+        try {
+            if (size)
+                done = onData(block->output.data(), size);
+        } catch (const std::exception & exc) {
+            cerr << "warning: log block write threw exception: "
+                 << exc.what() << endl;
+        }
+
+        // After a short or failed write, the offsets of the following
+        // blocks are unknown
+        bool written = (size && done == size);
+        if (done != size)
+            indexValid = false;
+
+        if (written && seekable && indexValid) {
+            SeekableLogBlock entry;
+            entry.offset = sinkOffset;
+            entry.size = size;
+            entry.firstRecord = index.numRecords();
+            entry.numRecords = block->numRecords;
+            entry.earliest = block->started;
+            entry.latest = block->latest;
+            index.blocks.push_back(entry);
+        }
+
+        sinkOffset += done;
+
+        std::unique_lock<std::mutex> guard(blockLock);
+        double writeDelay = Date::now().secondsSince(block->queued);
+        blockStats.written += 1;
+        blockStats.writeDelay += writeDelay;
+        blockStats.maxWriteDelay
+            = std::max(blockStats.maxWriteDelay, writeDelay);
+        ++blocksWritten;
+        blockCond.notify_all();
+    }
+}
+
+void
+CompressingOutput::
+waitForBlocks()
+{
+    std::unique_lock<std::mutex> guard(blockLock);
+    blockCond.wait(guard, [&] () { return blocksWritten == blocksSubmitted; });
+}
+
+void
+CompressingOutput::BlockStats::
+clear()
+{
+    blocks = written = errors = bytesIn = bytesOut = maxInFlight = 0;
+    queueDelay = maxQueueDelay = writeDelay = maxWriteDelay = 0.0;
+}
+
+Json::Value
+CompressingOutput::
+stats() const
+{
+    Json::Value result = WorkerThreadOutput::stats();
+
+    if (!blockMode())
+        return result;
+
+    std::unique_lock<std::mutex> guard(blockLock);
+
+    Json::Value & parallel = result["parallelCompression"];
+    parallel["threads"] = numCompressionThreads;
+    parallel["blocks"] = (double)blockStats.blocks;
+    parallel["errors"] = (double)blockStats.errors;
+    parallel["bytesIn"] = (double)blockStats.bytesIn;
+    parallel["bytesOut"] = (double)blockStats.bytesOut;
+    parallel["inFlight"] = (int)(blocksSubmitted - blocksWritten);
+    parallel["maxInFlight"] = (int)blockStats.maxInFlight;
+
+    double blocks = std::max<uint64_t>(blockStats.blocks, 1);
+    double written = std::max<uint64_t>(blockStats.written, 1);
+    parallel["queueDelay"]["mean"] = blockStats.queueDelay / blocks;
+    parallel["queueDelay"]["max"] = blockStats.maxQueueDelay;
+    parallel["writeDelay"]["mean"] = blockStats.writeDelay / written;
+    parallel["writeDelay"]["max"] = blockStats.maxWriteDelay;
+
+    return result;
+}
+
+void
+CompressingOutput::
+clearStats()
+{
+    WorkerThreadOutput::clearStats();
+
+    std::unique_lock<std::mutex> guard(blockLock);
+    blockStats.clear();
+}
+
 } // namespace Datacratic
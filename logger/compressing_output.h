@@ -9,8 +9,14 @@
 
 #include "logger.h"
 #include "compressor.h"
+#include "seekable_log.h"
 #include "jml/utils/ring_buffer.h"
 #include "jml/arch/timers.h"
+#include "soa/types/date.h"
+#include <boost/thread/thread.hpp>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
 
 
 namespace Datacratic {
@@ -41,6 +47,9 @@ struct WorkerThreadOutput : public LogOutput {
     virtual void logMessage(const std::string & channel,
                             const std::string & message);
 
+    virtual void logMessageData(const std::string & channel,
+                                const char * message, size_t length);
+
     virtual Json::Value stats() const;
 
     virtual void clearStats();
@@ -73,6 +82,11 @@ protected:
     virtual void implementLogMessage(const std::string & channel,
                                      const std::string & message) = 0;
 
+    /** Called in the worker thread when it has been waiting for half a
+        second without anything to do.
+    */
+    virtual void implementIdle();
+
     /// Thread to do the logging
     boost::scoped_ptr<boost::thread> logThread;
 
@@ -130,18 +144,156 @@ struct CompressingOutput : public WorkerThreadOutput {
 
     void closeCompressor();
 
+    /** Use the given dictionary for the compressors opened after this
+        call (for the schemes that support one), such as by the next
+        rotation.  Null means none.
+    */
+    void setDictionary(std::shared_ptr<const CompressionDictionary> dict);
+
+    /** Compress on numThreads threads of its own instead of the worker
+        thread.  The stream is cut into blocks of about blockSize bytes,
+        each of which is compressed as a whole stream of its own, and they
+        are written to the sink in order.  The result is a valid
+        concatenated gzip or xz file, as made by pigz or pixz.
+
+        Instead of being flushed after each message, a block is sent to be
+        compressed once it is full or maxBlockAge seconds old, which is
+        how far behind the sink can get.
+
+        Zero threads turns it off again.  Can't be called while a
+        compressor is open.
+    */
+    void setParallelCompression(int numThreads,
+                                size_t blockSize = 1024 * 1024,
+                                double maxBlockAge = 1.0);
+
+    /** Write seekable log files (see seekable_log.h), that can be read
+        from any record or time with SeekableLogReader.  The blocks are
+        those of setParallelCompression(), compressed on the worker thread
+        if there are no threads for it, and the index is written to the
+        sink when the compressor is closed.  Not for appending to
+        existing files, as the offsets in the index start from the
+        beginning of the sink, and open() throws unless the compression
+        is zstd, the only format whose tools skip the index.  If a block
+        fails to be written, the index is left off.
+
+        Can't be called while a compressor is open.
+    */
+    void setSeekable(bool seekable);
+
+    bool isSeekable() const { return seekable; }
+
     boost::function<void (std::string, std::size_t)> onFileWrite;
 
+    virtual Json::Value stats() const;
+
+    virtual void clearStats();
+
 protected:
     Compressor::FlushLevel compressorFlushLevel;
     std::shared_ptr<Sink> sink;
     std::shared_ptr<Compressor> compressor;
     std::function<size_t (const char *, size_t)> onData;
+    std::string compression;
+    int compressionLevel;
+    std::shared_ptr<const CompressionDictionary> dictionary;
 
     // Overrides
 
     virtual void implementLogMessage(const std::string & channel,
                                      const std::string & message);
+
+    virtual void implementIdle();
+
+private:
+    /// Block of the stream for parallel compression
+    struct Block {
+        Block()
+            : numRecords(0), done(false)
+        {
+        }
+
+        std::string compression;
+        int compressionLevel;
+        std::shared_ptr<const CompressionDictionary> dictionary;
+        std::string input;       ///< uncompressed messages
+        std::string output;      ///< the whole compressed stream
+        Date started;            ///< when the first message was added
+        Date latest;             ///< when the last message was added
+        Date queued;             ///< when it was sent off to be compressed
+        uint64_t numRecords;
+        bool done;               ///< output is ready to be written
+    };
+
+    int numCompressionThreads;
+    size_t blockSize;
+    double maxBlockAge;
+    bool seekable;
+
+    /// Is the stream being cut into blocks?
+    bool blockMode() const { return numCompressionThreads || seekable; }
+
+    /// Block that messages are being added to; only used by the worker
+    std::shared_ptr<Block> currentBlock;
+
+    /// Protects everything below, and signalled when any of it changes
+    mutable std::mutex blockLock;
+    std::condition_variable blockCond;
+
+    std::deque<std::shared_ptr<Block> > toCompress;  ///< waiting for a thread
+    std::deque<std::shared_ptr<Block> > toWrite;     ///< in stream order
+    bool shutdownCompression;
+    uint64_t blocksSubmitted;
+    uint64_t blocksWritten;
+
+    /// Statistics on parallel compression, cleared by clearStats()
+    struct BlockStats {
+        BlockStats()
+        {
+            clear();
+        }
+
+        void clear();
+
+        uint64_t blocks;          ///< compressed
+        uint64_t written;
+        uint64_t errors;
+        uint64_t bytesIn;
+        uint64_t bytesOut;
+        uint64_t maxInFlight;
+        double queueDelay;        ///< total seconds from queued to started
+        double maxQueueDelay;
+        double writeDelay;        ///< total seconds from queued to written
+        double maxWriteDelay;
+    } blockStats;
+
+    /// Serializes writing of blocks to the sink between threads
+    std::mutex writeLock;
+
+    /// Index of the blocks written to the sink, for seekable logs
+    SeekableLogIndex index;
+    uint64_t sinkOffset;     ///< bytes written to the sink
+    bool indexValid;         ///< false once a write may have been partial
+
+    boost::thread_group compressionThreads;
+
+    void startCompressionThreads();
+    void stopCompressionThreads();
+    void runCompressionThread();
+
+    /** Compress the given block and mark it as done. */
+    void compressBlock(Block & block);
+
+    /** Send off the current block to be compressed, waiting if there are
+        already too many of them.
+    */
+    void submitBlock();
+
+    /** Write all compressed blocks at the start of toWrite to the sink. */
+    void writeCompletedBlocks();
+
+    /** Wait until all submitted blocks have been written. */
+    void waitForBlocks();
 };
 
 
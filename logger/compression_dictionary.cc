@@ -0,0 +1,183 @@
+/* compression_dictionary.cc
+   Copyright (c) 2015 Datacratic Inc.  All rights reserved.
+
+   Pre-trained dictionary for the zstd and lz4 compressors and filters.
+*/
+
+#include "compression_dictionary.h"
+#include "jml/arch/exception.h"
+#include "jml/utils/filter_streams.h"
+#include <zstd.h>
+#include <zdict.h>
+#define LZ4F_STATIC_LINKING_ONLY 1
+#include <lz4frame.h>
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+
+using namespace std;
+
+
+namespace Datacratic {
+
+
+/*****************************************************************************/
+/* COMPRESSION DICTIONARY                                                    */
+/*****************************************************************************/
+
+CompressionDictionary::
+CompressionDictionary(const std::string & data)
+    : data(data),
+      zstdDDict(0),
+      lz4CDict(0)
+{
+}
+
+CompressionDictionary::
+~CompressionDictionary()
+{
+    for (auto & d: zstdCDicts)
+        ZSTD_freeCDict(d.second);
+    if (zstdDDict)
+        ZSTD_freeDDict(zstdDDict);
+    if (lz4CDict)
+        LZ4F_freeCDict(lz4CDict);
+}
+
+std::shared_ptr<CompressionDictionary>
+CompressionDictionary::
+train(const std::vector<std::string> & samples, size_t maxSize)
+{
+    if (samples.empty())
+        throw ML::Exception("can't train compression dictionary without "
+                            "samples");
+
+    string allSamples;
+    vector<size_t> sampleSizes;
+    sampleSizes.reserve(samples.size());
+
+    for (auto & s: samples) {
+        allSamples += s;
+        sampleSizes.push_back(s.size());
+    }
+
+    string result(maxSize, '\0');
+    size_t res = ZDICT_trainFromBuffer(&result[0], maxSize,
+                                       allSamples.data(),
+                                       &sampleSizes[0],
+                                       sampleSizes.size());
+    if (ZDICT_isError(res))
+        throw ML::Exception("training compression dictionary on %zd "
+                            "samples: %s",
+                            samples.size(), ZDICT_getErrorName(res));
+
+    result.resize(res);
+    return std::make_shared<CompressionDictionary>(result);
+}
+
+std::shared_ptr<CompressionDictionary>
+CompressionDictionary::
+trainFromFile(const std::string & filename, size_t maxSize, size_t maxBytes)
+{
+    ML::filter_istream stream(filename);
+
+    vector<string> samples;
+    size_t bytes = 0;
+
+    while (stream && bytes < maxBytes) {
+        string line;
+        getline(stream, line);
+        if (line.empty())
+            continue;
+        bytes += line.size();
+        samples.push_back(std::move(line));
+    }
+
+    return train(samples, maxSize);
+}
+
+std::shared_ptr<CompressionDictionary>
+CompressionDictionary::
+load(const std::string & filename)
+{
+    std::ifstream stream(filename.c_str(), std::ios::binary);
+    if (!stream)
+        throw ML::Exception("couldn't open compression dictionary "
+                            + filename);
+
+    string data((std::istreambuf_iterator<char>(stream)),
+                std::istreambuf_iterator<char>());
+    return std::make_shared<CompressionDictionary>(data);
+}
+
+void
+CompressionDictionary::
+save(const std::string & filename) const
+{
+    std::ofstream stream(filename.c_str(), std::ios::binary);
+    stream.write(data.data(), data.size());
+    if (!stream)
+        throw ML::Exception("couldn't write compression dictionary "
+                            + filename);
+}
+
+ZSTD_CDict *
+CompressionDictionary::
+zstdCompressionDict(int level) const
+{
+    std::unique_lock<std::mutex> guard(lock);
+
+    ZSTD_CDict * & result = zstdCDicts[level];
+    if (!result) {
+        result = ZSTD_createCDict(data.data(), data.size(), level);
+        if (!result)
+            throw ML::Exception("couldn't create zstd dictionary");
+    }
+    return result;
+}
+
+ZSTD_DDict *
+CompressionDictionary::
+zstdDecompressionDict() const
+{
+    std::unique_lock<std::mutex> guard(lock);
+
+    if (!zstdDDict) {
+        zstdDDict = ZSTD_createDDict(data.data(), data.size());
+        if (!zstdDDict)
+            throw ML::Exception("couldn't create zstd dictionary");
+    }
+    return zstdDDict;
+}
+
+LZ4F_CDict *
+CompressionDictionary::
+lz4CompressionDict() const
+{
+    std::unique_lock<std::mutex> guard(lock);
+
+    if (!lz4CDict) {
+        lz4CDict = LZ4F_createCDict(lz4Data(), lz4Size());
+        if (!lz4CDict)
+            throw ML::Exception("couldn't create lz4 dictionary");
+    }
+    return lz4CDict;
+}
+
+const char *
+CompressionDictionary::
+lz4Data() const
+{
+    return data.data() + data.size() - lz4Size();
+}
+
+size_t
+CompressionDictionary::
+lz4Size() const
+{
+    // lz4 can only refer back 64kb, so only the end of the dictionary
+    // (where zstd training puts the most common content) is any use
+    return std::min<size_t>(data.size(), 65536);
+}
+
+} // namespace Datacratic
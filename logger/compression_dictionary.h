@@ -0,0 +1,98 @@
+/* compression_dictionary.h                                        -*- C++ -*-
+   Copyright (c) 2015 Datacratic Inc.  All rights reserved.
+
+   Pre-trained dictionary for the zstd and lz4 compressors and filters.
+*/
+
+#ifndef __logger__compression_dictionary_h__
+#define __logger__compression_dictionary_h__
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct ZSTD_CDict_s;
+struct ZSTD_DDict_s;
+struct LZ4F_CDict_s;
+
+
+namespace Datacratic {
+
+
+/*****************************************************************************/
+/* COMPRESSION DICTIONARY                                                    */
+/*****************************************************************************/
+
+/** Dictionary of content that is common to the records of a log channel.
+    Short records, that have nothing earlier in the stream to refer to,
+    compress much better when they can refer to a dictionary instead.
+
+    The dictionary is trained on a sample of records with train(), and
+    must be kept along with the files, as the same one is needed to
+    decompress them.
+
+    zstd uses the whole dictionary, lz4 uses its last 64kb as a prefix to
+    the stream.  The other compressors ignore it.
+*/
+
+struct CompressionDictionary {
+
+    CompressionDictionary(const std::string & data = "");
+
+    ~CompressionDictionary();
+
+    /** Train a dictionary of up to maxSize bytes on the given sample
+        records.  There needs to be a few hundred of them at least.
+    */
+    static std::shared_ptr<CompressionDictionary>
+    train(const std::vector<std::string> & samples,
+          size_t maxSize = 112640);
+
+    /** Train a dictionary on the lines of the given file, which may be
+        compressed, reading no more than maxBytes of it.
+    */
+    static std::shared_ptr<CompressionDictionary>
+    trainFromFile(const std::string & filename,
+                  size_t maxSize = 112640,
+                  size_t maxBytes = 100 * 1024 * 1024);
+
+    /** Load a dictionary from the given file. */
+    static std::shared_ptr<CompressionDictionary>
+    load(const std::string & filename);
+
+    /** Save the dictionary in the given file. */
+    void save(const std::string & filename) const;
+
+    /// Contents of the dictionary
+    const std::string data;
+
+    /** Digested form of the dictionary for zstd compression at the given
+        level.  It's made on first use and shared between threads.
+    */
+    ZSTD_CDict_s * zstdCompressionDict(int level) const;
+
+    /** Digested form of the dictionary for zstd decompression. */
+    ZSTD_DDict_s * zstdDecompressionDict() const;
+
+    /** Digested form of the dictionary for lz4 compression. */
+    LZ4F_CDict_s * lz4CompressionDict() const;
+
+    /** Part of the dictionary that lz4 can use.  The same part must be
+        given to the lz4 decompressor.
+    */
+    const char * lz4Data() const;
+    size_t lz4Size() const;
+
+private:
+    mutable std::mutex lock;
+    mutable std::map<int, ZSTD_CDict_s *> zstdCDicts;
+    mutable ZSTD_DDict_s * zstdDDict;
+    mutable LZ4F_CDict_s * lz4CDict;
+};
+
+
+} // namespace Datacratic
+
+#endif /* __logger__compression_dictionary_h__ */
@@ -8,7 +8,13 @@
 #include "compressor.h"
 #include "jml/utils/exc_assert.h"
 #include <zlib.h>
+#include <zstd.h>
+#define LZ4F_STATIC_LINKING_ONLY 1
+#include <lz4frame.h>
+#include <algorithm>
 #include <iostream>
+#include <string.h>
+#include <vector>
 
 using namespace std;
 
@@ -45,16 +51,25 @@ filenameToCompression(const std::string & filename)
         return "bzip2";
     if (ends_with(filename, ".xz") || ends_with(filename, ".xz~"))
         return "lzma";
+    if (ends_with(filename, ".zst") || ends_with(filename, ".zst~"))
+        return "zstd";
+    if (ends_with(filename, ".lz4") || ends_with(filename, ".lz4~"))
+        return "lz4";
     return "none";
 }
 
 Compressor *
 Compressor::
 create(const std::string & compression,
-       int level)
+       int level,
+       std::shared_ptr<const CompressionDictionary> dictionary)
 {
     if (compression == "gzip" || compression == "gz")
         return new GzipCompressor(level);
+    else if (compression == "zstd" || compression == "zst")
+        return new ZstdCompressor(level, dictionary);
+    else if (compression == "lz4")
+        return new Lz4Compressor(level, dictionary);
     else if (compression == "" || compression == "none")
         return new NullCompressor();
     else throw ML::Exception("unknown compression %s:%d", compression.c_str(),
@@ -243,7 +258,252 @@ finish(const OnData & onData)
 
 
 /*****************************************************************************/
-/* LZMA COMPRESSOR                                                           */
+/* ZSTD COMPRESSOR                                                           */
 /*****************************************************************************/
 
+struct ZstdCompressor::Itl {
+
+    Itl(int level, std::shared_ptr<const CompressionDictionary> dictionary)
+        : stream(ZSTD_createCCtx()),
+          dictionary(dictionary),
+          buffer(ZSTD_CStreamOutSize())
+    {
+        if (!stream)
+            throw ML::Exception("ZSTD_createCCtx failed");
+
+        if (level == -1)
+            level = ZSTD_CLEVEL_DEFAULT;
+
+        check(ZSTD_CCtx_setParameter(stream, ZSTD_c_checksumFlag, 1));
+
+        // A digested dictionary carries the level along with it
+        if (dictionary)
+            check(ZSTD_CCtx_refCDict(stream,
+                                     dictionary->zstdCompressionDict(level)));
+        else check(ZSTD_CCtx_setParameter(stream, ZSTD_c_compressionLevel,
+                                          level));
+    }
+
+    ~Itl()
+    {
+        ZSTD_freeCCtx(stream);
+    }
+
+    ZSTD_CCtx * stream;
+    std::shared_ptr<const CompressionDictionary> dictionary;
+    std::vector<char> buffer;
+
+    static size_t check(size_t res)
+    {
+        if (ZSTD_isError(res))
+            throw ML::Exception("zstd compression error: %s",
+                                ZSTD_getErrorName(res));
+        return res;
+    }
+
+    size_t pump(const char * data, size_t len, const OnData & onData,
+                ZSTD_EndDirective mode)
+    {
+        ZSTD_inBuffer input = { data, len, 0 };
+        size_t result = 0;
+
+        for (;;) {
+            ZSTD_outBuffer output = { &buffer[0], buffer.size(), 0 };
+            size_t remaining
+                = check(ZSTD_compressStream2(stream, &output, &input, mode));
+
+            if (output.pos)
+                onData(&buffer[0], output.pos);
+            result += output.pos;
+
+            // With continue, zstd is done once it has taken all of the
+            // input; otherwise once it has nothing left to write
+            if (mode == ZSTD_e_continue ? input.pos == input.size
+                                        : remaining == 0)
+                break;
+        }
+
+        return result;
+    }
+
+    size_t flush(FlushLevel flushLevel, const OnData & onData)
+    {
+        if (flushLevel == FLUSH_NONE)
+            return 0;
+        return pump(0, 0, onData, ZSTD_e_flush);
+    }
+};
+
+ZstdCompressor::
+ZstdCompressor(int level,
+               std::shared_ptr<const CompressionDictionary> dictionary)
+    : itl(new Itl(level, dictionary))
+{
+}
+
+ZstdCompressor::
+~ZstdCompressor()
+{
+}
+
+size_t
+ZstdCompressor::
+compress(const char * data, size_t len, const OnData & onData)
+{
+    return itl->pump(data, len, onData, ZSTD_e_continue);
+}
+    
+size_t
+ZstdCompressor::
+flush(FlushLevel flushLevel, const OnData & onData)
+{
+    return itl->flush(flushLevel, onData);
+}
+
+size_t
+ZstdCompressor::
+finish(const OnData & onData)
+{
+    return itl->pump(0, 0, onData, ZSTD_e_end);
+}
+
+
+/*****************************************************************************/
+/* LZ4 COMPRESSOR                                                            */
+/*****************************************************************************/
+
+struct Lz4Compressor::Itl {
+
+    enum {
+        CHUNK_SIZE = 65536   ///< Most input given to LZ4F at once
+    };
+
+    Itl(int level, std::shared_ptr<const CompressionDictionary> dictionary)
+        : dictionary(dictionary),
+          started(false)
+    {
+        check(LZ4F_createCompressionContext(&context, LZ4F_VERSION));
+
+        memset(&prefs, 0, sizeof(prefs));
+        prefs.compressionLevel = (level == -1 ? 0 : level);
+        prefs.frameInfo.blockMode = LZ4F_blockLinked;
+        prefs.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+
+        buffer.resize(LZ4F_compressBound(CHUNK_SIZE, &prefs)
+                      + LZ4F_HEADER_SIZE_MAX);
+    }
+
+    ~Itl()
+    {
+        LZ4F_freeCompressionContext(context);
+    }
+
+    LZ4F_cctx * context;
+    LZ4F_preferences_t prefs;
+    std::shared_ptr<const CompressionDictionary> dictionary;
+    std::vector<char> buffer;
+    bool started;    ///< Has the frame header been written?
+
+    static size_t check(size_t res)
+    {
+        if (LZ4F_isError(res))
+            throw ML::Exception("lz4 compression error: %s",
+                                LZ4F_getErrorName(res));
+        return res;
+    }
+
+    size_t write(size_t bytes, const OnData & onData)
+    {
+        if (bytes)
+            onData(&buffer[0], bytes);
+        return bytes;
+    }
+
+    size_t start(const OnData & onData)
+    {
+        if (started)
+            return 0;
+        started = true;
+
+        if (dictionary)
+            return write(check(LZ4F_compressBegin_usingCDict
+                               (context, &buffer[0], buffer.size(),
+                                dictionary->lz4CompressionDict(), &prefs)),
+                         onData);
+        return write(check(LZ4F_compressBegin(context,
+                                              &buffer[0], buffer.size(),
+                                              &prefs)),
+                     onData);
+    }
+
+    size_t compress(const char * data, size_t len, const OnData & onData)
+    {
+        size_t result = start(onData);
+
+        while (len) {
+            size_t todo = std::min<size_t>(len, CHUNK_SIZE);
+            result += write(check(LZ4F_compressUpdate
+                                  (context, &buffer[0], buffer.size(),
+                                   data, todo, 0)),
+                            onData);
+            data += todo;
+            len -= todo;
+        }
+
+        return result;
+    }
+
+    size_t flush(FlushLevel flushLevel, const OnData & onData)
+    {
+        if (flushLevel == FLUSH_NONE || !started)
+            return 0;
+        return write(check(LZ4F_flush(context, &buffer[0], buffer.size(), 0)),
+                     onData);
+    }
+
+    size_t finish(const OnData & onData)
+    {
+        size_t result = start(onData);
+        result += write(check(LZ4F_compressEnd(context,
+                                               &buffer[0], buffer.size(),
+                                               0)),
+                        onData);
+        started = false;
+        return result;
+    }
+};
+
+Lz4Compressor::
+Lz4Compressor(int level,
+              std::shared_ptr<const CompressionDictionary> dictionary)
+    : itl(new Itl(level, dictionary))
+{
+}
+
+Lz4Compressor::
+~Lz4Compressor()
+{
+}
+
+size_t
+Lz4Compressor::
+compress(const char * data, size_t len, const OnData & onData)
+{
+    return itl->compress(data, len, onData);
+}
+    
+size_t
+Lz4Compressor::
+flush(FlushLevel flushLevel, const OnData & onData)
+{
+    return itl->flush(flushLevel, onData);
+}
+
+size_t
+Lz4Compressor::
+finish(const OnData & onData)
+{
+    return itl->finish(onData);
+}
+
 } // namespace Datacratic
@@ -19,6 +19,7 @@
 #include <memory>
 #include <functional>
 #include <string>
+#include "compression_dictionary.h"
 
 namespace Datacratic {
 
@@ -65,9 +66,14 @@ struct Compressor {
     /** Convert a filename to a compression scheme. */
     static std::string filenameToCompression(const std::string & filename);
 
-    /** Create a compressor with the given scheme. */
-    static Compressor * create(const std::string & compression,
-                               int level);
+    /** Create a compressor with the given scheme.  The dictionary, if
+        any, is used by the schemes that support one (zstd and lz4).
+    */
+    static Compressor *
+    create(const std::string & compression,
+           int level,
+           std::shared_ptr<const CompressionDictionary> dictionary
+               = std::shared_ptr<const CompressionDictionary>());
 };
 
 
@@ -114,14 +120,48 @@ private:
 };
 
 /*****************************************************************************/
-/* LZMA COMPRESSOR                                                           */
+/* ZSTD COMPRESSOR                                                           */
 /*****************************************************************************/
 
-struct LzmaCompressor : public Compressor {
+/** Zstandard compressor.  With a dictionary trained on the records of the
+    channel, this gets close to the ratio of xz at a speed better than
+    gzip.
+*/
+
+struct ZstdCompressor : public Compressor {
+
+    ZstdCompressor(int level = -1,
+                   std::shared_ptr<const CompressionDictionary> dictionary
+                       = std::shared_ptr<const CompressionDictionary>());
+
+    virtual ~ZstdCompressor();
+
+    virtual size_t compress(const char * data, size_t len,
+                            const OnData & onData);
+    
+    virtual size_t flush(FlushLevel flushLevel, const OnData & onData);
+
+    virtual size_t finish(const OnData & onData);
+
+private:
+    struct Itl;
+    std::unique_ptr<Itl> itl;
+};
+
+
+/*****************************************************************************/
+/* LZ4 COMPRESSOR                                                            */
+/*****************************************************************************/
+
+/** LZ4 frame compressor, for when speed matters more than ratio. */
+
+struct Lz4Compressor : public Compressor {
 
-    LzmaCompressor();
+    Lz4Compressor(int level = -1,
+                  std::shared_ptr<const CompressionDictionary> dictionary
+                      = std::shared_ptr<const CompressionDictionary>());
 
-    ~LzmaCompressor();
+    virtual ~Lz4Compressor();
 
     virtual size_t compress(const char * data, size_t len,
                             const OnData & onData);
@@ -108,6 +108,14 @@ switchFile(const std::string & filename,
         append = true;
     }
 
+    if (isSeekable()) {
+        if (append)
+            throw ML::Exception("can't append to seekable log " + fn);
+        if (!SeekableLogIndex::supportsCompression(compression))
+            throw ML::Exception("seekable log " + fn + " needs zstd "
+                                "compression, not " + compression);
+    }
+
     if (onPreFileOpen)
         onPreFileOpen(fn);
 
@@ -291,7 +299,12 @@ RotatingFileOutput::
 RotatingFileOutput()
     : RotatingOutputAdaptor(std::bind(&RotatingFileOutput::createFile,
                                       this,
-                                      std::placeholders::_1))
+                                      std::placeholders::_1)),
+      level(-1),
+      numCompressionThreads(0),
+      blockSize(1024 * 1024),
+      maxBlockAge(1.0),
+      seekable(false)
 {
 }
 
@@ -314,6 +327,29 @@ open(const std::string & filenamePattern,
     RotatingOutputAdaptor::open(filenamePattern, periodPattern);
 }
 
+void
+RotatingFileOutput::
+setParallelCompression(int numThreads, size_t blockSize, double maxBlockAge)
+{
+    this->numCompressionThreads = numThreads;
+    this->blockSize = blockSize;
+    this->maxBlockAge = maxBlockAge;
+}
+
+void
+RotatingFileOutput::
+setSeekable(bool seekable)
+{
+    this->seekable = seekable;
+}
+
+void
+RotatingFileOutput::
+setDictionary(std::shared_ptr<const CompressionDictionary> dict)
+{
+    dictionary = dict;
+}
+
 FileOutput *
 RotatingFileOutput::
 createFile(const std::string & filename)
@@ -331,6 +367,10 @@ createFile(const std::string & filename)
     result->onFileWrite = [=] (const string& channel, const std::size_t bytes)
 	{ if (this->onFileWrite) this->onFileWrite(channel, bytes); };
 
+    result->setParallelCompression(numCompressionThreads, blockSize,
+                                   maxBlockAge);
+    result->setSeekable(seekable);
+    result->setDictionary(dictionary);
     result->open(filename, compression, level);
 
     return result.release();
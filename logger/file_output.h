@@ -136,12 +136,27 @@ struct RotatingFileOutput : public RotatingOutputAdaptor {
               const std::string & periodPattern,
               const std::string & compression = "",
               int level = -1);
+
+    /** Settings for the files that get opened; see the methods of the
+        same name of CompressingOutput.  Must be called before open().
+    */
+    void setParallelCompression(int numThreads,
+                                size_t blockSize = 1024 * 1024,
+                                double maxBlockAge = 1.0);
+    void setSeekable(bool seekable);
+    void setDictionary(std::shared_ptr<const CompressionDictionary> dict);
     
 private:
     FileOutput * createFile(const std::string & filename);
 
     std::string compression;
     int level;
+
+    int numCompressionThreads;
+    size_t blockSize;
+    double maxBlockAge;
+    bool seekable;
+    std::shared_ptr<const CompressionDictionary> dictionary;
 };
 
 } // namespace Datacratic
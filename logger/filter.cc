@@ -15,6 +15,11 @@
 #include "jml/utils/hex_dump.h"
 #include "jml/utils/string_functions.h"
 #include "lzma.h"
+#include "compression_dictionary.h"
+#include <zstd.h>
+#define LZ4F_STATIC_LINKING_ONLY 1
+#include <lz4frame.h>
+#include <vector>
 
 
 using namespace std;
@@ -85,7 +90,8 @@ process(const std::string & buf,
 Filter *
 Filter::
 create(const std::string & extension,
-       Direction direction)
+       Direction direction,
+       std::shared_ptr<const CompressionDictionary> dictionary)
 {
     if (extension == "z") {
         if (direction == COMPRESS) return new ZlibCompressor();
@@ -99,6 +105,16 @@ create(const std::string & extension,
         if (direction == COMPRESS) return new LzmaCompressor();
         else return new LzmaDecompressor();
     }
+    else if (extension == "zst" || extension == "zstd") {
+        if (direction == COMPRESS)
+            return new ZstdCompressorFilter(-1, dictionary);
+        else return new ZstdDecompressor(dictionary);
+    }
+    else if (extension == "lz4") {
+        if (direction == COMPRESS)
+            return new Lz4CompressorFilter(-1, dictionary);
+        else return new Lz4Decompressor(dictionary);
+    }
     else return new IdentityFilter();
 }
 
@@ -906,5 +922,341 @@ LzmaDecompressor::
 {
 }
 
+/*****************************************************************************/
+/* ZSTD COMPRESSOR                                                           */
+/*****************************************************************************/
+
+struct ZstdCompressorFilter::Itl {
+    Itl(Direction direction, int level,
+        std::shared_ptr<const CompressionDictionary> dictionary)
+        : direction(direction),
+          cstream(0),
+          dstream(0),
+          dictionary(dictionary)
+    {
+        if (level == -1)
+            level = ZSTD_CLEVEL_DEFAULT;
+
+        if (direction == COMPRESS) {
+            cstream = ZSTD_createCCtx();
+            if (!cstream)
+                throw ML::Exception("ZSTD_createCCtx failed");
+            check(ZSTD_CCtx_setParameter(cstream, ZSTD_c_checksumFlag, 1));
+            if (dictionary)
+                check(ZSTD_CCtx_refCDict
+                      (cstream, dictionary->zstdCompressionDict(level)));
+            else check(ZSTD_CCtx_setParameter
+                       (cstream, ZSTD_c_compressionLevel, level));
+        }
+        else {
+            dstream = ZSTD_createDCtx();
+            if (!dstream)
+                throw ML::Exception("ZSTD_createDCtx failed");
+            if (dictionary)
+                check(ZSTD_DCtx_refDDict
+                      (dstream, dictionary->zstdDecompressionDict()));
+        }
+    }
+    
+    ~Itl()
+    {
+        if (cstream)
+            ZSTD_freeCCtx(cstream);
+        if (dstream)
+            ZSTD_freeDCtx(dstream);
+    }
+
+    Direction direction;
+    ZSTD_CCtx * cstream;
+    ZSTD_DCtx * dstream;
+    std::shared_ptr<const CompressionDictionary> dictionary;
+
+    size_t check(size_t res)
+    {
+        if (ZSTD_isError(res))
+            throw ML::Exception("zstd error on %s: %s",
+                                (direction == COMPRESS
+                                 ? "compression" : "decompression"),
+                                ZSTD_getErrorName(res));
+        return res;
+    }
+
+    /** Process as much as will fit in the output buffer.  Returns true
+        once everything has been done for this input at this flush level.
+    */
+    bool process(ZSTD_inBuffer & input, ZSTD_outBuffer & output,
+                 FlushLevel level)
+    {
+        if (direction == DECOMPRESS) {
+            check(ZSTD_decompressStream(dstream, &output, &input));
+            return input.pos == input.size && output.pos < output.size;
+        }
+
+        ZSTD_EndDirective mode;
+        switch (level) {
+        case FLUSH_NONE:   mode = ZSTD_e_continue;  break;
+        case FLUSH_SYNC:   mode = ZSTD_e_flush;     break;
+        case FLUSH_FULL:   mode = ZSTD_e_end;       break;  // new frame
+        case FLUSH_FINISH: mode = ZSTD_e_end;       break;
+        default:
+            throw Exception("invalid flush level for zstd processing");
+        }
+
+        size_t remaining
+            = check(ZSTD_compressStream2(cstream, &output, &input, mode));
+        if (mode == ZSTD_e_continue)
+            return input.pos == input.size;
+        return remaining == 0;
+    }
+};
+
+ZstdCompressorFilter::
+ZstdCompressorFilter(int level,
+                     std::shared_ptr<const CompressionDictionary> dict)
+    : itl(new Itl(COMPRESS, level, dict))
+{
+}
+    
+ZstdCompressorFilter::
+ZstdCompressorFilter(Direction dir,
+                     std::shared_ptr<const CompressionDictionary> dict)
+    : itl(new Itl(dir, -1, dict))
+{
+}
+    
+ZstdCompressorFilter::
+~ZstdCompressorFilter()
+{
+}
+
+void
+ZstdCompressorFilter::
+process(const char * src_begin, const char * src_end,
+        FlushLevel level,
+        boost::function<void ()> onMessageDone)
+{
+    size_t buffer_size = 65536;
+
+    ZSTD_inBuffer input = { src_begin, (size_t)(src_end - src_begin), 0 };
+    bool done;
+
+    do {
+        char dest[buffer_size];
+        ZSTD_outBuffer output = { dest, buffer_size, 0 };
+
+        done = itl->process(input, output, level);
+
+        onOutput(dest, output.pos, done ? level : FLUSH_NONE,
+                 done ? onMessageDone : boost::function<void ()>());
+    } while (!done);
+}
+
+
+/*****************************************************************************/
+/* ZSTD DECOMPRESSOR                                                         */
+/*****************************************************************************/
+
+ZstdDecompressor::
+ZstdDecompressor(std::shared_ptr<const CompressionDictionary> dict)
+    : ZstdCompressorFilter(DECOMPRESS, dict)
+{
+}
+    
+ZstdDecompressor::
+~ZstdDecompressor()
+{
+}
+
+
+/*****************************************************************************/
+/* LZ4 COMPRESSOR                                                            */
+/*****************************************************************************/
+
+struct Lz4CompressorFilter::Itl {
+
+    enum {
+        CHUNK_SIZE = 65536   ///< Most input given to LZ4F at once
+    };
+
+    Itl(Direction direction, int level,
+        std::shared_ptr<const CompressionDictionary> dictionary)
+        : direction(direction),
+          cctx(0),
+          dctx(0),
+          dictionary(dictionary),
+          started(false)
+    {
+        if (direction == COMPRESS) {
+            check(LZ4F_createCompressionContext(&cctx, LZ4F_VERSION));
+
+            memset(&prefs, 0, sizeof(prefs));
+            prefs.compressionLevel = (level == -1 ? 0 : level);
+            prefs.frameInfo.blockMode = LZ4F_blockLinked;
+            prefs.frameInfo.contentChecksumFlag
+                = LZ4F_contentChecksumEnabled;
+
+            buffer.resize(LZ4F_compressBound(CHUNK_SIZE, &prefs)
+                          + LZ4F_HEADER_SIZE_MAX);
+        }
+        else {
+            check(LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION));
+            buffer.resize(CHUNK_SIZE);
+        }
+    }
+    
+    ~Itl()
+    {
+        if (cctx)
+            LZ4F_freeCompressionContext(cctx);
+        if (dctx)
+            LZ4F_freeDecompressionContext(dctx);
+    }
+
+    Direction direction;
+    LZ4F_cctx * cctx;
+    LZ4F_dctx * dctx;
+    LZ4F_preferences_t prefs;
+    std::shared_ptr<const CompressionDictionary> dictionary;
+    std::vector<char> buffer;
+    bool started;    ///< Has the frame header been written?
+
+    size_t check(size_t res)
+    {
+        if (LZ4F_isError(res))
+            throw ML::Exception("lz4 error on %s: %s",
+                                (direction == COMPRESS
+                                 ? "compression" : "decompression"),
+                                LZ4F_getErrorName(res));
+        return res;
+    }
+
+    typedef std::function<void (const char *, size_t)> OnData;
+
+    void compress(const char * src_begin, const char * src_end,
+                  FlushLevel level, const OnData & onData)
+    {
+        if (!started && (src_begin != src_end || level == FLUSH_FINISH)) {
+            size_t n;
+            if (dictionary)
+                n = LZ4F_compressBegin_usingCDict
+                    (cctx, &buffer[0], buffer.size(),
+                     dictionary->lz4CompressionDict(), &prefs);
+            else n = LZ4F_compressBegin(cctx, &buffer[0], buffer.size(),
+                                        &prefs);
+            onData(&buffer[0], check(n));
+            started = true;
+        }
+
+        while (src_begin != src_end) {
+            size_t todo = std::min<size_t>(src_end - src_begin, CHUNK_SIZE);
+            size_t n = LZ4F_compressUpdate(cctx, &buffer[0], buffer.size(),
+                                           src_begin, todo, 0);
+            onData(&buffer[0], check(n));
+            src_begin += todo;
+        }
+
+        if (!started)
+            return;
+
+        switch (level) {
+        case FLUSH_NONE:
+            break;
+        case FLUSH_SYNC:
+            onData(&buffer[0],
+                   check(LZ4F_flush(cctx, &buffer[0], buffer.size(), 0)));
+            break;
+        case FLUSH_FULL:    // ending the frame makes what follows independent
+        case FLUSH_FINISH:
+            onData(&buffer[0],
+                   check(LZ4F_compressEnd(cctx, &buffer[0], buffer.size(),
+                                          0)));
+            started = false;
+            break;
+        default:
+            throw Exception("invalid flush level for lz4 processing");
+        }
+    }
+
+    void decompress(const char * src_begin, const char * src_end,
+                    const OnData & onData)
+    {
+        for (;;) {
+            size_t dstSize = buffer.size();
+            size_t srcSize = src_end - src_begin;
+
+            size_t n;
+            if (dictionary)
+                n = LZ4F_decompress_usingDict(dctx, &buffer[0], &dstSize,
+                                              src_begin, &srcSize,
+                                              dictionary->lz4Data(),
+                                              dictionary->lz4Size(),
+                                              0);
+            else n = LZ4F_decompress(dctx, &buffer[0], &dstSize,
+                                     src_begin, &srcSize, 0);
+            check(n);
+
+            src_begin += srcSize;
+            onData(&buffer[0], dstSize);
+
+            if (src_begin == src_end && dstSize < buffer.size())
+                break;
+        }
+    }
+};
+
+Lz4CompressorFilter::
+Lz4CompressorFilter(int level,
+                    std::shared_ptr<const CompressionDictionary> dict)
+    : itl(new Itl(COMPRESS, level, dict))
+{
+}
+    
+Lz4CompressorFilter::
+Lz4CompressorFilter(Direction dir,
+                    std::shared_ptr<const CompressionDictionary> dict)
+    : itl(new Itl(dir, -1, dict))
+{
+}
+    
+Lz4CompressorFilter::
+~Lz4CompressorFilter()
+{
+}
+
+void
+Lz4CompressorFilter::
+process(const char * src_begin, const char * src_end,
+        FlushLevel level,
+        boost::function<void ()> onMessageDone)
+{
+    auto onData = [&] (const char * data, size_t len)
+        {
+            if (len)
+                onOutput(data, len, FLUSH_NONE, boost::function<void ()>());
+        };
+
+    if (itl->direction == COMPRESS)
+        itl->compress(src_begin, src_end, level, onData);
+    else itl->decompress(src_begin, src_end, onData);
+
+    onOutput(0, 0, level, onMessageDone);
+}
+
+
+/*****************************************************************************/
+/* LZ4 DECOMPRESSOR                                                          */
+/*****************************************************************************/
+
+Lz4Decompressor::
+Lz4Decompressor(std::shared_ptr<const CompressionDictionary> dict)
+    : Lz4CompressorFilter(DECOMPRESS, dict)
+{
+}
+    
+Lz4Decompressor::
+~Lz4Decompressor()
+{
+}
+
 
 } // namespace Datacratic
@@ -25,6 +25,8 @@ struct gzip_params;
 
 namespace Datacratic {
 
+struct CompressionDictionary;
+
 enum Direction {
     COMPRESS,
     DECOMPRESS
@@ -74,8 +76,14 @@ struct Filter {
                          boost::function<void ()> onFilterDone
                              = boost::function<void ()>()) = 0;
 
-    static Filter * create(const std::string & extension,
-                           Direction direction);
+    /** Create a filter for the given extension.  The dictionary, if
+        any, is used by the schemes that support one (zstd and lz4).
+    */
+    static Filter *
+    create(const std::string & extension,
+           Direction direction,
+           std::shared_ptr<const CompressionDictionary> dictionary
+               = std::shared_ptr<const CompressionDictionary>());
 };
 
 
@@ -292,6 +300,90 @@ struct LzmaDecompressor
 };
 
 
+/*****************************************************************************/
+/* ZSTD COMPRESSOR                                                           */
+/*****************************************************************************/
+
+struct ZstdCompressorFilter
+    : public Filter {
+
+    ZstdCompressorFilter(int level = -1,
+                         std::shared_ptr<const CompressionDictionary> dict
+                             = std::shared_ptr<const CompressionDictionary>());
+    ~ZstdCompressorFilter();
+
+    using Filter::process;
+
+    virtual void process(const char * src_begin, const char * src_end,
+                         FlushLevel level,
+                         boost::function<void ()> onMessageDone);
+
+protected:
+    ZstdCompressorFilter(Direction direction,
+                         std::shared_ptr<const CompressionDictionary> dict);
+
+private:
+    struct Itl;
+    std::shared_ptr<Itl> itl;
+};
+
+
+/*****************************************************************************/
+/* ZSTD DECOMPRESSOR                                                         */
+/*****************************************************************************/
+
+struct ZstdDecompressor
+    : public ZstdCompressorFilter {
+
+    ZstdDecompressor(std::shared_ptr<const CompressionDictionary> dict
+                         = std::shared_ptr<const CompressionDictionary>());
+    
+    ~ZstdDecompressor();
+};
+
+
+/*****************************************************************************/
+/* LZ4 COMPRESSOR                                                            */
+/*****************************************************************************/
+
+struct Lz4CompressorFilter
+    : public Filter {
+
+    Lz4CompressorFilter(int level = -1,
+                        std::shared_ptr<const CompressionDictionary> dict
+                            = std::shared_ptr<const CompressionDictionary>());
+    ~Lz4CompressorFilter();
+
+    using Filter::process;
+
+    virtual void process(const char * src_begin, const char * src_end,
+                         FlushLevel level,
+                         boost::function<void ()> onMessageDone);
+
+protected:
+    Lz4CompressorFilter(Direction direction,
+                        std::shared_ptr<const CompressionDictionary> dict);
+
+private:
+    struct Itl;
+    std::shared_ptr<Itl> itl;
+};
+
+
+/*****************************************************************************/
+/* LZ4 DECOMPRESSOR                                                          */
+/*****************************************************************************/
+
+struct Lz4Decompressor
+    : public Lz4CompressorFilter {
+
+    Lz4Decompressor(std::shared_ptr<const CompressionDictionary> dict
+                        = std::shared_ptr<const CompressionDictionary>());
+    
+    ~Lz4Decompressor();
+};
+
+
 } // namespace Datacratic
 
 
@@ -12,6 +12,10 @@
 #include "jml/utils/hash_specializations.h"
 #include "jml/utils/vector_utils.h"
 #include "jml/arch/format.h"
+#include <algorithm>
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
 
 using namespace std;
 using namespace ML;
@@ -415,14 +419,364 @@ struct RootState : public ParseState {
 
 
 
+/*****************************************************************************/
+/* COLUMNAR ENCODING                                                         */
+/*****************************************************************************/
+
+/* In columnar mode, records (lines) are encoded in blocks.  Each record is
+   split into a template, which is its text with the values taken out
+   (keys, punctuation, anything that isn't a JSON string or number), and
+   the values.  Records with the same template share the same schema, and
+   the values of each slot of a template are written together as a column
+   after the templates.  A block is:
+
+       'B' size
+       numRecords flags(1 byte)
+       numTemplates { numSlots literal * (numSlots + 1) } * numTemplates
+       templateNum * numRecords
+       column * (numSlots of each template in turn)
+
+   where a column is one of
+
+       'N' scale delta * n     Decimal numbers with the same number of
+                               digits after the point, as zigzag deltas
+                               of the value without the point
+       'D' numDistinct string * numDistinct index * n
+                               Dictionary of the strings
+       'S' string * n          Raw strings
+
+   Sizes are compact encoded, and strings are a size then the bytes.  The
+   text between the values is kept as is, so any input round trips.
+*/
+
+typedef std::pair<const char *, const char *> JsonValueRange;
+
+inline void appendSize(std::string & output, unsigned long long size)
+{
+    char buf[16];
+    char * p = buf;
+    DB::encode_compact(p, buf + sizeof(buf), size);
+    output.append(buf, p);
+}
+
+inline void appendString(std::string & output,
+                         const char * first, const char * last)
+{
+    appendSize(output, last - first);
+    output.append(first, last);
+}
+
+inline bool isJsonTokenChar(char c)
+{
+    return isalnum((unsigned char)c) || c == '_' || c == '.';
+}
+
+/** Parse a number into its digits without the decimal point and the
+    number of digits after the point.  Only numbers that would be written
+    back identically by printColumnarDecimal() are accepted.
+*/
+bool parseColumnarDecimal(const char * p, const char * e,
+                          int64_t & mantissa, int & scale)
+{
+    bool negative = (p < e && *p == '-');
+    if (negative)
+        ++p;
+
+    const char * intStart = p;
+    while (p < e && isdigit(*p))
+        ++p;
+    const char * intEnd = p;
+
+    if (intEnd == intStart || (intEnd - intStart > 1 && *intStart == '0'))
+        return false;
+
+    const char * fracStart = intEnd, * fracEnd = intEnd;
+    if (p < e && *p == '.') {
+        fracStart = ++p;
+        while (p < e && isdigit(*p))
+            ++p;
+        fracEnd = p;
+        if (fracEnd == fracStart)
+            return false;
+    }
+
+    if (p != e || (intEnd - intStart) + (fracEnd - fracStart) > 18)
+        return false;
+
+    int64_t result = 0;
+    for (const char * q = intStart;  q < intEnd;  ++q)
+        result = result * 10 + (*q - '0');
+    for (const char * q = fracStart;  q < fracEnd;  ++q)
+        result = result * 10 + (*q - '0');
+
+    // -0 would come back as 0
+    if (negative && result == 0)
+        return false;
+
+    mantissa = negative ? -result : result;
+    scale = fracEnd - fracStart;
+    return true;
+}
+
+void printColumnarDecimal(std::string & output, int64_t mantissa, int scale)
+{
+    char buf[32];
+    unsigned long long abs
+        = mantissa < 0 ? -(unsigned long long)mantissa : mantissa;
+    int n = snprintf(buf, sizeof(buf), "%0*llu", scale + 1, abs);
+
+    if (mantissa < 0)
+        output += '-';
+    output.append(buf, n - scale);
+    if (scale) {
+        output += '.';
+        output.append(buf + n - scale, scale);
+    }
+}
+
+inline unsigned long long zigzag(int64_t val)
+{
+    return ((unsigned long long)val << 1) ^ (val >> 63);
+}
+
+inline int64_t unzigzag(unsigned long long val)
+{
+    return (int64_t)(val >> 1) ^ -(int64_t)(val & 1);
+}
+
+struct JsonColumnarEncoder {
+
+    JsonColumnarEncoder(size_t blockRecords)
+        : blockRecords(blockRecords), pendingRecords(0)
+    {
+    }
+
+    size_t blockRecords;
+
+    std::string pending;        ///< Input not yet encoded
+    size_t pendingRecords;      ///< Number of whole lines in pending
+
+    struct Template {
+        std::string literals;   ///< Encoded literals between the slots
+        std::vector<std::vector<JsonValueRange> > columns;
+    };
+
+    // Kept between blocks to save on allocations
+    std::unordered_map<std::string, int> templateNums;
+    std::vector<Template> templates;
+    std::vector<int> recordTemplates;
+    std::vector<JsonValueRange> values;
+    std::string literals;
+    std::string block;
+
+    void process(const char * first, const char * last,
+                 JsonContext & context, bool flush)
+    {
+        pending.append(first, last);
+        pendingRecords += std::count(first, last, '\n');
+
+        if (flush) {
+            if (!pending.empty())
+                encodeBlock(pending.data(), pending.data() + pending.size(),
+                            context);
+            pending.clear();
+            pendingRecords = 0;
+        }
+        else if (pendingRecords >= blockRecords) {
+            // Encode the whole lines, and keep the partial one for later
+            size_t end = pending.rfind('\n') + 1;
+            encodeBlock(pending.data(), pending.data() + end, context);
+            pending.erase(0, end);
+            pendingRecords = 0;
+        }
+    }
+
+    /** Split the record into the encoded literals of its template and its
+        values.
+    */
+    void splitRecord(const char * p, const char * e)
+    {
+        literals.clear();
+        values.clear();
+
+        const char * literalStart = p;
+
+        auto addValue = [&] (const char * first, const char * last)
+            {
+                appendString(literals, literalStart, first);
+                values.push_back(JsonValueRange(first, last));
+                literalStart = last;
+            };
+
+        for (const char * q = p;  q < e;  /* no inc */) {
+            char c = *q;
+
+            if (c == '"') {
+                const char * r = q + 1;
+                while (r < e && *r != '"')
+                    r += (*r == '\\' ? 2 : 1);
+                if (r >= e)
+                    break;  // unterminated; the rest is literal
+
+                // A string followed by a colon is a key, and part of the
+                // template
+                const char * next = r + 1;
+                while (next < e && *next == ' ')
+                    ++next;
+                if (next == e || *next != ':')
+                    addValue(q + 1, r);
+                q = r + 1;
+            }
+            else if ((c == '-' || isdigit((unsigned char)c))
+                     && (q == p || !isJsonTokenChar(q[-1]))) {
+                const char * r = q + (c == '-');
+                const char * digits = r;
+                while (r < e && isdigit(*r))
+                    ++r;
+                if (r == digits) {
+                    ++q;
+                    continue;
+                }
+                if (r + 1 < e && *r == '.' && isdigit(r[1])) {
+                    ++r;
+                    while (r < e && isdigit(*r))
+                        ++r;
+                }
+                if (r == e || !isJsonTokenChar(*r))
+                    addValue(q, r);
+                q = r;
+            }
+            else ++q;
+        }
+
+        appendString(literals, literalStart, e);
+    }
+
+    void encodeBlock(const char * p, const char * e, JsonContext & context)
+    {
+        templateNums.clear();
+        templates.clear();
+        recordTemplates.clear();
+
+        bool noFinalNewline = (e[-1] != '\n');
+
+        while (p < e) {
+            const char * eol = (const char *)memchr(p, '\n', e - p);
+            if (!eol)
+                eol = e;
+
+            splitRecord(p, eol);
+
+            auto it = templateNums.find(literals);
+            if (it == templateNums.end()) {
+                it = templateNums.insert(make_pair(literals,
+                                                   templates.size())).first;
+                templates.push_back(Template());
+                templates.back().literals = literals;
+                templates.back().columns.resize(values.size());
+            }
+
+            Template & templ = templates[it->second];
+            for (unsigned i = 0;  i < values.size();  ++i)
+                templ.columns[i].push_back(values[i]);
+            recordTemplates.push_back(it->second);
+
+            p = eol + 1;
+        }
+
+        block.clear();
+        appendSize(block, recordTemplates.size());
+        block += char(noFinalNewline);
+
+        appendSize(block, templates.size());
+        for (auto & t: templates) {
+            appendSize(block, t.columns.size());
+            block += t.literals;
+        }
+
+        for (int t: recordTemplates)
+            appendSize(block, t);
+
+        for (auto & t: templates)
+            for (auto & column: t.columns)
+                encodeColumn(column);
+
+        context.writeByte('B');
+        context.writeSize(block.size());
+        context.writeBinary(block.c_str(), block.size());
+    }
+
+    void encodeColumn(const std::vector<JsonValueRange> & column)
+    {
+        // Numbers, if they all have the same scale
+        std::vector<int64_t> mantissas;
+        mantissas.reserve(column.size());
+        int scale = -1;
+
+        for (auto & v: column) {
+            int64_t m;
+            int s;
+            if (!parseColumnarDecimal(v.first, v.second, m, s)
+                || (scale != -1 && s != scale))
+                break;
+            scale = s;
+            mantissas.push_back(m);
+        }
+
+        if (mantissas.size() == column.size()) {
+            block += 'N';
+            appendSize(block, scale);
+            int64_t prev = 0;
+            for (int64_t m: mantissas) {
+                appendSize(block, zigzag(m - prev));
+                prev = m;
+            }
+            return;
+        }
+
+        // Otherwise a dictionary, if there are few enough distinct values
+        std::unordered_map<std::string, int> distinct;
+        std::vector<int> indexes;
+        indexes.reserve(column.size());
+
+        for (auto & v: column) {
+            auto res = distinct.insert(make_pair(string(v.first, v.second),
+                                                 distinct.size()));
+            indexes.push_back(res.first->second);
+            if (distinct.size() * 2 > column.size())
+                break;
+        }
+
+        if (indexes.size() == column.size()) {
+            block += 'D';
+            appendSize(block, distinct.size());
+            std::vector<const std::string *> strings(distinct.size());
+            for (auto & d: distinct)
+                strings[d.second] = &d.first;
+            for (auto s: strings)
+                appendString(block, s->data(), s->data() + s->size());
+            for (int i: indexes)
+                appendSize(block, i);
+            return;
+        }
+
+        block += 'S';
+        for (auto & v: column)
+            appendString(block, v.first, v.second);
+    }
+};
+
 struct JsonCompressor::Itl {
-    Itl()
+    Itl(bool columnar, size_t blockRecords)
         : state(context)
     {
+        if (columnar)
+            columnarEncoder.reset(new JsonColumnarEncoder(blockRecords));
     }
 
     JsonContext context;
     RootState state;
+    std::unique_ptr<JsonColumnarEncoder> columnarEncoder;
 
     void reset()
     {
@@ -432,8 +786,8 @@ struct JsonCompressor::Itl {
 };
 
 JsonCompressor::
-JsonCompressor()
-    : itl(new Itl())
+JsonCompressor(bool columnar, size_t blockRecords)
+    : itl(new Itl(columnar, blockRecords))
 {
 }
 
@@ -448,6 +802,15 @@ process(const char * src_begin, const char * src_end,
         FlushLevel level,
         boost::function<void ()> onMessageDone)
 {
+    if (itl->columnarEncoder) {
+        // Blocks are independent of each other, so there is nothing more
+        // to do for a full flush
+        itl->columnarEncoder->process(src_begin, src_end, itl->context,
+                                      level != FLUSH_NONE);
+        itl->context.writeOutput(onOutput, level, onMessageDone);
+        return;
+    }
+
     itl->state.process(src_begin, src_end);
     if (level != FLUSH_NONE)
         itl->state.flush();
@@ -462,6 +825,114 @@ process(const char * src_begin, const char * src_end,
 /* JSON DECOMPRESSOR                                                         */
 /*****************************************************************************/
 
+/** Decode a block written by JsonColumnarEncoder into the stream. */
+void decodeColumnarBlock(const std::string & block, std::ostream & stream)
+{
+    const char * p = block.data();
+    const char * e = p + block.size();
+
+    auto readSize = [&] () -> unsigned long long
+        {
+            if (p >= e
+                || e - p < DB::compact_decode_length(*p))
+                throw Exception("truncated columnar JSON block");
+            return DB::decode_compact(p, e);
+        };
+
+    auto readByte = [&] () -> char
+        {
+            if (p >= e)
+                throw Exception("truncated columnar JSON block");
+            return *p++;
+        };
+
+    auto readString = [&] () -> std::string
+        {
+            size_t len = readSize();
+            if ((size_t)(e - p) < len)
+                throw Exception("truncated columnar JSON block");
+            p += len;
+            return std::string(p - len, p);
+        };
+
+    size_t numRecords = readSize();
+    bool noFinalNewline = readByte();
+
+    size_t numTemplates = readSize();
+    std::vector<std::vector<std::string> > literals(numTemplates);
+    for (auto & l: literals) {
+        size_t numSlots = readSize();
+        if (numSlots > block.size())
+            throw Exception("corrupt columnar JSON block");
+        l.resize(numSlots + 1);
+        for (auto & s: l)
+            s = readString();
+    }
+
+    std::vector<size_t> recordTemplates(numRecords);
+    std::vector<size_t> templateCounts(numTemplates);
+    for (auto & t: recordTemplates) {
+        t = readSize();
+        if (t >= numTemplates)
+            throw Exception("corrupt columnar JSON block");
+        ++templateCounts[t];
+    }
+
+    // columns[template][slot][record of the template]
+    std::vector<std::vector<std::vector<std::string> > > columns(numTemplates);
+    for (unsigned t = 0;  t < numTemplates;  ++t) {
+        size_t n = templateCounts[t];
+        columns[t].resize(literals[t].size() - 1);
+
+        for (auto & column: columns[t]) {
+            column.reserve(n);
+            char type = readByte();
+
+            if (type == 'N') {
+                unsigned long long scale = readSize();
+                if (scale > 18)
+                    throw Exception("corrupt columnar JSON block");
+                int64_t val = 0;
+                for (unsigned i = 0;  i < n;  ++i) {
+                    val += unzigzag(readSize());
+                    column.push_back(std::string());
+                    printColumnarDecimal(column.back(), val, scale);
+                }
+            }
+            else if (type == 'D') {
+                size_t numStrings = readSize();
+                if (numStrings > block.size())
+                    throw Exception("corrupt columnar JSON block");
+                std::vector<std::string> strings(numStrings);
+                for (auto & s: strings)
+                    s = readString();
+                for (unsigned i = 0;  i < n;  ++i)
+                    column.push_back(strings.at(readSize()));
+            }
+            else if (type == 'S') {
+                for (unsigned i = 0;  i < n;  ++i)
+                    column.push_back(readString());
+            }
+            else throw Exception("unknown columnar JSON column type %d",
+                                 type);
+        }
+    }
+
+    std::vector<size_t> done(numTemplates);
+    for (unsigned i = 0;  i < numRecords;  ++i) {
+        size_t t = recordTemplates[i];
+        size_t r = done[t]++;
+        auto & l = literals[t];
+
+        for (unsigned j = 0;  j + 1 < l.size();  ++j)
+            stream << l[j] << columns[t][j][r];
+        stream << l.back();
+
+        if (i != numRecords - 1 || !noFinalNewline)
+            stream << '\n';
+    }
+}
+
 struct JsonDecompressor::Itl {
 
     struct State;
@@ -565,6 +1036,10 @@ struct JsonDecompressor::Itl {
             pushState(&Itl::processCommonString);
             return;
 
+        case 'B':
+            pushState(&Itl::processColumnarBlock);
+            return;
+
         default:
             if (c >= 128)
                 current << commonStrings.at(c - 128);
@@ -654,7 +1129,7 @@ struct JsonDecompressor::Itl {
         case 1: { // reading data
             size_t avail = last - first;
             size_t toRead = std::min(avail, state.len - state.done);
-            
+
             state.str.append(first, first + toRead);
             first += toRead;
             state.done += toRead;
@@ -673,6 +1148,37 @@ struct JsonDecompressor::Itl {
         }
     }
 
+    void processColumnarBlock(const char * & first, const char * last,
+                              State & state)
+    {
+        if (first >= last)
+            throw Exception("processing with no characters");
+
+        switch (state.phase) {
+
+        case 0: // reading length
+            pushState(&Itl::processLength, &Itl::doneInternedStringLength);
+            break;
+
+        case 1: { // reading data
+            size_t avail = last - first;
+            size_t toRead = std::min(avail, state.len - state.done);
+
+            state.str.append(first, first + toRead);
+            first += toRead;
+            state.done += toRead;
+
+            if (state.done == state.len) {
+                decodeColumnarBlock(state.str, current);
+                popState();
+            }
+            break;
+        }
+        default:
+            throw Exception("processColumnarBlock: invalid phase");
+        }
+    }
+
     void doneInternedStringReference(State & current, State & parent)
     {
         parent.phase = 1;
@@ -16,11 +16,21 @@ namespace Datacratic {
 /* JSON COMPRESSOR                                                           */
 /*****************************************************************************/
 
-/** Pre-compressor for JSON data. */
+/** Pre-compressor for JSON data.
+
+    In columnar mode, the records (lines) are buffered into blocks of
+    blockRecords.  Each block is encoded with the schema of each record
+    (the keys and everything around the values) written once, and the
+    values of each field written together as a column: numbers are delta
+    encoded and repeated strings are dictionary coded.  This works much
+    better than the default mode on regular records like auction logs,
+    at the cost of holding a block in memory.  Any flush encodes what is
+    buffered, so that the output can be decompressed up to that point.
+*/
 
 struct JsonCompressor: public Filter {
 
-    JsonCompressor();
+    JsonCompressor(bool columnar = false, size_t blockRecords = 1024);
     ~JsonCompressor();
 
     using Filter::process;
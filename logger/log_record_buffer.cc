@@ -0,0 +1,246 @@
+/* log_record_buffer.cc
+   Copyright (c) 2015 Datacratic Inc.  All rights reserved.
+
+   Preallocated ring of binary log records.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "log_record_buffer.h"
+#include "soa/types/dtoa.h"
+#include "jml/arch/exception.h"
+#include "jml/utils/exc_assert.h"
+
+
+using namespace std;
+
+
+namespace Datacratic {
+
+
+/*****************************************************************************/
+/* LOG RECORD BUFFER                                                         */
+/*****************************************************************************/
+
+/* A record is laid out as follows, and padded to a multiple of 8 bytes so
+   that the space left at the end of the ring always fits the size and
+   channel of a wrap marker:
+
+       uint32_t size;         // of the whole record, padding included
+       uint16_t channel;      // WrapChannel: skip to the start of the ring
+       uint16_t numFields;
+       double timestamp;      // seconds since the epoch
+       fields...
+
+   Each field is its type as a byte, followed by 8 bytes for numbers and
+   dates, a byte for booleans, or a 32 bit length and the characters for
+   strings.  Nothing is aligned, so everything is copied with memcpy. */
+
+namespace {
+
+enum {
+    HeaderSize = 16,
+    WrapChannel = 0xffff
+};
+
+size_t encodedSize(const LogField & field)
+{
+    switch (field.type) {
+    case LogField::BOOL:   return 2;
+    case LogField::STRING: return 5 + field.length;
+    default:               return 9;
+    }
+}
+
+template<typename T>
+void store(char * & p, T value)
+{
+    memcpy(p, &value, sizeof(value));
+    p += sizeof(value);
+}
+
+template<typename T>
+T load(const char * & p)
+{
+    T result;
+    memcpy(&result, p, sizeof(result));
+    p += sizeof(result);
+    return result;
+}
+
+} // file scope
+
+LogRecordBuffer::
+LogRecordBuffer(size_t capacity)
+    : writePos(0), cachedReadPos(0), readPos(0), cachedWritePos(0),
+      nextReadPos(0)
+{
+    size_t size = 64;
+    while (size < capacity)
+        size *= 2;
+    data.reset(new char[size]);
+    mask = size - 1;
+}
+
+LogRecordBuffer::
+~LogRecordBuffer()
+{
+}
+
+LogRecordBuffer::WriteResult
+LogRecordBuffer::
+writeFields(unsigned channel, Date timestamp,
+            const LogField * fields, size_t numFields)
+{
+    ExcAssertLess(channel, WrapChannel);
+    ExcAssertLessEqual(numFields, 0xffff);
+
+    size_t size = HeaderSize;
+    for (size_t i = 0;  i < numFields;  ++i)
+        size += encodedSize(fields[i]);
+    size = (size + 7) & ~size_t(7);
+
+    // With records of at most half the ring, the end skipped by a wrap and
+    // the record together never need more than the whole of an empty ring
+    if (size > capacity() / 2)
+        throw ML::Exception("log record of %zd bytes is too large for a "
+                            "buffer of %zd", size, capacity());
+
+    // A record that doesn't fit before the end of the ring goes at the
+    // start, behind a marker to skip the end
+    uint64_t pos = writePos.load(std::memory_order_relaxed);
+    size_t offset = pos & mask;
+    size_t skip = 0;
+    if (offset + size > capacity())
+        skip = capacity() - offset;
+    uint64_t end = pos + skip + size;
+
+    if (end - cachedReadPos > capacity()) {
+        cachedReadPos = readPos.load(std::memory_order_acquire);
+        if (end - cachedReadPos > capacity())
+            return FULL;
+    }
+
+    if (skip) {
+        char * p = data.get() + offset;
+        store<uint32_t>(p, skip);
+        store<uint16_t>(p, WrapChannel);
+        offset = 0;
+    }
+
+    char * p = data.get() + offset;
+    store<uint32_t>(p, size);
+    store<uint16_t>(p, channel);
+    store<uint16_t>(p, numFields);
+    store<double>(p, timestamp.secondsSinceEpoch());
+
+    for (size_t i = 0;  i < numFields;  ++i) {
+        const LogField & field = fields[i];
+        store<uint8_t>(p, field.type);
+        switch (field.type) {
+        case LogField::BOOL:
+            store<uint8_t>(p, field.u);
+            break;
+        case LogField::STRING:
+            store<uint32_t>(p, field.length);
+            memcpy(p, field.str, field.length);
+            p += field.length;
+            break;
+        default:
+            store<uint64_t>(p, field.u);
+        }
+    }
+
+    // Publishing the record and then looking at where the reader is, as
+    // the reader does the opposite before it sleeps, means that one of
+    // them always sees the other
+    writePos.store(end, std::memory_order_seq_cst);
+    if (readPos.load(std::memory_order_seq_cst) == pos)
+        return WRITTEN_FIRST;
+    return WRITTEN;
+}
+
+bool
+LogRecordBuffer::
+next(Record & record)
+{
+    for (;;) {
+        uint64_t pos = readPos.load(std::memory_order_relaxed);
+        if (pos == cachedWritePos) {
+            cachedWritePos = writePos.load(std::memory_order_acquire);
+            if (pos == cachedWritePos)
+                return false;
+        }
+
+        const char * p = data.get() + (pos & mask);
+        uint32_t size = load<uint32_t>(p);
+        uint16_t channel = load<uint16_t>(p);
+
+        if (channel == WrapChannel) {
+            readPos.store(pos + size, std::memory_order_seq_cst);
+            continue;
+        }
+
+        record.channel = channel;
+        record.numFields = load<uint16_t>(p);
+        record.timestamp = Date::fromSecondsSinceEpoch(load<double>(p));
+        record.fields = p;
+        nextReadPos = pos + size;
+        return true;
+    }
+}
+
+void
+LogRecordBuffer::
+pop()
+{
+    readPos.store(nextReadPos, std::memory_order_seq_cst);
+}
+
+void
+LogRecordBuffer::Record::
+format(std::string & output) const
+{
+    output += timestamp.print(5);
+
+    char buf[32];
+    const char * p = fields;
+
+    for (unsigned i = 0;  i < numFields;  ++i) {
+        output += '\t';
+
+        switch (load<uint8_t>(p)) {
+        case LogField::INT: {
+            int n = snprintf(buf, sizeof(buf), "%lld",
+                             (long long)load<int64_t>(p));
+            output.append(buf, n);
+            break;
+        }
+        case LogField::UINT: {
+            int n = snprintf(buf, sizeof(buf), "%llu",
+                             (unsigned long long)load<uint64_t>(p));
+            output.append(buf, n);
+            break;
+        }
+        case LogField::DOUBLE:
+            output += dtoa(load<double>(p));
+            break;
+        case LogField::BOOL:
+            output += load<uint8_t>(p) ? '1' : '0';
+            break;
+        case LogField::STRING: {
+            uint32_t length = load<uint32_t>(p);
+            output.append(p, length);
+            p += length;
+            break;
+        }
+        case LogField::DATE:
+            output += Date::fromSecondsSinceEpoch(load<double>(p)).print(5);
+            break;
+        default:
+            throw ML::Exception("unknown log field type");
+        }
+    }
+}
+
+} // namespace Datacratic
@@ -0,0 +1,205 @@
+/* log_record_buffer.h                                             -*- C++ -*-
+   Copyright (c) 2015 Datacratic Inc.  All rights reserved.
+
+   Preallocated ring of binary log records, written by one thread and turned
+   into text by another.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include "soa/types/date.h"
+
+
+namespace Datacratic {
+
+
+/*****************************************************************************/
+/* LOG FIELD                                                                 */
+/*****************************************************************************/
+
+/** One field of a log record, as passed to LogRecordBuffer::write().  It
+    refers to the string that it was made from rather than copying it.
+*/
+
+struct LogField {
+    enum Type : uint8_t {
+        NONE,
+        INT,
+        UINT,
+        DOUBLE,
+        BOOL,
+        STRING,
+        DATE
+    };
+
+    LogField()
+        : type(NONE), u(0), length(0)
+    {
+    }
+
+    template<typename T>
+    LogField(T value,
+             typename std::enable_if<std::is_integral<T>::value
+                                     && std::is_signed<T>::value>::type * = 0)
+        : type(INT), i(value), length(0)
+    {
+    }
+
+    template<typename T>
+    LogField(T value,
+             typename std::enable_if<std::is_integral<T>::value
+                                     && std::is_unsigned<T>::value>::type * = 0)
+        : type(UINT), u(value), length(0)
+    {
+    }
+
+    template<typename T>
+    LogField(T value,
+             typename std::enable_if<std::is_floating_point<T>::value>::type
+                 * = 0)
+        : type(DOUBLE), d(value), length(0)
+    {
+    }
+
+    LogField(bool value)
+        : type(BOOL), u(value), length(0)
+    {
+    }
+
+    LogField(const char * s)
+        : type(STRING), str(s), length(strlen(s))
+    {
+    }
+
+    LogField(const std::string & s)
+        : type(STRING), str(s.data()), length(s.size())
+    {
+    }
+
+    LogField(Date date)
+        : type(DATE), d(date.secondsSinceEpoch()), length(0)
+    {
+    }
+
+    Type type;
+    union {
+        int64_t i;
+        uint64_t u;
+        double d;
+        const char * str;
+    };
+    size_t length;   ///< of the string
+};
+
+
+/*****************************************************************************/
+/* LOG RECORD BUFFER                                                         */
+/*****************************************************************************/
+
+/** Ring of variable sized log records, written by a single thread and read
+    by a single other thread, with no locking or memory allocation on
+    either side.
+
+    A record is a channel number, a timestamp and a list of fields, which
+    are copied in binary.  Formatting them as text is left to the reading
+    thread, with Record::format().
+*/
+
+struct LogRecordBuffer {
+
+    /** Create a buffer of at least the given number of bytes. */
+    LogRecordBuffer(size_t capacity = 1 << 20);
+
+    ~LogRecordBuffer();
+
+    enum WriteResult {
+        FULL,           ///< no room for the record; nothing was written
+        WRITTEN,        ///< written behind records that are still unread
+        WRITTEN_FIRST   ///< the reader had read everything before it
+    };
+
+    /** Copy a record into the buffer.  Must only be called by the writing
+        thread.  The reader may need waking up if WRITTEN_FIRST is
+        returned.  Throws if the record is larger than half the buffer.
+    */
+    template<typename... Fields>
+    WriteResult write(unsigned channel, Date timestamp,
+                      const Fields &... fields)
+    {
+        LogField encoded[sizeof...(Fields) + 1] = { LogField(fields)... };
+        return writeFields(channel, timestamp, encoded, sizeof...(Fields));
+    }
+
+    WriteResult writeFields(unsigned channel, Date timestamp,
+                            const LogField * fields, size_t numFields);
+
+    /** A record in the buffer, only valid until the reader moves on. */
+    struct Record {
+        unsigned channel;
+        Date timestamp;
+        unsigned numFields;
+        const char * fields;    ///< encoded fields
+
+        /** Append the timestamp then the fields to the given string,
+            separated by tabs.
+        */
+        void format(std::string & output) const;
+    };
+
+    /** Call onRecord(const Record &) for each record that has been written,
+        up to the given number of them.  Returns the number of records
+        read.  Must only be called by the reading thread.
+    */
+    template<typename OnRecord>
+    size_t read(const OnRecord & onRecord, size_t maxRecords = -1)
+    {
+        size_t numRead = 0;
+        Record record;
+        while (numRead < maxRecords && next(record)) {
+            onRecord(record);
+            pop();
+            ++numRead;
+        }
+        return numRead;
+    }
+
+    /** Is there a record to read?  Safe to call from any thread. */
+    bool couldRead() const
+    {
+        return readPos.load(std::memory_order_seq_cst)
+            != writePos.load(std::memory_order_seq_cst);
+    }
+
+    size_t capacity() const
+    {
+        return mask + 1;
+    }
+
+private:
+    /** Find the next record to read.  Returns false if there is none. */
+    bool next(Record & record);
+
+    /** Free the record found by next() for the writer. */
+    void pop();
+
+    std::unique_ptr<char[]> data;
+    size_t mask;
+
+    // Each position only ever grows and is masked to index the data.  They
+    // are on their own cache lines along with their thread's cached copy of
+    // the other one.
+    alignas(64) std::atomic<uint64_t> writePos;
+    uint64_t cachedReadPos;    ///< writer's copy of readPos
+    alignas(64) std::atomic<uint64_t> readPos;
+    uint64_t cachedWritePos;   ///< reader's copy of writePos
+    uint64_t nextReadPos;      ///< after the record returned by next()
+};
+
+
+} // namespace Datacratic
@@ -11,9 +11,11 @@
 #include "jml/arch/demangle.h"
 #include "jml/utils/string_functions.h"
 #include "jml/arch/timers.h"
+#include "jml/utils/exc_assert.h"
 #include "file_output.h"
 #include "publish_output.h"
 #include "callback_output.h"
+#include "jml/arch/wakeup_fd.h"
 #include <boost/make_shared.hpp>
 
 
@@ -41,17 +43,61 @@ clearStats()
 {
 }
 
+void
+LogOutput::
+logMessageData(const std::string & channel,
+               const char * message, size_t length)
+{
+    logMessage(channel, std::string(message, length));
+}
+
 
 /*****************************************************************************/
 /* LOGGER                                                                    */
 /*****************************************************************************/
 
+/** Buffer of logRecord() for a thread. */
+struct Logger::RecordSlot {
+    RecordSlot()
+        : buffer(RecordBufferSize), inUse(true)
+    {
+    }
+
+    LogRecordBuffer buffer;
+    std::atomic<bool> inUse;    ///< false once its thread has exited
+};
+
+/** What a thread knows of its record buffer.  Destroyed when the thread
+    exits, which frees its slot for another thread.
+*/
+struct Logger::ThreadRecords {
+    ThreadRecords(std::shared_ptr<RecordSlot> slot, bool shared)
+        : slot(std::move(slot)), buffer(&this->slot->buffer), shared(shared)
+    {
+    }
+
+    ~ThreadRecords()
+    {
+        if (!shared)
+            slot->inUse.store(false, std::memory_order_release);
+    }
+
+    std::shared_ptr<RecordSlot> slot;
+    LogRecordBuffer * buffer;
+    bool shared;                ///< the slot of the threads beyond the limit
+};
+
 Logger::
 Logger(size_t bufferSize)
     : context(std::make_shared<zmq::context_t>(1)),
       messages(bufferSize),
       outputs(0),
-      messagesSent(0), messagesDone(0)
+      messagesSent(0), messagesDone(0),
+      recordBuffers(new std::shared_ptr<RecordSlot>[MaxRecordThreads + 1]),
+      numRecordBuffers(0),
+      sharedRecords(nullptr),
+      channelNames(new std::string[MaxChannels]), numChannels(0),
+      recordsDropped(0)
 {
     doShutdown = false;
 }
@@ -61,7 +107,12 @@ Logger(zmq::context_t & contextRef, size_t bufferSize)
     : context(ML::make_unowned_std_sp(contextRef)),
       messages(bufferSize),
       outputs(0),
-      messagesSent(0), messagesDone(0)
+      messagesSent(0), messagesDone(0),
+      recordBuffers(new std::shared_ptr<RecordSlot>[MaxRecordThreads + 1]),
+      numRecordBuffers(0),
+      sharedRecords(nullptr),
+      channelNames(new std::string[MaxChannels]), numChannels(0),
+      recordsDropped(0)
 {
     doShutdown = false;
 }
@@ -71,7 +122,12 @@ Logger(std::shared_ptr<zmq::context_t> & context, size_t bufferSize)
     : context(context),
       messages(bufferSize),
       outputs(0),
-      messagesSent(0), messagesDone(0)
+      messagesSent(0), messagesDone(0),
+      recordBuffers(new std::shared_ptr<RecordSlot>[MaxRecordThreads + 1]),
+      numRecordBuffers(0),
+      sharedRecords(nullptr),
+      channelNames(new std::string[MaxChannels]), numChannels(0),
+      recordsDropped(0)
 {
     doShutdown = false;
 }
@@ -93,6 +149,9 @@ init()
     };
 
     messageLoop.addSource("Logger::messages", messages);
+
+    recordSource = std::make_shared<RecordSource>(this);
+    messageLoop.addSource("Logger::records", recordSource);
 }
 
 void
@@ -153,10 +212,29 @@ struct Logger::Output {
     {
     }
     
+    bool matches(const std::string & channel) const
+    {
+        return (allowChannels.empty()
+                || boost::regex_match(channel, allowChannels))
+            && (denyChannels.empty()
+                || !boost::regex_match(channel, denyChannels));
+    }
+
+    /// matches() for a channel of logRecord(), worked out only once
+    bool matches(unsigned channelNum, const std::string & channel)
+    {
+        if (channelNum >= channelMatches.size())
+            channelMatches.resize(channelNum + 1, -1);
+        if (channelMatches[channelNum] == -1)
+            channelMatches[channelNum] = matches(channel);
+        return channelMatches[channelNum];
+    }
+
     boost::regex allowChannels;  // channels to match
     boost::regex denyChannels;  // channels to filter out
     std::shared_ptr<LogOutput> output;  // thing to write to
     double logProbability;
+    std::vector<signed char> channelMatches;  // -1 if not worked out yet
 };
 
 /// List of entries to output to
@@ -215,9 +293,64 @@ struct Logger::Outputs : public std::vector<Output> {
         }
     }
     
+    void logRecord(unsigned channelNum, const std::string & channel,
+                   const std::string & message)
+    {
+        for (auto it = begin(); it != end();  ++it) {
+            try {
+                if (!it->matches(channelNum, channel))
+                    continue;
+                if (it->logProbability == 1.0
+                    || ((random() % 100000)
+                        < (it->logProbability * 100000)))
+                    it->output->logMessageData(channel, message.data(),
+                                               message.size());
+            } catch (const std::exception & exc) {
+                cerr << "error: writing message to channel " << channel
+                     << " with output " << ML::type_name(*it->output)
+                     << ": " << exc.what() << "; message = "
+                     << message << endl;
+            }
+        }
+    }
+
     Outputs * old;   // to allow cleanup
 };
 
+
+/// Wakes up the message loop when a thread logs a record and the loop may
+/// have run out of records to read
+struct Logger::RecordSource : public AsyncEventSource {
+    RecordSource(Logger * logger)
+        : logger(logger), wakeup(EFD_NONBLOCK)
+    {
+    }
+
+    virtual int selectFd() const
+    {
+        return wakeup.fd();
+    }
+
+    virtual bool poll() const
+    {
+        return logger->recordsWaiting();
+    }
+
+    virtual bool processOne()
+    {
+        if (logger->readRecords())
+            return true;
+
+        // As in TypedMessageSink, look again once the wakeup is cleared in
+        // case a record came in meanwhile
+        wakeup.tryRead();
+        return logger->recordsWaiting();
+    }
+
+    Logger * logger;
+    ML::Wakeup_Fd wakeup;
+};
+
 bool startsWith(std::string & s,
                 const std::string & prefix)
 {
@@ -295,6 +428,144 @@ clearOutputs()
     newOutputs.release();
 }
 
+unsigned
+Logger::
+registerChannel(const std::string & channel)
+{
+    std::lock_guard<std::mutex> guard(recordsLock);
+
+    unsigned n = numChannels.load(std::memory_order_relaxed);
+    for (unsigned i = 0;  i < n;  ++i)
+        if (channelNames[i] == channel)
+            return i;
+
+    if (n == MaxChannels)
+        throw ML::Exception("too many channels registered with the logger");
+
+    channelNames[n] = channel;
+    numChannels.store(n + 1, std::memory_order_release);
+    return n;
+}
+
+bool
+Logger::
+logRecordFields(unsigned channel, const LogField * fields, size_t numFields)
+{
+    if (!outputs) return true;
+
+    ExcAssertLess(channel, numChannels.load(std::memory_order_relaxed));
+
+    ThreadRecords * records = threadRecords.get();
+    LogRecordBuffer * buffer = (JML_LIKELY(records != nullptr)
+                                ? records->buffer : createRecordBuffer());
+
+    LogRecordBuffer::WriteResult result;
+    if (JML_LIKELY(buffer != sharedRecords.load(std::memory_order_relaxed)))
+        result = buffer->writeFields(channel, Date::now(), fields, numFields);
+    else {
+        std::lock_guard<ML::Spinlock> guard(sharedRecordsLock);
+        result = buffer->writeFields(channel, Date::now(), fields, numFields);
+    }
+
+    if (result == LogRecordBuffer::FULL) {
+        recordsDropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    // The message loop may have gone to sleep once it read everything
+    // that was in the buffer
+    if (result == LogRecordBuffer::WRITTEN_FIRST && recordSource)
+        recordSource->wakeup.signal();
+
+    return true;
+}
+
+LogRecordBuffer *
+Logger::
+createRecordBuffer()
+{
+    std::lock_guard<std::mutex> guard(recordsLock);
+
+    unsigned n = numRecordBuffers.load(std::memory_order_relaxed);
+
+    // Take over the buffer of a thread that has exited.  Any records it
+    // left are still read before the new ones.
+    for (unsigned i = 0;  i < n && i < MaxRecordThreads;  ++i) {
+        bool free = false;
+        if (recordBuffers[i]->inUse.compare_exchange_strong
+                (free, true, std::memory_order_acquire)) {
+            threadRecords.reset(new ThreadRecords(recordBuffers[i], false));
+            return &recordBuffers[i]->buffer;
+        }
+    }
+
+    if (n <= MaxRecordThreads) {
+        recordBuffers[n] = std::make_shared<RecordSlot>();
+        if (n == MaxRecordThreads)
+            sharedRecords.store(&recordBuffers[n]->buffer,
+                                std::memory_order_relaxed);
+        numRecordBuffers.store(++n, std::memory_order_release);
+    }
+
+    bool shared = (n == MaxRecordThreads + 1);
+    threadRecords.reset(new ThreadRecords(recordBuffers[n - 1], shared));
+    return &recordBuffers[n - 1]->buffer;
+}
+
+Logger::Outputs *
+Logger::
+currentOutputs()
+{
+    Outputs * current = outputs;
+        
+    if (!current) return 0;
+
+    if (current->empty()) {
+        current = 0;  // TODO: delete it
+    }
+    else if (current->old) {
+        delete current->old;
+        current->old = 0;
+    }
+
+    return current;
+}
+
+bool
+Logger::
+readRecords()
+{
+    enum { BatchSize = 256 };
+
+    Outputs * current = currentOutputs();
+
+    auto onRecord = [&] (const LogRecordBuffer::Record & record)
+        {
+            if (!current) return;
+            recordMessage.clear();
+            record.format(recordMessage);
+            current->logRecord(record.channel, channelNames[record.channel],
+                               recordMessage);
+        };
+
+    unsigned n = numRecordBuffers.load(std::memory_order_acquire);
+    for (unsigned i = 0;  i < n;  ++i)
+        recordBuffers[i]->buffer.read(onRecord, BatchSize);
+
+    return recordsWaiting();
+}
+
+bool
+Logger::
+recordsWaiting() const
+{
+    unsigned n = numRecordBuffers.load(std::memory_order_acquire);
+    for (unsigned i = 0;  i < n;  ++i)
+        if (recordBuffers[i]->buffer.couldRead())
+            return true;
+    return false;
+}
+
 void
 Logger::
 start(std::function<void ()> onStop)
@@ -321,7 +592,7 @@ void
 Logger::
 waitUntilFinished()
 {
-    while (messagesDone < messagesSent) {
+    while (messagesDone < messagesSent || recordsWaiting()) {
         //cerr << "sent " << messagesSent << " done "
         //     << messagesDone << endl;
         ML::sleep(0.01);
@@ -404,17 +675,9 @@ void
 Logger::
 handleListenerMessage(std::vector<std::string> const & message)
 {
-    Outputs * current = outputs;
-        
-    if (!current) return;
+    if (!outputs) return;
 
-    if (current->empty()) {
-        current = 0;  // TODO: delete it
-    }
-    else if (current->old) {
-        delete current->old;
-        current->old = 0;
-    }
+    Outputs * current = currentOutputs();
 
     if (message.size() == 1 && message[0] == "SHUTDOWN")
         return;
@@ -446,18 +709,10 @@ void
 Logger::
 handleRawListenerMessage(std::vector<std::string> const & message)
 {
-    Outputs * current = outputs;
-        
-    if (!current) return;
+    if (!outputs) return;
+
+    Outputs * current = currentOutputs();
 
-    if (current->empty()) {
-        current = 0;  // TODO: delete it
-    }
-    else if (current->old) {
-        delete current->old;
-        current->old = 0;
-    }
-    
     atomic_add(messagesDone, 1);
 
     if (message.size() == 1) {
@@ -486,18 +741,8 @@ void
 Logger::
 handleMessage(std::vector<zmq::message_t> && message)
 {
-    Outputs * current = outputs;
-        
-    if (!current) return;
+    Outputs * current = currentOutputs();
 
-    if (current->empty()) {
-        current = 0;  // TODO: delete it
-    }
-    else if (current->old) {
-        delete current->old;
-        current->old = 0;
-    }
-    
     //cerr << "got subscription message " << message << endl;
                 
     if (!current) return;
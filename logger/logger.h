@@ -9,12 +9,17 @@
 #include "soa/service/zmq_named_pub_sub.h"
 #include "soa/service/zmq_utils.h"
 #include "soa/service/socket_per_thread.h"
+#include "log_record_buffer.h"
+#include <atomic>
+#include <mutex>
 #include <sstream>
 #include "jml/utils/filter_streams.h"
 #include <boost/thread/thread.hpp>
+#include <boost/thread/tss.hpp>
 #include "jml/utils/smart_ptr_utils.h"
 #include "jml/utils/vector_utils.h"
 #include "jml/arch/atomic_ops.h"
+#include "jml/arch/spinlock.h"
 #include "ace/Synch.h"
 #include <boost/function.hpp>
 #include <boost/regex.hpp>
@@ -46,6 +51,14 @@ struct LogOutput {
     virtual void logMessage(const std::string & channel,
                             const std::string & message) = 0;
 
+    /** Called instead of logMessage() for the records of
+        Logger::logRecord(), with a message that is only valid during the
+        call.  The default copies it into a string for logMessage();
+        outputs that can write it straight away should override this.
+    */
+    virtual void logMessageData(const std::string & channel,
+                                const char * message, size_t length);
+
     /** Should close whatever resources are being used by the output
         and join any threads that it's created.
     */
@@ -178,6 +191,47 @@ struct Logger {
         messages.push(message);
     }
 
+    /** Return the number of the given channel for logRecord(), registering
+        it if it is new.  There can be at most MaxChannels of them.
+    */
+    unsigned registerChannel(const std::string & channel);
+
+    /** Log a record with the given fields to a channel from
+        registerChannel(), with a timestamp of now.  The message that the
+        outputs get is the same as with logMessage(), but all the work of
+        making it is done by the logging thread: the calling thread only
+        copies the fields in binary into a buffer of its own, without
+        allocating memory, taking a lock or converting anything to a
+        string.  See LogField for the types that the fields can have.
+
+        Records from one thread are logged in order, but not necessarily
+        in order with those of other threads or with logMessage().
+
+        The buffer of a thread is handed over to the next new thread once
+        it exits.  Beyond MaxRecordThreads threads alive at the same time,
+        the others share a buffer under a lock.
+
+        Returns false if the record was dropped because the buffer of the
+        thread is full.
+    */
+    template<typename... Fields>
+    bool logRecord(unsigned channel, const Fields &... fields)
+    {
+        if (!outputs) return true;
+        LogField encoded[sizeof...(Fields) + 1] = { LogField(fields)... };
+        return logRecordFields(channel, encoded, sizeof...(Fields));
+    }
+
+    /// logRecord() for a number of fields that is only known at run time
+    bool logRecordFields(unsigned channel, const LogField * fields,
+                         size_t numFields);
+
+    enum {
+        MaxChannels = 4096,          ///< for logRecord()
+        MaxRecordThreads = 256,      ///< with a buffer of their own
+        RecordBufferSize = 1 << 20   ///< bytes per buffer for logRecord()
+    };
+
     template<typename GetEl>
     void logMessage(const std::string & channel,
                     int numElements,
@@ -217,6 +271,12 @@ struct Logger {
     uint64_t numMessagesSent() const { return messagesSent; }
     uint64_t numMessagesDone() const { return messagesDone; }
 
+    /// Number of records that logRecord() dropped for lack of room
+    uint64_t numRecordsDropped() const { return recordsDropped; }
+
+    /// Number of buffers that logRecord() has created for its threads
+    unsigned numRecordBuffersCreated() const { return numRecordBuffers; }
+
     void handleListenerMessage(std::vector<std::string> const & message);
     void handleRawListenerMessage(std::vector<std::string> const & message);
     void handleMessage(std::vector<zmq::message_t> && message);
@@ -243,10 +303,51 @@ private:
 
     struct Output;
     struct Outputs;
+    struct RecordSource;
+    struct RecordSlot;
+    struct ThreadRecords;
 
     /// Current list of outputs.  Must be swapped atomically.
     Outputs * outputs;
 
+    /// Current outputs, once the previous ones are freed.  Null if there
+    /// are none.  Must be called from the message loop.
+    Outputs * currentOutputs();
+
+    /// Wakes up the message loop to read the records of logRecord()
+    std::shared_ptr<RecordSource> recordSource;
+
+    /// Buffers of logRecord(), one per thread that calls it, then one
+    /// shared by the threads beyond MaxRecordThreads.  A thread's slot is
+    /// shared with its ThreadRecords, which marks it free when the thread
+    /// exits, even if that happens after the logger is destroyed.
+    std::unique_ptr<std::shared_ptr<RecordSlot>[]> recordBuffers;
+    std::atomic<unsigned> numRecordBuffers;
+    boost::thread_specific_ptr<ThreadRecords> threadRecords;
+    std::atomic<LogRecordBuffer *> sharedRecords;
+    ML::Spinlock sharedRecordsLock;
+
+    /// Names of the channels of logRecord(), indexed by number
+    std::unique_ptr<std::string[]> channelNames;
+    std::atomic<unsigned> numChannels;
+
+    /// Held to register a channel or add a record buffer
+    std::mutex recordsLock;
+
+    std::atomic<uint64_t> recordsDropped;
+
+    /// Message of the record being logged, kept to reuse its memory
+    std::string recordMessage;
+
+    LogRecordBuffer * createRecordBuffer();
+
+    /// Log the records that are waiting, a batch from each buffer at a
+    /// time.  Returns true if there may be more.
+    bool readRecords();
+
+    /// Are there records that haven't been read?
+    bool recordsWaiting() const;
+
     /// Thing we get subscription messages from
     std::vector<std::shared_ptr<zmq::socket_t> > subscriptions;
 
@@ -0,0 +1,357 @@
+/* seekable_log.cc
+   Copyright (c) 2015 Datacratic Inc.  All rights reserved.
+
+   Compressed log files that can be read from any point.
+*/
+
+#include "seekable_log.h"
+#include "filter.h"
+#include "jml/arch/exception.h"
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+using namespace std;
+
+
+namespace Datacratic {
+
+
+namespace {
+
+/* Layout of the index, all little endian:
+
+       uint32_t  skippable frame magic
+       uint32_t  size of the rest of the frame
+       per block: offset, size, firstRecord, numRecords as uint64_t,
+                  earliest, latest as double seconds since the epoch
+       char[16]  compression, zero padded
+       uint64_t  number of blocks
+       char[8]   INDEX_MAGIC
+
+   so that it can be found from the fixed size trailer at the end.
+*/
+
+const uint32_t SKIPPABLE_FRAME_MAGIC = 0x184D2A5E;
+const char INDEX_MAGIC[8] = { 'S', 'O', 'A', 'L', 'O', 'G', 'I', 'X' };
+
+enum {
+    HEADER_SIZE = 8,
+    ENTRY_SIZE = 48,
+    COMPRESSION_SIZE = 16,
+    TRAILER_SIZE = COMPRESSION_SIZE + 8 + 8
+};
+
+template<typename T>
+void store(std::string & output, const T & val)
+{
+    output.append((const char *)&val, sizeof(val));
+}
+
+template<typename T>
+T load(const char * & p)
+{
+    T result;
+    memcpy(&result, p, sizeof(T));
+    p += sizeof(T);
+    return result;
+}
+
+void readAt(int fd, const std::string & filename,
+            char * data, size_t size, off_t offset)
+{
+    while (size) {
+        ssize_t res = pread(fd, data, size, offset);
+        if (res == -1) {
+            if (errno == EINTR)
+                continue;
+            throw ML::Exception(errno, "pread of " + filename);
+        }
+        if (res == 0)
+            throw ML::Exception("unexpected end of " + filename);
+        data += res;
+        size -= res;
+        offset += res;
+    }
+}
+
+std::string gunzip(const char * data, size_t size)
+{
+    std::string result;
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit2(&stream, 15 + 16) != Z_OK)
+        throw ML::Exception("inflateInit2 failed");
+
+    stream.next_in = (Bytef *)data;
+    stream.avail_in = size;
+
+    int res = Z_OK;
+    while (res != Z_STREAM_END) {
+        char output[65536];
+        stream.next_out = (Bytef *)output;
+        stream.avail_out = sizeof(output);
+
+        res = inflate(&stream, Z_NO_FLUSH);
+        if (res != Z_OK && res != Z_STREAM_END) {
+            inflateEnd(&stream);
+            throw ML::Exception("gzip error %d reading log block", res);
+        }
+
+        result.append(output, (char *)stream.next_out - output);
+    }
+
+    inflateEnd(&stream);
+    return result;
+}
+
+} // file scope
+
+
+/*****************************************************************************/
+/* SEEKABLE LOG INDEX                                                        */
+/*****************************************************************************/
+
+uint64_t
+SeekableLogIndex::
+numRecords() const
+{
+    if (blocks.empty())
+        return 0;
+    return blocks.back().firstRecord + blocks.back().numRecords;
+}
+
+bool
+SeekableLogIndex::
+supportsCompression(const std::string & compression)
+{
+    return compression == "zstd" || compression == "zst";
+}
+
+std::string
+SeekableLogIndex::
+serialize() const
+{
+    if (compression.size() > COMPRESSION_SIZE)
+        throw ML::Exception("compression name too long for log index");
+
+    std::string result;
+    result.reserve(HEADER_SIZE + blocks.size() * ENTRY_SIZE + TRAILER_SIZE);
+
+    store<uint32_t>(result, SKIPPABLE_FRAME_MAGIC);
+    store<uint32_t>(result, blocks.size() * ENTRY_SIZE + TRAILER_SIZE);
+
+    for (auto & b: blocks) {
+        store<uint64_t>(result, b.offset);
+        store<uint64_t>(result, b.size);
+        store<uint64_t>(result, b.firstRecord);
+        store<uint64_t>(result, b.numRecords);
+        store<double>(result, b.earliest.secondsSinceEpoch());
+        store<double>(result, b.latest.secondsSinceEpoch());
+    }
+
+    std::string name = compression;
+    name.resize(COMPRESSION_SIZE, '\0');
+    result += name;
+    store<uint64_t>(result, blocks.size());
+    result.append(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+
+    return result;
+}
+
+SeekableLogIndex
+SeekableLogIndex::
+load(int fd, const std::string & filename)
+{
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+        throw ML::Exception(errno, "fstat of " + filename);
+
+    size_t fileSize = st.st_size;
+    if (fileSize < HEADER_SIZE + TRAILER_SIZE)
+        throw ML::Exception(filename + " is not a seekable log file");
+
+    char trailer[TRAILER_SIZE];
+    readAt(fd, filename, trailer, TRAILER_SIZE, fileSize - TRAILER_SIZE);
+
+    const char * p = trailer;
+    SeekableLogIndex result;
+    result.compression.assign(p, strnlen(p, COMPRESSION_SIZE));
+    p += COMPRESSION_SIZE;
+    uint64_t numBlocks = load<uint64_t>(p);
+
+    if (memcmp(p, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0)
+        throw ML::Exception(filename + " is not a seekable log file");
+
+    size_t indexSize = HEADER_SIZE + numBlocks * ENTRY_SIZE + TRAILER_SIZE;
+    if (numBlocks > fileSize / ENTRY_SIZE || indexSize > fileSize)
+        throw ML::Exception("corrupt index in " + filename);
+
+    std::string index(indexSize, '\0');
+    readAt(fd, filename, &index[0], indexSize, fileSize - indexSize);
+
+    p = index.data();
+    if (load<uint32_t>(p) != SKIPPABLE_FRAME_MAGIC
+        || load<uint32_t>(p) != indexSize - HEADER_SIZE)
+        throw ML::Exception("corrupt index in " + filename);
+
+    result.blocks.resize(numBlocks);
+    for (auto & b: result.blocks) {
+        b.offset = load<uint64_t>(p);
+        b.size = load<uint64_t>(p);
+        b.firstRecord = load<uint64_t>(p);
+        b.numRecords = load<uint64_t>(p);
+        b.earliest = Date::fromSecondsSinceEpoch(load<double>(p));
+        b.latest = Date::fromSecondsSinceEpoch(load<double>(p));
+
+        if (b.offset + b.size > fileSize - indexSize)
+            throw ML::Exception("corrupt index in " + filename);
+    }
+
+    return result;
+}
+
+
+/*****************************************************************************/
+/* SEEKABLE LOG READER                                                       */
+/*****************************************************************************/
+
+SeekableLogReader::
+SeekableLogReader(const std::string & filename,
+                  std::shared_ptr<const CompressionDictionary> dictionary)
+    : filename(filename),
+      fd(-1),
+      dictionary(dictionary)
+{
+    fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd == -1)
+        throw ML::Exception(errno, "open of " + filename);
+
+    try {
+        index_ = SeekableLogIndex::load(fd, filename);
+    } catch (...) {
+        ::close(fd);
+        throw;
+    }
+}
+
+SeekableLogReader::
+~SeekableLogReader()
+{
+    ::close(fd);
+}
+
+size_t
+SeekableLogReader::
+findBlockByRecord(uint64_t recordNum) const
+{
+    auto & blocks = index_.blocks;
+    auto it = std::upper_bound(blocks.begin(), blocks.end(), recordNum,
+                               [] (uint64_t n, const SeekableLogBlock & b)
+                               {
+                                   return n < b.firstRecord;
+                               });
+    if (it == blocks.begin() || recordNum >= numRecords())
+        return blocks.size();
+    return (it - blocks.begin()) - 1;
+}
+
+size_t
+SeekableLogReader::
+findBlockByTime(Date when) const
+{
+    // Blocks are written in order, so their latest times are too.  A
+    // record can't be written before its timestamp, so a block that was
+    // finished before then can't hold any of them.
+    auto & blocks = index_.blocks;
+    auto it = std::lower_bound(blocks.begin(), blocks.end(), when,
+                               [] (const SeekableLogBlock & b, Date when)
+                               {
+                                   return b.latest < when;
+                               });
+    return it - blocks.begin();
+}
+
+std::string
+SeekableLogReader::
+readBlock(size_t blockNum) const
+{
+    if (blockNum >= numBlocks())
+        throw ML::Exception("log block %zd out of range", blockNum);
+
+    const SeekableLogBlock & block = index_.blocks[blockNum];
+
+    std::string compressed(block.size, '\0');
+    readAt(fd, filename, &compressed[0], block.size, block.offset);
+
+    const std::string & compression = index_.compression;
+    if (compression == "gzip" || compression == "gz")
+        return gunzip(compressed.data(), compressed.size());
+
+    std::string result;
+
+    std::unique_ptr<Filter> decompressor
+        (Filter::create(compression == "lzma" ? "xz" : compression,
+                        DECOMPRESS, dictionary));
+    decompressor->onOutput = [&] (const char * data, size_t len,
+                                  FlushLevel, boost::function<void ()>)
+        {
+            result.append(data, len);
+        };
+
+    decompressor->process(compressed.data(),
+                          compressed.data() + compressed.size());
+    decompressor->flush(FLUSH_FINISH);
+
+    return result;
+}
+
+void
+SeekableLogReader::
+readBlocks(size_t blockNum, uint64_t skip, const OnRecord & onRecord) const
+{
+    for (; blockNum < numBlocks();  ++blockNum) {
+        std::string contents = readBlock(blockNum);
+
+        const char * p = contents.data();
+        const char * e = p + contents.size();
+
+        while (p < e) {
+            const char * eol = (const char *)memchr(p, '\n', e - p);
+            if (!eol)
+                eol = e;
+
+            if (skip)
+                --skip;
+            else if (!onRecord(p, eol - p))
+                return;
+
+            p = eol + 1;
+        }
+    }
+}
+
+void
+SeekableLogReader::
+readFromRecord(uint64_t recordNum, const OnRecord & onRecord) const
+{
+    size_t blockNum = findBlockByRecord(recordNum);
+    if (blockNum == numBlocks())
+        return;
+    readBlocks(blockNum, recordNum - index_.blocks[blockNum].firstRecord,
+               onRecord);
+}
+
+void
+SeekableLogReader::
+readFromTime(Date when, const OnRecord & onRecord) const
+{
+    readBlocks(findBlockByTime(when), 0, onRecord);
+}
+
+} // namespace Datacratic
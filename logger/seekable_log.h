@@ -0,0 +1,147 @@
+/* seekable_log.h                                                  -*- C++ -*-
+   Copyright (c) 2015 Datacratic Inc.  All rights reserved.
+
+   Compressed log files that can be read from any point.
+
+   A seekable log file is made of blocks that are each a whole compressed
+   stream of whole records, followed by an index of the blocks:
+
+       block 0 | block 1 | ... | block n-1 | index
+
+   The index is a zstd skippable frame, which zstd ignores, so the whole
+   file is still a valid zstd stream.  Other formats would fail on the
+   index (gzip and xz exit with an error on trailing data), so seekable logs
+   can only be written with zstd.
+*/
+
+#ifndef __logger__seekable_log_h__
+#define __logger__seekable_log_h__
+
+#include <stdint.h>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "soa/types/date.h"
+#include "compression_dictionary.h"
+
+
+namespace Datacratic {
+
+
+/*****************************************************************************/
+/* SEEKABLE LOG INDEX                                                        */
+/*****************************************************************************/
+
+/** Entry in the index of a seekable log file. */
+
+struct SeekableLogBlock {
+    uint64_t offset;        ///< Offset of the block in the file
+    uint64_t size;          ///< Compressed size of the block
+    uint64_t firstRecord;   ///< Number of the first record in the block
+    uint64_t numRecords;    ///< Number of records in the block
+
+    /** Range of times at which the records of the block were written.
+        This is when they got to the output, so the timestamps in the
+        records themselves are no later than it.
+    */
+    Date earliest;
+    Date latest;
+};
+
+
+/** Index of the blocks of a seekable log file. */
+
+struct SeekableLogIndex {
+
+    /// Compression scheme of the blocks, as given to Compressor::create()
+    std::string compression;
+
+    std::vector<SeekableLogBlock> blocks;
+
+    uint64_t numRecords() const;
+
+    /** Whether seekable logs can be written with the given compression,
+        ie whether its decompressor skips the index.
+    */
+    static bool supportsCompression(const std::string & compression);
+
+    /** Return the index as it is written at the end of the file. */
+    std::string serialize() const;
+
+    /** Read the index from the end of the given file descriptor.  Throws
+        if it isn't a seekable log file.
+    */
+    static SeekableLogIndex load(int fd, const std::string & filename);
+};
+
+
+/*****************************************************************************/
+/* SEEKABLE LOG READER                                                       */
+/*****************************************************************************/
+
+/** Reads the records of a seekable log file, starting from a given
+    record or time without decompressing what comes before.
+*/
+
+struct SeekableLogReader {
+
+    SeekableLogReader(const std::string & filename,
+                      std::shared_ptr<const CompressionDictionary> dictionary
+                          = std::shared_ptr<const CompressionDictionary>());
+
+    ~SeekableLogReader();
+
+    const SeekableLogIndex & index() const { return index_; }
+
+    size_t numBlocks() const { return index_.blocks.size(); }
+
+    uint64_t numRecords() const { return index_.numRecords(); }
+
+    /** Return the number of the block containing the given record, or
+        numBlocks() if it's past the end.
+    */
+    size_t findBlockByRecord(uint64_t recordNum) const;
+
+    /** Return the number of the first block that can contain records
+        with a timestamp of when or later, or numBlocks() if there are
+        none.
+    */
+    size_t findBlockByTime(Date when) const;
+
+    /** Return the decompressed contents of the given block. */
+    std::string readBlock(size_t blockNum) const;
+
+    /** Called with each record (without its newline) until it returns
+        false.
+    */
+    typedef std::function<bool (const char * record, size_t length)>
+        OnRecord;
+
+    /** Read the records from the given record number on. */
+    void readFromRecord(uint64_t recordNum, const OnRecord & onRecord) const;
+
+    /** Read the records from the first block that can contain records
+        with a timestamp of when or later.  As the block may start with
+        earlier ones, callers that need an exact start need to check the
+        timestamps of the first block's records themselves.
+    */
+    void readFromTime(Date when, const OnRecord & onRecord) const;
+
+private:
+    std::string filename;
+    int fd;
+    std::shared_ptr<const CompressionDictionary> dictionary;
+    SeekableLogIndex index_;
+
+    /** Call onRecord for the records of the blocks from the given one on,
+        skipping the first skip of them.
+    */
+    void readBlocks(size_t blockNum, uint64_t skip,
+                    const OnRecord & onRecord) const;
+};
+
+
+} // namespace Datacratic
+
+#endif /* __logger__seekable_log_h__ */
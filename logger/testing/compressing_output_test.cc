@@ -0,0 +1,163 @@
+/* compressing_output_test.cc
+   Copyright (c) 2015 Datacratic Inc.  All rights reserved.
+
+   Tests for parallel block compression in CompressingOutput.
+*/
+
+#define BOOST_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+
+#include <boost/test/unit_test.hpp>
+#include <mutex>
+#include <zlib.h>
+#include "soa/logger/compressing_output.h"
+#include "jml/arch/exception.h"
+#include "jml/arch/format.h"
+
+using namespace std;
+using namespace ML;
+using namespace Datacratic;
+
+
+namespace {
+
+/** Sink that keeps everything written to it in memory. */
+struct MemorySink : public CompressingOutput::Sink {
+
+    virtual void close()
+    {
+    }
+
+    virtual size_t write(const char * data, size_t size)
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        contents.append(data, size);
+        return size;
+    }
+
+    virtual size_t flush(FileFlushLevel flushLevel)
+    {
+        return 0;
+    }
+
+    std::mutex lock;
+    std::string contents;
+};
+
+struct MemoryOutput : public CompressingOutput {
+
+    MemoryOutput(int numThreads, size_t blockSize)
+    {
+        setParallelCompression(numThreads, blockSize);
+    }
+
+    ~MemoryOutput()
+    {
+        close();
+    }
+
+    void open(std::shared_ptr<Sink> sink, const std::string & compression)
+    {
+        CompressingOutput::open(sink, compression, 6);
+        startWorkerThread();
+    }
+
+    virtual void close()
+    {
+        stopWorkerThread();
+        closeCompressor();
+    }
+};
+
+/** Decompress a file made of one or more concatenated gzip members. */
+string gunzipAll(const string & compressed)
+{
+    string result;
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit2(&stream, 15 + 16) != Z_OK)
+        throw ML::Exception("inflateInit2 failed");
+
+    stream.next_in = (Bytef *)compressed.data();
+    stream.avail_in = compressed.size();
+
+    while (stream.avail_in) {
+        char output[65536];
+        stream.next_out = (Bytef *)output;
+        stream.avail_out = sizeof(output);
+
+        int res = inflate(&stream, Z_NO_FLUSH);
+        result.append(output, (char *)stream.next_out - output);
+
+        if (res == Z_STREAM_END)
+            inflateReset(&stream);
+        else if (res != Z_OK) {
+            inflateEnd(&stream);
+            throw ML::Exception("inflate failed");
+        }
+    }
+
+    inflateEnd(&stream);
+    return result;
+}
+
+string expectedLines(int numLines)
+{
+    string result;
+    for (unsigned i = 0;  i < numLines;  ++i)
+        result += ML::format("CHANNEL\tThis is message number %d\n", i);
+    return result;
+}
+
+} // file scope
+
+BOOST_AUTO_TEST_CASE( test_parallel_gzip_in_order )
+{
+    auto sink = std::make_shared<MemorySink>();
+
+    int numLines = 100000;
+
+    {
+        MemoryOutput output(4, 16384);
+        output.open(sink, "gzip");
+
+        for (unsigned i = 0;  i < numLines;  ++i)
+            output.logMessage("CHANNEL",
+                              ML::format("This is message number %d", i));
+
+        output.close();
+
+        Json::Value stats = output.stats();
+        cerr << stats << endl;
+        BOOST_CHECK_GT(stats["parallelCompression"]["blocks"].asInt(), 1);
+        BOOST_CHECK_EQUAL(stats["parallelCompression"]["errors"].asInt(), 0);
+        BOOST_CHECK_EQUAL(stats["parallelCompression"]["inFlight"].asInt(), 0);
+    }
+
+    BOOST_CHECK_EQUAL(gunzipAll(sink->contents), expectedLines(numLines));
+}
+
+BOOST_AUTO_TEST_CASE( test_parallel_partial_block_written_on_age )
+{
+    auto sink = std::make_shared<MemorySink>();
+
+    MemoryOutput output(2, 1 << 20);
+    output.setParallelCompression(2, 1 << 20, 0.1);
+    output.open(sink, "gzip");
+
+    output.logMessage("CHANNEL", "This is message number 0");
+
+    // The idle check of the worker thread should send the block off even
+    // though it is nowhere near full
+    string contents;
+    for (unsigned i = 0;  i < 50 && contents.empty();  ++i) {
+        ML::sleep(0.1);
+        std::unique_lock<std::mutex> guard(sink->lock);
+        contents = sink->contents;
+    }
+
+    BOOST_CHECK_EQUAL(gunzipAll(contents), expectedLines(1));
+
+    output.close();
+}
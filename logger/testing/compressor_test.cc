@@ -0,0 +1,172 @@
+/* compressor_test.cc
+   Copyright (c) 2015 Datacratic Inc.  All rights reserved.
+
+   Tests for the zstd and lz4 compressors and filters.
+*/
+
+#define BOOST_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+
+#include <boost/test/unit_test.hpp>
+#include "soa/logger/compressor.h"
+#include "soa/logger/filter.h"
+#include "jml/arch/format.h"
+
+using namespace std;
+using namespace ML;
+using namespace Datacratic;
+
+
+namespace {
+
+vector<string> makeRecords(int numRecords, int seed)
+{
+    vector<string> result;
+    for (unsigned i = 0;  i < numRecords;  ++i) {
+        int n = i * 7919 + seed;
+        result.push_back
+            (ML::format("{\"timestamp\":%d.%03d,\"auctionId\":\"%08x-%04x\","
+                        "\"exchange\":\"%s\",\"bidRequest\":{\"imp\":"
+                        "[{\"id\":\"%d\",\"banner\":{\"w\":%d,\"h\":%d}}],"
+                        "\"site\":{\"domain\":\"site%d.example.com\"}}}",
+                        1300000000 + n / 10, n % 1000, n * 2654435761u,
+                        n % 65536,
+                        (n % 3 == 0 ? "rubicon" : "adx"),
+                        n % 4, 300 + n % 3 * 100, 250 + n % 2 * 350,
+                        n % 97));
+    }
+    return result;
+}
+
+/** Compress the given records, flushing after each, and return the
+    result.
+*/
+string compress(Compressor & compressor, const vector<string> & records)
+{
+    string result;
+    auto onData = [&] (const char * data, size_t len) -> size_t
+        {
+            result.append(data, len);
+            return len;
+        };
+
+    for (auto & r: records) {
+        string line = r + "\n";
+        compressor.compress(line.data(), line.size(), onData);
+        compressor.flush(Compressor::FLUSH_AVAILABLE, onData);
+    }
+    compressor.finish(onData);
+
+    return result;
+}
+
+string decompress(Filter & filter, const string & compressed)
+{
+    string result;
+    filter.onOutput = [&] (const char * data, size_t len, FlushLevel,
+                           boost::function<void ()>)
+        {
+            result.append(data, len);
+        };
+
+    // Feed it in small pieces to exercise the buffering
+    for (size_t i = 0;  i < compressed.size();  i += 1000) {
+        size_t n = std::min<size_t>(1000, compressed.size() - i);
+        filter.process(compressed.data() + i, compressed.data() + i + n);
+    }
+
+    return result;
+}
+
+string join(const vector<string> & records)
+{
+    string result;
+    for (auto & r: records)
+        result += r + "\n";
+    return result;
+}
+
+void testRoundTrip(const string & compression, const string & extension)
+{
+    vector<string> records = makeRecords(2000, 0);
+    auto dict = CompressionDictionary::train(makeRecords(5000, 12345),
+                                             16384);
+
+    // Without a dictionary
+    {
+        std::unique_ptr<Compressor> compressor
+            (Compressor::create(compression, -1));
+        string compressed = compress(*compressor, records);
+
+        std::unique_ptr<Filter> decompressor
+            (Filter::create(extension, DECOMPRESS));
+        BOOST_CHECK_EQUAL(decompress(*decompressor, compressed),
+                          join(records));
+    }
+
+    // With a dictionary
+    {
+        std::unique_ptr<Compressor> compressor
+            (Compressor::create(compression, -1, dict));
+        string compressed = compress(*compressor, records);
+
+        std::unique_ptr<Filter> decompressor
+            (Filter::create(extension, DECOMPRESS, dict));
+        BOOST_CHECK_EQUAL(decompress(*decompressor, compressed),
+                          join(records));
+    }
+
+    // A single record is much smaller with the dictionary
+    vector<string> one(records.begin(), records.begin() + 1);
+    std::unique_ptr<Compressor> plain(Compressor::create(compression, -1));
+    std::unique_ptr<Compressor> withDict
+        (Compressor::create(compression, -1, dict));
+    size_t plainSize = compress(*plain, one).size();
+    size_t dictSize = compress(*withDict, one).size();
+    cerr << compression << ": one record is " << plainSize
+         << " bytes without dictionary and " << dictSize << " with" << endl;
+    BOOST_CHECK_LT(dictSize, plainSize);
+}
+
+} // file scope
+
+BOOST_AUTO_TEST_CASE( test_filename_to_compression )
+{
+    BOOST_CHECK_EQUAL(Compressor::filenameToCompression("a.log.zst"),
+                      "zstd");
+    BOOST_CHECK_EQUAL(Compressor::filenameToCompression("a.log.lz4"),
+                      "lz4");
+}
+
+BOOST_AUTO_TEST_CASE( test_zstd_round_trip )
+{
+    testRoundTrip("zstd", "zst");
+}
+
+BOOST_AUTO_TEST_CASE( test_lz4_round_trip )
+{
+    testRoundTrip("lz4", "lz4");
+}
+
+BOOST_AUTO_TEST_CASE( test_zstd_filter_round_trip )
+{
+    string input = join(makeRecords(1000, 7));
+
+    ZstdCompressorFilter compressor(1);
+    string compressed;
+    compressor.onOutput = [&] (const char * data, size_t len, FlushLevel,
+                               boost::function<void ()>)
+        {
+            compressed.append(data, len);
+        };
+
+    // A full flush starts a new frame, which must decompress as if it
+    // were all one
+    size_t half = input.size() / 2;
+    compressor.process(input.data(), input.data() + half, FLUSH_FULL);
+    compressor.process(input.data() + half, input.data() + input.size(),
+                       FLUSH_FINISH);
+
+    ZstdDecompressor decompressor;
+    BOOST_CHECK_EQUAL(decompress(decompressor, compressed), input);
+}
@@ -0,0 +1,132 @@
+/* json_columnar_filter_test.cc
+   Copyright (c) 2015 Datacratic Inc.  All rights reserved.
+
+   Tests for the columnar mode of the JSON pre-compressor.
+*/
+
+#define BOOST_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+
+#include <boost/test/unit_test.hpp>
+#include "soa/logger/json_filter.h"
+#include "soa/logger/filter.h"
+#include "jml/arch/format.h"
+
+using namespace std;
+using namespace ML;
+using namespace Datacratic;
+
+
+namespace {
+
+string makeRecords(int numRecords)
+{
+    string result;
+    for (unsigned i = 0;  i < numRecords;  ++i) {
+        int n = i * 7919;
+        result += ML::format("{\"timestamp\":%d.%03d,\"auctionId\":"
+                             "\"%08x-%04x\",\"exchange\":\"%s\","
+                             "\"bidRequest\":{\"imp\":[{\"id\":\"%d\","
+                             "\"banner\":{\"w\":%d,\"h\":%d}}],"
+                             "\"site\":{\"domain\":\"site%d.example.com\"}},"
+                             "\"price\":%s}\n",
+                             1300000000 + i / 10, i % 1000,
+                             n * 2654435761u, n % 65536,
+                             (n % 3 == 0 ? "rubicon" : "adx"),
+                             n % 4, 300 + n % 3 * 100, 250 + n % 2 * 350,
+                             n % 97, (i % 5 ? "1.50" : "null"));
+    }
+    return result;
+}
+
+/** Records that don't fit the schema, or have values that can't be
+    encoded as numbers without changing how they are written.
+*/
+const string irregular
+    = "not json at all\n"
+      "{\"a\":-0,\"b\":007,\"c\":1.50,\"d\":123456789012345678901,"
+      "\"e\":1e5,\"f\":-,\"g\":\"x\\\"y\"}\n"
+      "{\"a\":0,\"b\":7,\"c\":1.5,\"d\":-99999999999999999,\"e\":.5,"
+      "\"f\":\"unterminated\n"
+      "\n"
+      "\t weird 12abc 3.x \xff\xfe\n"
+      "{\"a\" : \"spaced key\" , \"n\":[1,2,-3]}\n"
+      "{\"a\":\"\",\"b\":\"\"}\n"
+      "partial {\"x\":42";
+
+/** Run the input through the filter in pieces of the given size, with the
+    given flush level after each, and return the output.
+*/
+string run(Filter & filter, const string & input, size_t pieceSize,
+           FlushLevel level = FLUSH_NONE)
+{
+    string result;
+    filter.onOutput = [&] (const char * data, size_t len, FlushLevel,
+                           boost::function<void ()> onDone)
+        {
+            result.append(data, len);
+            if (onDone) onDone();
+        };
+
+    for (size_t i = 0;  i < input.size();  i += pieceSize) {
+        size_t n = std::min(pieceSize, input.size() - i);
+        filter.process(input.data() + i, input.data() + i + n, level, [] {});
+    }
+    filter.process(0, 0, FLUSH_FINISH, [] {});
+
+    return result;
+}
+
+string roundTrip(const string & input, size_t blockRecords, size_t pieceSize,
+                 FlushLevel level = FLUSH_NONE)
+{
+    JsonCompressor compressor(true /* columnar */, blockRecords);
+    JsonDecompressor decompressor;
+
+    // Decompress in small pieces to exercise the buffering
+    return run(decompressor, run(compressor, input, pieceSize, level), 7);
+}
+
+} // file scope
+
+BOOST_AUTO_TEST_CASE( test_columnar_round_trip )
+{
+    string records = makeRecords(5000);
+
+    for (size_t blockRecords: { 1, 3, 1024 }) {
+        for (size_t pieceSize: { 100, 65536 }) {
+            BOOST_CHECK(roundTrip(records, blockRecords, pieceSize)
+                        == records);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE( test_columnar_irregular_round_trip )
+{
+    for (size_t blockRecords: { 1, 3, 1024 }) {
+        for (size_t pieceSize: { 1, 5, 100 }) {
+            BOOST_CHECK_EQUAL(roundTrip(irregular, blockRecords, pieceSize),
+                              irregular);
+            BOOST_CHECK_EQUAL(roundTrip(irregular, blockRecords, pieceSize,
+                                        FLUSH_SYNC),
+                              irregular);
+        }
+    }
+
+    for (string s: { "", "\n", "x", "\n\n", "{\"a\":1}" })
+        BOOST_CHECK_EQUAL(roundTrip(s, 10, 10), s);
+}
+
+BOOST_AUTO_TEST_CASE( test_columnar_smaller )
+{
+    string records = makeRecords(5000);
+
+    JsonCompressor generic, columnar(true /* columnar */);
+    size_t genericSize = run(generic, records, 65536).size();
+    size_t columnarSize = run(columnar, records, 65536).size();
+
+    cerr << "raw " << records.size() << " generic " << genericSize
+         << " columnar " << columnarSize << endl;
+
+    BOOST_CHECK_LT(columnarSize * 2, genericSize);
+}
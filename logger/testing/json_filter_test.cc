@@ -10,6 +10,7 @@
 
 #include <boost/test/unit_test.hpp>
 #include "soa/logger/json_filter.h"
+#include "soa/logger/compression_dictionary.h"
 #include "jml/utils/guard.h"
 #include "jml/arch/exception_handler.h"
 #include "jml/arch/timers.h"
@@ -24,6 +25,11 @@ string test_data;
 
 size_t max_bytes = 2000000;
 
+/// Records following the test data, to train dictionaries on
+vector<string> training_data;
+
+size_t max_training_bytes = 2000000;
+
 size_t default_buffer_size = 16384;//1024 * 1024;
 
 BOOST_AUTO_TEST_CASE( get_stream )
@@ -48,6 +54,19 @@ BOOST_AUTO_TEST_CASE( get_stream )
 
     test_data = output.str();
 
+    // Skip the rest of the current line so that we start on a record
+    string line;
+    getline(input, line);
+
+    for (size_t training_bytes = 0;
+         input && training_bytes < max_training_bytes;) {
+        getline(input, line);
+        if (line.empty())
+            continue;
+        training_bytes += line.size();
+        training_data.push_back(line);
+    }
+
     cerr << format("read in %.2fMB in %.2f s, rate = %.2fMB/sec",
                    test_data.length() / 1000000.0, timer.elapsed_wall(),
                    test_data.length() / 1000000.0 / timer.elapsed_wall())
@@ -155,6 +174,16 @@ BOOST_AUTO_TEST_CASE( test_json_filter1 )
     test_filters(compressor, decompressor, "Json", buffer_size);
 }
 
+BOOST_AUTO_TEST_CASE( test_json_columnar_filter )
+{
+    JsonCompressor compressor(true /* columnar */);
+    JsonDecompressor decompressor;
+
+    size_t buffer_size = default_buffer_size;
+
+    test_filters(compressor, decompressor, "columnar", buffer_size);
+}
+
 #if 1
 
 #if 1
@@ -205,6 +234,19 @@ BOOST_AUTO_TEST_CASE( test_json_plus_zlib_filter )
     test_filters(compressor, decompressor, "json+zlib", buffer_size);
 }
 
+BOOST_AUTO_TEST_CASE( test_json_columnar_plus_zlib_filter )
+{
+    FilterStack compressor, decompressor;
+    compressor.push(ML::make_std_sp(new JsonCompressor(true /* columnar */)));
+    compressor.push(ML::make_std_sp(new ZlibCompressor()));
+    decompressor.push(ML::make_std_sp(new ZlibDecompressor()));
+    decompressor.push(ML::make_std_sp(new JsonDecompressor()));
+
+    size_t buffer_size = default_buffer_size;
+
+    test_filters(compressor, decompressor, "columnar+zlib", buffer_size);
+}
+
 BOOST_AUTO_TEST_CASE( test_lzma1_filter )
 {
     LzmaCompressor compressor(1);
@@ -365,4 +407,90 @@ BOOST_AUTO_TEST_CASE( test_json_plus_lzma9_filter )
 
     test_filters(compressor, decompressor, "json+lzma9", buffer_size);
 }
+
+
+BOOST_AUTO_TEST_CASE( test_zstd_filter )
+{
+    ZstdCompressorFilter compressor;
+    ZstdDecompressor decompressor;
+
+    size_t buffer_size = default_buffer_size;
+
+    test_filters(compressor, decompressor, "zstd", buffer_size);
+}
+
+BOOST_AUTO_TEST_CASE( test_zstd19_filter )
+{
+    ZstdCompressorFilter compressor(19);
+    ZstdDecompressor decompressor;
+
+    size_t buffer_size = default_buffer_size;
+
+    test_filters(compressor, decompressor, "zstd19", buffer_size);
+}
+
+BOOST_AUTO_TEST_CASE( test_json_plus_zstd_filter )
+{
+    FilterStack compressor, decompressor;
+    compressor.push(ML::make_std_sp(new JsonCompressor()));
+    compressor.push(ML::make_std_sp(new ZstdCompressorFilter()));
+    decompressor.push(ML::make_std_sp(new ZstdDecompressor()));
+    decompressor.push(ML::make_std_sp(new JsonDecompressor()));
+
+    size_t buffer_size = default_buffer_size;
+
+    test_filters(compressor, decompressor, "json+zstd", buffer_size);
+}
+
+BOOST_AUTO_TEST_CASE( test_json_columnar_plus_zstd_filter )
+{
+    FilterStack compressor, decompressor;
+    compressor.push(ML::make_std_sp(new JsonCompressor(true /* columnar */)));
+    compressor.push(ML::make_std_sp(new ZstdCompressorFilter()));
+    decompressor.push(ML::make_std_sp(new ZstdDecompressor()));
+    decompressor.push(ML::make_std_sp(new JsonDecompressor()));
+
+    size_t buffer_size = default_buffer_size;
+
+    test_filters(compressor, decompressor, "columnar+zstd", buffer_size);
+}
+
+BOOST_AUTO_TEST_CASE( test_zstd_dictionary_filter )
+{
+    ML::Timer timer;
+    auto dict = CompressionDictionary::train(training_data);
+    cerr << format("trained %.2fkB dictionary on %zd records in %.2fs",
+                   dict->data.size() / 1000.0, training_data.size(),
+                   timer.elapsed_wall())
+         << endl;
+
+    ZstdCompressorFilter compressor(-1, dict);
+    ZstdDecompressor decompressor(dict);
+
+    size_t buffer_size = default_buffer_size;
+
+    test_filters(compressor, decompressor, "zstd+dict", buffer_size);
+}
+
+BOOST_AUTO_TEST_CASE( test_lz4_filter )
+{
+    Lz4CompressorFilter compressor;
+    Lz4Decompressor decompressor;
+
+    size_t buffer_size = default_buffer_size;
+
+    test_filters(compressor, decompressor, "lz4", buffer_size);
+}
+
+BOOST_AUTO_TEST_CASE( test_lz4_dictionary_filter )
+{
+    auto dict = CompressionDictionary::train(training_data);
+
+    Lz4CompressorFilter compressor(-1, dict);
+    Lz4Decompressor decompressor(dict);
+
+    size_t buffer_size = default_buffer_size;
+
+    test_filters(compressor, decompressor, "lz4+dict", buffer_size);
+}
 #endif
@@ -0,0 +1,234 @@
+/* log_record_buffer_test.cc
+   Copyright (c) 2015 Datacratic Inc.  All rights reserved.
+
+   Tests for the binary log records of Logger::logRecord().
+*/
+
+#define BOOST_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+
+#include <boost/test/unit_test.hpp>
+#include <boost/algorithm/string.hpp>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include "soa/logger/log_record_buffer.h"
+#include "soa/logger/logger.h"
+
+using namespace std;
+using namespace Datacratic;
+
+
+namespace {
+
+vector<string> readAll(LogRecordBuffer & buffer,
+                       vector<unsigned> * channels = nullptr)
+{
+    vector<string> result;
+    buffer.read([&] (const LogRecordBuffer::Record & record)
+                {
+                    string message;
+                    record.format(message);
+                    result.push_back(message);
+                    if (channels)
+                        channels->push_back(record.channel);
+                });
+    return result;
+}
+
+} // file scope
+
+BOOST_AUTO_TEST_CASE( test_log_record_fields )
+{
+    LogRecordBuffer buffer(4096);
+    Date ts = Date::fromSecondsSinceEpoch(1400000000.25);
+
+    string str = "a string";
+    BOOST_CHECK_EQUAL(buffer.write(3, ts, -12, 34u, 0.5, true, false,
+                                   "literal", str, ts, (int64_t)-1),
+                      LogRecordBuffer::WRITTEN_FIRST);
+    BOOST_CHECK_EQUAL(buffer.write(4, ts), LogRecordBuffer::WRITTEN);
+    BOOST_CHECK(buffer.couldRead());
+
+    vector<unsigned> channels;
+    vector<string> messages = readAll(buffer, &channels);
+    BOOST_REQUIRE_EQUAL(messages.size(), 2);
+    BOOST_CHECK_EQUAL(channels[0], 3);
+    BOOST_CHECK_EQUAL(channels[1], 4);
+
+    string expected = ts.print(5) + "\t-12\t34\t0.5\t1\t0\tliteral\ta string\t"
+        + ts.print(5) + "\t-1";
+    BOOST_CHECK_EQUAL(messages[0], expected);
+    BOOST_CHECK_EQUAL(messages[1], ts.print(5));
+
+    BOOST_CHECK(!buffer.couldRead());
+    BOOST_CHECK_EQUAL(buffer.write(5, ts, 1), LogRecordBuffer::WRITTEN_FIRST);
+}
+
+BOOST_AUTO_TEST_CASE( test_log_record_wrap_and_full )
+{
+    LogRecordBuffer buffer(256);
+    BOOST_CHECK_EQUAL(buffer.capacity(), 256);
+    Date ts = Date::now();
+
+    // Records of various sizes go round the ring many times, with the
+    // ones that don't fit dropped until the reader catches up
+    string text(80, 'x');
+    size_t written = 0, full = 0, read = 0;
+    for (unsigned i = 0;  i < 1000;  ++i) {
+        string field(text, 0, i % 80);
+        auto result = buffer.write(1, ts, i, field);
+        if (result == LogRecordBuffer::FULL) {
+            ++full;
+            vector<string> messages = readAll(buffer);
+            BOOST_REQUIRE(!messages.empty());
+            read += messages.size();
+            BOOST_CHECK_NE(buffer.write(1, ts, i, field),
+                           LogRecordBuffer::FULL);
+        }
+        ++written;
+
+        if (i % 7 == 0) {
+            vector<string> messages = readAll(buffer);
+            for (auto & m: messages)
+                BOOST_CHECK_EQUAL(m.substr(0, ts.print(5).size()),
+                                  ts.print(5));
+            read += messages.size();
+        }
+    }
+
+    read += readAll(buffer).size();
+    BOOST_CHECK_EQUAL(read, written);
+    BOOST_CHECK_GT(full, 0);
+
+    BOOST_CHECK_THROW(buffer.write(1, ts, string(120, 'x')), ML::Exception);
+}
+
+BOOST_AUTO_TEST_CASE( test_log_record_threads )
+{
+    LogRecordBuffer buffer(4096);
+    const unsigned numRecords = 100000;
+    Date ts = Date::now();
+
+    std::thread writer([&] ()
+        {
+            for (unsigned i = 0;  i < numRecords;  ++i) {
+                while (buffer.write(1, ts, i, "record")
+                       == LogRecordBuffer::FULL)
+                    std::this_thread::yield();
+            }
+        });
+
+    unsigned next = 0;
+    bool ordered = true;
+    while (next < numRecords) {
+        buffer.read([&] (const LogRecordBuffer::Record & record)
+                    {
+                        string message;
+                        record.format(message);
+                        if (message != ts.print(5) + "\t" + to_string(next)
+                                       + "\trecord")
+                            ordered = false;
+                        ++next;
+                    });
+    }
+
+    writer.join();
+    BOOST_CHECK(ordered);
+    BOOST_CHECK(!buffer.couldRead());
+}
+
+BOOST_AUTO_TEST_CASE( test_logger_log_record )
+{
+    Logger logger;
+    logger.init();
+
+    std::mutex lock;
+    vector<pair<string, string> > logged;
+    logger.addCallback([&] (string channel, string message)
+                       {
+                           std::lock_guard<std::mutex> guard(lock);
+                           logged.emplace_back(channel, message);
+                       },
+                       boost::regex(), boost::regex("DENIED"));
+
+    unsigned hello = logger.registerChannel("HELLO");
+    unsigned denied = logger.registerChannel("DENIED");
+    BOOST_CHECK_EQUAL(logger.registerChannel("HELLO"), hello);
+    BOOST_CHECK_NE(hello, denied);
+
+    logger.start();
+
+    const unsigned numThreads = 4, numRecords = 1000;
+    std::atomic<unsigned> numFailed(0);
+    vector<std::thread> threads;
+    for (unsigned t = 0;  t < numThreads;  ++t) {
+        threads.emplace_back([&, t] ()
+            {
+                for (unsigned i = 0;  i < numRecords;  ++i) {
+                    if (!logger.logRecord(hello, t, i, "world"))
+                        ++numFailed;
+                    logger.logRecord(denied, t, i);
+                }
+            });
+    }
+    for (auto & t: threads)
+        t.join();
+    BOOST_CHECK_EQUAL(numFailed, 0);
+
+    logger.waitUntilFinished();
+    logger.shutdown();
+
+    BOOST_CHECK_EQUAL(logger.numRecordsDropped(), 0);
+    BOOST_REQUIRE_EQUAL(logged.size(), numThreads * numRecords);
+
+    // Records of each thread are logged in order
+    vector<unsigned> nextOfThread(numThreads);
+    for (auto & l: logged) {
+        BOOST_CHECK_EQUAL(l.first, "HELLO");
+        vector<string> fields;
+        boost::split(fields, l.second, boost::is_any_of("\t"));
+        BOOST_REQUIRE_EQUAL(fields.size(), 4);
+        unsigned t = stoi(fields[1]);
+        BOOST_REQUIRE_LT(t, numThreads);
+        BOOST_CHECK_EQUAL(fields[2], to_string(nextOfThread[t]++));
+        BOOST_CHECK_EQUAL(fields[3], "world");
+    }
+}
+
+BOOST_AUTO_TEST_CASE( test_logger_log_record_thread_reuse )
+{
+    Logger logger;
+    logger.init();
+
+    std::mutex lock;
+    vector<string> logged;
+    logger.addCallback([&] (string channel, string message)
+                       {
+                           std::lock_guard<std::mutex> guard(lock);
+                           logged.push_back(message);
+                       });
+
+    unsigned hello = logger.registerChannel("HELLO");
+    logger.start();
+
+    // Each thread exits before the next one starts, so they all get the
+    // same buffer rather than ending up on the shared one
+    const unsigned numThreads = 2 * Logger::MaxRecordThreads;
+    for (unsigned t = 0;  t < numThreads;  ++t) {
+        std::thread thread([&, t] () { logger.logRecord(hello, t); });
+        thread.join();
+    }
+
+    logger.waitUntilFinished();
+    logger.shutdown();
+
+    BOOST_CHECK_EQUAL(logger.numRecordBuffersCreated(), 1);
+    BOOST_REQUIRE_EQUAL(logged.size(), numThreads);
+    for (unsigned t = 0;  t < numThreads;  ++t) {
+        vector<string> fields;
+        boost::split(fields, logged[t], boost::is_any_of("\t"));
+        BOOST_REQUIRE_EQUAL(fields.size(), 2);
+        BOOST_CHECK_EQUAL(fields[1], to_string(t));
+    }
+}
@@ -3,9 +3,14 @@ $(eval $(call nodejs_test,remote_logger_test,logger))
 $(eval $(call test,remote_logger_test2,logger,boost))
 $(eval $(call nodejs_test,filter_js_test,logger sync))
 $(eval $(call test,json_filter_test,logger,boost manual))
+$(eval $(call test,json_columnar_filter_test,logger,boost))
 
 $(eval $(call vowscoffee_test,logger_fs_test,logger))
 $(eval $(call test,logger_deadlock_test,logger,boost manual))
 
 $(eval $(call test,multi_output_logger_test,logger,boost))
 $(eval $(call test,rotating_file_logger_test,logger,manual boost))
+$(eval $(call test,log_record_buffer_test,logger,boost))
+$(eval $(call test,compressing_output_test,logger z,boost))
+$(eval $(call test,compressor_test,logger,boost))
+$(eval $(call test,seekable_log_test,logger,boost))
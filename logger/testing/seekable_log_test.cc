@@ -0,0 +1,160 @@
+/* seekable_log_test.cc
+   Copyright (c) 2015 Datacratic Inc.  All rights reserved.
+
+   Tests for writing and reading seekable log files.
+*/
+
+#define BOOST_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+
+#include <boost/test/unit_test.hpp>
+#include "soa/logger/file_output.h"
+#include "soa/logger/seekable_log.h"
+#include "jml/utils/guard.h"
+#include "jml/arch/format.h"
+#include "jml/arch/timers.h"
+
+using namespace std;
+using namespace ML;
+using namespace Datacratic;
+
+
+namespace {
+
+string record(int i)
+{
+    return ML::format("CHANNEL\tThis is message number %d", i);
+}
+
+/** Write numRecords records to a seekable file, in two halves with a
+    pause in between.  Returns the time of the pause.
+*/
+Date writeFile(const string & filename, const string & compression,
+               int numThreads, int numRecords)
+{
+    FileOutput output;
+    output.setParallelCompression(numThreads, 4096, 0.05);
+    output.setSeekable(true);
+    output.open(filename, compression);
+
+    for (unsigned i = 0;  i < numRecords / 2;  ++i)
+        output.logMessage("CHANNEL",
+                          ML::format("This is message number %d", i));
+
+    ML::sleep(0.2);
+    Date middle = Date::now();
+    ML::sleep(0.2);
+
+    for (unsigned i = numRecords / 2;  i < numRecords;  ++i)
+        output.logMessage("CHANNEL",
+                          ML::format("This is message number %d", i));
+
+    output.close();
+
+    return middle;
+}
+
+vector<string> readFrom(const SeekableLogReader & reader, uint64_t recordNum,
+                        int maxRecords)
+{
+    vector<string> result;
+    reader.readFromRecord(recordNum,
+                          [&] (const char * record, size_t length)
+                          {
+                              result.push_back(string(record, length));
+                              return result.size() < maxRecords;
+                          });
+    return result;
+}
+
+void testSeekable(const string & compression, int numThreads)
+{
+    string filename = ML::format("tmp/seekable-log-test-%d.log", getpid());
+    ML::Call_Guard guard([&] () { unlink(filename.c_str()); });
+
+    int numRecords = 20000;
+    Date middle = writeFile(filename, compression, numThreads, numRecords);
+
+    SeekableLogReader reader(filename);
+
+    BOOST_CHECK_GT(reader.numBlocks(), 10);
+    BOOST_CHECK_EQUAL(reader.numRecords(), numRecords);
+
+    // Jumping to a record
+    for (int i: { 0, 1, 4567, numRecords / 2, numRecords - 1 }) {
+        vector<string> records = readFrom(reader, i, 3);
+        BOOST_REQUIRE_GT(records.size(), 0);
+        for (unsigned j = 0;  j < records.size();  ++j)
+            BOOST_CHECK_EQUAL(records[j], record(i + j));
+    }
+
+    BOOST_CHECK(readFrom(reader, numRecords, 1).empty());
+
+    // Everything, in order
+    BOOST_CHECK_EQUAL(readFrom(reader, 0, numRecords + 1).size(),
+                      numRecords);
+
+    // Jumping to a time gets the second half, and no more than a block of
+    // the first
+    size_t blockNum = reader.findBlockByTime(middle);
+    BOOST_REQUIRE_LT(blockNum, reader.numBlocks());
+    uint64_t first = reader.index().blocks[blockNum].firstRecord;
+    BOOST_CHECK_LE(first, numRecords / 2);
+    BOOST_CHECK_GE(first + reader.index().blocks[blockNum].numRecords,
+                   numRecords / 2);
+
+    vector<string> fromTime;
+    reader.readFromTime(middle,
+                        [&] (const char * record, size_t length)
+                        {
+                            fromTime.push_back(string(record, length));
+                            return true;
+                        });
+    BOOST_CHECK_EQUAL(fromTime.size(), numRecords - first);
+    BOOST_CHECK_EQUAL(fromTime.back(), record(numRecords - 1));
+}
+
+} // file scope
+
+BOOST_AUTO_TEST_CASE( test_seekable_zstd )
+{
+    testSeekable("zstd", 0);
+}
+
+BOOST_AUTO_TEST_CASE( test_seekable_zstd_parallel )
+{
+    testSeekable("zstd", 4);
+}
+
+BOOST_AUTO_TEST_CASE( test_not_seekable )
+{
+    string filename = ML::format("tmp/not-seekable-log-test-%d.log.gz",
+                                 getpid());
+    ML::Call_Guard guard([&] () { unlink(filename.c_str()); });
+
+    {
+        FileOutput output(filename);
+        output.logMessage("CHANNEL", "hello");
+        output.close();
+    }
+
+    BOOST_CHECK_THROW(SeekableLogReader reader(filename), std::exception);
+}
+
+BOOST_AUTO_TEST_CASE( test_seekable_needs_new_compressed_file )
+{
+    string filename = ML::format("tmp/seekable-log-test-bad-%d.log",
+                                 getpid());
+    ML::Call_Guard guard([&] () { unlink(filename.c_str()); });
+
+    FileOutput output;
+    output.setSeekable(true);
+
+    // The index would be appended to plain text, or break the tools of
+    // formats that don't skip it
+    for (string compression: { "none", "gzip", "lzma", "lz4" })
+        BOOST_CHECK_THROW(output.open(filename, compression), std::exception);
+
+    // The offsets of the index would be wrong
+    BOOST_CHECK_THROW(output.open(filename + ".+", "zstd"), std::exception);
+}
@@ -6,7 +6,9 @@
 */
 
 #include <fcntl.h>
+#include <limits.h>
 #include <sys/epoll.h>
+#include <sys/uio.h>
 #include <poll.h>
 #include <unistd.h>
 
@@ -19,6 +21,52 @@ using namespace std;
 using namespace Datacratic;
 
 
+/****************************************************************************/
+/* ASYNC WRITE BUFFER                                                       */
+/****************************************************************************/
+
+AsyncWriteBuffer::
+AsyncWriteBuffer(string && str)
+{
+    auto owner = make_shared<string>(move(str));
+    data_ = owner->c_str();
+    size_ = owner->size();
+    owner_ = move(owner);
+}
+
+AsyncWriteBuffer::
+AsyncWriteBuffer(const char * data, size_t size,
+                 const OnRelease & onRelease)
+    : data_(data), size_(size)
+{
+    if (onRelease) {
+        auto release = [=] (const char * releasedData) {
+            onRelease(releasedData, size);
+        };
+        owner_.reset(data, release);
+    }
+}
+
+AsyncWriteBuffer
+AsyncWriteBuffer::
+slice(size_t offset, size_t size)
+    const
+{
+    ExcCheck(offset + size <= size_, "slice out of bounds");
+
+    AsyncWriteBuffer result;
+    result.owner_ = owner_;
+    result.data_ = data_ + offset;
+    result.size_ = size;
+
+    return result;
+}
+
+
+/****************************************************************************/
+/* ASYNC WRITER SOURCE                                                      */
+/****************************************************************************/
+
 AsyncWriterSource::
 AsyncWriterSource(const OnClosed & onClosed,
                   const OnReceivedData & onReceivedData,
@@ -81,7 +129,8 @@ void
 AsyncWriterSource::
 closeFd()
 {
-    ExcCheck(queue_.size() == 0, "message queue not empty");
+    ExcCheck(queue_.size() == 0 && writes_.empty(),
+             "message queue not empty");
     ExcCheck(fd_ != -1, "already closed (fd)");
 
     handleClosing(false, false);
@@ -107,6 +156,20 @@ write(string data, const OnWriteResult & onWriteResult)
     return result;
 }
 
+bool
+AsyncWriterSource::
+write(AsyncWriteBuffer buffer, const OnWriteResult & onWriteResult)
+{
+    ExcAssert(!closing_);
+
+    if (!queueEnabled()) {
+        throw ML::Exception("cannot write while queue is disabled");
+    }
+    ExcCheck(buffer.size() > 0, "attempting to write empty data");
+
+    return queue_.push_back(AsyncWrite(move(buffer), onWriteResult));
+}
+
 void
 AsyncWriterSource::
 handleReadReady()
@@ -166,16 +229,16 @@ handleWriteReady()
 
 void
 AsyncWriterSource::
-handleWriteResult(int error, AsyncWrite && currentWrite)
+handleWriteResult(int error, AsyncWrite && write)
 {
-    if (currentWrite.onWriteResult) {
-        currentWrite.onWriteResult(
+    if (write.onWriteResult) {
+        write.onWriteResult(
             AsyncWriteResult(error,
-                             move(currentWrite.message),
-                             currentWrite.sent)
+                             move(write.message),
+                             write.sent,
+                             move(write.buffer))
         );
     }
-    currentWrite.clear();
 }
 
 void
@@ -233,50 +296,47 @@ flush()
         return;
     }
 
-    auto popWrite = [&] () {
-        if (queue_.size() == 0) {
-            return false;
-        }
-        auto writes = queue_.pop_front(1);
-        ExcAssert(writes.size() > 0);
-        currentWrite_ = move(writes[0]);
-        return true;
-    };
+    /* maximum number of writes gathered into a single "writev" call */
+    static constexpr int MaxIovecs(IOV_MAX);
+
+    struct iovec iov[MaxIovecs];
 
-    if (currentWrite_.message.empty()) {
-        if (!popWrite()) {
-            return;
+    errno = 0;
+
+    while (true) {
+        if (writes_.size() < size_t(MaxIovecs) && queue_.size() > 0) {
+            auto writes = queue_.pop_front(0);
+            for (auto & write: writes) {
+                writes_.emplace_back(move(write));
+            }
         }
-        if (currentWrite_.message.empty()) {
+        if (writes_.empty()) {
+            break;
+        }
+        if (writes_.front().isCloseRequest()) {
             ExcAssert(closing_);
             handleClosing(false, true);
-            return;
+            break;
         }
-    }
 
-    ssize_t remaining(currentWrite_.message.size() - currentWrite_.sent);
-
-    errno = 0;
+        /* gather the pending writes, up to the first close request */
+        int iovcnt(0);
+        for (const AsyncWrite & write: writes_) {
+            if (iovcnt == MaxIovecs || write.isCloseRequest()) {
+                break;
+            }
+            iov[iovcnt].iov_base = (void *) (write.data() + write.sent);
+            iov[iovcnt].iov_len = write.size() - write.sent;
+            iovcnt++;
+        }
 
-    while (true) {
-        const char * data = currentWrite_.message.c_str() + currentWrite_.sent;
-        ssize_t len = ::write(fd_, data, remaining);
+        ssize_t len = ::writev(fd_, iov, iovcnt);
         if (len > 0) {
-            currentWrite_.sent += len;
-            remaining -= len;
             bytesSent_ += len;
-            if (remaining == 0) {
-                msgsSent_++;
-                handleWriteResult(0, move(currentWrite_));
-                if (!popWrite()) {
-                    break;
-                }
-                if (currentWrite_.message.empty()) {
-                    ExcAssert(closing_);
-                    handleClosing(false, true);
-                    break;
-                }
-                remaining = currentWrite_.message.size();
+            handleBytesWritten(len);
+            if (fd_ == -1) {
+                /* closed from a callback */
+                break;
             }
         }
         else if (len < 0) {
@@ -284,8 +344,11 @@ flush()
             if (errno == EWOULDBLOCK || errno == EAGAIN) {
                 break;
             }
-            handleWriteResult(errno, move(currentWrite_));
-            if (errno == EPIPE || errno == EBADF) {
+            int error = errno;
+            AsyncWrite failedWrite(move(writes_.front()));
+            writes_.pop_front();
+            handleWriteResult(error, move(failedWrite));
+            if (error == EPIPE || error == EBADF) {
                 handleClosing(true, true);
                 break;
             }
@@ -293,12 +356,40 @@ flush()
                 /* This exception indicates a lack of code in the handling of
                    errno. In a perfect world, it should never ever be
                    thrown. */
-                throw ML::Exception(errno, "unhandled write error");
+                throw ML::Exception(error, "unhandled write error");
             }
         }
     }
 }
 
+/* Distribute the bytes sent by "writev" among the pending writes, in
+   order, and report the writes that were completely sent. */
+void
+AsyncWriterSource::
+handleBytesWritten(size_t written)
+{
+    while (written > 0) {
+        AsyncWrite & write = writes_.front();
+        size_t remaining = write.size() - write.sent;
+        if (written < remaining) {
+            write.sent += written;
+            break;
+        }
+
+        write.sent += remaining;
+        written -= remaining;
+        msgsSent_++;
+
+        AsyncWrite doneWrite(move(write));
+        writes_.pop_front();
+        handleWriteResult(0, move(doneWrite));
+        if (fd_ == -1) {
+            /* closed from the callback */
+            break;
+        }
+    }
+}
+
 /* fd events */
 
 void
@@ -354,8 +445,26 @@ emptyMessageQueue()
 
     auto writes = queue_.pop_front(0);
     for (auto & write: writes) {
-        messages.emplace_back(move(write.message));
+        writes_.emplace_back(move(write));
+    }
+    for (auto & write: writes_) {
+        if (write.isCloseRequest()) {
+            continue;
+        }
+        /* only report the bytes that have not been sent yet, so that callers
+           resending the lost messages do not duplicate partial writes */
+        if (write.sent > 0) {
+            messages.emplace_back(write.data() + write.sent,
+                                  write.size() - write.sent);
+        }
+        else if (write.buffer.empty()) {
+            messages.emplace_back(move(write.message));
+        }
+        else {
+            messages.emplace_back(write.buffer.toString());
+        }
     }
+    writes_.clear();
 
     return messages;
 }
@@ -8,6 +8,8 @@
 #pragma once
 
 #include <atomic>
+#include <deque>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -17,6 +19,54 @@
 
 namespace Datacratic {
 
+/****************************************************************************/
+/* ASYNC WRITE BUFFER                                                       */
+/****************************************************************************/
+
+/* A refcounted and immutable slice of memory, which can be enqueued for
+   writing without being copied. Slices of the same buffer share its
+   storage. */
+
+struct AsyncWriteBuffer {
+    /* type of callback invoked when the memory passed to the constructor is
+       not referenced anymore */
+    typedef std::function<void(const char *, size_t)> OnRelease;
+
+    AsyncWriteBuffer()
+        : data_(nullptr), size_(0)
+    {
+    }
+
+    /* takes ownership of "str" */
+    AsyncWriteBuffer(std::string && str);
+
+    /* references "data", which must remain valid until "onRelease" is
+       invoked, or forever if "onRelease" is null */
+    AsyncWriteBuffer(const char * data, size_t size,
+                     const OnRelease & onRelease);
+
+    /* returns a slice of "size" bytes starting at "offset" */
+    AsyncWriteBuffer slice(size_t offset, size_t size) const;
+
+    const char * data() const
+    { return data_; }
+
+    size_t size() const
+    { return size_; }
+
+    bool empty() const
+    { return size_ == 0; }
+
+    std::string toString() const
+    { return std::string(data_, size_); }
+
+private:
+    std::shared_ptr<const void> owner_;
+    const char * data_;
+    size_t size_;
+};
+
+
 /****************************************************************************/
 /* ASYNC WRITE RESULT                                                       */
 /****************************************************************************/
@@ -24,7 +74,8 @@ namespace Datacratic {
 /* invoked when a write operation has been performed, where "written" is the
    string that was sent, "writtenSize" is the amount of bytes from it that was
    sent; the latter is always equal to the length of the string when error is
-   0 */
+   0. When the write was performed from an AsyncWriteBuffer, "written" is
+   empty and "writtenBuffer" contains the buffer instead. */
 
 struct AsyncWriteResult {
     AsyncWriteResult(int newError,
@@ -36,9 +87,21 @@ struct AsyncWriteResult {
     {
     }
 
+    AsyncWriteResult(int newError,
+                     std::string && newWritten,
+                     size_t newWrittenSize,
+                     AsyncWriteBuffer && newWrittenBuffer)
+        : error(newError),
+          written(std::move(newWritten)),
+          writtenSize(newWrittenSize),
+          writtenBuffer(std::move(newWrittenBuffer))
+    {
+    }
+
     int error;
     std::string written;
     size_t writtenSize;
+    AsyncWriteBuffer writtenBuffer;
 };
 
 
@@ -82,6 +145,18 @@ struct AsyncWriterSource : public EpollLoop
         return write(std::string(data, size), onWriteResult);
     }
 
+    /* enqueue "buffer" for writing without copying its contents. Pending
+     * writes are gathered and sent with a single "writev" call, while
+     * "onWriteResult" is invoked for each of them. */
+    bool write(AsyncWriteBuffer buffer,
+               const OnWriteResult & onWriteResult);
+    bool write(const char * data, size_t size,
+               const AsyncWriteBuffer::OnRelease & onRelease,
+               const OnWriteResult & onWriteResult)
+    {
+        return write(AsyncWriteBuffer(data, size, onRelease), onWriteResult);
+    }
+
     /* returns whether we are ready to accept messages for sending */
     bool queueEnabled()
         const
@@ -96,7 +171,8 @@ struct AsyncWriterSource : public EpollLoop
     /* invoked when the connection is closed, where "fromPeer" indicates
      * whether the file descriptor was closed due to a call to "requestClose"
      * or due to a pipe reset. In the latter case, "msgs" also contains all
-     * the unsent messages. */
+     * the unsent messages, reduced to their unsent remainder when they were
+     * partially written. */
     virtual void onClosed(bool fromPeer,
                           const std::vector<std::string> & msgs);
 
@@ -157,14 +233,32 @@ private:
         {
         }
 
-        void clear()
+        AsyncWrite(AsyncWriteBuffer && newBuffer,
+                   const OnWriteResult & newOnWriteResult)
+            : buffer(std::move(newBuffer)), sent(0),
+              onWriteResult(newOnWriteResult)
+        {
+        }
+
+        /* data to write, from either "message" or "buffer" */
+        const char * data() const
         {
-            message.clear();
-            sent = 0;
-            onWriteResult = nullptr;
+            return buffer.empty() ? message.c_str() : buffer.data();
+        }
+
+        size_t size() const
+        {
+            return buffer.empty() ? message.size() : buffer.size();
+        }
+
+        /* an empty write is used to request the closing of the fd */
+        bool isCloseRequest() const
+        {
+            return size() == 0;
         }
 
         std::string message;
+        AsyncWriteBuffer buffer;
         size_t sent;
         OnWriteResult onWriteResult;
     };
@@ -175,7 +269,8 @@ private:
     void handleFdEvent(const ::epoll_event & event);
     void handleReadReady();
     void handleWriteReady();
-    void handleWriteResult(int error, AsyncWrite && currentWrite);
+    void handleWriteResult(int error, AsyncWrite && write);
+    void handleBytesWritten(size_t written);
     void handleClosing(bool fromPeer, bool delayedUnregistration);
 
     /* wakeup operations */
@@ -189,7 +284,9 @@ private:
 
     bool queueEnabled_;
     TypedMessageQueue<AsyncWrite> queue_;
-    AsyncWrite currentWrite_;
+
+    /* writes moved from the queue and being sent */
+    std::deque<AsyncWrite> writes_;
 
     uint64_t bytesSent_;
     uint64_t bytesReceived_;
@@ -35,7 +35,8 @@ namespace Datacratic {
 
 MultiAggregator::
 MultiAggregator()
-    : doShutdown(false), doDump(false), dumpInterval(0.0)
+    : outcomeStorage(GaugeAggregator::Samples),
+      doShutdown(false), doDump(false), dumpInterval(0.0)
 {
 }
 
@@ -44,7 +45,8 @@ MultiAggregator(const std::string & path,
                 const OutputFn & output,
                 double dumpInterval,
                 std::function<void ()> onStop)
-    : doShutdown(false), doDump(false)
+    : outcomeStorage(GaugeAggregator::Samples),
+      doShutdown(false), doDump(false)
 {
     open(path, output, dumpInterval, onStop);
 }
@@ -116,9 +118,11 @@ StatAggregator * createNewLevel()
     return new GaugeAggregator(GaugeAggregator::Level);
 }
 
-StatAggregator * createNewOutcome(const std::vector<int>& percentiles)
+StatAggregator * createNewOutcome(const std::vector<int>& percentiles,
+                                  GaugeAggregator::Storage storage)
 {
-    return new GaugeAggregator(GaugeAggregator::Outcome, percentiles);
+    return new GaugeAggregator(GaugeAggregator::Outcome, percentiles,
+                               storage);
 }
 
 void
@@ -182,9 +186,139 @@ MultiAggregator::
 recordOutcome(const std::string & stat, float value,
               const std::vector<int>& percentiles)
 {
-    getAggregator(stat, createNewOutcome, percentiles).record(value);
+    getAggregator(stat, createNewOutcome, percentiles,
+                  GaugeAggregator::Storage(outcomeStorage)).record(value);
 }
 
+StatHandle
+MultiAggregator::
+registerStat(const std::string & stat, EventType type,
+             const std::vector<int>& percentiles)
+{
+    std::unique_lock<Lock> guard(lock);
+
+    for (unsigned i = 0;  i < registered.size();  ++i) {
+        if (registered[i].name != stat)
+            continue;
+        if (registered[i].type != type)
+            throw ML::Exception("stat '%s' already registered with another "
+                                "type", stat.c_str());
+        return StatHandle(i, type);
+    }
+
+    auto found = stats.find(stat);
+    if (found == stats.end()) {
+        StatAggregator * aggregator;
+        switch (type) {
+        case ET_HIT:
+        case ET_COUNT:
+            aggregator = createNewCounter();
+            break;
+        case ET_STABLE_LEVEL:
+            aggregator = createNewStableLevel();
+            break;
+        case ET_LEVEL:
+            aggregator = createNewLevel();
+            break;
+        case ET_OUTCOME:
+            aggregator = createNewOutcome(percentiles, outcomeStorage);
+            break;
+        default:
+            throw ML::Exception("unknown stat type");
+        }
+        found = stats.insert(make_pair(stat, std::shared_ptr<StatAggregator>
+                                       (aggregator))).first;
+    }
+
+    // Stats recorded by name may already use that name, in which case the
+    // values recorded both ways end up in the same aggregator.
+    StatAggregator * aggregator = found->second.get();
+    bool isCounter = (type == ET_HIT || type == ET_COUNT);
+    if (isCounter ? !dynamic_cast<CounterAggregator *>(aggregator)
+                  : !dynamic_cast<GaugeAggregator *>(aggregator))
+        throw ML::Exception("stat '%s' already recorded with another type",
+                            stat.c_str());
+
+    registered.push_back({ stat, type, aggregator });
+
+    return StatHandle(registered.size() - 1, type);
+}
+
+MultiAggregator::Shard &
+MultiAggregator::
+createShard()
+{
+    std::shared_ptr<Shard> shard;
+    {
+        std::lock_guard<std::mutex> guard(shardsLock);
+
+        // Take over the shard of a thread that has exited
+        for (auto & s: shards) {
+            bool free = false;
+            if (s->inUse.compare_exchange_strong(free, true,
+                                                 std::memory_order_acquire)) {
+                shard = s;
+                break;
+            }
+        }
+
+        if (!shard) {
+            shard = std::make_shared<Shard>();
+            shards.push_back(shard);
+        }
+    }
+    threadShard.reset(new ThreadShard(shard));
+
+    return *shard;
+}
+
+size_t
+MultiAggregator::
+numShards() const
+{
+    std::lock_guard<std::mutex> guard(shardsLock);
+    return shards.size();
+}
+
+void
+MultiAggregator::
+mergeShards() const
+{
+    // Handles are only ever appended, so a snapshot of the aggregators is
+    // enough to merge the cells known at this point.
+    vector<pair<EventType, StatAggregator *> > aggregators;
+    {
+        std::unique_lock<Lock> guard(this->lock);
+        aggregators.reserve(registered.size());
+        for (auto & r: registered)
+            aggregators.push_back(make_pair(r.type, r.aggregator));
+    }
+
+    std::lock_guard<std::mutex> shardsGuard(shardsLock);
+    for (auto & shard: shards) {
+        std::lock_guard<ML::Spinlock> guard(shard->lock);
+
+        size_t numCells = std::min(shard->cells.size(), aggregators.size());
+        for (size_t i = 0;  i < numCells;  ++i) {
+            ShardCell & cell = shard->cells[i];
+            if (!cell.dirty)
+                continue;
+
+            EventType type = aggregators[i].first;
+            StatAggregator * aggregator = aggregators[i].second;
+            if (type == ET_HIT || type == ET_COUNT) {
+                aggregator->record(cell.total);
+                cell.total = 0.0;
+            }
+            else {
+                static_cast<GaugeAggregator *>(aggregator)
+                    ->record(cell.values.data(), cell.values.size());
+                cell.values.clear();
+            }
+            cell.dirty = false;
+        }
+    }
+}
 
 void
 MultiAggregator::
@@ -202,6 +336,8 @@ void
 MultiAggregator::
 dumpSync(std::ostream & stream) const
 {
+    mergeShards();
+
     std::unique_lock<Lock> guard(this->lock);
 
     for (auto & s: stats) {
@@ -249,6 +385,8 @@ runDumpingThread()
         if (cond.wait_until(lock, nextWakeup.toStd(), [&] { return doShutdown.load(); }))
             break;
 
+        mergeShards();
+
         // Get the read lock to extract a list of stats to dump
         vector<Stats::iterator> toDump;
         {
@@ -11,6 +11,7 @@
 #include "soa/service/stats_events.h"
 #include "ace/INET_Addr.h"
 #include "jml/stats/distribution.h"
+#include "jml/arch/spinlock.h"
 #include "soa/types/date.h"
 #include <unordered_map>
 #include <map>
@@ -24,6 +25,35 @@
 namespace Datacratic {
 
 
+/*****************************************************************************/
+/* STAT HANDLE                                                               */
+/*****************************************************************************/
+
+/** Reference to a stat registered with MultiAggregator::registerStat, to
+    record it without looking up its name.
+*/
+
+struct StatHandle {
+    StatHandle()
+        : index(-1), type(ET_COUNT)
+    {
+    }
+
+    StatHandle(unsigned index, EventType type)
+        : index(index), type(type)
+    {
+    }
+
+    bool valid() const
+    {
+        return index != unsigned(-1);
+    }
+
+    unsigned index;
+    EventType type;
+};
+
+
 /*****************************************************************************/
 /* MULTI AGGREGATOR                                                          */
 /*****************************************************************************/
@@ -52,6 +82,12 @@ struct MultiAggregator {
 
     OutputFn outputFn;
 
+    /** Storage of the outcomes created from now on.  Sketches avoid
+        keeping and sorting every value, at the cost of a 1% error on the
+        percentiles.  Defaults to GaugeAggregator::Samples.
+    */
+    GaugeAggregator::Storage outcomeStorage;
+
     /** Function to be called when the stat is to be done.  Default will
         call the OutputFn.
     */
@@ -101,6 +137,44 @@ struct MultiAggregator {
     void recordOutcome(const std::string & stat, float value,
             const std::vector<int>& percentiles = DefaultOutcomePercentiles);
 
+    /** Register a stat of the given type, for use with the handle-based
+        record functions below.  Registering the same name again returns
+        the same handle, provided that the type matches.  Takes a lock.
+    */
+    StatHandle registerStat(const std::string & stat, EventType type,
+            const std::vector<int>& percentiles = DefaultOutcomePercentiles);
+
+    /** Record a value for a registered stat, according to its type.  The
+        value is accumulated in a shard private to the calling thread and
+        merged into the stat when it is dumped, so that neither a lookup nor
+        a contended lock is needed.  Only allocates the first time a thread
+        records a given stat, or when a thread records more values of a
+        gauge between two dumps than it ever did before.
+    */
+    void record(StatHandle stat, float value)
+    {
+        Shard & shard = getShard();
+        std::lock_guard<ML::Spinlock> guard(shard.lock);
+        if (stat.index >= shard.cells.size())
+            shard.cells.resize(stat.index + 1);
+
+        ShardCell & cell = shard.cells[stat.index];
+        if (stat.type == ET_HIT || stat.type == ET_COUNT)
+            cell.total += value;
+        else cell.values.push_back(value);
+        cell.dirty = true;
+    }
+
+    void recordHit(StatHandle stat)
+    {
+        record(stat, 1.0);
+    }
+
+    /** Number of per-thread shards created by record(), which is the
+        largest number of threads that recorded stats at the same time.
+    */
+    size_t numShards() const;
+
     /** Dump synchronously (taking the lock).  This should only be used in
         testing or debugging, not when connected to Carbon.
     */
@@ -140,6 +214,84 @@ private:
     // very much.
     boost::thread_specific_ptr<LookupCache> lookupCache;
 
+    /** Stats registered via registerStat, indexed by their handle. */
+    struct RegisteredStat {
+        std::string name;
+        EventType type;
+        StatAggregator * aggregator;
+    };
+    std::vector<RegisteredStat> registered;
+
+    /** Values accumulated by one thread for one registered stat since the
+        last merge.  Counts are summed and the values of gauges are kept as
+        is, in a buffer that keeps its capacity across merges.
+    */
+    struct ShardCell {
+        ShardCell()
+            : total(0.0), dirty(false)
+        {
+        }
+
+        double total;
+        std::vector<float> values;
+        bool dirty;
+    };
+
+    /** Per-thread accumulation of registered stats.  The lock is only ever
+        contended by the dumping thread, once per merge.
+    */
+    struct Shard {
+        Shard()
+            : inUse(true)
+        {
+        }
+
+        ML::Spinlock lock;
+        std::vector<ShardCell> cells;
+        std::atomic<bool> inUse;    ///< false once its thread has exited
+    };
+
+    /** What a thread knows of its shard.  Destroyed when the thread exits,
+        which frees the shard for another thread.  The values left in it
+        are merged as usual, whichever thread recorded them.
+    */
+    struct ThreadShard {
+        ThreadShard(std::shared_ptr<Shard> shard)
+            : shard(std::move(shard))
+        {
+        }
+
+        ~ThreadShard()
+        {
+            shard->inUse.store(false, std::memory_order_release);
+        }
+
+        std::shared_ptr<Shard> shard;
+    };
+
+    // Shards of the threads that recorded a registered stat, reused by new
+    // threads once theirs have exited so that thread churn doesn't add
+    // shards.  They are shared with the ThreadShard of their thread, which
+    // may only be destroyed after the aggregator.
+    std::vector<std::shared_ptr<Shard> > shards;
+    mutable std::mutex shardsLock;
+    boost::thread_specific_ptr<ThreadShard> threadShard;
+
+    Shard & getShard()
+    {
+        ThreadShard * threadShard = this->threadShard.get();
+        if (!threadShard)
+            return createShard();
+        return *threadShard->shard;
+    }
+
+    Shard & createShard();
+
+    /** Fold the values accumulated in all the shards into the aggregators
+        of the registered stats.
+    */
+    void mergeShards() const;
+
     /** Thread that's started up to start dumping. */
     void runDumpingThread();
 
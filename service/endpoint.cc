@@ -54,6 +54,16 @@ EndpointBase(const std::string & name)
     Epoller::handleEvent = [&] (epoll_event & event) {
         return this->handleEpollEvent(event);
     };
+
+    /* not part of epollDataSet, as the fd is owned by transportTimers_ */
+    transportTimersData_
+        = make_shared<EpollData>(EpollData::EpollDataType::TIMER,
+                                 transportTimers_.selectFd());
+    transportTimersData_->onTimer = [&] (uint64_t) {
+        this->handleTransportTimers();
+    };
+    Epoller::addFdOneShot(transportTimersData_->fd,
+                          transportTimersData_.get());
 }
 
 EndpointBase::
@@ -105,6 +115,44 @@ addPeriodic(double timePeriodSeconds, OnTimer toRun)
     startPolling(timerData);
 }
 
+void
+EndpointBase::
+scheduleTransportTimer(TransportBase * transport, Date timeout)
+{
+    MutexGuard guard(transportTimersLock_);
+
+    if (transport->timerId_ != 0)
+        transportTimers_.cancel(transport->timerId_);
+    transport->timerExpired_ = false;
+
+    auto onTimer = [=] () {
+        transport->notifyTimerExpired();
+        transport->timerId_ = 0;
+    };
+    transport->timerId_ = transportTimers_.arm(timeout, onTimer);
+}
+
+void
+EndpointBase::
+cancelTransportTimer(TransportBase * transport)
+{
+    MutexGuard guard(transportTimersLock_);
+
+    if (transport->timerId_ != 0) {
+        transportTimers_.cancel(transport->timerId_);
+        transport->timerId_ = 0;
+    }
+    transport->timerExpired_ = false;
+}
+
+void
+EndpointBase::
+handleTransportTimers()
+{
+    MutexGuard guard(transportTimersLock_);
+    transportTimers_.processOne();
+}
+
 void
 EndpointBase::
 spinup(int num_threads, bool synchronous)
@@ -21,6 +21,7 @@
 #include "transport.h"
 #include "connection_handler.h"
 #include "soa/service/epoller.h"
+#include "soa/service/timer_source.h"
 #include <map>
 #include <mutex>
 
@@ -272,6 +273,19 @@ private:
     bool shutdown_;
     bool disallowTimers_;
 
+    /* Timers of the transports, which share a single timerfd */
+    std::mutex transportTimersLock_;
+    TimerSource transportTimers_;
+    std::shared_ptr<EpollData> transportTimersData_;
+
+    /** Arm the timer of the given transport, replacing its previous one. */
+    void scheduleTransportTimer(TransportBase * transport, Date timeout);
+
+    /** Disarm the timer of the given transport. */
+    void cancelTransportTimer(TransportBase * transport);
+
+    void handleTransportTimers();
+
    //Poll start time
     Date pollStart_;
 
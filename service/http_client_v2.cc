@@ -4,11 +4,11 @@
 */
 
 #include <errno.h>
-#include <sys/timerfd.h>
 
 #include "jml/arch/exception.h"
 #include "jml/utils/exc_assert.h"
 
+#include "soa/types/date.h"
 #include "soa/types/url.h"
 #include "message_loop.h"
 #include "http_header.h"
@@ -23,6 +23,9 @@ using namespace Datacratic;
 
 namespace {
 
+/* interval in seconds between checks for idle connections */
+const double ReapPeriod(1.0);
+
 HttpClientError
 translateError(TcpConnectionCode code)
 {
@@ -98,9 +101,10 @@ makeRequestStr(const HttpRequest & request)
 /****************************************************************************/
 
 HttpConnection::
-HttpConnection()
-    : responseState_(IDLE), requestEnded_(false), lastCode_(Success),
-      timeoutFd_(-1)
+HttpConnection(const shared_ptr<TimerSource> & timers)
+    : TcpClient(nullptr, nullptr, nullptr, 0),
+      numSent_(0), closeRequested_(false), lastCode_(Success),
+      timers_(timers), timerId_(0)
 {
     // cerr << "HttpConnection(): " << this << "\n";
 
@@ -129,54 +133,77 @@ HttpConnection::
 {
     // cerr << "~HttpConnection: " << this << "\n";
     cancelRequestTimer();
-    if (responseState_ != IDLE) {
+    if (requests_.size() > 0) {
         ::fprintf(stderr,
-                  "destroying non-idle connection: %d",
-                  responseState_);
+                  "destroying non-idle connection: %zu requests in flight\n",
+                  requests_.size());
     }
 }
 
-void
-HttpConnection::
-clear()
-{
-    responseState_ = IDLE;
-    request_.clear();
-    lastCode_ = Success;
-}
-
-void
+bool
 HttpConnection::
 perform(HttpRequest && request)
 {
     // cerr << "perform: " << this << endl;
+    bool reused = isOpen();
 
-    if (responseState_ != IDLE) {
-        throw ML::Exception("%p: cannot process a request when state is not"
-                            " idle: %d", this, responseState_);
+    requests_.emplace_back(move(request));
+    if (requests_.size() == 1) {
+        parser_.setExpectBody(getExpectResponseBody(requests_.front()));
     }
 
-    request_ = move(request);
+    /* when the connection is being closed, the request will be sent once
+       that operation has completed */
+    if (!closeRequested_) {
+        sendPendingRequests();
+    }
+
+    return reused;
+}
 
-    if (queueEnabled()) {
-        startSendingRequest();
+void
+HttpConnection::
+closeIdle()
+{
+    if (requests_.size() == 0 && isOpen()) {
+        closeRequested_ = true;
+        lastCode_ = Success;
+        requestClose();
     }
-    else {
+}
+
+/* Sends the requests that have not been sent yet, establishing the
+ * connection first if needed. Since the writes are queued while the
+ * connection is in progress, the requests are written in order without
+ * awaiting its result. */
+void
+HttpConnection::
+sendPendingRequests()
+{
+    if (!queueEnabled()) {
         auto onConnectionResult = [&] (TcpConnectionResult result) {
-            if (result.code == TcpConnectionCode::Success) {
-                startSendingRequest();
-            }
-            else {
-                handleEndOfRq(result.code, false);
+            if (result.code != TcpConnectionCode::Success) {
+                TcpConnectionCode code(closeRequested_
+                                       ? lastCode_ : result.code);
+                closeRequested_ = false;
+                failRequests(requests_.size(), code, result.code);
             }
         };
         connect(onConnectionResult);
     }
+
+    while (queueEnabled() && numSent_ < requests_.size()) {
+        sendRequest(requests_[numSent_]);
+        numSent_++;
+        if (numSent_ == 1) {
+            armRequestTimer();
+        }
+    }
 }
 
 void
 HttpConnection::
-startSendingRequest()
+sendRequest(const HttpRequest & request)
 {
     /* This controls the maximum body size from which the body will be written
        separately from the request headers. This tend to improve performance
@@ -185,51 +212,19 @@ startSendingRequest()
        tested on different setups. */
     static constexpr size_t TwoStepsThreshold(65536);
 
-    parser_.setExpectBody(getExpectResponseBody(request_));
-    string rqData = makeRequestStr(request_);
-
-    bool twoSteps(false);
+    string rqData = makeRequestStr(request);
 
-    const HttpRequest::Content & content = request_.content_;
-    if (content.str.size() > 0) {
-        if (content.str.size() < TwoStepsThreshold) {
-            rqData.append(content.str);
-        }
-        else {
-            twoSteps = true;
-        }
+    const HttpRequest::Content & content = request.content_;
+    if (content.str.size() > 0 && content.str.size() < TwoStepsThreshold) {
+        rqData.append(content.str);
     }
-    responseState_ = PENDING;
 
-    auto onWriteResultFinal = [&] (AsyncWriteResult result) {
-        if (result.error == 0) {
-            ExcAssertEqual(responseState_, PENDING);
-            responseState_ = IDLE;
-        }
-        else {
-            throw ML::Exception("unhandled error");
-        }
-    };
-
-    if (twoSteps) {
-        auto onWriteResultFirst
-            = [this, onWriteResultFinal] (AsyncWriteResult result) {
-            if (result.error == 0) {
-                ExcAssertEqual(responseState_, PENDING);
-                const HttpRequest::Content & content = request_.content_;
-                write(move(content.str), onWriteResultFinal);
-            }
-            else {
-                throw ML::Exception("unhandled error");
-            }
-        };
-        write(move(rqData), onWriteResultFirst);
-    }
-    else {
-        write(move(rqData), onWriteResultFinal);
+    /* Write errors are followed by the closing of the connection, where
+       the pending requests are reported as failed. */
+    write(move(rqData), nullptr);
+    if (content.str.size() >= TwoStepsThreshold) {
+        write(string(content.str), nullptr);
     }
-
-    armRequestTimer();
 }
 
 void
@@ -237,7 +232,12 @@ HttpConnection::
 onReceivedData(const char * data, size_t size)
 {
     // cerr << "onReceivedData: " + string(data, size) + "\n";
-    parser_.feed(data, size);
+
+    /* data received after a timeout or a "Connection: close" response is
+       discarded */
+    if (!closeRequested_) {
+        parser_.feed(data, size);
+    }
 }
 
 void
@@ -253,7 +253,8 @@ HttpConnection::
 onParserResponseStart(const string & httpVersion, int code)
 {
     // ::fprintf(stderr, "%p: onParserResponseStart\n", this);
-    request_.callbacks_->onResponseStart(request_, httpVersion, code);
+    const HttpRequest & request = requests_.front();
+    request.callbacks_->onResponseStart(request, httpVersion, code);
 }
 
 void
@@ -261,7 +262,8 @@ HttpConnection::
 onParserHeader(const char * data, size_t size)
 {
     // cerr << "onParserHeader: " << this << endl;
-    request_.callbacks_->onHeader(request_, data, size);
+    const HttpRequest & request = requests_.front();
+    request.callbacks_->onHeader(request, data, size);
 }
 
 void
@@ -269,7 +271,8 @@ HttpConnection::
 onParserData(const char * data, size_t size)
 {
     // cerr << "onParserData: " << this << endl;
-    request_.callbacks_->onData(request_, data, size);
+    const HttpRequest & request = requests_.front();
+    request.callbacks_->onData(request, data, size);
 }
 
 void
@@ -279,55 +282,81 @@ onParserDone(bool doClose)
     handleEndOfRq(Success, doClose);
 }
 
-/* This method handles end of requests: callback invocation, timer
- * cancellation etc. It may request the closing of the connection, in which
- * case the HttpConnection will be ready for a new request only after
- * finalizeEndOfRq is invoked. */
+/* This method handles the end of the first request in flight. It may request
+ * the closing of the connection, in which case the completion of that request
+ * and of the ones that were pipelined behind it is deferred until "onClosed"
+ * is invoked. */
 void
 HttpConnection::
 handleEndOfRq(TcpConnectionCode code, bool requireClose)
 {
-    if (requestEnded_) {
+    if (closeRequested_ || requests_.size() == 0) {
         // cerr << "ignoring extraneous end of request\n";
-        ;
+        return;
+    }
+
+    cancelRequestTimer();
+    if (requireClose) {
+        closeRequested_ = true;
+        lastCode_ = code;
+        requestClose();
     }
     else {
-        /* "requestEnded_" is meant to ignore this part of the code, since
-           "handleEndOfRq" is called again from "onClosed", in the callback chain started in
-           "requestClose". */
-        requestEnded_ = true;
-        cancelRequestTimer();
-        if (requireClose) {
-            lastCode_ = code;
-            requestClose();
-        }
-        else {
-            finalizeEndOfRq(code);
+        finishRequest(code);
+    }
+}
+
+/* Report the completion of the first request in flight and prepare the
+ * connection for the response to the next one. */
+void
+HttpConnection::
+finishRequest(TcpConnectionCode code)
+{
+    HttpRequest request(move(requests_.front()));
+    requests_.pop_front();
+    if (numSent_ > 0) {
+        numSent_--;
+    }
+
+    if (requests_.size() > 0) {
+        parser_.setExpectBody(getExpectResponseBody(requests_.front()));
+        if (numSent_ > 0) {
+            armRequestTimer();
         }
     }
+
+    request.callbacks_->onDone(request, translateError(code));
+    onDone(code);
 }
 
+/* Complete the first "count" requests in flight, the first one with "code"
+ * and the others with "otherCode". */
 void
 HttpConnection::
-finalizeEndOfRq(TcpConnectionCode code)
+failRequests(size_t count,
+             TcpConnectionCode code, TcpConnectionCode otherCode)
 {
-    if (request_) {
-        request_.callbacks_->onDone(request_, translateError(code));
-        clear();
-        onDone(code);
+    for (size_t i = 0; i < count && requests_.size() > 0; i++) {
+        finishRequest(i == 0 ? code : otherCode);
     }
-    requestEnded_ = false;
+    numSent_ = 0;
+    cancelRequestTimer();
 }
 
 void
 HttpConnection::
 onClosed(bool fromPeer, const std::vector<std::string> & msgs)
 {
-    if (fromPeer) {
-        handleEndOfRq(ConnectionEnded, false);
-    }
-    else {
-        finalizeEndOfRq(lastCode_);
+    /* It is unknown whether the server has processed the requests that
+       were pipelined behind the first one. */
+    TcpConnectionCode code(closeRequested_ ? lastCode_ : ConnectionEnded);
+    closeRequested_ = false;
+    failRequests(numSent_, code, ConnectionEnded);
+
+    /* requests performed while the connection was closing */
+    if (requests_.size() > 0) {
+        parser_.setExpectBody(getExpectResponseBody(requests_.front()));
+        sendPendingRequests();
     }
 }
 
@@ -335,35 +364,15 @@ void
 HttpConnection::
 armRequestTimer()
 {
-    if (request_.timeout_ > 0) {
-        if (timeoutFd_ == -1) {
-            timeoutFd_ = timerfd_create(CLOCK_MONOTONIC,
-                                        TFD_NONBLOCK | TFD_CLOEXEC);
-            if (timeoutFd_ == -1) {
-                throw ML::Exception(errno, "timerfd_create");
-            }
-            auto handleTimeoutEventCb = [&] (const struct epoll_event & event) {
-                this->handleTimeoutEvent(event);
-            };
-            registerFdCallback(timeoutFd_, handleTimeoutEventCb);
-            // cerr << " timeoutFd_: "  + to_string(timeoutFd_) + "\n";
-            addFdOneShot(timeoutFd_, true, false);
-            // cerr << "timer armed\n";
-        }
-        else {
-            // cerr << "timer rearmed\n";
-            modifyFdOneShot(timeoutFd_, true, false);
-        }
-
-        itimerspec spec;
-        ::memset(&spec, 0, sizeof(itimerspec));
+    cancelRequestTimer();
 
-        spec.it_interval.tv_sec = 0;
-        spec.it_value.tv_sec = request_.timeout_;
-        int res = timerfd_settime(timeoutFd_, 0, &spec, nullptr);
-        if (res == -1) {
-            throw ML::Exception(errno, "timerfd_settime");
-        }
+    const HttpRequest & request = requests_.front();
+    if (request.timeout_ > 0) {
+        auto onTimeout = [&] () {
+            this->timerId_ = 0;
+            this->handleEndOfRq(Timeout, true);
+        };
+        timerId_ = timers_->armRelative(request.timeout_, onTimeout);
     }
 }
 
@@ -371,41 +380,195 @@ void
 HttpConnection::
 cancelRequestTimer()
 {
-    // cerr << "cancel request timer " << this << "\n";
-    if (timeoutFd_ != -1) {
-        // cerr << "  was active\n";
-        removeFd(timeoutFd_);
-        unregisterFdCallback(timeoutFd_, true);
-        ::close(timeoutFd_);
-        timeoutFd_ = -1;
+    if (timerId_ != 0) {
+        timers_->cancel(timerId_);
+        timerId_ = 0;
     }
-    // else {
-    //     cerr << "  was not active\n";
-    // }
+}
+
+
+/****************************************************************************/
+/* HTTP CONNECTION POOL                                                     */
+/****************************************************************************/
+
+HttpConnectionPool::
+HttpConnectionPool(MessageLoop & loop, const string & hostUrl,
+                   size_t maxConnections)
+    : minConnections(0), maxConnections(maxConnections),
+      pipelineDepth(1), idleTimeout(30.0),
+      loop_(loop), hostUrl_(hostUrl), timers_(make_shared<TimerSource>()),
+      partialSlots_(0),
+      numConnections_(0), inFlight_(0),
+      numRequests_(0), numReused_(0), numPipelined_(0), numReaped_(0)
+{
+    ExcAssertGreater(maxConnections, 0);
+    entries_.reserve(maxConnections);
+    loop_.addSource("timers", timers_);
+}
+
+size_t
+HttpConnectionPool::
+capacity()
+    const
+{
+    return (idle_.size() + (maxConnections - entries_.size())
+            + partialSlots_);
 }
 
 void
-HttpConnection::
-handleTimeoutEvent(const ::epoll_event & event)
+HttpConnectionPool::
+perform(HttpRequest && request)
 {
-    if (timeoutFd_ == -1) {
-        return;
+    size_t idx = getConnection();
+    Entry & entry = entries_[idx];
+    HttpConnection & connection = *entry.connection;
+
+    numRequests_++;
+    inFlight_++;
+    if (connection.inFlight() > 0) {
+        numPipelined_++;
+    }
+
+    /* "perform" may report the completion of the request synchronously */
+    bool reused = connection.perform(move(request));
+    if (reused) {
+        numReused_++;
     }
+    updatePartial(entry, idx);
+}
 
-    if ((event.events & EPOLLIN) != 0) {
-        while (true) {
-            uint64_t expiries;
-            int res = ::read(timeoutFd_, &expiries, sizeof(expiries));
-            if (res == -1) {
-                if (errno == EAGAIN) {
-                    break;
-                }
+/* Returns the index of the connection that should handle the next request:
+ * the most recently used idle connection, a new connection or the next
+ * connection in the pipelining rotation, in that order. */
+size_t
+HttpConnectionPool::
+getConnection()
+{
+    size_t idx;
 
-                throw ML::Exception(errno, "read");
-            }
+    if (idle_.size() > 0) {
+        idx = idle_.back();
+        idle_.pop_back();
+    }
+    else if (entries_.size() < maxConnections) {
+        idx = createConnection();
+    }
+    else if (partial_.size() > 0) {
+        idx = partial_.front();
+        partial_.splice(partial_.end(), partial_, partial_.begin());
+    }
+    else {
+        throw ML::Exception("no connection available");
+    }
+
+    return idx;
+}
+
+size_t
+HttpConnectionPool::
+createConnection()
+{
+    size_t idx = entries_.size();
+
+    auto connection = make_shared<HttpConnection>(timers_);
+    connection->init(hostUrl_);
+    connection->onDone = [&, idx] (TcpConnectionCode result) {
+        this->releaseConnection(idx);
+    };
+    loop_.addSource("connection" + to_string(idx), connection);
+
+    entries_.emplace_back();
+    entries_.back().connection = move(connection);
+    numConnections_++;
+
+    return idx;
+}
+
+void
+HttpConnectionPool::
+releaseConnection(size_t idx)
+{
+    Entry & entry = entries_[idx];
+
+    inFlight_--;
+    if (entry.connection->inFlight() == 0) {
+        entry.idleSince = Date::now().secondsSinceEpoch();
+        idle_.push_back(idx);
+    }
+    updatePartial(entry, idx);
+}
+
+/* Maintain the presence of the connection in the list of connections that
+ * can accept pipelined requests, as well as the count of free slots. */
+void
+HttpConnectionPool::
+updatePartial(Entry & entry, size_t idx)
+{
+    size_t inFlight = entry.connection->inFlight();
+    bool isPartial = (inFlight > 0 && inFlight < pipelineDepth);
+
+    partialSlots_ -= entry.freeSlots;
+    if (isPartial) {
+        if (!entry.inPartial) {
+            entry.partialIt = partial_.insert(partial_.end(), idx);
+            entry.inPartial = true;
+        }
+        entry.freeSlots = pipelineDepth - inFlight;
+    }
+    else {
+        if (entry.inPartial) {
+            partial_.erase(entry.partialIt);
+            entry.inPartial = false;
         }
-        handleEndOfRq(Timeout, true);
+        entry.freeSlots = 0;
     }
+    partialSlots_ += entry.freeSlots;
+}
+
+void
+HttpConnectionPool::
+reapIdleConnections()
+{
+    size_t numOpen(0);
+    for (const Entry & entry: entries_) {
+        if (entry.connection->isOpen()) {
+            numOpen++;
+        }
+    }
+
+    /* "idle_" is sorted from the least to the most recently used */
+    double limit = Date::now().secondsSinceEpoch() - idleTimeout;
+    for (size_t idx: idle_) {
+        if (numOpen <= minConnections) {
+            break;
+        }
+        Entry & entry = entries_[idx];
+        if (entry.idleSince > limit) {
+            break;
+        }
+        if (entry.connection->isOpen()) {
+            entry.connection->closeIdle();
+            numOpen--;
+            numReaped_++;
+        }
+    }
+}
+
+HttpConnectionPool::Stats
+HttpConnectionPool::
+stats()
+    const
+{
+    Stats stats;
+
+    stats.numConnections = numConnections_;
+    stats.inFlight = inFlight_;
+    stats.numRequests = numRequests_;
+    stats.numReused = numReused_;
+    stats.numPipelined = numPipelined_;
+    stats.numReaped = numReaped_;
+
+    return stats;
 }
 
 
@@ -418,24 +581,17 @@ HttpClientV2(const string & baseUrl, int numParallel, size_t queueSize)
     : HttpClientImpl(baseUrl, numParallel, queueSize),
       loop_(1, 0, -1),
       baseUrl_(baseUrl),
-      avlConnections_(numParallel),
-      nextAvail_(0),
+      pool_(loop_, baseUrl, numParallel),
+      pipelineDepth_(DefaultPipelineDepth),
+      pipelining_(false),
       queue_([&]() { this->handleQueueEvent(); }, queueSize)
 {
     ExcAssert(baseUrl.compare(0, 8, "https://") != 0);
 
-    /* available connections */
-    for (size_t i = 0; i < numParallel; i++) {
-        HttpConnection * connPtr = new HttpConnection();
-        shared_ptr<HttpConnection> connection(connPtr);
-        connection->init(baseUrl);
-        connection->onDone = [&, connPtr] (TcpConnectionCode result) {
-            releaseConnection(connPtr);
-        };
-        loop_.addSource("connection" + to_string(i), connection);
-        avlConnections_[i] = connPtr;
-    }
     loop_.addSource("queue", queue_);
+    loop_.addPeriodic("reaper", ReapPeriod, [&] (uint64_t) {
+        this->pool_.reapIdleConnections();
+    });
 }
 
 HttpClientV2::
@@ -482,9 +638,45 @@ void
 HttpClientV2::
 enablePipelining(bool value)
 {
-    if (value) {
-        throw ML::Exception("pipeline is not supported");
-    }
+    pipelining_ = value;
+    pool_.pipelineDepth = pipelining_ ? pipelineDepth_ : 1;
+}
+
+void
+HttpClientV2::
+setPipelineDepth(size_t depth)
+{
+    ExcAssertGreater(depth, 0);
+    pipelineDepth_ = depth;
+    enablePipelining(pipelining_);
+}
+
+void
+HttpClientV2::
+setMinConnections(size_t minConnections)
+{
+    pool_.minConnections = minConnections;
+}
+
+void
+HttpClientV2::
+setIdleTimeout(double seconds)
+{
+    pool_.idleTimeout = seconds;
+}
+
+HttpClientV2::Stats
+HttpClientV2::
+stats()
+    const
+{
+    Stats stats;
+
+    HttpConnectionPool::Stats & poolStats = stats;
+    poolStats = pool_.stats();
+    stats.queueDepth = queue_.size();
+
+    return stats;
 }
 
 bool
@@ -505,50 +697,12 @@ void
 HttpClientV2::
 handleQueueEvent()
 {
-    size_t numConnections = avlConnections_.size() - nextAvail_;
-    if (numConnections > 0) {
+    size_t capacity = pool_.capacity();
+    if (capacity > 0) {
         /* "0" has a special meaning for pop_front and must be avoided here */
-        auto requests = queue_.pop_front(numConnections);
+        auto requests = queue_.pop_front(capacity);
         for (auto & request: requests) {
-            HttpConnection * conn = getConnection();
-            if (!conn) {
-                cerr << ("nextAvail_: "  + to_string(nextAvail_)
-                         + "; num conn: "  + to_string(numConnections)
-                         + "; num reqs: "  + to_string(requests.size())
-                         + "\n");
-                throw ML::Exception("inconsistency in count of available"
-                                    " connections");
-            }
-            conn->perform(move(request));
+            pool_.perform(move(request));
         }
     }
 }
-
-HttpConnection *
-HttpClientV2::
-getConnection()
-{
-    HttpConnection * conn;
-
-    if (nextAvail_ < avlConnections_.size()) {
-        conn = avlConnections_[nextAvail_];
-        nextAvail_++;
-    }
-    else {
-        conn = nullptr;
-    }
-
-    // cerr << " returning conn: " << conn << "\n";
-
-    return conn;
-}
-
-void
-HttpClientV2::
-releaseConnection(HttpConnection * oldConnection)
-{
-    if (nextAvail_ > 0) {
-        nextAvail_--;
-        avlConnections_[nextAvail_] = oldConnection;
-    }
-}
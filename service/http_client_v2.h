@@ -16,11 +16,13 @@
    - parser:
      - needs better validation (header key size, ...)
    - compression
-   - auto disconnect (keep-alive)
    - SSL support
-   - pipelining
  */
 
+#include <atomic>
+#include <deque>
+#include <list>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -31,6 +33,7 @@
 #include "soa/service/message_loop.h"
 #include "soa/service/typed_message_channel.h"
 #include "soa/service/tcp_client.h"
+#include "soa/service/timer_source.h"
 
 
 namespace Datacratic {
@@ -39,28 +42,51 @@ namespace Datacratic {
 /* HTTP CONNECTION                                                          */
 /****************************************************************************/
 
+/* An HTTP/1.1 connection to a single host. Requests passed to "perform" are
+ * written to the socket immediately, even when responses to earlier requests
+ * are still pending, which enables pipelining. Responses are matched to
+ * their requests in FIFO order. */
+
 struct HttpConnection : TcpClient {
     typedef std::function<void (TcpConnectionCode)> OnDone;
 
-    enum HttpState {
-        IDLE,
-        PENDING
-    };
-
-    HttpConnection();
+    /* "timers" hosts the request timeouts of the connection */
+    HttpConnection(const std::shared_ptr<TimerSource> & timers);
 
     HttpConnection(const HttpConnection & other) = delete;
 
     ~HttpConnection();
 
-    void clear();
-    void perform(HttpRequest && request);
+    /* Send "request" on the connection, which is established first if
+     * needed. Returns "true" when an established or pending connection was
+     * reused. */
+    bool perform(HttpRequest && request);
+
+    /* Number of requests awaiting a response, including those not yet
+     * sent */
+    size_t inFlight() const
+    {
+        return requests_.size();
+    }
+
+    /* Whether the socket is open or being opened */
+    bool isOpen() const
+    {
+        return queueEnabled() && !closeRequested_;
+    }
+
+    /* Close the connection if no request is in flight. Requests performed
+     * while the closing is in progress are sent on a new connection. */
+    void closeIdle();
 
+    /* The request to which the next response will be associated */
     const HttpRequest & request() const
     {
-        return request_;
+        return requests_.front();
     }
 
+    /* Invoked once for each request that completes, after its own
+     * callbacks. */
     OnDone onDone;
 
 private:
@@ -75,26 +101,133 @@ private:
     void onParserData(const char * data, size_t size);
     void onParserDone(bool onClose);
 
-    void startSendingRequest();
+    void sendPendingRequests();
+    void sendRequest(const HttpRequest & request);
 
     void handleEndOfRq(TcpConnectionCode code, bool requireClose);
-    void finalizeEndOfRq(TcpConnectionCode code);
+    void finishRequest(TcpConnectionCode code);
+    void failRequests(size_t count,
+                      TcpConnectionCode code, TcpConnectionCode otherCode);
 
     HttpResponseParser parser_;
 
-    HttpState responseState_;
-    HttpRequest request_;
-    bool requestEnded_;
+    /* requests awaiting a response, in the order they were performed, the
+       first "numSent_" of which have been written to the socket */
+    std::deque<HttpRequest> requests_;
+    size_t numSent_;
 
-    /* Connection: close */
+    /* the closing of the connection was requested and "onClosed" will
+       complete the requests that were sent */
+    bool closeRequested_;
+
+    /* completion code of the first request when the connection is closed
+       (Connection: close, timeout) */
     TcpConnectionCode lastCode_;
 
     /* request timeouts */
     void armRequestTimer();
     void cancelRequestTimer();
-    void handleTimeoutEvent(const ::epoll_event & event);
 
-    int timeoutFd_;
+    std::shared_ptr<TimerSource> timers_;
+    TimerSource::Id timerId_;
+};
+
+
+/****************************************************************************/
+/* HTTP CONNECTION POOL                                                     */
+/****************************************************************************/
+
+/* The connections opened by a client to its host. Connections are created on
+ * demand, up to "maxConnections", and share a single TimerSource for the
+ * timeouts of their requests. Idle connections are reused in LIFO order,
+ * so that the least recently used ones can be closed once they have been
+ * idle for "idleTimeout" seconds, as long as "minConnections" remain open.
+ * When "pipelineDepth" is greater than 1, busy connections accept additional
+ * requests once no idle connection is left and the pool is full.
+ *
+ * The pool is only used from the thread of the owning loop, except for
+ * "stats", which can be invoked from any thread. */
+
+struct HttpConnectionPool {
+    struct Stats {
+        Stats()
+            : numConnections(0), inFlight(0),
+              numRequests(0), numReused(0), numPipelined(0), numReaped(0)
+        {
+        }
+
+        size_t numConnections;     /* connections created */
+        size_t inFlight;           /* requests awaiting a response */
+        uint64_t numRequests;      /* requests performed */
+        uint64_t numReused;        /* requests sent on an open connection */
+        uint64_t numPipelined;     /* requests sent behind other requests */
+        uint64_t numReaped;        /* idle connections closed */
+
+        /* ratio of requests that did not require a new connection */
+        double reuseRate() const
+        {
+            return numRequests > 0 ? double(numReused) / numRequests : 0.0;
+        }
+    };
+
+    HttpConnectionPool(MessageLoop & loop, const std::string & hostUrl,
+                       size_t maxConnections);
+
+    HttpConnectionPool(const HttpConnectionPool & other) = delete;
+
+    /* Number of requests that can be performed immediately */
+    size_t capacity() const;
+
+    /* Perform "request" on the most appropriate connection. Must not be
+     * invoked when "capacity" is 0. */
+    void perform(HttpRequest && request);
+
+    /* Close the connections that have remained idle for too long */
+    void reapIdleConnections();
+
+    Stats stats() const;
+
+    size_t minConnections;
+    size_t maxConnections;
+    size_t pipelineDepth;
+    double idleTimeout;
+
+private:
+    struct Entry {
+        Entry()
+            : idleSince(0), inPartial(false), freeSlots(0)
+        {
+        }
+
+        std::shared_ptr<HttpConnection> connection;
+        double idleSince; /* timestamp of the last completion */
+
+        /* partially loaded connections, with pipelining */
+        bool inPartial;
+        std::list<size_t>::iterator partialIt;
+        size_t freeSlots;
+    };
+
+    size_t getConnection();
+    size_t createConnection();
+    void releaseConnection(size_t idx);
+    void updatePartial(Entry & entry, size_t idx);
+
+    MessageLoop & loop_;
+    std::string hostUrl_;
+    std::shared_ptr<TimerSource> timers_;
+
+    std::vector<Entry> entries_;
+    std::deque<size_t> idle_;       /* LIFO, oldest first */
+    std::list<size_t> partial_;     /* round robin */
+    size_t partialSlots_;           /* free pipelining slots in "partial_" */
+
+    std::atomic<size_t> numConnections_;
+    std::atomic<size_t> inFlight_;
+    std::atomic<uint64_t> numRequests_;
+    std::atomic<uint64_t> numReused_;
+    std::atomic<uint64_t> numPipelined_;
+    std::atomic<uint64_t> numReaped_;
 };
 
 
@@ -103,6 +236,11 @@ private:
 /****************************************************************************/
 
 struct HttpClientV2 : public HttpClientImpl {
+    /* Default number of requests per connection with pipelining */
+    enum {
+        DefaultPipelineDepth = 8
+    };
+
     HttpClientV2(const std::string & baseUrl,
                  int numParallel, size_t queueSize);
 
@@ -118,6 +256,28 @@ struct HttpClientV2 : public HttpClientImpl {
     void enableTcpNoDelay(bool value);
     void enablePipelining(bool value);
 
+    /* Maximum number of requests sent on a connection before their
+       responses are received, when pipelining is enabled */
+    void setPipelineDepth(size_t depth);
+
+    /* Number of connections that are never closed for being idle, and
+       duration after which the other idle connections are closed */
+    void setMinConnections(size_t minConnections);
+    void setIdleTimeout(double seconds);
+
+    /* Statistics of the connection pool, including the number of requests
+       waiting in the queue */
+    struct Stats : public HttpConnectionPool::Stats {
+        Stats()
+            : queueDepth(0)
+        {
+        }
+
+        size_t queueDepth;
+    };
+
+    Stats stats() const;
+
     bool enqueueRequest(const std::string & verb,
                         const std::string & resource,
                         const std::shared_ptr<HttpClientCallbacks> & callbacks,
@@ -138,19 +298,15 @@ struct HttpClientV2 : public HttpClientImpl {
 private:
     void handleQueueEvent();
 
-    HttpConnection * getConnection();
-    void releaseConnection(HttpConnection * connection);
-
     MessageLoop loop_;
 
     std::string baseUrl_;
 
-    std::vector<HttpConnection *> avlConnections_;
-    size_t nextAvail_;
+    HttpConnectionPool pool_;
+    size_t pipelineDepth_;
+    bool pipelining_;
 
     TypedMessageQueue<HttpRequest> queue_; /* queued requests */
-
-    HttpConnection::OnDone onHttpConnectionDone_;
 };
 
 } // namespace Datacratic
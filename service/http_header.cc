@@ -4,7 +4,10 @@
 
 */
 
+#include <string.h>
+#include <strings.h>
 #include "http_header.h"
+#include "http_parsers.h"
 #include "jml/utils/parse_context.h"
 #include "jml/utils/string_functions.h"
 #include "jml/db/persistent.h"
@@ -105,6 +108,160 @@ toBinary() const
 }
 
 
+/*****************************************************************************/
+/* HTTP HEADER NAME                                                          */
+/*****************************************************************************/
+
+namespace {
+
+struct InternedName {
+    HttpHeaderName id;
+    const char * name;
+    size_t size;
+};
+
+#define INTERNED_NAME(id, name) { HttpHeaderName::id, name, sizeof(name) - 1 }
+
+/* indexed by HttpHeaderName */
+const InternedName internedNames[] = {
+    INTERNED_NAME(Other, ""),
+    INTERNED_NAME(Accept, "accept"),
+    INTERNED_NAME(AcceptEncoding, "accept-encoding"),
+    INTERNED_NAME(AcceptLanguage, "accept-language"),
+    INTERNED_NAME(Authorization, "authorization"),
+    INTERNED_NAME(CacheControl, "cache-control"),
+    INTERNED_NAME(Connection, "connection"),
+    INTERNED_NAME(ContentEncoding, "content-encoding"),
+    INTERNED_NAME(ContentLength, "content-length"),
+    INTERNED_NAME(ContentType, "content-type"),
+    INTERNED_NAME(Cookie, "cookie"),
+    INTERNED_NAME(Date, "date"),
+    INTERNED_NAME(ETag, "etag"),
+    INTERNED_NAME(Expect, "expect"),
+    INTERNED_NAME(Expires, "expires"),
+    INTERNED_NAME(Host, "host"),
+    INTERNED_NAME(KeepAlive, "keep-alive"),
+    INTERNED_NAME(LastModified, "last-modified"),
+    INTERNED_NAME(Location, "location"),
+    INTERNED_NAME(Pragma, "pragma"),
+    INTERNED_NAME(Server, "server"),
+    INTERNED_NAME(SetCookie, "set-cookie"),
+    INTERNED_NAME(TransferEncoding, "transfer-encoding"),
+    INTERNED_NAME(UserAgent, "user-agent"),
+    INTERNED_NAME(Vary, "vary"),
+    INTERNED_NAME(XForwardedFor, "x-forwarded-for")
+};
+
+#undef INTERNED_NAME
+
+const size_t numInternedNames
+    = sizeof(internedNames) / sizeof(internedNames[0]);
+
+} // file scope
+
+HttpHeaderName
+internHttpHeaderName(const char * name, size_t size)
+{
+    if (size == 0) {
+        return HttpHeaderName::Other;
+    }
+
+    /* Comparing the size and the first character first rules out most
+       candidates without calling strncasecmp. */
+    char first = name[0] | 0x20;
+    for (size_t i = 1; i < numInternedNames; i++) {
+        const InternedName & interned = internedNames[i];
+        if (interned.size == size && interned.name[0] == first
+            && ::strncasecmp(interned.name, name, size) == 0) {
+            return interned.id;
+        }
+    }
+
+    return HttpHeaderName::Other;
+}
+
+const std::string &
+httpHeaderNameString(HttpHeaderName id)
+{
+    static const std::vector<std::string> names = [] () {
+        std::vector<std::string> result;
+        for (const InternedName & interned: internedNames) {
+            result.emplace_back(interned.name, interned.size);
+        }
+        return result;
+    } ();
+
+    return names.at(size_t(id));
+}
+
+
+/*****************************************************************************/
+/* HTTP STRING VIEW                                                          */
+/*****************************************************************************/
+
+bool
+HttpStringView::
+equals(const char * str, size_t len) const
+{
+    return size == len && ::memcmp(data, str, len) == 0;
+}
+
+bool
+HttpStringView::
+equalsIgnoreCase(const char * str, size_t len) const
+{
+    return size == len && ::strncasecmp(data, str, len) == 0;
+}
+
+bool
+HttpStringView::
+startsWithIgnoreCase(const char * str, size_t len) const
+{
+    return size >= len && ::strncasecmp(data, str, len) == 0;
+}
+
+std::ostream &
+operator << (std::ostream & stream, const HttpStringView & view)
+{
+    return stream.write(view.data, view.size);
+}
+
+
+/*****************************************************************************/
+/* HTTP HEADER FIELD                                                         */
+/*****************************************************************************/
+
+bool
+parseHttpHeaderField(const char * data, size_t size, HttpHeaderField & field)
+{
+    size_t colon = httpScan(data, size, ':', ':', ':');
+    if (colon == size) {
+        return false;
+    }
+
+    size_t end = size;
+    if (end > 0 && data[end - 1] == '\n') {
+        end--;
+    }
+    if (end > 0 && data[end - 1] == '\r') {
+        end--;
+    }
+    size_t valueStart = colon + 1;
+    while (valueStart < end
+           && (data[valueStart] == ' ' || data[valueStart] == '\t')) {
+        valueStart++;
+    }
+
+    field.name = HttpStringView(data, colon);
+    field.value = HttpStringView(data + valueStart, end - valueStart);
+    field.id = (colon > 0
+                ? internHttpHeaderName(data, colon)
+                : HttpHeaderName::Other);
+
+    return true;
+}
+
+
 /*****************************************************************************/
 /* HTTP HEADER                                                               */
 /*****************************************************************************/
@@ -121,6 +278,9 @@ swap(HttpHeader & other)
     knownData.swap(other.knownData);
     std::swap(isChunked, other.isChunked);
     std::swap(version, other.version);
+    text_.swap(other.text_);
+    fields_.swap(other.fields_);
+    std::swap(materialized_, other.materialized_);
 }
 
 namespace {
@@ -179,6 +339,21 @@ expectUrlEncodedString(ML::Parse_Context & context,
 void
 HttpHeader::
 parse(const std::string & headerAndData, bool checkBodyLength)
+{
+    parseImpl(headerAndData, checkBodyLength, false);
+}
+
+void
+HttpHeader::
+parseViews(const std::string & headerAndData, bool checkBodyLength)
+{
+    parseImpl(headerAndData, checkBodyLength, true);
+}
+
+void
+HttpHeader::
+parseImpl(const std::string & headerAndData, bool checkBodyLength,
+          bool views)
 {
     try {
         HttpHeader parsed;
@@ -207,35 +382,42 @@ parse(const std::string & headerAndData, bool checkBodyLength)
         parsed.version = context.expect_text('\r');
         context.expect_eol();
 
-        while (!context.match_literal("\r\n")) {
-            string name = lowercase(context.expect_text("\r\n:"));
-            //cerr << "name = " << name << endl;
-            context.expect_literal(':');
-            context.match_whitespace();
-            if (name == "content-length") {
-                parsed.contentLength = context.expect_long_long();
-                //cerr << "******* set cntentLength " << parsed.contentLength
-                //     << endl;
-            }
-            else if (name == "content-type")
-                parsed.contentType = context.expect_text('\r');
-            else if (name == "transfer-encoding") {
-                string transferEncoding = lowercase(context.expect_text('\r'));
+        size_t bodyOffset;
+        if (views) {
+            bodyOffset = parsed.parseFieldViews(headerAndData,
+                                                context.get_offset());
+        }
+        else {
+            while (!context.match_literal("\r\n")) {
+                string name = lowercase(context.expect_text("\r\n:"));
+                //cerr << "name = " << name << endl;
+                context.expect_literal(':');
+                context.match_whitespace();
+                if (name == "content-length") {
+                    parsed.contentLength = context.expect_long_long();
+                    //cerr << "******* set cntentLength " << parsed.contentLength
+                    //     << endl;
+                }
+                else if (name == "content-type")
+                    parsed.contentType = context.expect_text('\r');
+                else if (name == "transfer-encoding") {
+                    string transferEncoding = lowercase(context.expect_text('\r'));
                 
-                if (transferEncoding != "chunked")
-                    throw ML::Exception("unknown transfer-encoding");
-                parsed.isChunked = true;
-            }
-            else {
-                string value = context.expect_text('\r');
-                parsed.headers[name] = value;
+                    if (transferEncoding != "chunked")
+                        throw ML::Exception("unknown transfer-encoding");
+                    parsed.isChunked = true;
+                }
+                else {
+                    string value = context.expect_text('\r');
+                    parsed.headers[name] = value;
+                }
+                context.expect_eol();
             }
-            context.expect_eol();
+            bodyOffset = context.get_offset();
         }
 
         // The rest of the data is the body
-        const char * content_start
-            = headerAndData.c_str() + context.get_offset();
+        const char * content_start = headerAndData.c_str() + bodyOffset;
 
         parsed.knownData
             = string(content_start,
@@ -264,6 +446,180 @@ parse(const std::string & headerAndData, bool checkBodyLength)
     }
 }
 
+/* Record the position of the header fields starting at "offset" and return
+ * the offset of the body. */
+size_t
+HttpHeader::
+parseFieldViews(const std::string & headerAndData, size_t offset)
+{
+    const char * start = headerAndData.c_str();
+    const char * end = start + headerAndData.size();
+    const char * fieldsStart = start + offset;
+    const char * ptr = fieldsStart;
+
+    while (true) {
+        if (end - ptr >= 2 && ptr[0] == '\r' && ptr[1] == '\n') {
+            ptr += 2;
+            break;
+        }
+
+        size_t lineSize = httpScan(ptr, end - ptr, '\n', '\n', '\n');
+        if (ptr + lineSize == end) {
+            throw ML::Exception("expected end of line");
+        }
+        lineSize++;
+
+        HttpHeaderField field;
+        if (!parseHttpHeaderField(ptr, lineSize, field)) {
+            throw ML::Exception("expected ':' in header line");
+        }
+
+        if (field.id == HttpHeaderName::ContentLength) {
+            /* the value is followed by the CRLF */
+            char * valueEnd;
+            contentLength = ::strtoll(field.value.data, &valueEnd, 10);
+            if (field.value.size == 0
+                || valueEnd != field.value.data + field.value.size) {
+                throw ML::Exception("invalid content-length: "
+                                    + field.value.toString());
+            }
+        }
+        else if (field.id == HttpHeaderName::ContentType) {
+            contentType = field.value.toString();
+        }
+        else if (field.id == HttpHeaderName::TransferEncoding) {
+            if (!field.value.equalsIgnoreCase("chunked", 7)) {
+                throw ML::Exception("unknown transfer-encoding");
+            }
+            isChunked = true;
+        }
+        else {
+            FieldRef ref;
+            ref.id = field.id;
+            ref.nameStart = field.name.data - fieldsStart;
+            ref.nameSize = field.name.size;
+            ref.valueStart = field.value.data - fieldsStart;
+            ref.valueSize = field.value.size;
+            fields_.push_back(ref);
+        }
+
+        ptr += lineSize;
+    }
+
+    text_.assign(fieldsStart, ptr - fieldsStart);
+
+    return ptr - start;
+}
+
+HttpHeaderField
+HttpHeader::
+getField(size_t index) const
+{
+    const FieldRef & ref = fields_.at(index);
+    const char * text = text_.c_str();
+
+    HttpHeaderField field;
+    field.id = ref.id;
+    field.name = HttpStringView(text + ref.nameStart, ref.nameSize);
+    field.value = HttpStringView(text + ref.valueStart, ref.valueSize);
+
+    return field;
+}
+
+HttpStringView
+HttpHeader::
+field(HttpHeaderName id) const
+{
+    if (id == HttpHeaderName::Other) {
+        throw ML::Exception("the name of the field must be given");
+    }
+    for (const FieldRef & ref: fields_) {
+        if (ref.id == id) {
+            return HttpStringView(text_.c_str() + ref.valueStart,
+                                  ref.valueSize);
+        }
+    }
+
+    return HttpStringView();
+}
+
+HttpStringView
+HttpHeader::
+field(const std::string & name) const
+{
+    HttpStringView value;
+    findField(name.c_str(), name.size(), value);
+    return value;
+}
+
+bool
+HttpHeader::
+findField(const char * name, size_t size, HttpStringView & value) const
+{
+    HttpHeaderName id = internHttpHeaderName(name, size);
+    const char * text = text_.c_str();
+    for (const FieldRef & ref: fields_) {
+        if (ref.id == id
+            && (id != HttpHeaderName::Other
+                || (ref.nameSize == size
+                    && ::strncasecmp(text + ref.nameStart, name, size) == 0))) {
+            value = HttpStringView(text + ref.valueStart, ref.valueSize);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+const std::map<std::string, std::string> &
+HttpHeader::
+materializeHeaders()
+{
+    if (!materialized_) {
+        for (size_t i = 0; i < fields_.size(); i++) {
+            HttpHeaderField field = getField(i);
+            headers[lowercase(field.name.toString())] = field.value.toString();
+        }
+        materialized_ = true;
+    }
+
+    return headers;
+}
+
+std::string
+HttpHeader::
+getHeader(const std::string & key) const
+{
+    auto it = headers.find(key);
+    if (it != headers.end()) {
+        return it->second;
+    }
+
+    HttpStringView value;
+    if (!materialized_ && findField(key.c_str(), key.size(), value)) {
+        return value.toString();
+    }
+
+    throw ML::Exception("couldn't find header " + key);
+}
+
+std::string
+HttpHeader::
+tryGetHeader(const std::string & key) const
+{
+    auto it = headers.find(key);
+    if (it != headers.end()) {
+        return it->second;
+    }
+
+    HttpStringView value;
+    if (!materialized_ && findField(key.c_str(), key.size(), value)) {
+        return value.toString();
+    }
+
+    return "";
+}
+
 int HttpHeader::responseCode() const
 {
     return boost::lexical_cast<int>(resource);
@@ -283,6 +639,13 @@ std::ostream & operator << (std::ostream & stream, const HttpHeader & header)
          it != end;  ++it) {
         stream << it->first << ": " << it->second << "\r\n";
     }
+    // Fields from "parseViews" that were not materialized
+    for (size_t i = 0;  header.headers.empty() && i < header.numFields();
+         ++i) {
+        HttpHeaderField field = header.getField(i);
+        stream << lowercase(field.name.toString()) << ": "
+               << field.value.toString() << "\r\n";
+    }
     stream << "\r\n";
     return stream;
 }
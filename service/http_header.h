@@ -7,6 +7,7 @@
 
 #pragma once
 
+#include <stdint.h>
 #include <string>
 #include <map>
 #include <iostream>
@@ -16,6 +17,114 @@
 
 namespace Datacratic {
 
+/*****************************************************************************/
+/* HTTP HEADER NAME                                                          */
+/*****************************************************************************/
+
+/** Interned identifiers of the most common header names, which enables
+    recognizing them without allocating or comparing strings.
+*/
+
+enum class HttpHeaderName : uint8_t {
+    Other,
+    Accept,
+    AcceptEncoding,
+    AcceptLanguage,
+    Authorization,
+    CacheControl,
+    Connection,
+    ContentEncoding,
+    ContentLength,
+    ContentType,
+    Cookie,
+    Date,
+    ETag,
+    Expect,
+    Expires,
+    Host,
+    KeepAlive,
+    LastModified,
+    Location,
+    Pragma,
+    Server,
+    SetCookie,
+    TransferEncoding,
+    UserAgent,
+    Vary,
+    XForwardedFor
+};
+
+/** Returns the identifier of the given header name, compared without regard
+    to case, or HttpHeaderName::Other if it is not interned. */
+HttpHeaderName internHttpHeaderName(const char * name, size_t size);
+
+/** Returns the lowercase name of an interned header. */
+const std::string & httpHeaderNameString(HttpHeaderName id);
+
+
+/*****************************************************************************/
+/* HTTP STRING VIEW                                                          */
+/*****************************************************************************/
+
+/** Non-owning reference to a range of characters, usually within a receive
+    buffer. It is only valid as long as the referenced buffer.
+*/
+
+struct HttpStringView {
+    HttpStringView()
+        : data(nullptr), size(0)
+    {
+    }
+
+    HttpStringView(const char * data, size_t size)
+        : data(data), size(size)
+    {
+    }
+
+    bool empty() const
+    {
+        return size == 0;
+    }
+
+    std::string toString() const
+    {
+        return std::string(data, size);
+    }
+
+    bool equals(const char * str, size_t len) const;
+    bool equalsIgnoreCase(const char * str, size_t len) const;
+    bool startsWithIgnoreCase(const char * str, size_t len) const;
+
+    const char * data;
+    size_t size;
+};
+
+std::ostream & operator << (std::ostream & stream, const HttpStringView & view);
+
+
+/*****************************************************************************/
+/* HTTP HEADER FIELD                                                         */
+/*****************************************************************************/
+
+/** A "name: value" header line split into views. */
+
+struct HttpHeaderField {
+    HttpHeaderField()
+        : id(HttpHeaderName::Other)
+    {
+    }
+
+    HttpHeaderName id;
+    HttpStringView name;
+    HttpStringView value;  // without the leading whitespace and the CRLF
+};
+
+/** Split the header line at "data", with or without its trailing CRLF, into
+    "field". Returns false if the line does not contain a colon. */
+bool parseHttpHeaderField(const char * data, size_t size,
+                          HttpHeaderField & field);
+
+
 /*****************************************************************************/
 /* REST PARAMS                                                               */
 /*****************************************************************************/
@@ -53,7 +162,7 @@ struct RestParams
 
 struct HttpHeader {
     HttpHeader()
-        : contentLength(-1), isChunked(false)
+        : contentLength(-1), isChunked(false), materialized_(false)
     {
     }
 
@@ -61,6 +170,17 @@ struct HttpHeader {
 
     void parse(const std::string & headerAndData, bool checkBodyLength = true);
 
+    /** Parse the header like "parse", but instead of filling "headers", only
+        record the position of the fields within a private copy of the header
+        text. This replaces the allocations performed for each field by a
+        single one. "getHeader", "tryGetHeader" and "field" work directly
+        from the text, while "headers" stays empty until "materializeHeaders"
+        is called. Headers that are handed to code reading "headers" must
+        therefore be materialized first, or parsed with "parse".
+    */
+    void parseViews(const std::string & headerAndData,
+                    bool checkBodyLength = true);
+
     std::string verb;       // GET, PUT, etc
     std::string resource;   // after the get
     std::string version;    // after the get
@@ -74,27 +194,54 @@ struct HttpHeader {
     int64_t contentLength;
     bool isChunked;
 
-    // The rest of the headers are here
+    // The rest of the headers are here, keyed by their lowercase name. With
+    // "parseViews", only filled by "materializeHeaders".
     std::map<std::string, std::string> headers;
 
-    std::string getHeader(const std::string & key) const
-    {
-        auto it = headers.find(key);
-        if (it == headers.end())
-            throw ML::Exception("couldn't find header " + key);
-        return it->second;
-    }
+    std::string getHeader(const std::string & key) const;
+    std::string tryGetHeader(const std::string & key) const;
 
-    std::string tryGetHeader(const std::string & key) const
+    /** Fields recorded by "parseViews". The views refer to this object and
+        are invalidated by its modification or destruction. */
+    size_t numFields() const
     {
-        auto it = headers.find(key);
-        if (it == headers.end())
-            return "";
-        return it->second;
+        return fields_.size();
     }
 
+    HttpHeaderField getField(size_t index) const;
+
+    /** Value of the first field recorded by "parseViews" with the given name,
+        which is compared without regard to case, or an empty view. */
+    HttpStringView field(HttpHeaderName id) const;
+    HttpStringView field(const std::string & name) const;
+
+    /** Fill "headers" with the fields recorded by "parseViews", unless
+        already done. This modifies the header, so it must not be called
+        while other threads read it. */
+    const std::map<std::string, std::string> & materializeHeaders();
+
     // If some portion of the data is known, it's put in here
     std::string knownData;
+
+private:
+    void parseImpl(const std::string & headerAndData, bool checkBodyLength,
+                   bool views);
+    size_t parseFieldViews(const std::string & headerAndData, size_t offset);
+    bool findField(const char * name, size_t size,
+                   HttpStringView & value) const;
+
+    /* position of a field in "text_" */
+    struct FieldRef {
+        HttpHeaderName id;
+        uint32_t nameStart;
+        uint32_t nameSize;
+        uint32_t valueStart;
+        uint32_t valueSize;
+    };
+
+    std::string text_;
+    std::vector<FieldRef> fields_;
+    bool materialized_;
 };
 
 std::ostream & operator << (std::ostream & stream, const HttpHeader & header);
@@ -5,7 +5,11 @@
 */
 
 #include <string.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
+#include <atomic>
 #include <iostream>
 #include "jml/arch/exception.h"
 #include "jml/utils/string_functions.h"
@@ -16,6 +20,197 @@ using namespace std;
 using namespace Datacratic;
 
 
+/****************************************************************************/
+/* HTTP SCANNER                                                             */
+/****************************************************************************/
+
+namespace {
+
+typedef size_t (*ScanFn)(const char * data, size_t size,
+                         char c1, char c2, char c3);
+
+size_t
+scanScalar(const char * data, size_t size, char c1, char c2, char c3)
+{
+    for (size_t i = 0; i < size; i++) {
+        char c = data[i];
+        if (c == c1 || c == c2 || c == c3) {
+            return i;
+        }
+    }
+
+    return size;
+}
+
+#if defined(__x86_64__)
+
+/* The SIMD variants are compiled for their target instruction set via
+   function attributes, so that the library itself does not require it. The
+   tail of the input is processed by the scalar code, since reading past it
+   could cross into an unmapped page. */
+
+__attribute__((target("sse4.2")))
+size_t
+scanSse42(const char * data, size_t size, char c1, char c2, char c3)
+{
+    const __m128i set = _mm_setr_epi8(c1, c2, c3, 0, 0, 0, 0, 0,
+                                      0, 0, 0, 0, 0, 0, 0, 0);
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *) (data + i));
+        int idx = _mm_cmpestri(set, 3, block, 16,
+                               _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY
+                               | _SIDD_LEAST_SIGNIFICANT);
+        if (idx < 16) {
+            return i + idx;
+        }
+    }
+
+    return i + scanScalar(data + i, size - i, c1, c2, c3);
+}
+
+__attribute__((target("avx2")))
+size_t
+scanAvx2(const char * data, size_t size, char c1, char c2, char c3)
+{
+    const __m256i v1 = _mm256_set1_epi8(c1);
+    const __m256i v2 = _mm256_set1_epi8(c2);
+    const __m256i v3 = _mm256_set1_epi8(c3);
+
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i *) (data + i));
+        __m256i matches
+            = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(block, v1),
+                                              _mm256_cmpeq_epi8(block, v2)),
+                              _mm256_cmpeq_epi8(block, v3));
+        uint32_t mask = _mm256_movemask_epi8(matches);
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+
+    if (i + 16 <= size) {
+        const __m128i w1 = _mm_set1_epi8(c1);
+        const __m128i w2 = _mm_set1_epi8(c2);
+        const __m128i w3 = _mm_set1_epi8(c3);
+        __m128i block = _mm_loadu_si128((const __m128i *) (data + i));
+        __m128i matches
+            = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, w1),
+                                        _mm_cmpeq_epi8(block, w2)),
+                           _mm_cmpeq_epi8(block, w3));
+        uint32_t mask = _mm_movemask_epi8(matches);
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+        i += 16;
+    }
+
+    return i + scanScalar(data + i, size - i, c1, c2, c3);
+}
+
+bool
+isSupported(HttpScanner scanner)
+{
+    /* may run during static initialization, before the cpu model used by
+       __builtin_cpu_supports is set up */
+    __builtin_cpu_init();
+
+    switch (scanner) {
+    case HttpScanner::Scalar:
+        return true;
+    case HttpScanner::Sse42:
+        return __builtin_cpu_supports("sse4.2");
+    case HttpScanner::Avx2:
+        return __builtin_cpu_supports("avx2");
+    }
+
+    return false;
+}
+
+ScanFn
+scanFunction(HttpScanner scanner)
+{
+    switch (scanner) {
+    case HttpScanner::Sse42:
+        return scanSse42;
+    case HttpScanner::Avx2:
+        return scanAvx2;
+    default:
+        return scanScalar;
+    }
+}
+
+#else /* __x86_64__ */
+
+bool
+isSupported(HttpScanner scanner)
+{
+    return (scanner == HttpScanner::Scalar);
+}
+
+ScanFn
+scanFunction(HttpScanner scanner)
+{
+    return scanScalar;
+}
+
+#endif /* __x86_64__ */
+
+HttpScanner
+bestScanner()
+{
+    if (isSupported(HttpScanner::Avx2)) {
+        return HttpScanner::Avx2;
+    }
+    if (isSupported(HttpScanner::Sse42)) {
+        return HttpScanner::Sse42;
+    }
+    return HttpScanner::Scalar;
+}
+
+/* changed by setHttpScanner while parsers may be running */
+std::atomic<HttpScanner> currentScanner(bestScanner());
+std::atomic<ScanFn> currentScanFn(scanFunction(currentScanner));
+
+ScanFn
+scanFn()
+{
+    return currentScanFn.load(std::memory_order_relaxed);
+}
+
+} // file scope
+
+
+namespace Datacratic {
+
+HttpScanner
+httpScanner()
+{
+    return currentScanner;
+}
+
+bool
+setHttpScanner(HttpScanner scanner)
+{
+    if (!isSupported(scanner)) {
+        return false;
+    }
+    currentScanFn = scanFunction(scanner);
+    currentScanner = scanner;
+
+    return true;
+}
+
+size_t
+httpScan(const char * data, size_t size, char c1, char c2, char c3)
+{
+    return scanFn()(data, size, c1, c2, c3);
+}
+
+} // namespace Datacratic
+
+
 /****************************************************************************/
 /* HTTP PARSER                                                              */
 /****************************************************************************/
@@ -25,7 +220,6 @@ HttpParser::
 clear()
     noexcept
 {
-    expectBody_ = true;
     stage_ = 0;
     buffer_.clear();
     remainingBody_ = 0;
@@ -122,18 +316,23 @@ HttpParser::
 BufferState::
 skipToChar(char c, bool throwOnEol)
 {
-    while (ptr < dataSize) {
-        if (data[ptr] == c) {
-            return true;
-        }
-        else if (throwOnEol
-                 && (data[ptr] == '\r' || data[ptr] == '\n')) {
-            throw ML::Exception("unexpected end of line");
-        }
-        ptr++;
+    if (ptr >= dataSize) {
+        return false;
     }
 
-    return false;
+    const char * start = data + ptr;
+    size_t size = dataSize - ptr;
+    ptr += (throwOnEol
+            ? scanFn()(start, size, c, '\r', '\n')
+            : scanFn()(start, size, c, c, c));
+    if (ptr == dataSize) {
+        return false;
+    }
+    if (data[ptr] != c) {
+        throw ML::Exception("unexpected end of line");
+    }
+
+    return true;
 }
 
 bool
@@ -205,59 +404,33 @@ void
 HttpParser::
 handleHeader(const char * data, size_t dataSize)
 {
-    size_t ptr(0);
-
-    auto skipToChar = [&] (char c) {
-        while (ptr < dataSize) {
-            if (data[ptr] == c)
-                return true;
-            ptr++;
-        }
+    HttpHeaderField field;
+    if (!parseHttpHeaderField(data, dataSize, field)) {
+        throw ML::Exception("expected ':' in header line");
+    }
 
-        return false;
-    };
-    auto skipChar = [&] (char c) {
-        while (ptr < dataSize && data[ptr] == c) {
-            ptr++;
-        }
-    };
-    auto matchString = [&] (const char * testString, size_t len) {
-        bool result;
-        if (dataSize >= (ptr + len)
-            && ::strncasecmp(data + ptr, testString, len) == 0) {
-            ptr += len;
-            result = true;
-        }
-        else {
-            result = false;
-        }
-        return result;
-    };
-
-    auto skipToValue = [&] () {
-        skipChar(' ');
-        skipToChar(':');
-        ptr++;
-        skipChar(' ');
-    };
-
-    if (matchString("Connection", 10)) {
-        skipToValue();
-        if (matchString("close", 5)) {
+    switch (field.id) {
+    case HttpHeaderName::Connection:
+        if (field.value.startsWithIgnoreCase("close", 5)) {
             requireClose_ = true;
         }
-    }
-    else if (matchString("Content-Length", 14)) {
-        skipToValue();
-        remainingBody_ = ML::antoi(data + ptr, data + dataSize - 2);
-    }
-    else if (matchString("Transfer-Encoding", 15)) {
-        skipToValue();
-        if (matchString("chunked", 7)) {
+        break;
+    case HttpHeaderName::ContentLength:
+        remainingBody_ = ML::antoi(field.value.data,
+                                   field.value.data + field.value.size);
+        break;
+    case HttpHeaderName::TransferEncoding:
+        if (field.value.startsWithIgnoreCase("chunked", 7)) {
             useChunkedEncoding_ = true;
         }
+        break;
+    default:
+        break;
     }
 
+    if (onField) {
+        onField(field);
+    }
     if (onHeader) {
         onHeader(data, dataSize);
     }
@@ -292,12 +465,8 @@ parseChunkedBody(BufferState & state)
         const char * sizeEnd = state.data + state.ptr;
 
         /* look for ';' and adjust sizeEnd in consequence */
-        for (const char * ptr = sizeStart; ptr < sizeEnd; ptr++) {
-            if (*ptr == ';') {
-                sizeEnd = ptr;
-                break;
-            }
-        }
+        sizeEnd = sizeStart + scanFn()(sizeStart, sizeEnd - sizeStart,
+                                       ';', ';', ';');
 
         chunkSize = ML::antoi(sizeStart, sizeEnd, 16);
 
@@ -426,6 +595,9 @@ parseFirstLine(BufferState & state)
     size_t urlEnd = state.ptr;
     state.ptr++;
 
+    if (state.remaining() < 5) {
+        return false;
+    }
     if (::memcmp(state.currentDataPtr(), "HTTP/", 5) != 0) {
         throw ML::Exception("version must start with 'HTTP/'");
     }
@@ -13,9 +13,36 @@
 #include <functional>
 #include <string>
 
+#include "soa/service/http_header.h"
+
 
 namespace Datacratic {
 
+/****************************************************************************/
+/* HTTP SCANNER                                                             */
+/****************************************************************************/
+
+/* Implementation used by the parsers to search their input for delimiters.
+   The fastest one supported by the CPU is selected at startup. */
+
+enum class HttpScanner {
+    Scalar,
+    Sse42,
+    Avx2
+};
+
+HttpScanner httpScanner();
+
+/* Select the scanner to use, for example for benchmarking. Returns "false"
+   and leaves the current scanner unchanged when "scanner" is not supported
+   by the CPU. */
+bool setHttpScanner(HttpScanner scanner);
+
+/* Returns the offset of the first occurrence of "c1", "c2" or "c3" in the
+   "size" bytes at "data", or "size" if none is found. */
+size_t httpScan(const char * data, size_t size, char c1, char c2, char c3);
+
+
 /****************************************************************************/
 /* HTTP PARSER                                                              */
 /****************************************************************************/
@@ -25,6 +52,12 @@ struct HttpParser {
      * header key and the value. */
     typedef std::function<void (const char *, size_t)> OnHeader;
 
+    /* Type of callback used to report a header line split into views of its
+     * name and value, as an alternative to OnHeader that does not require
+     * the caller to parse the line again. The views are only valid during
+     * the invocation. */
+    typedef std::function<void (const HttpHeaderField &)> OnField;
+
     /* Type of callback used when to report a chunk of the response body. Only
        invoked when the body is larger than 0 byte. */
     typedef std::function<void (const char *, size_t)> OnData;
@@ -69,6 +102,7 @@ struct HttpParser {
 
     HttpParser()
         noexcept
+        : expectBody_(true)
     {
         clear();
     }
@@ -105,9 +139,14 @@ struct HttpParser {
     }
 
     OnHeader onHeader;
+    OnField onField;
     OnData onData;
     OnDone onDone;
 
+protected:
+    /* whether the message being parsed, or the next one, has a body */
+    bool expectBody_;
+
 private:
     void clear() noexcept;
 
@@ -120,8 +159,6 @@ private:
     void handleHeader(const char * data, size_t dataSize);
     void finalizeParsing();
 
-    bool expectBody_;
-
     int stage_;
     std::string buffer_;
 
@@ -146,7 +183,8 @@ struct HttpResponseParser : public HttpParser {
     typedef std::function<void (const std::string &, int)> OnResponseStart;
 
     /* Indicates whether to expect a body during the parsing of the next
-       response. */
+       response. The setting remains in effect for the following responses
+       until changed. */
     void setExpectBody(bool expBody)
     { expectBody_ = expBody; }
 
@@ -156,8 +194,6 @@ struct HttpResponseParser : public HttpParser {
 
 private:
     bool parseStatusLine(BufferState & state);
-
-    bool expectBody_;
 };
 
 
@@ -182,8 +218,6 @@ struct HttpRequestParser : public HttpParser {
 
 private:
     bool parseRequestLine(BufferState & state);
-
-    bool expectBody_;
 };
 
 } // namespace Datacratic
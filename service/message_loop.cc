@@ -33,16 +33,113 @@ Logging::Category MessageLoopLogs::trace("Message Loop Trace", print);
 
 typedef MessageLoopLogs Logs;
 
+namespace {
+
+/* Number of closures pending on a reactor above which a sleeping reactor is
+   woken up to steal some of them. */
+constexpr size_t StealThreshold = 4;
+
+/* Maximum number of closures stolen at once. */
+constexpr size_t MaxStolenClosures = 64;
+
+} // file scope
+
+
+/*****************************************************************************/
+/* REACTOR STATE                                                             */
+/*****************************************************************************/
+
+/* State of a reactor loop in a multi-reactor MessageLoop. */
+
+struct MessageLoop::ReactorState {
+    /* Source woken up when an idle reactor should steal work from its
+       siblings. */
+    struct StealSignal : public AsyncEventSource {
+        StealSignal(MessageLoop * loop)
+            : loop(loop), wakeup(EFD_NONBLOCK | EFD_CLOEXEC)
+        {
+        }
+
+        virtual int selectFd() const
+        {
+            return wakeup.fd();
+        }
+
+        virtual bool processOne()
+        {
+            while (wakeup.tryRead());
+            while (loop->stealWork());
+            return false;
+        }
+
+        MessageLoop * loop;
+        ML::Wakeup_Fd wakeup;
+    };
+
+    ReactorState(MessageLoop * loop, MessageLoop * owner, int index)
+        : owner(owner), index(index),
+          runQueue([=] () { this->runClosures(); }),
+          numQueued(0), stealSignal(loop), sleeping(false), numStolen(0)
+    {
+    }
+
+    bool queueClosure(std::function<void ()> && closure)
+    {
+        /* counted first, so that the count never goes below zero */
+        numQueued.fetch_add(1, std::memory_order_relaxed);
+        if (!runQueue.push_back(std::move(closure))) {
+            numQueued.fetch_sub(1, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    std::vector<std::function<void ()> > takeClosures(size_t number)
+    {
+        auto closures = runQueue.pop_front(number);
+        numQueued.fetch_sub(closures.size(), std::memory_order_relaxed);
+        return closures;
+    }
+
+    void runClosures()
+    {
+        auto closures = takeClosures(0);
+        for (auto & closure: closures) {
+            closure();
+        }
+    }
+
+    /* Multi-reactor loop owning this reactor */
+    MessageLoop * owner;
+    int index;
+
+    /* Closures queued via the owner's runInMessageLoopThread */
+    TypedMessageQueue<std::function<void ()> > runQueue;
+
+    /* Approximate number of closures in runQueue, which siblings read
+       without taking its lock */
+    std::atomic<size_t> numQueued;
+
+    StealSignal stealSignal;
+
+    /* Whether the reactor is waiting for events */
+    std::atomic<bool> sleeping;
+
+    /* Number of closures stolen from siblings */
+    std::atomic<uint64_t> numStolen;
+};
+
+
 /*****************************************************************************/
 /* MESSAGE LOOP                                                              */
 /*****************************************************************************/
 
 MessageLoop::
 MessageLoop(int numThreads, double maxAddedLatency, int epollTimeout)
-    : sourceActions_([&] () { handleSourceActions(); }),
-      numThreadsCreated(0),
+    : numThreadsCreated(0),
       shutdown_(true),
-      totalSleepTime_(0.0)
+      totalSleepTime_(0.0),
+      nextReactor_(0)
 {
     init(numThreads, maxAddedLatency, epollTimeout);
 }
@@ -63,11 +160,29 @@ init(int numThreads, double maxAddedLatency, int epollTimeout)
             << "MessageLoop with maxAddedLatency of zero and "
             << "epollTeimout != -1 will busy wait" << endl;
     
-    // See the comments on processOne below for more details on this assertion.
-    ExcAssertEqual(numThreads, 1);
+    /* A single loop is only ever run by one thread. See the comments on
+       processOne below for more details. Multiple threads are supported by
+       having one single-threaded reactor loop per thread. */
+    ExcAssertGreaterEqual(numThreads, 1);
 
-    Epoller::init(16384, epollTimeout);
     maxAddedLatency_ = maxAddedLatency;
+    debug_ = false;
+
+    reactors_.clear();
+    if (numThreads > 1) {
+        /* Only the reactors handle events and source actions; this loop
+           merely dispatches to them. */
+        Epoller::close();
+        sourceActions_.reset();
+        for (int i = 0; i < numThreads; i++) {
+            reactors_.emplace_back(new MessageLoop(1, maxAddedLatency,
+                                                   epollTimeout));
+            reactors_.back()->initReactor(this, i);
+        }
+        return;
+    }
+
+    Epoller::init(16384, epollTimeout);
     handleEvent = std::bind(&MessageLoop::handleEpollEvent,
                             this,
                             std::placeholders::_1);
@@ -77,9 +192,18 @@ init(int numThreads, double maxAddedLatency, int epollTimeout)
 
        Adding a special source named "_shutdown" triggers shutdown-related
        events, without requiring the use of an additional signal fd. */
-    addFd(sourceActions_.selectFd(), &sourceActions_);
+    sourceActions_.reset(new TypedMessageQueue<SourceAction>
+                         ([&] () { handleSourceActions(); }));
+    addFd(sourceActions_->selectFd(), sourceActions_.get());
+}
 
-    debug_ = false;
+void
+MessageLoop::
+initReactor(MessageLoop * owner, int index)
+{
+    reactor_.reset(new ReactorState(this, owner, index));
+    addFd(reactor_->runQueue.selectFd(), &reactor_->runQueue);
+    addFd(reactor_->stealSignal.selectFd(), &reactor_->stealSignal);
 }
 
 void
@@ -91,6 +215,21 @@ start(const OnStop & onStop)
 
     shutdown_ = false;
 
+    if (!reactors_.empty()) {
+        /* "onStop" is invoked once, when the last reactor has stopped */
+        auto running = make_shared<atomic<int> >(reactors_.size());
+        auto onReactorStop = [=] () {
+            if (--*running == 0 && onStop) {
+                onStop();
+            }
+        };
+        for (auto & reactor: reactors_) {
+            reactor->start(onReactorStop);
+        }
+        ++numThreadsCreated;
+        return;
+    }
+
     //cerr << "starting thread from " << this << endl;
     //ML::backtrace();
 
@@ -114,6 +253,15 @@ startSync()
     ++numThreadsCreated;
 
     shutdown_ = false;
+
+    if (!reactors_.empty()) {
+        for (size_t i = 1; i < reactors_.size(); i++) {
+            reactors_[i]->start();
+        }
+        reactors_[0]->startSync();
+        return;
+    }
+
     runWorkerThread();
 }
     
@@ -126,11 +274,17 @@ shutdown()
 
     shutdown_ = true;
 
+    for (auto & reactor: reactors_) {
+        reactor->shutdown();
+    }
+
     // We could be asleep (in which case we sleep on the shutdown_ futex and
     // will be woken by the futex_wake) or blocked in epoll (in which case
     // we will get the addSource event to wake us up).
     ML::futex_wake(shutdown_);
-    addSource("_shutdown", nullptr);
+    if (reactors_.empty()) {
+        addSource("_shutdown", nullptr);
+    }
 
     for (auto & t: threads)
         t.join();
@@ -153,6 +307,10 @@ addSource(const std::string & name,
           const std::shared_ptr<AsyncEventSource> & source,
           int priority)
 {
+    if (!reactors_.empty() && name != "_shutdown") {
+        return addSourceOnReactor(name, source, -1, priority);
+    }
+
     if (name != "_shutdown") {
         ExcCheck(!source->parent_, "source already has a parent: " + name);
         source->parent_ = this;
@@ -168,7 +326,49 @@ addSource(const std::string & name,
     SourceEntry entry(name, source, priority);
     SourceAction newAction(SourceAction::ADD, move(entry));
 
-    return sourceActions_.push_back(move(newAction));
+    return sourceActions_->push_back(move(newAction));
+}
+
+bool
+MessageLoop::
+addSourceOnReactor(const std::string & name,
+                   const std::shared_ptr<AsyncEventSource> & source,
+                   int reactor, int priority)
+{
+    if (reactors_.empty()) {
+        return addSource(name, source, priority);
+    }
+
+    if (reactor == -1) {
+        reactor = reactorForSource(source.get());
+    }
+    ExcCheck(reactor >= 0 && size_t(reactor) < reactors_.size(),
+             "invalid reactor index: " + to_string(reactor));
+
+    return reactors_[reactor]->addSource(name, source, priority);
+}
+
+int
+MessageLoop::
+reactorIndex()
+    const
+{
+    return reactor_ ? reactor_->index : -1;
+}
+
+int
+MessageLoop::
+reactorForSource(const AsyncEventSource * source)
+    const
+{
+    /* Sources are aligned in memory, so the address bits are mixed before
+       taking the modulo. */
+    uint64_t key = reinterpret_cast<uintptr_t>(source);
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+
+    return key % reactors_.size();
 }
 
 bool
@@ -191,9 +391,19 @@ removeSource(AsyncEventSource * source)
     // we just make it a nop.
     if (shutdown_) return true;
 
+    /* In multi-reactor mode, the parent of the source is the reactor it was
+       pinned to. */
+    if (!reactors_.empty()) {
+        MessageLoop * reactor = source->parent_;
+        if (!reactor || reactor == this) {
+            return false;
+        }
+        return reactor->removeSource(source);
+    }
+
     SourceEntry entry("", ML::make_unowned_std_sp(*source), 0);
     SourceAction newAction(SourceAction::REMOVE, move(entry));
-    return sourceActions_.push_back(move(newAction));
+    return sourceActions_->push_back(move(newAction));
 }
 
 bool
@@ -214,9 +424,22 @@ bool
 MessageLoop::
 runInMessageLoopThread(std::function<void ()> toRun)
 {
+    if (!reactors_.empty()) {
+        unsigned index = nextReactor_++ % reactors_.size();
+        ReactorState & target = *reactors_[index]->reactor_;
+        if (!target.queueClosure(move(toRun))) {
+            return false;
+        }
+        if (target.numQueued.load(std::memory_order_relaxed)
+            > StealThreshold) {
+            wakeupIdleReactor(index);
+        }
+        return true;
+    }
+
     SourceEntry entry("", toRun, 0);
     SourceAction newAction(SourceAction::RUN, move(entry));
-    return sourceActions_.push_back(move(newAction));
+    return sourceActions_->push_back(move(newAction));
 }
 
 void
@@ -226,6 +449,61 @@ wakeupMainThread()
     ML::futex_wake(shutdown_);
 }
 
+void
+MessageLoop::
+wakeupIdleReactor(unsigned busyReactor)
+{
+    for (unsigned i = 1; i < reactors_.size(); i++) {
+        unsigned index = (busyReactor + i) % reactors_.size();
+        ReactorState & reactor = *reactors_[index]->reactor_;
+        if (reactor.sleeping) {
+            reactor.stealSignal.wakeup.signal();
+            return;
+        }
+    }
+}
+
+/* Run, on the current reactor, some of the closures pending on the most
+   loaded sibling reactor. Returns whether any closure was stolen. Only
+   reads the approximate queue sizes, without locking, and does nothing
+   while the current reactor has closures of its own. */
+bool
+MessageLoop::
+stealWork()
+{
+    if (!reactor_ || shutdown_
+        || reactor_->numQueued.load(std::memory_order_relaxed) > 0) {
+        return false;
+    }
+
+    MessageLoop * victim(nullptr);
+    size_t victimLoad(0);
+    for (auto & sibling: reactor_->owner->reactors_) {
+        if (sibling.get() == this) {
+            continue;
+        }
+        size_t load
+            = sibling->reactor_->numQueued.load(std::memory_order_relaxed);
+        if (load > victimLoad) {
+            victim = sibling.get();
+            victimLoad = load;
+        }
+    }
+    if (!victim) {
+        return false;
+    }
+
+    /* "0" has a special meaning for pop_front and must be avoided here */
+    size_t toSteal = std::min((victimLoad + 1) / 2, MaxStolenClosures);
+    auto closures = victim->reactor_->takeClosures(toSteal);
+    for (auto & closure: closures) {
+        closure();
+    }
+    reactor_->numStolen += closures.size();
+
+    return !closures.empty();
+}
+
 void
 MessageLoop::
 startSubordinateThread(const SubordinateThreadFn & thread)
@@ -261,10 +539,12 @@ runWorkerThread()
                 {
                     duty.notifyBeforeSleep();
                     beforeSleepTime = Date::now();
+                    if (reactor_) reactor_->sleeping = true;
                 };
 
             auto afterSleep = [&] ()
                 {
+                    if (reactor_) reactor_->sleeping = false;
                     double delta  = Date::now().secondsSince(beforeSleepTime);
                     totalSleepTime_ += delta;
                     duty.notifyAfterSleep();
@@ -300,6 +580,11 @@ runWorkerThread()
             if (shutdown_)
                 return;
 
+        // Help our sibling reactors once we have nothing left to do
+        while (stealWork())
+            if (shutdown_)
+                return;
+
         // At this point, we've done as much work as we can (there is no more
         // work to do).  We will now sleep for the maximum allowable delay
         // time minus the time we spent working.  This allows us to batch up
@@ -373,7 +658,7 @@ void
 MessageLoop::
 handleSourceActions()
 {
-    vector<SourceAction> actions = sourceActions_.pop_front(0);
+    vector<SourceAction> actions = sourceActions_->pop_front(0);
     for (auto & action: actions) {
         if (action.action_ == SourceAction::ADD) {
             processAddSource(action.entry_);
@@ -509,7 +794,7 @@ processOne()
     // NOTE: this is required for some buggy sources that don't have a reliable FD to
     // sleep on.  It shouldn't be substantially less efficient.
     if (needsPoll || true) {
-        more = sourceActions_.processOne();
+        more = sourceActions_ && sourceActions_->processOne();
 
         for (unsigned i = 0;  i < sources.size();  ++i) {
             try {
@@ -534,6 +819,39 @@ MessageLoop::
 debug(bool debugOn)
 {
     debug_ = debugOn;
+    for (auto & reactor: reactors_) {
+        reactor->debug(debugOn);
+    }
+}
+
+double
+MessageLoop::
+totalSleepSeconds()
+    const
+{
+    if (reactors_.empty()) {
+        return totalSleepTime_;
+    }
+
+    double total(0.0);
+    for (auto & reactor: reactors_) {
+        total += reactor->totalSleepSeconds();
+    }
+
+    return total / reactors_.size();
+}
+
+uint64_t
+MessageLoop::
+numStolenClosures()
+    const
+{
+    uint64_t total(0);
+    for (auto & reactor: reactors_) {
+        total += reactor->reactor_->numStolen;
+    }
+
+    return total;
 }
 
 void
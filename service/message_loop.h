@@ -7,6 +7,8 @@
 
 #pragma once
 
+#include <atomic>
+#include <memory>
 #include <thread>
 #include <functional>
 
@@ -43,6 +45,17 @@ struct MessageLoop : public Epoller {
                 int epollTimeout = 0);
     ~MessageLoop();
 
+    /** Initialize the loop.
+
+        When "numThreads" is greater than 1, the loop runs in multi-reactor
+        mode: it owns "numThreads" reactor threads, each with its own epoll
+        set. Sources are pinned to one reactor, either explicitly via
+        addSourceOnReactor or by hashing the source address. Closures passed
+        to runInMessageLoopThread are distributed among the reactors and can
+        be stolen by idle reactors, and thus must not depend on running on a
+        specific thread or in a specific order. A multi-reactor loop cannot
+        itself be added as a source to another loop.
+    */
     void init(int numThreads = 1, double maxAddedLatency = 0.0005,
               int epollTimeout = 0);
 
@@ -76,6 +89,29 @@ struct MessageLoop : public Epoller {
                    const std::shared_ptr<AsyncEventSource> & source,
                    int priority = 0);
 
+    /** Add the given source to the given reactor of a multi-reactor loop.
+        A "reactor" value of -1 selects the reactor by hashing the source,
+        which is what addSource does. Outside of multi-reactor mode, this is
+        equivalent to addSource.
+
+        Returns true if the request was successfully enqueued, false otherwise.
+    */
+    bool addSourceOnReactor(const std::string & name,
+                            const std::shared_ptr<AsyncEventSource> & source,
+                            int reactor, int priority = 0);
+
+    /** Number of reactor threads used by this loop, which is 1 outside of
+        multi-reactor mode. */
+    int numReactors() const
+    {
+        return reactors_.empty() ? 1 : reactors_.size();
+    }
+
+    /** Index of this loop among the reactors of the multi-reactor loop that
+        owns it, as passed to addSourceOnReactor, or -1 if this loop is not
+        a reactor. */
+    int reactorIndex() const;
+
     /** Add a periodic job to be performed by the loop.  The number passed
         to the toRun function is the number of timeouts that have elapsed
         since the last call; this is useful to know if something has
@@ -123,7 +159,8 @@ struct MessageLoop : public Epoller {
     */
     bool removeSourceSync(AsyncEventSource * source);
 
-    /** Run the given function in the main message loop thread.
+    /** Run the given function in the main message loop thread. In
+        multi-reactor mode, the function is run by any of the reactor threads.
         WARNING: calling this function from the message loop thread will result
         in a deadlock.
     */
@@ -133,9 +170,14 @@ struct MessageLoop : public Epoller {
     void checkNeedsPoll();
 
     /** Total number of seconds that this message loop has spent sleeping.
-        Can be polled regularly to determine the duty cycle of the loop.
+        Can be polled regularly to determine the duty cycle of the loop. In
+        multi-reactor mode, this is the average over all reactors.
      */
-    double totalSleepSeconds() const { return totalSleepTime_; }
+    double totalSleepSeconds() const;
+
+    /** Number of closures that were run by a reactor other than the one they
+        were queued on. Always 0 outside of multi-reactor mode. */
+    uint64_t numStolenClosures() const;
 
     void debug(bool debugOn);
     
@@ -187,8 +229,9 @@ private:
         SourceEntry entry_;
     };
 
-    /* Queue of source actions to perform */
-    TypedMessageQueue<SourceAction> sourceActions_;
+    /* Queue of source actions to perform, null in multi-reactor mode where
+       the reactors have their own */
+    std::unique_ptr<TypedMessageQueue<SourceAction> > sourceActions_;
     // ML::Wakeup_Fd queueFd;
 
     Lock threadsLock;
@@ -214,6 +257,25 @@ private:
     void processAddSource(const SourceEntry & entry);
     void processRemoveSource(const SourceEntry & entry);
     void processRunAction(const SourceEntry & entry);
+
+    /* Multi-reactor mode */
+    struct ReactorState;
+
+    /* Reactors owned by this loop, empty unless running in multi-reactor
+       mode */
+    std::vector<std::unique_ptr<MessageLoop> > reactors_;
+
+    /* Index of the reactor that receives the next closure */
+    std::atomic<unsigned> nextReactor_;
+
+    /* State of this loop when it is a reactor of a multi-reactor loop, null
+       otherwise */
+    std::unique_ptr<ReactorState> reactor_;
+
+    void initReactor(MessageLoop * owner, int index);
+    int reactorForSource(const AsyncEventSource * source) const;
+    void wakeupIdleReactor(unsigned busyReactor);
+    bool stealWork();
 };
 
 } // namespace Datacratic
@@ -0,0 +1,288 @@
+/* quantile_sketch.cc
+   Copyright (c) 2015 Datacratic.  All rights reserved.
+
+*/
+
+#include <math.h>
+#include <float.h>
+
+#include <algorithm>
+
+#include "jml/arch/exception.h"
+#include "jml/db/persistent.h"
+#include "soa/service/quantile_sketch.h"
+
+
+using namespace std;
+
+
+namespace Datacratic {
+
+
+/*****************************************************************************/
+/* QUANTILE SKETCH                                                           */
+/*****************************************************************************/
+
+constexpr double QuantileSketch::MinMagnitude;
+
+QuantileSketch::
+QuantileSketch(double relativeAccuracy)
+    : accuracy(relativeAccuracy), zeroCount(0),
+      numValues(0), total(0.0), minimum(INFINITY), maximum(-INFINITY)
+{
+    if (!(relativeAccuracy > 0.0 && relativeAccuracy < 1.0))
+        throw ML::Exception("relative accuracy must be between 0 and 1");
+
+    gamma = (1.0 + accuracy) / (1.0 - accuracy);
+    invLogGamma = 1.0 / ::log(gamma);
+}
+
+int
+QuantileSketch::
+index(double magnitude) const
+{
+    // the bucket of index i covers ]gamma^(i-1), gamma^i]
+    return ::ceil(::log(std::min(magnitude, DBL_MAX)) * invLogGamma);
+}
+
+double
+QuantileSketch::
+value(int index) const
+{
+    return 2.0 * ::pow(gamma, index) / (gamma + 1.0);
+}
+
+void
+QuantileSketch::
+merge(const QuantileSketch & other)
+{
+    if (other.accuracy != accuracy)
+        throw ML::Exception("cannot merge sketches of different accuracies");
+
+    positive.merge(other.positive);
+    negative.merge(other.negative);
+    zeroCount += other.zeroCount;
+
+    numValues += other.numValues;
+    total += other.total;
+    minimum = std::min(minimum, other.minimum);
+    maximum = std::max(maximum, other.maximum);
+}
+
+double
+QuantileSketch::
+quantile(double quantile) const
+{
+    if (numValues == 0)
+        return NAN;
+
+    uint64_t rank = std::min<double>(numValues - 1,
+                                     std::max(0.0, quantile * numValues));
+
+    double result;
+
+    // Walk the values in increasing order: negatives by decreasing
+    // magnitude, zeros, then positives by increasing magnitude.
+    if (rank < negative.numValues) {
+        uint64_t seen = 0;
+        int i = negative.counts.size() - 1;
+        for (;  seen + negative.counts[i] <= rank;  --i)
+            seen += negative.counts[i];
+        result = -value(negative.offset + i);
+    }
+    else if (rank < negative.numValues + zeroCount) {
+        result = 0.0;
+    }
+    else {
+        uint64_t seen = negative.numValues + zeroCount;
+        int i = 0;
+        for (;  seen + positive.counts[i] <= rank;  ++i)
+            seen += positive.counts[i];
+        result = value(positive.offset + i);
+    }
+
+    // The extrema are exact, which also tightens the first and last buckets
+    return std::max(minimum, std::min(maximum, result));
+}
+
+void
+QuantileSketch::
+clear()
+{
+    positive.clear();
+    negative.clear();
+    zeroCount = 0;
+
+    numValues = 0;
+    total = 0.0;
+    minimum = INFINITY;
+    maximum = -INFINITY;
+}
+
+double
+QuantileSketch::
+mean() const
+{
+    return numValues ? total / numValues : NAN;
+}
+
+double
+QuantileSketch::
+min() const
+{
+    return numValues ? minimum : NAN;
+}
+
+double
+QuantileSketch::
+max() const
+{
+    return numValues ? maximum : NAN;
+}
+
+void
+QuantileSketch::
+serialize(ML::DB::Store_Writer & store) const
+{
+    unsigned char version = 0;
+    store << version;
+    store.save_binary(&accuracy, sizeof(accuracy));
+    store.save_binary(&zeroCount, sizeof(zeroCount));
+    store.save_binary(&total, sizeof(total));
+    store.save_binary(&minimum, sizeof(minimum));
+    store.save_binary(&maximum, sizeof(maximum));
+
+    // only the range of non-empty buckets is written
+    auto saveBuckets = [&] (const Buckets & buckets)
+        {
+            auto isUsed = [] (uint64_t count) { return count != 0; };
+            auto first = std::find_if(buckets.counts.begin(),
+                                      buckets.counts.end(), isUsed);
+            auto last = std::find_if(buckets.counts.rbegin(),
+                                     std::reverse_iterator<decltype(first)>(first),
+                                     isUsed).base();
+
+            int32_t offset = buckets.offset + (first - buckets.counts.begin());
+            uint32_t size = last - first;
+            store.save_binary(&offset, sizeof(offset));
+            store.save_binary(&size, sizeof(size));
+            if (size > 0)
+                store.save_binary(&*first, size * sizeof(uint64_t));
+        };
+
+    saveBuckets(positive);
+    saveBuckets(negative);
+}
+
+void
+QuantileSketch::
+reconstitute(ML::DB::Store_Reader & store)
+{
+    unsigned char version;
+    store >> version;
+    if (version != 0)
+        throw ML::Exception("unknown QuantileSketch version %d",
+                            (int)version);
+
+    double newAccuracy;
+    store.load_binary(&newAccuracy, sizeof(newAccuracy));
+    QuantileSketch result(newAccuracy);
+
+    store.load_binary(&result.zeroCount, sizeof(result.zeroCount));
+    store.load_binary(&result.total, sizeof(result.total));
+    store.load_binary(&result.minimum, sizeof(result.minimum));
+    store.load_binary(&result.maximum, sizeof(result.maximum));
+
+    auto loadBuckets = [&] (Buckets & buckets)
+        {
+            int32_t offset;
+            uint32_t size;
+            store.load_binary(&offset, sizeof(offset));
+            store.load_binary(&size, sizeof(size));
+
+            buckets.offset = offset;
+            buckets.counts.resize(size);
+            if (size > 0)
+                store.load_binary(&buckets.counts[0],
+                                  size * sizeof(uint64_t));
+
+            buckets.numValues = 0;
+            for (uint64_t count: buckets.counts)
+                buckets.numValues += count;
+        };
+
+    loadBuckets(result.positive);
+    loadBuckets(result.negative);
+    result.numValues = (result.positive.numValues + result.negative.numValues
+                        + result.zeroCount);
+
+    *this = std::move(result);
+}
+
+
+/*****************************************************************************/
+/* QUANTILE SKETCH BUCKETS                                                   */
+/*****************************************************************************/
+
+void
+QuantileSketch::Buckets::
+extend(int begin, int end)
+{
+    if (counts.empty()) {
+        offset = begin;
+        counts.resize(end - begin);
+        return;
+    }
+
+    int newOffset = std::min(offset, begin);
+    int newEnd = std::max<int>(offset + counts.size(), end);
+
+    // Grow by at least half of the current size on either side, so that a
+    // stream drifting towards larger or smaller values does not resize on
+    // every new bucket.
+    int slack = counts.size() / 2;
+    if (newOffset < offset)
+        newOffset = std::min(newOffset, offset - slack);
+    if (newEnd > offset + (int)counts.size())
+        newEnd = std::max<int>(newEnd, offset + counts.size() + slack);
+
+    counts.insert(counts.begin(), offset - newOffset, 0);
+    counts.resize(newEnd - newOffset, 0);
+    offset = newOffset;
+}
+
+void
+QuantileSketch::Buckets::
+merge(const Buckets & other)
+{
+    if (other.numValues == 0)
+        return;
+
+    // skip the empty buckets at the ends of the other range
+    size_t first = 0, last = other.counts.size();
+    while (other.counts[first] == 0)
+        ++first;
+    while (other.counts[last - 1] == 0)
+        --last;
+
+    int begin = other.offset + first;
+    int end = other.offset + last;
+    if (counts.empty() || begin < offset
+        || end > offset + (int)counts.size())
+        extend(begin, end);
+
+    for (size_t i = first;  i < last;  ++i)
+        counts[other.offset + i - offset] += other.counts[i];
+    numValues += other.numValues;
+}
+
+void
+QuantileSketch::Buckets::
+clear()
+{
+    std::fill(counts.begin(), counts.end(), 0);
+    numValues = 0;
+}
+
+
+} // namespace Datacratic
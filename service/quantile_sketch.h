@@ -0,0 +1,160 @@
+/* quantile_sketch.h                                               -*- C++ -*-
+   Copyright (c) 2015 Datacratic.  All rights reserved.
+
+   Streaming quantile estimation with bounded relative error.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "jml/db/persistent_fwd.h"
+
+
+namespace Datacratic {
+
+
+/*****************************************************************************/
+/* QUANTILE SKETCH                                                           */
+/*****************************************************************************/
+
+/** Summary of a stream of values from which quantiles can be estimated
+    without keeping the values themselves.
+
+    Values are counted in buckets whose bounds grow geometrically, so that
+    any quantile returned is within "relativeAccuracy" of the exact value
+    of that rank.  Memory only depends on the range of magnitudes seen,
+    never on the number of values: with the default 1% accuracy, values
+    spanning 6 orders of magnitude take up about 6KB.  Clearing the sketch
+    keeps its buckets, so that a sketch reused across intervals of a similar
+    stream does not allocate.
+
+    Two sketches with the same accuracy can be merged, for instance those
+    of several threads, or those of several processes after going through
+    serialize and reconstitute.  The count, sum, minimum and maximum are
+    kept exactly.
+
+    Magnitudes below 1e-9 are counted as 0 and NaNs are ignored.  Not
+    thread safe.
+*/
+
+struct QuantileSketch {
+    QuantileSketch(double relativeAccuracy = 0.01);
+
+    /** Record a value. */
+    void add(double value)
+    {
+        if (value > MinMagnitude) {
+            positive.add(index(value));
+        }
+        else if (value < -MinMagnitude) {
+            negative.add(index(-value));
+        }
+        else if (value == value) {
+            zeroCount++;
+        }
+        else return;
+
+        numValues++;
+        total += value;
+        if (value < minimum) minimum = value;
+        if (value > maximum) maximum = value;
+    }
+
+    /** Add the values of another sketch, which must have the same accuracy,
+        to this one.
+    */
+    void merge(const QuantileSketch & other);
+
+    /** Estimate the value at the given quantile, between 0 and 1.  As with
+        a sorted array of the values, this is the value of rank
+        floor(quantile * count).  Returns NaN when empty.
+    */
+    double quantile(double quantile) const;
+
+    /** Forget all the values but keep the memory allocated. */
+    void clear();
+
+    bool empty() const
+    {
+        return numValues == 0;
+    }
+
+    uint64_t count() const
+    {
+        return numValues;
+    }
+
+    double sum() const
+    {
+        return total;
+    }
+
+    double mean() const;
+
+    /** Exact extrema; NaN when empty. */
+    double min() const;
+    double max() const;
+
+    double relativeAccuracy() const
+    {
+        return accuracy;
+    }
+
+    void serialize(ML::DB::Store_Writer & store) const;
+    void reconstitute(ML::DB::Store_Reader & store);
+
+private:
+    static constexpr double MinMagnitude = 1e-9;
+
+    /** Counts of the buckets of one sign, from index "offset" onwards. */
+    struct Buckets {
+        Buckets()
+            : offset(0), numValues(0)
+        {
+        }
+
+        void add(int index)
+        {
+            if (index < offset || index >= offset + (int)counts.size())
+                extend(index, index + 1);
+            counts[index - offset]++;
+            numValues++;
+        }
+
+        /** Make room for the buckets from "begin" up to "end". */
+        void extend(int begin, int end);
+
+        void merge(const Buckets & other);
+        void clear();
+
+        int offset;
+        std::vector<uint64_t> counts;
+        uint64_t numValues;
+    };
+
+    /** Bucket of a strictly positive magnitude */
+    int index(double magnitude) const;
+
+    /** Value representing all the magnitudes of a bucket, at an equal
+        relative distance from its bounds.
+    */
+    double value(int index) const;
+
+    double accuracy;
+    double gamma;             ///< ratio between the bounds of a bucket
+    double invLogGamma;
+
+    Buckets positive;
+    Buckets negative;         ///< buckets of -value for negative values
+    uint64_t zeroCount;
+
+    uint64_t numValues;
+    double total;
+    double minimum;
+    double maximum;
+};
+
+
+} // namespace Datacratic
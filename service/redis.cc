@@ -408,7 +408,7 @@ struct AsyncConnection::RequestData
     AsyncConnection * connection;
     int64_t id;
     Requests::iterator requestIterator;
-    Timeouts::iterator timeoutIterator;
+    Timeouts::Id timeoutId;
     int state;
 };
 
@@ -860,12 +860,10 @@ resultCallback(redisAsyncContext * context, void * reply, void * privData)
             data->requestIterator = c->requests.end();
         }
         
-        if (data->timeoutIterator != c->timeouts.end()) {
-            c->timeouts.erase(data->timeoutIterator);
-            data->timeoutIterator = c->timeouts.end();
-            if (c->timeouts.empty())
-                c->earliestTimeout = Date::positiveInfinity();
-            else c->earliestTimeout = c->timeouts.begin()->first;
+        if (data->timeoutId != 0) {
+            c->timeouts.cancel(data->timeoutId);
+            data->timeoutId = 0;
+            c->earliestTimeout = c->timeouts.nextExpiry();
         }
 
         if (data->state != WAITING) return;  // raced; timeout happened
@@ -928,7 +926,7 @@ queue(const Command & command,
     data->connection = this;
     data->id = id;
     data->requestIterator = requests.end();
-    data->timeoutIterator = timeouts.end();
+    data->timeoutId = 0;
     data->state = WAITING;
 
     ExcAssertEqual(requests.count(id), 0);
@@ -943,9 +941,10 @@ queue(const Command & command,
     
     if (timeout.expiry.isADate()) {
         needWakeup = !timeouts.empty()
-            && timeout.expiry < timeouts.begin()->first;
-        data->timeoutIterator = timeouts.insert(make_pair(timeout.expiry, it));
-        earliestTimeout = timeouts.begin()->first;
+            && timeout.expiry < earliestTimeout;
+        data->timeoutId = timeouts.arm(timeout.expiry, it);
+        if (timeout.expiry < earliestTimeout)
+            earliestTimeout = timeout.expiry;
     }
     
     vector<const char *> argv = command.argv();
@@ -1078,25 +1077,17 @@ expireTimeouts(Date now)
 {
     boost::unique_lock<Lock> guard(lock);
     
-    auto it = timeouts.begin(), end = timeouts.end();
-    for (;  it != end;  ++it) {
-        if (it->first > now) break;
-
-        auto resultIt = it->second;
+    timeouts.expire(now, [&] (Timeouts::Id id, Requests::iterator resultIt) {
         auto data = resultIt->second;
 
         data->state = TIMEDOUT;
+        data->timeoutId = 0;
         data->onResult(Result(Result::timeoutError));
-        data->timeoutIterator = end;
 
         // Let it be cleaned up from hiredis once it's finished
-    }
-
-    timeouts.erase(timeouts.begin(), it);
+    });
 
-    if (timeouts.empty())
-        earliestTimeout = Date::positiveInfinity();
-    else earliestTimeout = timeouts.begin()->first;
+    earliestTimeout = timeouts.nextExpiry();
 }
 
 } // namespace Redis
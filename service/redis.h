@@ -18,6 +18,7 @@
 #include "jml/utils/ring_buffer.h"
 #include "soa/jsoncpp/json.h"
 #include "soa/types/date.h"
+#include "soa/service/timer_wheel.h"
 #include <boost/shared_ptr.hpp>
 #include <boost/function.hpp>
 #include <boost/thread/thread.hpp>
@@ -451,7 +452,7 @@ private:
     typedef std::map<uint64_t, std::shared_ptr<RequestData> > Requests;
     Requests requests;
     
-    typedef std::multimap<Datacratic::Date, Requests::iterator> Timeouts;
+    typedef Datacratic::TimerWheel<Requests::iterator> Timeouts;
     Timeouts timeouts;
 
     /** Called when something knows that at least one timeout is expired;
@@ -459,6 +460,9 @@ private:
     */
     void expireTimeouts(Datacratic::Date now);
 
+    /** When expireTimeouts() needs to be called next.  May be earlier than
+        the earliest timeout, but never later.
+    */
     Datacratic::Date earliestTimeout;
 
     void checkError(const char * command)
@@ -3,10 +3,11 @@
 
 
 LIBOPSTATS_SOURCES := \
-	statsd_connector.cc carbon_connector.cc stat_aggregator.cc process_stats.cc
+	statsd_connector.cc carbon_connector.cc stat_aggregator.cc process_stats.cc \
+	quantile_sketch.cc
 
 LIBOPSTATS_LINK := \
-	ACE arch utils boost_thread types
+	ACE arch utils boost_thread types db
 
 $(eval $(call library,opstats,$(LIBOPSTATS_SOURCES),$(LIBOPSTATS_LINK)))
 
@@ -39,6 +40,7 @@ LIBSERVICES_SOURCES := \
 	loop_monitor.cc \
 	named_endpoint.cc \
 	async_event_source.cc \
+	timer_source.cc \
 	async_writer_source.cc \
 	tcp_client.cc \
 	rest_service_endpoint.cc \
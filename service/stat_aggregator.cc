@@ -90,26 +90,48 @@ read(const std::string & prefix)
 /*****************************************************************************/
 
 GaugeAggregator::
-GaugeAggregator(Verbosity verbosity, const std::vector<int>& extra)
-    : verbosity(verbosity), values(new ML::distribution<float>())
-    , extra(extra)
+GaugeAggregator(Verbosity verbosity, const std::vector<int>& extra,
+                Storage storage)
+    : verbosity(verbosity), storage(storage), values(0)
+    , extra(extra), sketch(0)
 {
     if (verbosity == Outcome)
         ExcCheck(this->extra.size() > 0, "Can not construct with empty percentiles");
 
-    values->reserve(100);
+    if (storage == Sketch) {
+        sketch = new QuantileSketch();
+        spareSketch.reset(new QuantileSketch());
+    }
+    else {
+        values = new ML::distribution<float>();
+        values->reserve(100);
+    }
 }
 
 GaugeAggregator::
 ~GaugeAggregator()
 {
     delete values;
+    delete sketch;
 }
 
 void
 GaugeAggregator::
 record(float value)
 {
+    if (storage == Sketch) {
+        QuantileSketch * current = sketch;
+        while ((current = sketch) == 0 || !cmp_xchg(sketch, current,
+                                         (QuantileSketch*)0));
+
+        current->add(value);
+
+        memory_barrier();
+
+        sketch = current;
+        return;
+    }
+
     ML::distribution<float> * current = values;
     while ((current = values) == 0 || !cmp_xchg(values, current,
                                      (ML::distribution<float>*)0));
@@ -121,10 +143,46 @@ record(float value)
     values = current;
 }
 
+void
+GaugeAggregator::
+record(const float * newValues, size_t numValues)
+{
+    if (numValues == 0)
+        return;
+
+    if (storage == Sketch) {
+        QuantileSketch * current = sketch;
+        while ((current = sketch) == 0 || !cmp_xchg(sketch, current,
+                                         (QuantileSketch*)0));
+
+        for (size_t i = 0;  i < numValues;  ++i)
+            current->add(newValues[i]);
+
+        memory_barrier();
+
+        sketch = current;
+        return;
+    }
+
+    ML::distribution<float> * current = values;
+    while ((current = values) == 0 || !cmp_xchg(values, current,
+                                     (ML::distribution<float>*)0));
+
+    current->insert(current->end(), newValues, newValues + numValues);
+
+    memory_barrier();
+
+    values = current;
+}
+
 std::pair<ML::distribution<float> *, Date>
 GaugeAggregator::
 reset()
 {
+    if (storage != Samples)
+        throw ML::Exception("GaugeAggregator::reset() requires the Samples "
+                            "storage");
+
     ML::distribution<float> * current = values;
     ML::distribution<float> * new_current = new ML::distribution<float>();
 
@@ -142,6 +200,9 @@ std::vector<StatReading>
 GaugeAggregator::
 read(const std::string & prefix)
 {
+    if (storage == Sketch)
+        return readSketch(prefix);
+
     ML::distribution<float> * values;
     Date oldStart;
 
@@ -191,4 +252,50 @@ read(const std::string & prefix)
     return result;
 }
 
+std::vector<StatReading>
+GaugeAggregator::
+readSketch(const std::string & prefix)
+{
+    // The spare sketch is only ever touched here, by the reading thread,
+    // and keeps its buckets so that swapping it in does not allocate.
+    QuantileSketch * current = sketch;
+    QuantileSketch * empty = spareSketch.release();
+    while ((current = sketch) == 0 || !cmp_xchg(sketch, current, empty));
+    spareSketch.reset(current);
+
+    start = Date::now();
+
+    vector<StatReading> result;
+
+    if (current->empty())
+        return result;
+
+    auto addMetric = [&] (const char * name, double value)
+        {
+            result.push_back(StatReading(prefix + "." + name,
+                                         value, start));
+        };
+
+    if (verbosity == StableLevel)
+        result.push_back(StatReading(prefix, current->mean(), start));
+
+    else {
+        addMetric("mean", current->mean());
+        addMetric("upper", current->max());
+        addMetric("lower", current->min());
+
+        if (verbosity == Outcome) {
+            addMetric("count", current->count());
+            for (int pct: extra) {
+                addMetric(ML::format("upper_%d", pct).c_str(),
+                          current->quantile(pct / 100.0));
+            }
+        }
+    }
+
+    current->clear();
+
+    return result;
+}
+
 } // namespace Datacratic
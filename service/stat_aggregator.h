@@ -12,10 +12,12 @@
 #include <boost/thread.hpp>
 #include "soa/types/date.h"
 #include "stats_events.h"
+#include "soa/service/quantile_sketch.h"
 #include <unordered_map>
 #include <map>
 #include <deque>
 #include <boost/scoped_ptr.hpp>
+#include <memory>
 
 
 namespace Datacratic {
@@ -98,15 +100,28 @@ struct GaugeAggregator : public StatAggregator {
         Outcome      ///< mean, min, max, percentiles, count
     };
 
+    /** How the values are kept until they are read. */
+    enum Storage
+    {
+        Samples,     ///< every value, for exact percentiles
+        Sketch       ///< a QuantileSketch, with 1% error on percentiles
+    };
+
     GaugeAggregator(Verbosity  verbosity = Outcome,
-            const std::vector<int>& extra = DefaultOutcomePercentiles);
+            const std::vector<int>& extra = DefaultOutcomePercentiles,
+            Storage storage = Samples);
 
     virtual ~GaugeAggregator();
 
     /** Record a new value of the stat.  Lock-free but may spin briefly. */
     virtual void record(float value);
 
-    /** Obtain a the current statistics and replace with a new version. */
+    /** Record a batch of values at the cost of a single record. */
+    void record(const float * values, size_t numValues);
+
+    /** Obtain a the current statistics and replace with a new version.
+        Only available with the Samples storage.
+    */
     std::pair<ML::distribution<float> *, Date> reset();
 
     /** Read and reset the counter, providing output in Graphite's preferred
@@ -115,10 +130,16 @@ struct GaugeAggregator : public StatAggregator {
     virtual std::vector<StatReading> read(const std::string & prefix);
 
 private:
+    std::vector<StatReading> readSketch(const std::string & prefix);
+
     Verbosity verbosity;
+    Storage storage;
     Date start;  //< Date at which we last cleared the counter
     ML::distribution<float> * volatile values;  //< List of added values
     std::vector<int> extra;
+
+    QuantileSketch * volatile sketch;  //< Summary of the added values
+    std::unique_ptr<QuantileSketch> spareSketch;  //< Swapped in on read
 };
 
 
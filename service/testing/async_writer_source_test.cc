@@ -0,0 +1,147 @@
+/* async_writer_source_test.cc
+   Copyright (c) 2015 Datacratic.  All rights reserved.
+
+   Tests for AsyncWriterSource
+*/
+
+#define BOOST_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+#include "jml/arch/exception.h"
+#include "soa/service/async_writer_source.h"
+
+using namespace std;
+using namespace Datacratic;
+
+
+namespace {
+
+struct PipeWriter : public AsyncWriterSource {
+    PipeWriter(int fd)
+        : AsyncWriterSource(nullptr, nullptr, nullptr, 0, 0)
+    {
+        setFd(fd);
+    }
+
+    using AsyncWriterSource::emptyMessageQueue;
+};
+
+}
+
+
+/* Ensure that strings, buffers and buffer slices are written in order, that
+ * each write is reported and that buffers are released once written. */
+BOOST_AUTO_TEST_CASE( test_async_writer_buffers )
+{
+    int fds[2];
+    if (::pipe2(fds, O_NONBLOCK) == -1) {
+        throw ML::Exception(errno, "pipe2");
+    }
+
+    string expected;
+    vector<string> reported;
+    auto onWriteResult = [&] (AsyncWriteResult result) {
+        BOOST_CHECK_EQUAL(result.error, 0);
+        if (result.writtenBuffer.empty()) {
+            reported.push_back(result.written);
+        }
+        else {
+            reported.push_back(result.writtenBuffer.toString());
+        }
+        BOOST_CHECK_EQUAL(result.writtenSize, reported.back().size());
+    };
+
+    static const char staticData[] = "static data;";
+    int numReleased(0);
+    auto onRelease = [&] (const char * data, size_t size) {
+        BOOST_CHECK_EQUAL(data, staticData);
+        BOOST_CHECK_EQUAL(size, sizeof(staticData) - 1);
+        numReleased++;
+    };
+
+    const int numWrites(1500);
+    {
+        PipeWriter writer(fds[1]);
+
+        AsyncWriteBuffer shared(string("0123456789"));
+        for (int i = 0; i < numWrites; i++) {
+            if (i % 3 == 0) {
+                string message = "message " + to_string(i) + ";";
+                expected += message;
+                writer.write(move(message), onWriteResult);
+            }
+            else if (i % 3 == 1) {
+                AsyncWriteBuffer slice = shared.slice(i % 10, 10 - i % 10);
+                expected += slice.toString();
+                writer.write(slice, onWriteResult);
+            }
+            else {
+                expected += staticData;
+                writer.write(staticData, sizeof(staticData) - 1, onRelease,
+                             onWriteResult);
+            }
+        }
+
+        while (reported.size() < numWrites) {
+            writer.loop(-1, 1000);
+        }
+        BOOST_CHECK_EQUAL(writer.msgsSent(), numWrites);
+        BOOST_CHECK_EQUAL(writer.bytesSent(), expected.size());
+    }
+    BOOST_CHECK_EQUAL(numReleased, numWrites / 3);
+
+    string received(expected.size() + 1, '\0');
+    ssize_t len = ::read(fds[0], &received[0], received.size());
+    BOOST_REQUIRE_EQUAL(len, expected.size());
+    received.resize(len);
+    BOOST_CHECK_EQUAL(received, expected);
+
+    string reportedStr;
+    for (const string & write: reported) {
+        reportedStr += write;
+    }
+    BOOST_CHECK_EQUAL(reportedStr, expected);
+
+    ::close(fds[0]);
+}
+
+/* Ensure that a message that was partially written is reported as lost with
+ * only its unsent bytes. */
+BOOST_AUTO_TEST_CASE( test_async_writer_partial_lost_message )
+{
+    int fds[2];
+    if (::pipe2(fds, O_NONBLOCK) == -1) {
+        throw ML::Exception(errno, "pipe2");
+    }
+
+    /* larger than the pipe capacity */
+    string message(1024 * 1024, 'a');
+    for (size_t i = 0; i < message.size(); i++) {
+        message[i] = 'a' + (i % 26);
+    }
+
+    {
+        PipeWriter writer(fds[1]);
+        writer.write(message, nullptr);
+        while (writer.bytesSent() == 0) {
+            writer.loop(-1, 1000);
+        }
+        size_t sent = writer.bytesSent();
+        BOOST_REQUIRE(sent < message.size());
+        BOOST_CHECK_EQUAL(writer.msgsSent(), 0);
+
+        vector<string> lost = writer.emptyMessageQueue();
+        BOOST_REQUIRE_EQUAL(lost.size(), 1);
+        BOOST_CHECK(lost[0] == message.substr(sent));
+    }
+
+    ::close(fds[0]);
+}
@@ -14,6 +14,8 @@
 #include "jml/arch/timers.h"
 #include "soa/service/passive_endpoint.h"
 #include <boost/make_shared.hpp>
+#include <map>
+#include <sstream>
 
 
 using namespace std;
@@ -169,6 +171,86 @@ BOOST_AUTO_TEST_CASE( test_multi_aggregator )
     BOOST_CHECK_EQUAL(readings[0].value, 50.0);
 }
 
+BOOST_AUTO_TEST_CASE( test_multi_aggregator_handles )
+{
+    // Registered stats are recorded in per-thread shards which must all be
+    // merged when dumping.
+
+    MultiAggregator agg;
+
+    StatHandle hits = agg.registerStat("hits", ET_HIT);
+    StatHandle level = agg.registerStat("level", ET_LEVEL);
+    BOOST_CHECK_EQUAL(agg.registerStat("hits", ET_HIT).index, hits.index);
+    BOOST_CHECK_THROW(agg.registerStat("hits", ET_LEVEL), ML::Exception);
+
+    agg.recordLevel("named", 1.0);
+    BOOST_CHECK_THROW(agg.registerStat("named", ET_COUNT), ML::Exception);
+    StatHandle named = agg.registerStat("named", ET_LEVEL);
+
+    unsigned nthreads = 8, iter = 100000;
+    boost::barrier barrier(nthreads);
+    boost::thread_group tg;
+    for (unsigned i = 0;  i < nthreads;  ++i) {
+        auto doThread = [&, i] ()
+            {
+                barrier.wait();
+
+                for (unsigned j = 0;  j < iter;  ++j) {
+                    agg.recordHit(hits);
+                    agg.record(level, i);
+                }
+                agg.record(named, 3.0);
+            };
+
+        tg.create_thread(doThread);
+    }
+
+    tg.join_all();
+
+    std::ostringstream stream;
+    agg.dumpSync(stream);
+
+    std::map<std::string, double> values;
+    std::istringstream lines(stream.str());
+    std::string name;
+    double value;
+    while (lines >> name >> value)
+        values[name.substr(0, name.size() - 1)] = value;
+
+    BOOST_CHECK_EQUAL(values["hits"], nthreads * iter);
+    BOOST_CHECK_EQUAL(values["level.mean"], (nthreads - 1) / 2.0);
+    BOOST_CHECK_EQUAL(values["level.lower"], 0.0);
+    BOOST_CHECK_EQUAL(values["level.upper"], nthreads - 1);
+    BOOST_CHECK_CLOSE(values["named.mean"],
+                      (1.0 + nthreads * 3.0) / (nthreads + 1), 0.001);
+}
+
+BOOST_AUTO_TEST_CASE( test_multi_aggregator_shard_reuse )
+{
+    // Threads that come after others have exited take over their shards,
+    // along with the values that were not merged yet.
+
+    MultiAggregator agg;
+    StatHandle hits = agg.registerStat("hits", ET_HIT);
+
+    unsigned nthreads = 20, iter = 1000;
+    for (unsigned i = 0;  i < nthreads;  ++i) {
+        boost::thread thread([&] ()
+            {
+                for (unsigned j = 0;  j < iter;  ++j)
+                    agg.recordHit(hits);
+            });
+        thread.join();
+    }
+
+    BOOST_CHECK_EQUAL(agg.numShards(), 1);
+
+    std::ostringstream stream;
+    agg.dumpSync(stream);
+    BOOST_CHECK(stream.str().find("hits:\t" + std::to_string(nthreads * iter))
+                != std::string::npos);
+}
+
 struct FakeCarbon : public PassiveEndpointT<SocketTransport> {
 
     FakeCarbon()
@@ -10,3 +10,73 @@ struct AtInit {
 } atInit;
 
 #include "http_client_test.cc"
+
+#include "soa/service/http_client_v2.h"
+
+
+#if 1
+/* Ensure that connections are reused across requests, that the pool grows
+ * only as needed and that idle connections are reaped. */
+BOOST_AUTO_TEST_CASE( test_http_client_v2_connection_pool )
+{
+    ML::Watchdog watchdog(30);
+    auto proxies = make_shared<ServiceProxies>();
+
+    HttpGetService service(proxies);
+    service.addResponse("GET", "/", 200, "coucou");
+    service.start();
+    service.waitListening();
+
+    MessageLoop loop;
+    loop.start();
+
+    string baseUrl("http://127.0.0.1:" + to_string(service.port()));
+
+    auto client = make_shared<HttpClientV2>(baseUrl, 4, 0);
+    client->setIdleTimeout(1.0);
+    loop.addSource("client", client);
+    client->waitConnectionState(AsyncEventSource::CONNECTED);
+
+    int done(0);
+    auto onDone = [&] (const HttpRequest & rq,
+                       HttpClientError errorCode, int status,
+                       string && headers, string && body) {
+        BOOST_CHECK_EQUAL(errorCode, HttpClientError::None);
+        done++;
+        ML::futex_wake(done);
+    };
+    auto cbs = make_shared<HttpClientSimpleCallbacks>(onDone);
+
+    /* sequential requests all use the same connection */
+    for (int i = 0; i < 10; i++) {
+        client->enqueueRequest("GET", "/", cbs, HttpRequest::Content(),
+                               {}, {});
+        while (done < i + 1) {
+            ML::futex_wait(done, i);
+        }
+    }
+
+    auto stats = client->stats();
+    BOOST_CHECK_EQUAL(stats.numRequests, 10);
+    BOOST_CHECK_EQUAL(stats.numConnections, 1);
+    BOOST_CHECK_EQUAL(stats.numReused, 9);
+    BOOST_CHECK_EQUAL(stats.inFlight, 0);
+    BOOST_CHECK_EQUAL(stats.queueDepth, 0);
+
+    /* the idle connection is closed and reopened on demand */
+    ML::sleep(2.5);
+    BOOST_CHECK_EQUAL(client->stats().numReaped, 1);
+
+    client->enqueueRequest("GET", "/", cbs, HttpRequest::Content(), {}, {});
+    while (done < 11) {
+        ML::futex_wait(done, 10);
+    }
+    stats = client->stats();
+    BOOST_CHECK_EQUAL(stats.numRequests, 11);
+    BOOST_CHECK_EQUAL(stats.numConnections, 1);
+    BOOST_CHECK_EQUAL(stats.numReused, 9);
+
+    loop.shutdown();
+    service.shutdown();
+}
+#endif
@@ -1,6 +1,7 @@
 #define BOOST_TEST_MAIN
 #define BOOST_TEST_DYN_LINK
 
+#include <sstream>
 #include <string>
 #include <boost/test/unit_test.hpp>
 #include "soa/service/http_header.h"
@@ -122,3 +123,82 @@ BOOST_AUTO_TEST_CASE(test_http_header_space_as_plus)
 
     testQueryParam(header, "arg1", "1 2");
 }
+
+
+/* header views */
+
+BOOST_AUTO_TEST_CASE(test_http_header_name_interning)
+{
+    using namespace Datacratic;
+
+    BOOST_CHECK(internHttpHeaderName("Content-Length", 14)
+                == HttpHeaderName::ContentLength);
+    BOOST_CHECK(internHttpHeaderName("x-forwarded-FOR", 15)
+                == HttpHeaderName::XForwardedFor);
+    BOOST_CHECK(internHttpHeaderName("Content-Lengthx", 15)
+                == HttpHeaderName::Other);
+    BOOST_CHECK(internHttpHeaderName("", 0) == HttpHeaderName::Other);
+    BOOST_CHECK_EQUAL(httpHeaderNameString(HttpHeaderName::UserAgent),
+                      "user-agent");
+
+    HttpHeaderField field;
+    BOOST_CHECK(!parseHttpHeaderField("no colon\r\n", 10, field));
+    BOOST_CHECK(parseHttpHeaderField("Host: \t example.com\r\n", 21, field));
+    BOOST_CHECK(field.id == HttpHeaderName::Host);
+    BOOST_CHECK_EQUAL(field.name.toString(), "Host");
+    BOOST_CHECK_EQUAL(field.value.toString(), "example.com");
+}
+
+/* Ensure that "parseViews" gives the same results as "parse", and that the
+ * header map is only filled on demand. */
+BOOST_AUTO_TEST_CASE(test_http_header_parse_views)
+{
+    using namespace Datacratic;
+
+    string request = ("POST /auction?id=1234 HTTP/1.1\r\n"
+                      "Host: 127.0.0.1:9985\r\n"
+                      "User-Agent: bidder/1.0\r\n"
+                      "X-Openrtb-Version: 2.2\r\n"
+                      "Content-Type: application/json\r\n"
+                      "Content-Length: 8\r\n"
+                      "\r\n"
+                      "{\"a\":1}");
+
+    HttpHeader parsed;
+    parsed.parse(request, false);
+
+    HttpHeader header;
+    header.parseViews(request, false);
+    BOOST_CHECK_EQUAL(header.verb, parsed.verb);
+    BOOST_CHECK_EQUAL(header.resource, parsed.resource);
+    BOOST_CHECK_EQUAL(header.version, parsed.version);
+    BOOST_CHECK_EQUAL(header.queryParams.getValue("id"), "1234");
+    BOOST_CHECK_EQUAL(header.contentType, parsed.contentType);
+    BOOST_CHECK_EQUAL(header.contentLength, parsed.contentLength);
+    BOOST_CHECK_EQUAL(header.knownData, parsed.knownData);
+
+    BOOST_CHECK(header.headers.empty());
+    BOOST_CHECK_EQUAL(header.numFields(), 3);
+    BOOST_CHECK_EQUAL(header.field(HttpHeaderName::UserAgent).toString(),
+                      "bidder/1.0");
+    BOOST_CHECK_EQUAL(header.field("x-openrtb-version").toString(), "2.2");
+    BOOST_CHECK(header.field("x-missing").empty());
+    BOOST_CHECK_EQUAL(header.getHeader("host"), "127.0.0.1:9985");
+    BOOST_CHECK_EQUAL(header.tryGetHeader("x-missing"), "");
+    BOOST_CHECK_THROW(header.getHeader("x-missing"), ML::Exception);
+
+    /* printing the header doesn't modify it */
+    ostringstream printed;
+    printed << header;
+    BOOST_CHECK(printed.str().find("user-agent: bidder/1.0\r\n")
+                != string::npos);
+    BOOST_CHECK(header.headers.empty());
+
+    /* the views remain valid after a copy */
+    HttpHeader copy(header);
+    header = HttpHeader();
+    BOOST_CHECK_EQUAL(copy.field(HttpHeaderName::Host).toString(),
+                      "127.0.0.1:9985");
+
+    BOOST_CHECK(copy.materializeHeaders() == parsed.headers);
+}
@@ -0,0 +1,195 @@
+/* http_parsers_bench.cc
+   Copyright (c) 2015 Datacratic.  All rights reserved.
+
+   Throughput of HttpResponseParser and HttpRequestParser with each of the
+   delimiter scanners supported by the CPU.
+*/
+
+#include <string>
+#include <vector>
+
+#include "jml/arch/exception.h"
+#include "soa/types/date.h"
+#include "soa/service/http_parsers.h"
+
+using namespace std;
+using namespace Datacratic;
+
+
+namespace {
+
+const char * scannerName(HttpScanner scanner)
+{
+    switch (scanner) {
+    case HttpScanner::Scalar: return "scalar";
+    case HttpScanner::Sse42: return "sse4.2";
+    case HttpScanner::Avx2: return "avx2";
+    }
+
+    return "unknown";
+}
+
+/* typical response of a JSON api */
+string makeJsonResponse()
+{
+    string body("{\"id\":\"3f9c2a\",\"status\":\"ok\",\"results\":[");
+    for (int i = 0; i < 8; i++) {
+        if (i > 0) {
+            body += ",";
+        }
+        body += ("{\"key\":\"item" + to_string(i)
+                 + "\",\"value\":" + to_string(i * 1234)
+                 + ",\"tags\":[\"a\",\"b\",\"c\"]}");
+    }
+    body += "]}";
+
+    return ("HTTP/1.1 200 OK\r\n"
+            "Server: nginx/1.6.2\r\n"
+            "Date: Tue, 17 Mar 2015 14:32:11 GMT\r\n"
+            "Content-Type: application/json; charset=utf-8\r\n"
+            "Content-Length: " + to_string(body.size()) + "\r\n"
+            "Connection: keep-alive\r\n"
+            "Cache-Control: no-cache, no-store, must-revalidate\r\n"
+            "Pragma: no-cache\r\n"
+            "Expires: 0\r\n"
+            "X-Request-Id: 5b1e7c0a-8a3e-4f6b-9d0c-2e4f5a6b7c8d\r\n"
+            "X-Frame-Options: SAMEORIGIN\r\n"
+            "Vary: Accept-Encoding\r\n"
+            "\r\n"
+            + body);
+}
+
+string makeChunkedResponse()
+{
+    string response("HTTP/1.1 200 OK\r\n"
+                    "Server: Apache\r\n"
+                    "Content-Type: text/plain\r\n"
+                    "Transfer-Encoding: chunked\r\n"
+                    "\r\n");
+    for (int i = 0; i < 6; i++) {
+        string chunk(100 + i * 50, 'x');
+        char size[32];
+        ::sprintf(size, "%zx", chunk.size());
+        response += string(size) + (i % 2 ? ";name=value" : "") + "\r\n";
+        response += chunk + "\r\n";
+    }
+    response += "0\r\n\r\n";
+
+    return response;
+}
+
+string makeNoContentResponse()
+{
+    return ("HTTP/1.1 204 No Content\r\n"
+            "Date: Tue, 17 Mar 2015 14:32:11 GMT\r\n"
+            "Content-Length: 0\r\n"
+            "\r\n");
+}
+
+/* request as sent by a browser */
+string makeBrowserRequest()
+{
+    return ("GET /api/v1/campaigns/12345/creatives?fields=id,name,status"
+            "&limit=100 HTTP/1.1\r\n"
+            "Host: api.example.com\r\n"
+            "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36"
+            " (KHTML, like Gecko) Chrome/41.0.2272.89 Safari/537.36\r\n"
+            "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,"
+            "image/webp,*/*;q=0.8\r\n"
+            "Accept-Encoding: gzip, deflate, sdch\r\n"
+            "Accept-Language: en-US,en;q=0.8,fr;q=0.6\r\n"
+            "Cookie: _ga=GA1.2.1234567890.1426600000; session=abcdef0123456789"
+            "abcdef0123456789; prefs=theme%3Ddark%26lang%3Den\r\n"
+            "Connection: keep-alive\r\n"
+            "\r\n");
+}
+
+string makePostRequest()
+{
+    string body("{\"bidRequest\":{\"id\":\"1234\",\"imp\":[{\"id\":\"1\","
+                "\"banner\":{\"w\":300,\"h\":250}}],\"site\":{\"domain\":"
+                "\"example.com\"}}}");
+
+    return ("POST /auctions HTTP/1.1\r\n"
+            "Host: 127.0.0.1:9985\r\n"
+            "Accept: */*\r\n"
+            "Content-Type: application/json\r\n"
+            "Content-Length: " + to_string(body.size()) + "\r\n"
+            "\r\n"
+            + body);
+}
+
+/* Feed "numMessages" messages from "corpus" to "parser" in slices of
+ * "sliceSize" bytes, as a socket would deliver them. */
+template<typename Parser>
+void doBench(const string & label, Parser & parser,
+             const vector<string> & corpus,
+             int numMessages, size_t sliceSize)
+{
+    string input;
+    for (int i = 0; i < numMessages; i++) {
+        input += corpus[i % corpus.size()];
+    }
+
+    int numDone(0);
+    parser.onDone = [&] (bool) {
+        numDone++;
+    };
+
+    for (HttpScanner scanner: {HttpScanner::Scalar, HttpScanner::Sse42,
+                               HttpScanner::Avx2}) {
+        if (!setHttpScanner(scanner)) {
+            continue;
+        }
+
+        numDone = 0;
+        Date start = Date::now();
+        for (size_t ptr = 0; ptr < input.size(); ptr += sliceSize) {
+            parser.feed(input.c_str() + ptr,
+                        min(sliceSize, input.size() - ptr));
+        }
+        double delta = Date::now() - start;
+
+        if (numDone != numMessages) {
+            throw ML::Exception("parsed %d messages out of %d",
+                                numDone, numMessages);
+        }
+
+        ::printf("%s,%s,%zu,%d,%zu,%f,%f,%f\n",
+                 label.c_str(), scannerName(scanner),
+                 sliceSize, numMessages, input.size(), delta,
+                 double(numMessages) / delta,
+                 double(input.size()) / delta / 1000000.0);
+    }
+}
+
+} // file scope
+
+
+int main()
+{
+    static const int numMessages(200000);
+
+    HttpScanner initial = httpScanner();
+
+    ::printf("label,scanner,slice_size,msgs_count,bytes,delta,"
+             "msg_rate,mb_rate\n");
+
+    vector<string> responses{makeJsonResponse(), makeChunkedResponse(),
+                             makeNoContentResponse()};
+    vector<string> requests{makeBrowserRequest(), makePostRequest()};
+
+    for (size_t sliceSize: {1500, 65536}) {
+        HttpResponseParser responseParser;
+        doBench("responses", responseParser, responses,
+                numMessages, sliceSize);
+
+        HttpRequestParser requestParser;
+        doBench("requests", requestParser, requests,
+                numMessages, sliceSize);
+    }
+
+    setHttpScanner(initial);
+
+    return 0;
+}
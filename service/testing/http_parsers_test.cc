@@ -307,3 +307,83 @@ BOOST_AUTO_TEST_CASE( http_request_parser_test )
     BOOST_CHECK_EQUAL(statusLine, "GET|/poiltruc?blablabla|HTTP/1.1");
 }
 #endif
+
+#if 1
+/* Ensure that all the scanners supported by the CPU return the same results
+ * as the scalar one, regardless of the alignment and size of the input. */
+BOOST_AUTO_TEST_CASE( http_scanner_test )
+{
+    HttpScanner initial = httpScanner();
+
+    string data;
+    for (int i = 0; i < 300; i++) {
+        data += char('a' + (i * 7) % 26);
+    }
+
+    auto doScan = [&] (HttpScanner scanner, size_t start, size_t size) {
+        BOOST_REQUIRE(setHttpScanner(scanner));
+        return httpScan(data.c_str() + start, size, ':', '\r', '\n');
+    };
+
+    vector<HttpScanner> scanners{HttpScanner::Sse42, HttpScanner::Avx2};
+    for (size_t pos: {0, 1, 15, 16, 17, 31, 32, 33, 63, 64, 200, 299}) {
+        string saved = data;
+        data[pos] = (pos % 2) ? ':' : '\n';
+        for (size_t start: {0, 1, 5, 16}) {
+            for (size_t size = 0; start + size <= data.size(); size += 3) {
+                size_t expected = doScan(HttpScanner::Scalar, start, size);
+                BOOST_CHECK_EQUAL(expected,
+                                  (pos >= start && pos < start + size)
+                                  ? pos - start : size);
+                for (HttpScanner scanner: scanners) {
+                    if (setHttpScanner(scanner)) {
+                        BOOST_CHECK_EQUAL(doScan(scanner, start, size),
+                                          expected);
+                    }
+                }
+            }
+        }
+        data = saved;
+    }
+
+    setHttpScanner(initial);
+}
+#endif
+
+#if 1
+/* Ensure that header fields are reported as views with interned names and
+ * that "setExpectBody" applies to the following responses. */
+BOOST_AUTO_TEST_CASE( http_parser_fields_test )
+{
+    vector<pair<HttpHeaderName, string> > fields;
+    int numDone(0);
+
+    HttpResponseParser parser;
+    parser.onField = [&] (const HttpHeaderField & field) {
+        fields.emplace_back(field.id, field.value.toString());
+    };
+    parser.onDone = [&] (bool doClose) {
+        numDone++;
+    };
+
+    /* response to a HEAD request */
+    parser.setExpectBody(false);
+    parser.feed("HTTP/1.1 200 OK\r\n"
+                "Content-Length: 10\r\n"
+                "X-Custom:  some value\r\n"
+                "\r\n");
+    BOOST_CHECK_EQUAL(numDone, 1);
+    BOOST_REQUIRE_EQUAL(fields.size(), 2);
+    BOOST_CHECK(fields[0].first == HttpHeaderName::ContentLength);
+    BOOST_CHECK_EQUAL(fields[0].second, "10");
+    BOOST_CHECK(fields[1].first == HttpHeaderName::Other);
+    BOOST_CHECK_EQUAL(fields[1].second, "some value");
+
+    parser.setExpectBody(true);
+    parser.feed("HTTP/1.1 200 OK\r\n"
+                "Content-Length: 4\r\n"
+                "\r\n"
+                "body");
+    BOOST_CHECK_EQUAL(numDone, 2);
+}
+#endif
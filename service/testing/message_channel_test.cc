@@ -14,6 +14,7 @@
 #include "soa/service/message_loop.h"
 #include "soa/service/typed_message_channel.h"
 #include <sys/socket.h>
+#include <poll.h>
 #include "jml/utils/guard.h"
 #include "jml/arch/exception_handler.h"
 #include "jml/utils/testing/watchdog.h"
@@ -208,4 +209,138 @@ BOOST_AUTO_TEST_CASE( test_typed_message_queue )
     }
 }
 
+BOOST_AUTO_TEST_CASE( test_mpsc_message_queue_policies )
+{
+    /* Reject, wakeup coalescing and batch drain */
+    {
+        MpscMessageQueue<string> queue(nullptr, 5);
+        BOOST_CHECK_EQUAL(queue.capacity(), 8);
+
+        for (int i = 0; i < 8; i++) {
+            BOOST_CHECK(queue.push_back("message " + to_string(i)));
+        }
+        BOOST_CHECK(!queue.push_back("one too many"));
+        BOOST_CHECK_EQUAL(queue.numRejected(), 1);
+        BOOST_CHECK_EQUAL(queue.size(), 8);
+
+        /* a single signal for the 8 messages */
+        uint64_t count(0);
+        BOOST_CHECK_EQUAL(::read(queue.selectFd(), &count, sizeof(count)),
+                          sizeof(count));
+        BOOST_CHECK_EQUAL(count, 1);
+
+        vector<string> msgs;
+        msgs.reserve(16);
+        const string * storage = msgs.data();
+        BOOST_CHECK_EQUAL(queue.pop_front(msgs, 3), 3);
+        BOOST_CHECK_EQUAL(msgs.size(), 3);
+        BOOST_CHECK_EQUAL(msgs[0], "message 0");
+        BOOST_CHECK_EQUAL(msgs[2], "message 2");
+
+        /* the queue is not empty: no new signal */
+        BOOST_CHECK(queue.push_back("message 8"));
+        BOOST_CHECK_EQUAL(::read(queue.selectFd(), &count, sizeof(count)),
+                          -1);
+
+        BOOST_CHECK_EQUAL(queue.pop_front(msgs, 0), 6);
+        BOOST_CHECK_EQUAL(msgs.size(), 9);
+        BOOST_CHECK_EQUAL(msgs[8], "message 8");
+        BOOST_CHECK_EQUAL(msgs.data(), storage);
+        BOOST_CHECK_EQUAL(queue.size(), 0);
+
+        /* the queue has been drained: the next message is signaled */
+        BOOST_CHECK(queue.push_back("message 9"));
+        BOOST_CHECK_EQUAL(::read(queue.selectFd(), &count, sizeof(count)),
+                          sizeof(count));
+        auto last = queue.pop_front(0);
+        BOOST_REQUIRE_EQUAL(last.size(), 1);
+        BOOST_CHECK_EQUAL(last[0], "message 9");
+    }
+
+    /* Popping exactly the messages left drains the queue */
+    {
+        MpscMessageQueue<int> queue(nullptr, 8);
+        uint64_t count(0);
+        for (int round = 0; round < 3; round++) {
+            for (int i = 0; i < 2; i++) {
+                BOOST_CHECK(queue.push_back(i));
+            }
+            BOOST_CHECK_EQUAL(::read(queue.selectFd(), &count, sizeof(count)),
+                              sizeof(count));
+            BOOST_CHECK_EQUAL(queue.pop_front(2).size(), 2);
+        }
+
+        BOOST_CHECK(queue.push_back(2));
+        BOOST_CHECK_EQUAL(queue.pop_front(1).size(), 1);
+        BOOST_CHECK(queue.push_back(3));
+        pollfd item = { queue.selectFd(), POLLIN, 0 };
+        BOOST_CHECK_EQUAL(::poll(&item, 1, 0), 1);
+    }
+
+    /* DropOldest */
+    {
+        MpscMessageQueue<unique_ptr<int> >
+            queue(nullptr, 4, QueueFullPolicy::DropOldest);
+        for (int i = 0; i < 6; i++) {
+            BOOST_CHECK(queue.push_back(unique_ptr<int>(new int(i))));
+        }
+        BOOST_CHECK_EQUAL(queue.numDropped(), 2);
+
+        vector<int> values;
+        queue.consume([&] (unique_ptr<int> && value) {
+            values.push_back(*value);
+        });
+        BOOST_CHECK(values == vector<int>({2, 3, 4, 5}));
+    }
+}
+
+/* Ensure that messages are neither lost nor reordered with many producers,
+ * and that no wakeup is lost. */
+BOOST_AUTO_TEST_CASE( test_mpsc_message_queue_threads )
+{
+    const int numThreads(8);
+    const int numMessages(50000);
+
+    for (QueueFullPolicy policy: {QueueFullPolicy::Reject,
+                                  QueueFullPolicy::Block}) {
+        MpscMessageQueue<pair<int, int> > queue(nullptr, 64, policy);
+
+        auto threadFn = [&] (int threadNum) {
+            for (int i = 0; i < numMessages; i++) {
+                while (!queue.push_back(make_pair(threadNum, i))) {
+                    std::this_thread::yield();
+                }
+            }
+        };
+
+        vector<thread> workers;
+        for (int i = 0; i < numThreads; i++) {
+            workers.emplace_back(threadFn, i);
+        }
+
+        vector<int> next(numThreads, 0);
+        int numReceived(0);
+        int numWakeups(0);
+        while (numReceived < numThreads * numMessages) {
+            pollfd item = { queue.selectFd(), POLLIN, 0 };
+            int res = ::poll(&item, 1, 5000);
+            BOOST_REQUIRE_EQUAL(res, 1);
+            queue.processOne();
+            numWakeups++;
+            queue.consume([&] (pair<int, int> && msg) {
+                BOOST_REQUIRE_EQUAL(msg.second, next[msg.first]);
+                next[msg.first]++;
+                numReceived++;
+            });
+        }
+
+        for (thread & worker: workers) {
+            worker.join();
+        }
+        BOOST_CHECK_EQUAL(queue.size(), 0);
+        cerr << ("received " + to_string(numReceived) + " msgs in "
+                 + to_string(numWakeups) + " wakeups\n");
+    }
+}
+
 } // namespace Datacratic
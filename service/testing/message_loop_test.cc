@@ -1,7 +1,10 @@
 #define BOOST_TEST_MAIN
 #define BOOST_TEST_DYN_LINK
 
+#include <atomic>
 #include <iostream>
+#include <mutex>
+#include <set>
 
 #include <boost/test/unit_test.hpp>
 
@@ -102,3 +105,94 @@ BOOST_AUTO_TEST_CASE( test_addSource_after_before_start )
         }
     }
 }
+
+/* This test ensures that a multi-reactor loop spreads its sources and the
+ * closures passed to runInMessageLoopThread over its reactor threads. */
+BOOST_AUTO_TEST_CASE( test_multi_reactor )
+{
+    ML::Watchdog wd(30);
+    const int numReactors(4);
+    const int numSources(100);
+    const int numClosures(10000);
+
+    typedef shared_ptr<TypedMessageSink<string> > TestSource;
+
+    MessageLoop loop(numReactors);
+    BOOST_CHECK_EQUAL(loop.numReactors(), numReactors);
+    loop.start();
+
+    vector<TestSource> sources;
+    for (int i = 0; i < numSources; i++) {
+        sources.emplace_back(new TypedMessageSink<string>(5));
+        loop.addSource("source", sources.back());
+    }
+
+    /* explicit affinity */
+    TestSource pinned(new TypedMessageSink<string>(5));
+    loop.addSourceOnReactor("pinned", pinned, 2);
+
+    set<MessageLoop *> reactors;
+    for (auto & source: sources) {
+        source->waitConnectionState(AsyncEventSource::CONNECTED);
+        BOOST_CHECK_NE(source->parent_, &loop);
+        reactors.insert(source->parent_);
+    }
+    BOOST_CHECK_EQUAL(reactors.size(), numReactors);
+    pinned->waitConnectionState(AsyncEventSource::CONNECTED);
+    BOOST_CHECK(reactors.count(pinned->parent_) == 1);
+    BOOST_CHECK_EQUAL(pinned->parent_->reactorIndex(), 2);
+    BOOST_CHECK_EQUAL(loop.reactorIndex(), -1);
+
+    mutex threadIdsLock;
+    set<thread::id> threadIds;
+    atomic<int> numRun(0);
+    for (int i = 0; i < numClosures; i++) {
+        auto closure = [&] () {
+            {
+                lock_guard<mutex> guard(threadIdsLock);
+                threadIds.insert(this_thread::get_id());
+            }
+            numRun++;
+        };
+        BOOST_CHECK(loop.runInMessageLoopThread(closure));
+    }
+    while (numRun < numClosures) {
+        ML::sleep(0.1);
+    }
+    BOOST_CHECK_EQUAL(threadIds.size(), numReactors);
+
+    /* the closures queued on a busy reactor are run by the others */
+    atomic<bool> blocked(false), released(false);
+    BOOST_CHECK(loop.runInMessageLoopThread([&] () {
+        blocked = true;
+        while (!released) {
+            ML::sleep(0.001);
+        }
+    }));
+    while (!blocked) {
+        ML::sleep(0.01);
+    }
+
+    uint64_t stolenBefore = loop.numStolenClosures();
+    numRun = 0;
+    for (int i = 0; i < numClosures; i++) {
+        BOOST_CHECK(loop.runInMessageLoopThread([&] () { numRun++; }));
+    }
+    while (numRun < numClosures) {
+        ML::sleep(0.1);
+    }
+    released = true;
+
+    /* one closure out of "numReactors" went to the blocked reactor */
+    BOOST_CHECK_GE(loop.numStolenClosures() - stolenBefore,
+                   numClosures / numReactors);
+
+    /* cleanup */
+    sources.push_back(pinned);
+    for (auto & source: sources) {
+        loop.removeSource(source.get());
+    }
+    for (auto & source: sources) {
+        source->waitConnectionState(AsyncEventSource::DISCONNECTED);
+    }
+}
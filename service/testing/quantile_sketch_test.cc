@@ -0,0 +1,175 @@
+/* quantile_sketch_test.cc
+   Copyright (c) 2015 Datacratic.  All rights reserved.
+
+   Tests for QuantileSketch and the sketch storage of GaugeAggregator.
+*/
+
+#define BOOST_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+
+#include <math.h>
+
+#include <algorithm>
+#include <map>
+#include <random>
+#include <sstream>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+#include "jml/arch/exception.h"
+#include "jml/db/persistent.h"
+#include "soa/service/quantile_sketch.h"
+#include "soa/service/stat_aggregator.h"
+
+using namespace std;
+using namespace ML;
+using namespace Datacratic;
+
+
+namespace {
+
+/* value of the given quantile in a sorted vector, as GaugeAggregator
+   computes it */
+double exactQuantile(const vector<double> & sorted, double quantile)
+{
+    size_t rank = min<double>(sorted.size() - 1, quantile * sorted.size());
+    return sorted[rank];
+}
+
+void checkQuantiles(const QuantileSketch & sketch, vector<double> values)
+{
+    std::sort(values.begin(), values.end());
+
+    BOOST_REQUIRE_EQUAL(sketch.count(), values.size());
+    BOOST_CHECK_EQUAL(sketch.min(), values.front());
+    BOOST_CHECK_EQUAL(sketch.max(), values.back());
+
+    for (double q: { 0.0, 0.01, 0.1, 0.25, 0.5, 0.75, 0.9, 0.95, 0.98,
+                     0.99, 0.999, 1.0 }) {
+        double expected = exactQuantile(values, q);
+        double actual = sketch.quantile(q);
+        BOOST_CHECK_MESSAGE(fabs(actual - expected)
+                            <= sketch.relativeAccuracy() * fabs(expected),
+                            "quantile " << q << ": expected " << expected
+                            << ", got " << actual);
+    }
+}
+
+} // file scope
+
+
+BOOST_AUTO_TEST_CASE( test_quantile_sketch_accuracy )
+{
+    mt19937 rng(42);
+    lognormal_distribution<double> latencies(2.0, 1.5);
+
+    QuantileSketch sketch;
+    BOOST_CHECK(sketch.empty());
+    BOOST_CHECK(isnan(sketch.quantile(0.5)));
+
+    vector<double> values;
+    for (int i = 0; i < 100000; i++) {
+        double value = latencies(rng);
+        /* some negatives and zeros */
+        if (i % 10 == 0) {
+            value = -value;
+        }
+        else if (i % 101 == 0) {
+            value = 0.0;
+        }
+        values.push_back(value);
+        sketch.add(value);
+    }
+    sketch.add(NAN);
+
+    checkQuantiles(sketch, values);
+
+    /* clearing keeps the buckets, to be reused */
+    sketch.clear();
+    BOOST_CHECK(sketch.empty());
+    sketch.add(12.0);
+    BOOST_CHECK_EQUAL(sketch.quantile(0.5), 12.0);
+    BOOST_CHECK_EQUAL(sketch.mean(), 12.0);
+
+    BOOST_CHECK_THROW(QuantileSketch(0.0), ML::Exception);
+    BOOST_CHECK_THROW(QuantileSketch(1.0), ML::Exception);
+}
+
+BOOST_AUTO_TEST_CASE( test_quantile_sketch_merge_serialize )
+{
+    mt19937 rng(1);
+    exponential_distribution<double> small(1000.0);
+    exponential_distribution<double> large(0.001);
+
+    /* sketches of disjoint ranges, as seen by different threads */
+    QuantileSketch sketch1, sketch2, sketch3(0.05);
+    vector<double> values;
+    for (int i = 0; i < 10000; i++) {
+        double value1 = small(rng);
+        double value2 = large(rng);
+        sketch1.add(value1);
+        sketch2.add(value2);
+        values.push_back(value1);
+        values.push_back(value2);
+    }
+
+    BOOST_CHECK_THROW(sketch1.merge(sketch3), ML::Exception);
+
+    /* as another process would receive it */
+    ostringstream oStream;
+    {
+        DB::Store_Writer oStore(oStream);
+        sketch2.serialize(oStore);
+    }
+
+    istringstream iStream(oStream.str());
+    QuantileSketch received;
+    {
+        DB::Store_Reader iStore(iStream);
+        received.reconstitute(iStore);
+    }
+    BOOST_CHECK_EQUAL(received.count(), sketch2.count());
+    BOOST_CHECK_EQUAL(received.sum(), sketch2.sum());
+    BOOST_CHECK_EQUAL(received.quantile(0.5), sketch2.quantile(0.5));
+
+    sketch1.merge(received);
+    checkQuantiles(sketch1, values);
+
+    /* merging into an empty sketch */
+    QuantileSketch merged;
+    merged.merge(sketch1);
+    BOOST_CHECK_EQUAL(merged.count(), values.size());
+    BOOST_CHECK_EQUAL(merged.quantile(0.9), sketch1.quantile(0.9));
+}
+
+BOOST_AUTO_TEST_CASE( test_gauge_aggregator_sketch )
+{
+    GaugeAggregator aggregator(GaugeAggregator::Outcome, { 50, 90 },
+                               GaugeAggregator::Sketch);
+    BOOST_CHECK_THROW(aggregator.reset(), ML::Exception);
+
+    for (int round = 0; round < 2; round++) {
+        for (int i = 1; i <= 1000; i++) {
+            aggregator.record(i);
+        }
+        float batch[] = { 0.5, 2000.0 };
+        aggregator.record(batch, 2);
+
+        map<string, double> readings;
+        for (const StatReading & reading: aggregator.read("latency")) {
+            readings[reading.name] = reading.value;
+        }
+
+        BOOST_CHECK_EQUAL(readings.size(), 6);
+        BOOST_CHECK_EQUAL(readings["latency.count"], 1002);
+        BOOST_CHECK_CLOSE(readings["latency.mean"],
+                          (500500.0 + 2000.5) / 1002, 0.0001);
+        BOOST_CHECK_EQUAL(readings["latency.lower"], 0.5);
+        BOOST_CHECK_EQUAL(readings["latency.upper"], 2000.0);
+        BOOST_CHECK_CLOSE(readings["latency.upper_50"], 501.0, 1.0);
+        BOOST_CHECK_CLOSE(readings["latency.upper_90"], 902.0, 1.0);
+    }
+
+    BOOST_CHECK(aggregator.read("latency").empty());
+}
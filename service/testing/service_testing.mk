@@ -1,6 +1,7 @@
 $(eval $(call library,mongo_tmp_server,mongo_temporary_server.cc, services))
 
 $(eval $(call test,epoll_test,services,boost))
+$(eval $(call test,async_writer_source_test,services,boost))
 $(eval $(call test,epoll_wait_test,services,boost manual))
 
 $(eval $(call test,message_channel_test,services,boost))
@@ -14,6 +15,7 @@ $(eval $(call nodejs_test,opstats_js_test,opstats,,,manual))
 
 $(eval $(call test,statsd_connector_test,opstats,boost  manual))
 $(eval $(call test,carbon_connector_test,opstats endpoint,boost manual))
+$(eval $(call test,quantile_sketch_test,opstats,boost))
 
 $(eval $(call test,endpoint_unit_test,endpoint,boost))
 $(eval $(call test,test_active_endpoint_nothing_listening,endpoint,boost manual))
@@ -29,6 +31,7 @@ $(eval $(call test,http_rest_proxy_stress_test,services,boost manual))
 $(eval $(call test,service_proxies_test,endpoint,boost manual))
 
 $(eval $(call test,message_loop_test,services,boost))
+$(eval $(call test,timer_wheel_test,services,boost))
 
 $(eval $(call program,runner_test_helper,utils))
 $(eval $(call test,runner_test,services,boost))
@@ -50,6 +53,7 @@ $(eval $(call test,http_client_test_v2,services test_services,boost manual))
 $(eval $(call test,http_client_online_test,services test_services,boost manual))
 $(eval $(call test,http_client_bench,boost_program_options services test_services,boost manual))
 $(eval $(call test,http_parsers_test,services test_services,boost valgrind))
+$(eval $(call test,http_parsers_bench,services,boost manual))
 
 $(eval $(call test,logs_test,services,boost))
 
@@ -0,0 +1,258 @@
+/* timer_wheel_test.cc
+   Copyright (c) 2015 Datacratic.  All rights reserved.
+
+   Tests for TimerWheel, TimeoutMap and TimerSource.
+*/
+
+#define BOOST_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+
+#include <poll.h>
+
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+#include "soa/types/date.h"
+#include "soa/service/timeout_map.h"
+#include "soa/service/timer_source.h"
+#include "soa/service/timer_wheel.h"
+
+using namespace std;
+using namespace Datacratic;
+
+
+/* Compare the wheel against a reference multimap with random operations,
+ * at dates spanning all levels of the wheel. */
+BOOST_AUTO_TEST_CASE( test_timer_wheel_vs_reference )
+{
+    Date start = Date::fromSecondsSinceEpoch(1000000.0);
+    TimerWheel<int> wheel(0.001, start);
+
+    mt19937 rng(1234);
+    uniform_real_distribution<double> unit(0.0, 1.0);
+
+    map<TimerWheel<int>::Id, Date> armed;
+    Date now = start;
+    int nextValue(0);
+    map<int, TimerWheel<int>::Id> ids;
+
+    for (int round = 0; round < 2000; round++) {
+        /* arm timers between now and 10^7 seconds from now, on a log
+           scale */
+        for (int i = 0; i < 20; i++) {
+            double delay = pow(10.0, unit(rng) * 10.0 - 3.0);
+            Date expiry = now.plusSeconds(delay);
+            int value = nextValue++;
+            auto id = wheel.arm(expiry, value);
+            BOOST_REQUIRE(armed.insert(make_pair(id, expiry)).second);
+            ids[value] = id;
+        }
+
+        /* cancel some */
+        for (int i = 0; i < 5 && !armed.empty(); i++) {
+            auto it = armed.begin();
+            advance(it, rng() % armed.size());
+            BOOST_CHECK(wheel.cancel(it->first));
+            BOOST_CHECK(!wheel.cancel(it->first));
+            armed.erase(it);
+        }
+        BOOST_REQUIRE_EQUAL(wheel.size(), armed.size());
+
+        /* the next expiry is never later than the earliest timer */
+        Date earliest = Date::positiveInfinity();
+        for (const auto & entry: armed) {
+            earliest = min(earliest, entry.second);
+        }
+        Date next = wheel.nextExpiry();
+        BOOST_REQUIRE(next <= earliest);
+
+        /* move forward by a random amount, sometimes up to the next
+           expiry */
+        if (round % 3 == 0 && next.secondsSinceEpoch() < INFINITY) {
+            now = max(now, next);
+        }
+        else {
+            now = now.plusSeconds(pow(10.0, unit(rng) * 8.0 - 4.0));
+        }
+
+        Date lastExpiry;
+        wheel.expire(now, [&] (TimerWheel<int>::Id id, int value) {
+            auto it = armed.find(id);
+            BOOST_REQUIRE(it != armed.end());
+            BOOST_CHECK_EQUAL(ids[value], id);
+            BOOST_CHECK(it->second <= now);
+            /* ordered by tick */
+            BOOST_CHECK(it->second.secondsSinceEpoch()
+                        > lastExpiry.secondsSinceEpoch() - 0.001);
+            lastExpiry = it->second;
+            armed.erase(it);
+        });
+
+        for (const auto & entry: armed) {
+            BOOST_REQUIRE(entry.second > now);
+            BOOST_REQUIRE(wheel.contains(entry.first));
+        }
+        BOOST_REQUIRE_EQUAL(wheel.size(), armed.size());
+    }
+
+    /* everything expires eventually */
+    wheel.expire(Date::fromSecondsSinceEpoch(1e10),
+                 [&] (TimerWheel<int>::Id id, int value) {
+        armed.erase(id);
+    });
+    BOOST_CHECK(armed.empty());
+    BOOST_CHECK(wheel.empty());
+    BOOST_CHECK_EQUAL(wheel.nextExpiry(), Date::positiveInfinity());
+}
+
+/* Ensure that timers can be armed, rearmed and cancelled from the expiry
+ * callback, and that timers armed in the past expire on the next call. */
+BOOST_AUTO_TEST_CASE( test_timer_wheel_reentrancy )
+{
+    Date start = Date::fromSecondsSinceEpoch(1000000.0);
+    TimerWheel<string> wheel(0.01, start);
+
+    auto a = wheel.arm(start.plusSeconds(1.0), "a");
+    auto b = wheel.arm(start.plusSeconds(1.0), "b");
+    auto c = wheel.arm(start.plusSeconds(5.0), "c");
+    auto d = wheel.arm(start.plusSeconds(1.005), "d");
+
+    vector<string> fired;
+    auto onExpire = [&] (TimerWheel<string>::Id id, const string & value) {
+        fired.push_back(value);
+        if (value == "a" || value == "b") {
+            /* cancel whichever of the two has not fired yet */
+            wheel.cancel(value == "a" ? b : a);
+            wheel.rearm(c, start.plusSeconds(2.0));
+            wheel.arm(start, "past");
+        }
+    };
+
+    /* "d" has the same tick as "a" and "b" but a later date */
+    BOOST_CHECK_EQUAL(wheel.expire(start.plusSeconds(1.001), onExpire), 1);
+    BOOST_REQUIRE_EQUAL(fired.size(), 1);
+    BOOST_CHECK(fired[0] == "a" || fired[0] == "b");
+    BOOST_CHECK_EQUAL(wheel.size(), 3);
+    BOOST_CHECK_EQUAL(wheel.expiry(c), start.plusSeconds(2.0));
+    BOOST_CHECK(wheel.contains(d));
+
+    fired.clear();
+    BOOST_CHECK_EQUAL(wheel.expire(start.plusSeconds(1.001), onExpire), 1);
+    BOOST_CHECK(fired == vector<string>({"past"}));
+
+    fired.clear();
+    BOOST_CHECK_EQUAL(wheel.expire(start.plusSeconds(3.0), onExpire), 2);
+    BOOST_CHECK(fired == vector<string>({"d", "c"}));
+    BOOST_CHECK(wheel.empty());
+
+    /* ids are not reused */
+    BOOST_CHECK(!wheel.cancel(a));
+    BOOST_CHECK(!wheel.rearm(c, start));
+    auto e = wheel.arm(start.plusSeconds(4.0), "e");
+    BOOST_CHECK(e != a && e != b && e != c && e != d);
+    BOOST_CHECK(!wheel.contains(c));
+}
+
+BOOST_AUTO_TEST_CASE( test_timeout_map )
+{
+    Date start = Date::now();
+    TimeoutMap<int, pair<int, int> > map;
+
+    map.insert(1, make_pair(1, 1), start.plusSeconds(1.0));
+    map.insert(2, make_pair(2, 2), start.plusSeconds(2.0));
+    map.insert(3, make_pair(3, 3), start.plusSeconds(3.0));
+    BOOST_CHECK_THROW(map.insert(3, make_pair(3, 3), start), ML::Exception);
+    BOOST_CHECK_EQUAL(map.earliest, start.plusSeconds(1.0));
+
+    map.updateTimeout(3, start.plusSeconds(0.5));
+    BOOST_CHECK(map.earliest <= start.plusSeconds(0.5));
+    BOOST_CHECK(map.erase(2));
+    BOOST_CHECK(!map.erase(2));
+
+    /* the entry of key 1 is renewed once */
+    vector<int> expired;
+    auto onExpire = [&] (int key, pair<int, int> & value) {
+        expired.push_back(key);
+        if (key == 1 && value.second == 1) {
+            value.second = 0;
+            return start.plusSeconds(4.0);
+        }
+        return Date();
+    };
+
+    map.expire(onExpire, start.plusSeconds(1.0));
+    BOOST_CHECK(expired == vector<int>({3, 1}));
+    BOOST_CHECK_EQUAL(map.size(), 1);
+    BOOST_CHECK_EQUAL(map.find(1)->second.timeout, start.plusSeconds(4.0));
+    BOOST_CHECK(map.earliest <= start.plusSeconds(4.0));
+    BOOST_CHECK(map.earliest > start.plusSeconds(1.0));
+
+    map.expire(start.plusSeconds(4.0));
+    BOOST_CHECK(map.empty());
+    BOOST_CHECK_EQUAL(map.earliest, Date::positiveInfinity());
+}
+
+BOOST_AUTO_TEST_CASE( test_timeout_map_update_from_expiry )
+{
+    Date start = Date::now();
+    TimeoutMap<int, pair<int, int> > map;
+
+    map.insert(1, make_pair(1, 1), start.plusSeconds(1.0));
+    map.insert(2, make_pair(2, 2), start.plusSeconds(1.0));
+    map.insert(3, make_pair(3, 3), start.plusSeconds(1.0));
+
+    /* each entry is updated from its own callback, whose result then
+       keeps that timeout (1), replaces it (2) or removes the entry (3) */
+    auto onExpire = [&] (int key, pair<int, int> & value) {
+        map.updateTimeout(key, start.plusSeconds(2.0));
+        BOOST_CHECK(map.timeouts.contains(map.find(key)->second.timeoutId));
+        if (key == 2)
+            return start.plusSeconds(3.0);
+        return key == 1 ? start.plusSeconds(2.0) : Date();
+    };
+
+    map.expire(onExpire, start.plusSeconds(1.0));
+    BOOST_CHECK_EQUAL(map.size(), 2);
+    BOOST_CHECK_EQUAL(map.timeouts.size(), 2);
+    BOOST_CHECK_EQUAL(map.find(1)->second.timeout, start.plusSeconds(2.0));
+    BOOST_CHECK_EQUAL(map.find(2)->second.timeout, start.plusSeconds(3.0));
+    BOOST_CHECK(map.earliest <= start.plusSeconds(2.0));
+
+    map.expire(start.plusSeconds(2.0));
+    BOOST_CHECK_EQUAL(map.size(), 1);
+    BOOST_CHECK(map.count(2));
+
+    map.expire(start.plusSeconds(3.0));
+    BOOST_CHECK(map.empty());
+}
+
+BOOST_AUTO_TEST_CASE( test_timer_source )
+{
+    TimerSource timers;
+
+    vector<int> fired;
+    timers.armRelative(0.05, [&] () { fired.push_back(1); });
+    auto id = timers.armRelative(0.02, [&] () { fired.push_back(2); });
+    timers.armRelative(0.01, [&] () {
+        fired.push_back(3);
+        timers.armRelative(0.0, [&] () { fired.push_back(4); });
+    });
+    BOOST_CHECK(timers.cancel(id));
+    BOOST_CHECK_EQUAL(timers.size(), 2);
+
+    Date start = Date::now();
+    while (fired.size() < 3 && Date::now() < start.plusSeconds(2.0)) {
+        pollfd item = { timers.selectFd(), POLLIN, 0 };
+        int res = ::poll(&item, 1, 1000);
+        BOOST_REQUIRE_EQUAL(res, 1);
+        timers.processOne();
+    }
+
+    BOOST_CHECK(fired == vector<int>({3, 4, 1}));
+    BOOST_CHECK(Date::now() >= start.plusSeconds(0.04));
+    BOOST_CHECK_EQUAL(timers.size(), 0);
+}
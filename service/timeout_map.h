@@ -2,7 +2,9 @@
    Jeremy Barnes, 2 February 2012
    Copyright (c) 2012 Datacratic.  All rights reserved.
 
-   Map from key -> value with inbuilt timeouts.
+   Map from key -> value with inbuilt timeouts.  The timeouts are kept in a
+   TimerWheel, so that inserting and removing entries does not depend on the
+   number of outstanding timeouts.
 
    Eventually will allow persistance.
 */
@@ -12,6 +14,7 @@
 
 #include <map>
 #include "soa/types/date.h"
+#include "soa/service/timer_wheel.h"
 #include <boost/function.hpp>
 #include "jml/arch/exception.h"
 #include <math.h>
@@ -59,8 +62,7 @@ struct TimeoutMap {
                 doThrowException("no default timeout specified and insert "
                                  "not used");
             Date timeout = Date::now().plusSeconds(defaultTimeout);
-            it->second.timeoutIt = timeouts.insert(std::make_pair(timeout, it));
-            if (timeout < earliest) earliest = timeout;
+            insertTimeout(it, timeout);
         }
         
         return it->second;
@@ -75,8 +77,7 @@ struct TimeoutMap {
         auto it = res.first;
         if (res.second) {
             // inserted... insert the timeout
-            it->second.timeoutIt = timeouts.insert(std::make_pair(timeout, it));
-            if (timeout < earliest) earliest = timeout;
+            insertTimeout(it, timeout);
         }
         else {
             // already existed... update the timeout
@@ -97,14 +98,13 @@ struct TimeoutMap {
             std::cerr << "contents (" << nodes.size() << ") = " << std::endl;
             int n = 0;
             for (auto it = nodes.begin(), end = nodes.end();  it != end && n < 20;  ++it, ++n)
-                std::cerr << it->first << " @ " << it->second.timeoutIt->first << " "
+                std::cerr << it->first << " @ " << it->second.timeout << " "
                           << (it->first == key ? "*****" : "") << std::endl;
             doThrowException("TimeoutMap: "
                              "attempt to re-insert existing key");
         }
         auto it = res.first;
-        it->second.timeoutIt = timeouts.insert(std::make_pair(timeout, it));
-        if (timeout < earliest) earliest = timeout;
+        insertTimeout(it, timeout);
         return it->second;
     }
 
@@ -119,14 +119,13 @@ struct TimeoutMap {
             std::cerr << "contents (" << nodes.size() << ") = " << std::endl;
             int n = 0;
             for (auto it = nodes.begin(), end = nodes.end();  it != end && n < 20;  ++it, ++n)
-                std::cerr << it->first << " @ " << it->second.timeoutIt->first << " "
+                std::cerr << it->first << " @ " << it->second.timeout << " "
                           << (it->first == key ? "*****" : "") << std::endl;
             doThrowException("TimeoutMap: "
                              "attempt to re-insert existing key");
         }
         auto it = res.first;
-        it->second.timeoutIt = timeouts.insert(std::make_pair(timeout, it));
-        if (timeout < earliest) earliest = timeout;
+        insertTimeout(it, timeout);
         return it->second;
     }
 
@@ -179,66 +178,63 @@ struct TimeoutMap {
 #endif
 
     /** Call the callback on any which have expired, removing them from
-        the map.
+        the map unless the callback returns a new expiry date.
     */
     template<typename Callback>
     void expire(const Callback & callback, Date now = Date::now())
     {
-        // Look for loss timeout expiries
-        for (auto it = timeouts.begin(), end = timeouts.end();
-             it != end && it->first <= now;  /* no inc */) {
-            auto it2 = it;
-            auto expired = it->second;
+        timeouts.expire(now, [&] (typename Timeouts::Id id,
+                                  typename Nodes::iterator expired) {
+            expired->second.timeoutId = 0;
             Date newExpiry = callback(expired->first, expired->second);
-            ++it;
+            // The callback may have given the entry a new timeout already
             if (newExpiry != Date()) {
-                auto tit = expired->second.timeoutIt;
-                timeouts.erase(tit);
-                expired->second.timeoutIt
-                    = timeouts.insert(make_pair(newExpiry, expired));
-                if (newExpiry < earliest) earliest = newExpiry;
+                if (!timeouts.rearm(expired->second.timeoutId, newExpiry))
+                    insertTimeout(expired, newExpiry);
+                else expired->second.timeout = newExpiry;
             } else {
-                erase(expired);
+                timeouts.cancel(expired->second.timeoutId);
+                nodes.erase(expired);
             }
-        }
+        });
+        earliest = timeouts.nextExpiry();
     }
 
     /** Remove any which have expired. */
     void expire(Date now = Date::now())
     {
-        // Look for loss timeout expiries
-        for (auto it = timeouts.begin(), end = timeouts.end();
-             it != end && it->first <= now;  /* no inc */) {
-            auto expired = it->second;
-            ++it;
-            erase(expired);
-        }
+        timeouts.expire(now, [&] (typename Timeouts::Id id,
+                                  typename Nodes::iterator expired) {
+            nodes.erase(expired);
+        });
+        earliest = timeouts.nextExpiry();
     }
     
     typedef std::map<Key, Node> Nodes;
     Nodes nodes;
 
-    /** Ordered set of timeouts in submitted for auction loss messages. */
-    typedef std::multimap<Date, typename Nodes::iterator> Timeouts;
+    /** Timeouts of the entries. */
+    typedef TimerWheel<typename Nodes::iterator> Timeouts;
     Timeouts timeouts;
 
-    // Date of the earliest timeout
+    // Date of the earliest timeout.  After a removal or an expiry, this may
+    // be earlier than the actual earliest timeout, but never later.
     Date earliest;
 
     struct Node : public Value {
-        Node() {}
+        Node() : timeoutId(0) {}
         Node(const Value & val, Date timeout)
-            : Value(val), timeout(timeout)
+            : Value(val), timeout(timeout), timeoutId(0)
         {
         }
 
         Node(Value && val, Date timeout)
-            : Value(val), timeout(timeout)
+            : Value(val), timeout(timeout), timeoutId(0)
         {
         }
 
         Date timeout;
-        typename Timeouts::iterator timeoutIt;
+        typename Timeouts::Id timeoutId;
     };
 
     typedef typename Nodes::const_iterator const_iterator;
@@ -301,12 +297,9 @@ struct TimeoutMap {
     {
         if (it == nodes.end())
             doThrowException("erasing with invalid iterator");
-        auto tit = it->second.timeoutIt;
+        timeouts.cancel(it->second.timeoutId);
         nodes.erase(it);
-        timeouts.erase(tit);
-        if (timeouts.empty())
-            earliest = Date::positiveInfinity();
-        else earliest = timeouts.begin()->first;
+        earliest = timeouts.nextExpiry();
     }
 
     void updateTimeout(const iterator & it, Date timeout)
@@ -314,10 +307,12 @@ struct TimeoutMap {
         if (it == nodes.end())
             throw ML::Exception("attempt to update wrong timeout");
 
-        auto & tit = it->second.timeoutIt;
-        timeouts.erase(tit);
-        tit = timeouts.insert(std::make_pair(timeout, it));
-        earliest = timeouts.begin()->first;
+        // Not armed from within its expiry callback, as the timer has
+        // already fired
+        if (!timeouts.rearm(it->second.timeoutId, timeout))
+            insertTimeout(it, timeout);
+        else it->second.timeout = timeout;
+        earliest = timeouts.nextExpiry();
     }
 
     size_t size() const
@@ -336,6 +331,14 @@ struct TimeoutMap {
         nodes.clear();
         earliest = Date::positiveInfinity();
     }
+
+private:
+    void insertTimeout(const iterator & it, Date timeout)
+    {
+        it->second.timeout = timeout;
+        it->second.timeoutId = timeouts.arm(timeout, it);
+        if (timeout < earliest) earliest = timeout;
+    }
 };
 
 
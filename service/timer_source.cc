@@ -0,0 +1,112 @@
+/* timer_source.cc
+   Copyright (c) 2015 Datacratic.  All rights reserved.
+
+*/
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include <iostream>
+
+#include "jml/arch/exception.h"
+#include "soa/service/timer_source.h"
+
+using namespace std;
+using namespace Datacratic;
+
+
+/****************************************************************************/
+/* TIMER SOURCE                                                             */
+/****************************************************************************/
+
+TimerSource::
+TimerSource(double resolution)
+    : wheel_(resolution), timerFd_(-1),
+      armedExpiry_(Date::positiveInfinity())
+{
+    /* Dates are expressed in wall clock time */
+    timerFd_ = ::timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timerFd_ == -1) {
+        throw ML::Exception(errno, "timerfd_create");
+    }
+}
+
+TimerSource::
+~TimerSource()
+{
+    int res = ::close(timerFd_);
+    if (res == -1) {
+        cerr << "warning: close on timerfd: " << strerror(errno) << endl;
+    }
+}
+
+TimerSource::Id
+TimerSource::
+arm(Date expiry, OnTimer onTimer)
+{
+    Id id = wheel_.arm(expiry, move(onTimer));
+
+    /* Cancelled timers are not removed from the timerfd, which then merely
+       causes a spurious wakeup. */
+    if (expiry < armedExpiry_) {
+        setTimerFd(expiry);
+    }
+
+    return id;
+}
+
+bool
+TimerSource::
+cancel(Id id)
+{
+    return wheel_.cancel(id);
+}
+
+bool
+TimerSource::
+processOne()
+{
+    uint64_t numWakeups;
+    int res = ::read(timerFd_, &numWakeups, sizeof(numWakeups));
+    if (res == -1 && errno != EAGAIN && errno != EINTR) {
+        throw ML::Exception(errno, "timerfd read");
+    }
+
+    /* an absolute timer is not rearmed after expiring */
+    Date now = Date::now();
+    if (armedExpiry_ <= now) {
+        armedExpiry_ = Date::positiveInfinity();
+    }
+
+    wheel_.expire(now, [&] (Id id, OnTimer & onTimer) {
+        onTimer();
+    });
+
+    Date next = wheel_.nextExpiry();
+    if (next < armedExpiry_) {
+        setTimerFd(next);
+    }
+
+    return false;
+}
+
+void
+TimerSource::
+setTimerFd(Date expiry)
+{
+    itimerspec spec = { { 0, 0 }, { 0, 0 } };
+
+    /* a zero value disarms the timer */
+    long seconds = std::max<long>(expiry.wholeSecondsSinceEpoch(), 1);
+    long nanoseconds = expiry.fractionalSeconds() * 1000000000.0;
+    spec.it_value.tv_sec = seconds;
+    spec.it_value.tv_nsec = nanoseconds;
+
+    int res = ::timerfd_settime(timerFd_, TFD_TIMER_ABSTIME, &spec, nullptr);
+    if (res == -1) {
+        throw ML::Exception(errno, "timerfd_settime");
+    }
+    armedExpiry_ = expiry;
+}
@@ -0,0 +1,77 @@
+/* timer_source.h                                                  -*- C++ -*-
+   Copyright (c) 2015 Datacratic.  All rights reserved.
+
+   Event source running any number of one-shot timers on a single timerfd.
+*/
+
+#pragma once
+
+#include <functional>
+
+#include "soa/types/date.h"
+#include "soa/service/async_event_source.h"
+#include "soa/service/timer_wheel.h"
+
+
+namespace Datacratic {
+
+/****************************************************************************/
+/* TIMER SOURCE                                                             */
+/****************************************************************************/
+
+/* An event source that invokes callbacks at given dates. The timers are kept
+ * in a TimerWheel and share a single timerfd, which is always set to the
+ * earliest of them, so that a loop can host as many timeouts as needed
+ * without creating a file descriptor for each of them.
+ *
+ * Timers must be armed and cancelled from the thread of the loop, or with
+ * the same lock held as when invoking "processOne". */
+
+struct TimerSource : public AsyncEventSource {
+    typedef std::function<void ()> OnTimer;
+    typedef TimerWheel<OnTimer>::Id Id;
+
+    TimerSource(double resolution = 0.001);
+    ~TimerSource();
+
+    TimerSource(const TimerSource & other) = delete;
+    TimerSource & operator = (const TimerSource & other) = delete;
+
+    /* Invoke "onTimer" once "expiry" has passed. */
+    Id arm(Date expiry, OnTimer onTimer);
+
+    /* Invoke "onTimer" in "seconds" seconds. */
+    Id armRelative(double seconds, OnTimer onTimer)
+    {
+        return arm(Date::now().plusSeconds(seconds), std::move(onTimer));
+    }
+
+    /* Disarm the given timer. Returns false if it had already expired or
+       been cancelled. */
+    bool cancel(Id id);
+
+    /* Number of armed timers */
+    size_t size() const
+    {
+        return wheel_.size();
+    }
+
+    /* AsyncEventSource */
+    virtual int selectFd() const
+    {
+        return timerFd_;
+    }
+
+    virtual bool processOne();
+
+private:
+    void setTimerFd(Date expiry);
+
+    TimerWheel<OnTimer> wheel_;
+    int timerFd_;
+
+    /* date at which the timerfd is set to expire */
+    Date armedExpiry_;
+};
+
+} // namespace Datacratic
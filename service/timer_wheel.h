@@ -0,0 +1,499 @@
+/* timer_wheel.h                                                   -*- C++ -*-
+   Copyright (c) 2015 Datacratic.  All rights reserved.
+
+   Hashed hierarchical timer wheel.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <math.h>
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "jml/arch/exception.h"
+#include "soa/types/date.h"
+
+
+namespace Datacratic {
+
+/****************************************************************************/
+/* TIMER WHEEL                                                              */
+/****************************************************************************/
+
+/* A hashed hierarchical timer wheel, which associates values to expiry dates
+ * and hands them back once their date has passed. Arming and cancelling a
+ * timer are O(1), whatever the number of timers, and expiring them costs
+ * O(1) per timer plus a small amount of work per 256 ticks elapsed.
+ *
+ * Time is divided in ticks of "resolution" seconds. Level 0 has one slot per
+ * tick and holds the timers expiring within the next 256 ticks, level 1 has
+ * one slot per 256 ticks and holds those expiring within the next 256^2
+ * ticks, and so on up to level 3. The timers of a slot of a higher level are
+ * moved down ("cascaded") when the current tick enters the range covered by
+ * that slot. Timers further away than 256^4 ticks wait in level 3 until they
+ * come closer.
+ *
+ * The exact expiry dates are kept with the timers, so that a timer is never
+ * handed back before its date, whatever the resolution.
+ *
+ * This class is not thread-safe.
+ */
+
+template<typename Value>
+struct TimerWheel {
+    /* Identifies an armed timer. 0 is never a valid id. */
+    typedef uint64_t Id;
+
+    TimerWheel(double resolution = 0.001, Date start = Date::now())
+        : resolution_(resolution), start_(start)
+    {
+        if (!(resolution > 0.0)) {
+            throw ML::Exception("timer wheel resolution must be positive");
+        }
+        clear();
+        current_ = 0;
+    }
+
+    /* Arm a timer for "value", expiring at "expiry". */
+    Id arm(Date expiry, Value value)
+    {
+        uint32_t idx = allocNode();
+        Node & node = nodes_[idx];
+        node.expiry = expiry;
+        node.tick = std::max(tickOf(expiry), current_);
+        node.value = std::move(value);
+        link(idx);
+        size_++;
+
+        return makeId(idx, node.generation);
+    }
+
+    /* Change the expiry of an armed timer. Returns false if "id" is not
+       armed. */
+    bool rearm(Id id, Date expiry)
+    {
+        uint32_t idx = findNode(id);
+        if (idx == Nil) {
+            return false;
+        }
+        unlink(idx);
+        Node & node = nodes_[idx];
+        node.expiry = expiry;
+        node.tick = std::max(tickOf(expiry), current_);
+        link(idx);
+
+        return true;
+    }
+
+    /* Disarm a timer. Returns false if "id" is not armed. */
+    bool cancel(Id id)
+    {
+        uint32_t idx = findNode(id);
+        if (idx == Nil) {
+            return false;
+        }
+        unlink(idx);
+        freeNode(idx);
+        size_--;
+
+        return true;
+    }
+
+    bool contains(Id id) const
+    {
+        return findNode(id) != Nil;
+    }
+
+    /* Expiry date of an armed timer */
+    Date expiry(Id id) const
+    {
+        uint32_t idx = findNode(id);
+        if (idx == Nil) {
+            throw ML::Exception("timer is not armed");
+        }
+        return nodes_[idx].expiry;
+    }
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+
+    /* Disarm all the timers. */
+    void clear()
+    {
+        nodes_.clear();
+        freeList_ = Nil;
+        std::fill(heads_, heads_ + NumSlots + 1, Nil);
+        std::fill(occupied_, occupied_ + NumSlots / 64, 0);
+        size_ = 0;
+    }
+
+    /* Date at which "expire" should be invoked next: the expiry of the
+       earliest timer, or an earlier date when timers need to be cascaded
+       before that. Returns positive infinity when no timer is armed. */
+    Date nextExpiry() const
+    {
+        if (size_ == 0) {
+            return Date::positiveInfinity();
+        }
+
+        double result(INFINITY);
+
+        /* the timers of level 0 have exact dates */
+        unsigned pos = current_ & SlotMask;
+        int slot = findOccupied(0, pos);
+        if (slot == -1) {
+            slot = findOccupied(0, 0);
+        }
+        if (slot != -1) {
+            for (uint32_t idx = heads_[slot]; idx != Nil;
+                 idx = nodes_[idx].next) {
+                result = std::min(result,
+                                  nodes_[idx].expiry.secondsSinceEpoch());
+            }
+        }
+
+        /* for the other levels, the start of the range of their earliest
+           occupied slot, where the timers will be cascaded */
+        for (unsigned level = 1; level < NumLevels; level++) {
+            unsigned shift = LevelBits * level;
+            pos = (current_ >> shift) & SlotMask;
+            slot = findOccupied(level, pos + 1);
+            if (slot == -1) {
+                slot = findOccupied(level, 0);
+            }
+            if (slot != -1) {
+                uint64_t delta = (slot - pos) & SlotMask;
+                if (delta == 0) {
+                    delta = SlotsPerLevel;
+                }
+                uint64_t tick = ((current_ >> shift) + delta) << shift;
+                result = std::min(result,
+                                  start_.secondsSinceEpoch()
+                                  + tick * resolution_);
+            }
+        }
+
+        return Date::fromSecondsSinceEpoch(result);
+    }
+
+    /* Disarm the timers that expire on or before "now" and invoke
+       "callback(id, value)" for each of them, ordered by tick. The callback
+       may arm and cancel timers; those armed with a date on or before "now"
+       are handed back by the next invocation. Returns the number of expired
+       timers. */
+    template<typename Callback>
+    size_t expire(Date now, const Callback & callback)
+    {
+        uint64_t target = tickOf(now);
+        size_t numExpired(0);
+
+        for (;;) {
+            numExpired += fireSlot(current_ & SlotMask, now, callback);
+            if (current_ >= target) {
+                break;
+            }
+
+            /* timers left in the slot of the current tick move to the next
+               one */
+            if (heads_[current_ & SlotMask] != Nil) {
+                relinkSlot(current_ & SlotMask, current_ + 1);
+            }
+            advance(target);
+        }
+
+        return numExpired;
+    }
+
+private:
+    enum {
+        LevelBits = 8,
+        SlotsPerLevel = 1 << LevelBits,
+        SlotMask = SlotsPerLevel - 1,
+        NumLevels = 4,
+        NumSlots = NumLevels * SlotsPerLevel,
+        FiringSlot = NumSlots       /* timers being expired */
+    };
+
+    static constexpr uint32_t Nil = uint32_t(-1);
+    static constexpr uint64_t MaxTick = uint64_t(1) << 62;
+
+    struct Node {
+        Node()
+            : tick(0), generation(0), prev(Nil), next(Nil), slot(Nil)
+        {
+        }
+
+        Date expiry;
+        uint64_t tick;
+        uint32_t generation;
+        uint32_t prev;
+        uint32_t next;      /* next free node when the node is free */
+        uint32_t slot;      /* Nil when the node is free */
+        Value value;
+    };
+
+    static Id makeId(uint32_t idx, uint32_t generation)
+    {
+        return (uint64_t(generation) << 32) | (uint64_t(idx) + 1);
+    }
+
+    uint64_t tickOf(Date date) const
+    {
+        double ticks = ((date.secondsSinceEpoch() - start_.secondsSinceEpoch())
+                        / resolution_);
+        if (!(ticks > 0.0)) {
+            return 0;
+        }
+        if (ticks >= double(MaxTick)) {
+            return MaxTick;
+        }
+        return uint64_t(ticks);
+    }
+
+    uint32_t findNode(Id id) const
+    {
+        uint32_t low = uint32_t(id);
+        if (low == 0 || low > nodes_.size()) {
+            return Nil;
+        }
+        uint32_t idx = low - 1;
+        const Node & node = nodes_[idx];
+        if (node.slot == Nil || node.generation != uint32_t(id >> 32)) {
+            return Nil;
+        }
+        return idx;
+    }
+
+    uint32_t allocNode()
+    {
+        if (freeList_ != Nil) {
+            uint32_t idx = freeList_;
+            freeList_ = nodes_[idx].next;
+            return idx;
+        }
+        if (nodes_.size() >= Nil - 1) {
+            throw ML::Exception("too many timers");
+        }
+        nodes_.emplace_back();
+        return nodes_.size() - 1;
+    }
+
+    void freeNode(uint32_t idx)
+    {
+        Node & node = nodes_[idx];
+        node.value = Value();
+        node.generation++;
+        node.slot = Nil;
+        node.next = freeList_;
+        freeList_ = idx;
+    }
+
+    void pushFront(uint32_t idx, uint32_t slot)
+    {
+        Node & node = nodes_[idx];
+        node.slot = slot;
+        node.prev = Nil;
+        node.next = heads_[slot];
+        if (node.next != Nil) {
+            nodes_[node.next].prev = idx;
+        }
+        heads_[slot] = idx;
+        if (slot < NumSlots) {
+            occupied_[slot / 64] |= uint64_t(1) << (slot % 64);
+        }
+    }
+
+    /* Insert a node in the slot matching its tick */
+    void link(uint32_t idx)
+    {
+        uint64_t tick = nodes_[idx].tick;
+        uint64_t delta = tick - current_;
+
+        unsigned level = 0;
+        while (level + 1 < NumLevels
+               && delta >= (uint64_t(1) << (LevelBits * (level + 1)))) {
+            level++;
+        }
+        if (level == NumLevels - 1) {
+            uint64_t maxDelta = (uint64_t(1) << (LevelBits * NumLevels)) - 1;
+            if (delta > maxDelta) {
+                tick = current_ + maxDelta;
+            }
+        }
+
+        unsigned slot = (tick >> (LevelBits * level)) & SlotMask;
+        pushFront(idx, level * SlotsPerLevel + slot);
+    }
+
+    void unlink(uint32_t idx)
+    {
+        Node & node = nodes_[idx];
+        if (node.prev != Nil) {
+            nodes_[node.prev].next = node.next;
+        }
+        else {
+            heads_[node.slot] = node.next;
+            if (node.next == Nil && node.slot < NumSlots) {
+                occupied_[node.slot / 64]
+                    &= ~(uint64_t(1) << (node.slot % 64));
+            }
+        }
+        if (node.next != Nil) {
+            nodes_[node.next].prev = node.prev;
+        }
+    }
+
+    /* Detach all the nodes of "slot" */
+    uint32_t takeSlot(uint32_t slot)
+    {
+        uint32_t head = heads_[slot];
+        heads_[slot] = Nil;
+        if (slot < NumSlots) {
+            occupied_[slot / 64] &= ~(uint64_t(1) << (slot % 64));
+        }
+        return head;
+    }
+
+    /* Reinsert the nodes of "slot" according to their tick, which is raised
+       to "minTick" */
+    void relinkSlot(uint32_t slot, uint64_t minTick)
+    {
+        uint32_t idx = takeSlot(slot);
+        while (idx != Nil) {
+            uint32_t next = nodes_[idx].next;
+            Node & node = nodes_[idx];
+            node.tick = std::max(node.tick, minTick);
+            link(idx);
+            idx = next;
+        }
+    }
+
+    /* First occupied slot of "level" at or after "from", or -1 */
+    int findOccupied(unsigned level, unsigned from) const
+    {
+        if (from >= SlotsPerLevel) {
+            return -1;
+        }
+        unsigned base = level * SlotsPerLevel;
+        unsigned bit = base + from;
+        unsigned end = base + SlotsPerLevel;
+        while (bit < end) {
+            uint64_t word = occupied_[bit / 64] >> (bit % 64);
+            if (word != 0) {
+                return bit + __builtin_ctzll(word) - base;
+            }
+            bit = (bit / 64 + 1) * 64;
+        }
+        return -1;
+    }
+
+    /* Move "current_" to the next tick that has timers in level 0 or
+       requires a cascade, without going past "target". */
+    void advance(uint64_t target)
+    {
+        uint64_t next;
+        if (size_ == 0) {
+            next = target;
+        }
+        else {
+            uint64_t boundary = (current_ | SlotMask) + 1;
+            int slot = findOccupied(0, (current_ & SlotMask) + 1);
+            next = (slot == -1
+                    ? boundary : (current_ & ~uint64_t(SlotMask)) + slot);
+            next = std::min(next, target);
+        }
+
+        uint64_t previous = current_;
+        current_ = next;
+        if ((current_ >> LevelBits) != (previous >> LevelBits)) {
+            cascade();
+        }
+    }
+
+    /* Move the timers of the higher level slots that cover the current
+       tick to the lower levels, from the top down. */
+    void cascade()
+    {
+        unsigned top = 1;
+        while (top + 1 < NumLevels
+               && ((current_ >> (LevelBits * top)) & SlotMask) == 0) {
+            top++;
+        }
+        for (unsigned level = top; level >= 1; level--) {
+            unsigned slot = (current_ >> (LevelBits * level)) & SlotMask;
+            relinkSlot(level * SlotsPerLevel + slot, 0);
+        }
+    }
+
+    /* Hand back the expired timers of level 0 slot "slot" */
+    template<typename Callback>
+    size_t fireSlot(uint32_t slot, Date now, const Callback & callback)
+    {
+        if (heads_[slot] == Nil) {
+            return 0;
+        }
+
+        /* The timers are moved to a separate list so that the callbacks can
+           safely arm and cancel timers. */
+        uint32_t idx = takeSlot(slot);
+        while (idx != Nil) {
+            uint32_t next = nodes_[idx].next;
+            pushFront(idx, FiringSlot);
+            idx = next;
+        }
+
+        size_t numExpired(0);
+        while (heads_[FiringSlot] != Nil) {
+            idx = heads_[FiringSlot];
+            unlink(idx);
+            Node & node = nodes_[idx];
+            if (node.expiry > now) {
+                link(idx);
+                continue;
+            }
+
+            Id id = makeId(idx, node.generation);
+            Value value(std::move(node.value));
+            freeNode(idx);
+            size_--;
+            numExpired++;
+            callback(id, value);
+        }
+
+        return numExpired;
+    }
+
+    double resolution_;
+    Date start_;
+
+    /* tick of the slot of level 0 that is next to expire */
+    uint64_t current_;
+
+    std::vector<Node> nodes_;
+    uint32_t freeList_;
+    size_t size_;
+
+    /* heads of the slot lists, followed by the list of firing timers */
+    uint32_t heads_[NumSlots + 1];
+
+    /* bitmap of the non-empty slots */
+    uint64_t occupied_[NumSlots / 64];
+};
+
+template<typename Value>
+constexpr uint32_t TimerWheel<Value>::Nil;
+
+template<typename Value>
+constexpr uint64_t TimerWheel<Value>::MaxTick;
+
+} // namespace Datacratic
@@ -17,7 +17,6 @@
 #include "jml/utils/environment.h"
 #include <iostream>
 #include <sys/epoll.h>
-#include <sys/timerfd.h>
 #include <sys/eventfd.h>
 #include <poll.h>
 
@@ -53,7 +52,8 @@ TransportBase(EndpointBase * endpoint)
       asyncHead_(0),
       endpoint_(endpoint),
       recycle_(0), close_(0), flags_(0),
-      hasConnection_(false), zombie_(false)
+      hasConnection_(false), timerId_(0), timerExpired_(false),
+      zombie_(false)
 {
     atomic_add(created, 1);
 
@@ -67,23 +67,16 @@ TransportBase(EndpointBase * endpoint)
     epollFd_ = epoll_create(1024);
     if (epollFd_ == -1)
         throw ML::Exception(errno, "couldn't create epoll fd");
-    timerFd_ = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK);
-    if (timerFd_ == -1)
-        throw ML::Exception(errno, "timer FD couldn't be created");
     eventFd_ = eventfd(0, EFD_NONBLOCK);
     if (eventFd_ == -1)
         throw ML::Exception(errno, "event FD couldn't be created");
 
-    /* Add all of these other FDs to the event FD */
+    /* Add the event FD to the epoll FD */
     struct epoll_event data;
     data.data.u64 = 0;
-    data.data.fd = timerFd_;
-    data.events = EPOLLIN;
-    int res = epoll_ctl(epollFd_, EPOLL_CTL_ADD, timerFd_, &data);
-    if (res == -1)
-        throw ML::Exception(errno, "epoll_ctl ADD timerFd");
     data.data.fd = eventFd_;
-    res = epoll_ctl(epollFd_, EPOLL_CTL_ADD, eventFd_, &data);
+    data.events = EPOLLIN;
+    int res = epoll_ctl(epollFd_, EPOLL_CTL_ADD, eventFd_, &data);
     if (res == -1)
         throw ML::Exception(errno, "epoll_ctl ADD eventFd");
 
@@ -94,12 +87,13 @@ TransportBase(EndpointBase * endpoint)
 TransportBase::
 ~TransportBase()
 {
+    /* the timer of the endpoint must not outlive us */
+    if (timerId_ != 0)
+        endpoint_->cancelTransportTimer(this);
+
     int res = close(epollFd_);
     if (res == -1)
         cerr << "closing epoll fd: " << strerror(errno) << endl;
-    res = close(timerFd_);
-    if (res == -1)
-        cerr << "closing timer fd: " << strerror(errno) << endl;
     res = close(eventFd_);
     if (res == -1)
         cerr << "closing event fd: " << strerror(errno) << endl;
@@ -591,13 +585,12 @@ handleEvents()
     addActivity("handleEvents");
         
     while (!isZombie() && rc != -1) {
-        struct pollfd items[3] = {
+        struct pollfd items[2] = {
             { eventFd_, POLLIN, 0 },
-            { timerFd_, POLLIN, 0 },
             { getHandle(), flags_, 0 }
         };
 
-        int res = poll(items, 3, 0);
+        int res = poll(items, 2, 0);
         
 #if 0
         cerr << "handleevents for " << getHandle() << " " << status()
@@ -605,12 +598,11 @@ handleEvents()
              << hasAsync() << " " << Date::now().print(4) << endl;
         cerr << "flags_ = " << pollFlags(flags_) << endl;
 
-        for (unsigned i = 0;  i < 3;  ++i) {
+        for (unsigned i = 0;  i < 2;  ++i) {
             if (!items[i].revents) continue;
             string fdname;
             if (i == 0) fdname = "wakeup";
-            else if (i == 1) fdname = "timer";
-            else if (i == 2) fdname = "connection";
+            else if (i == 1) fdname = "connection";
             
             int mask = items[i].revents;
 
@@ -619,7 +611,7 @@ handleEvents()
         }
 #endif
 
-        if (res == 0 && !hasAsync()) break;
+        if (res == 0 && !hasAsync() && !timerExpired_) break;
         
         if (items[0].revents) {
             // Clear the wakeup if there was one
@@ -629,7 +621,7 @@ handleEvents()
                 throw ML::Exception(errno, "eventfd_read");
             //cerr << "    got wakeup" << endl;
         }
-        if (rc != -1 && items[2].revents & POLLERR) {
+        if (rc != -1 && items[1].revents & POLLERR) {
             // Connection finished or has an error; check which one
             int error = 0;
             socklen_t error_len = sizeof(int);
@@ -643,17 +635,8 @@ handleEvents()
                 rc = handleError(strerror(error));
             }
         }
-        if (rc != -1 && items[1].revents & POLLIN) {
+        if (rc != -1 && timerExpired_.exchange(false)) {
             // Timeout...
-            
-            // First read the number of timeouts to reset the count
-            uint64_t numTimeouts;
-            int res = read(timerFd_, &numTimeouts, 8);
-            if (res == -1)
-                throw ML::Exception(errno, "reading from timerfd");
-            if (res != 8)
-                throw ML::Exception("read wrong num bytes from timerfd");
-            
             if (timeout_.isSet()) {
                 // Now call the handler
                 TransportTimer timer(this, "timeout");
@@ -663,21 +646,21 @@ handleEvents()
             //cerr << "    got timeout" << endl;
         }
         if (rc != -1
-            && (items[2].revents & POLLIN)
+            && (items[1].revents & POLLIN)
             && (flags_ & POLLIN)) {
             //cerr << "    got input" << endl;
             TransportTimer timer(this, "input");
             rc = handleInput();
         }
         if (rc != -1
-            && (items[2].revents & POLLOUT)
+            && (items[1].revents & POLLOUT)
             && (flags_ & POLLOUT)) {
             //cerr << "    got output" << endl;
             TransportTimer timer(this, "output");
             rc = handleOutput();
         }
         if (rc != -1
-            && (items[2].revents & POLLRDHUP)
+            && (items[1].revents & POLLRDHUP)
             && (flags_ & POLLRDHUP)) {
             //cerr << "    got output" << endl;
             TransportTimer timer(this, "peerShutdown");
@@ -806,12 +789,7 @@ scheduleTimerAbsolute(Date timeout, size_t cookie,
                       void (*freecookie) (size_t))
 {
     timeout_.set(timeout, cookie, freecookie);
-    long seconds = timeout.wholeSecondsSinceEpoch();
-    long nanoseconds = timeout.fractionalSeconds() * 1000000000.0;
-    itimerspec spec = { { 0, 0 }, { seconds, nanoseconds } };
-    int res = timerfd_settime(timerFd_, TFD_TIMER_ABSTIME, &spec, 0);
-    if (res == -1)
-        throw ML::Exception(errno, "timerfd_settime absolute");
+    endpoint_->scheduleTransportTimer(this, timeout);
 }
 
 void 
@@ -826,14 +804,9 @@ scheduleTimerRelative(double secondsFromNow,
         throw ML::Exception("attempting to schedule timer in the past: %f",
                             secondsFromNow);
 
-    timeout_.set(Date::now().plusSeconds(secondsFromNow),
-                 cookie, freecookie);
-    long seconds = secondsFromNow;
-    long nanoseconds = 1000000000.0 * (secondsFromNow - seconds);
-    itimerspec spec = { { 0, 0 }, { seconds, nanoseconds } };
-    int res = timerfd_settime(timerFd_, 0, &spec, 0);
-    if (res == -1)
-        throw ML::Exception(errno, "timerfd_settime relative");
+    Date timeout = Date::now().plusSeconds(secondsFromNow);
+    timeout_.set(timeout, cookie, freecookie);
+    endpoint_->scheduleTransportTimer(this, timeout);
 }
     
 void
@@ -841,11 +814,15 @@ TransportBase::
 cancelTimer()
 {
     timeout_.cancel();
+    endpoint_->cancelTransportTimer(this);
+}
 
-    itimerspec spec = { { 0, 0 }, { 0, 0 } };
-    int res = timerfd_settime(timerFd_, 0, &spec, 0);
-    if (res == -1)
-        throw ML::Exception(errno, "timerfd_settime");
+void
+TransportBase::
+notifyTimerExpired()
+{
+    timerExpired_ = true;
+    eventfd_write(eventFd_, 1);
 }
 
 void
@@ -8,6 +8,7 @@
 #ifndef __rtb__transport_h__
 #define __rtb__transport_h__
 
+#include <atomic>
 #include <boost/shared_ptr.hpp>
 #include <boost/utility.hpp>
 #include <boost/thread/locks.hpp>
@@ -108,7 +109,8 @@ struct TransportBase : public std::enable_shared_from_this<TransportBase> {
     void stopWriting();
 
     /** Schedule a timeout at the given absolute time.  Only one timer is
-        available per connection. */
+        available per connection.  The timers of all the connections of an
+        endpoint share a single timerfd. */
     void scheduleTimerAbsolute(Date timeout,
                                size_t cookie = 0,
                                void (*freecookie) (size_t) = 0);
@@ -483,15 +485,22 @@ private:
     /** FD used for epoll when multiplexing events */
     int epollFd_;
 
-    /** FD used for timeouts. */
-    int timerFd_;
-
     /** FD used for events */
     int eventFd_;
 
     /** Do we have a connection at the moment? */
     bool hasConnection_;
 
+    /** Timer armed in the endpoint for the current timeout, or 0.
+        Modified with the timer lock of the endpoint held. */
+    std::atomic<uint64_t> timerId_;
+
+    /** Set by the endpoint when the timer has expired. */
+    std::atomic<bool> timerExpired_;
+
+    /** Called by the endpoint, from any thread, when the timer expires. */
+    void notifyTimerExpired();
+
     /** Structure to hold a timeout value. */
     struct Timeout {
         Timeout()
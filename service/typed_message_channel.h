@@ -8,11 +8,18 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
 #include <queue>
 #include <thread>
+#include <type_traits>
+#include <vector>
 
 #include "jml/utils/ring_buffer.h"
 #include "jml/arch/wakeup_fd.h"
+#include "jml/arch/exception.h"
 #include "soa/service/async_event_source.h"
 
 
@@ -191,13 +198,14 @@ struct TypedMessageQueue: public AsyncEventSource
     uint64_t size()
         const
     {
+        Guard guard(queueLock_);
         return queue_.size();
     }
 
 private:
     typedef std::mutex Mutex;
     typedef std::unique_lock<Mutex> Guard;
-    Mutex queueLock_;
+    mutable Mutex queueLock_;
     std::queue<Message> queue_;
     size_t maxMessages_;
 
@@ -210,4 +218,324 @@ private:
     OnNotify onNotify_;
 };
 
+
+/*****************************************************************************
+ * MPSC MESSAGE QUEUE                                                        *
+ *****************************************************************************/
+
+/* Behaviour of MpscMessageQueue::push_back when the queue is full */
+enum class QueueFullPolicy {
+    Reject,         /* return false */
+    Block,          /* wait until the consumer has made room */
+    DropOldest      /* discard the oldest message */
+};
+
+/* A bounded queue with the same interface as TypedMessageQueue, for many
+ * producer threads and a single consumer, usually the thread of the loop the
+ * queue is attached to. Producers claim slots of a ring buffer with a
+ * compare-and-swap and never take a lock.
+ *
+ * The eventfd is only signaled when the queue stops being empty: producers
+ * pushing onto a queue that still has notifications pending do not issue
+ * any system call. The consumer must therefore drain the queue completely,
+ * via "pop_front" or "consume", before it gets notified again.
+ *
+ * With QueueFullPolicy::Block, "push_back" must never be invoked from the
+ * consumer thread. */
+template<typename Message>
+struct MpscMessageQueue: public AsyncEventSource
+{
+    typedef std::function<void ()> OnNotify;
+
+    /* "capacity" is rounded up to the next power of 2 */
+    MpscMessageQueue(const OnNotify & onNotify, size_t capacity,
+                     QueueFullPolicy policy = QueueFullPolicy::Reject)
+        : policy_(policy), wakeup_(EFD_NONBLOCK | EFD_CLOEXEC),
+          onNotify_(onNotify),
+          head_(0), tail_(0), pending_(false),
+          numRejected_(0), numDropped_(0)
+    {
+        if (capacity == 0) {
+            throw ML::Exception("MpscMessageQueue requires a capacity");
+        }
+        size_t size(1);
+        while (size < capacity) {
+            size <<= 1;
+        }
+        mask_ = size - 1;
+        cells_.reset(new Cell[size]);
+        for (size_t i = 0; i < size; i++) {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    ~MpscMessageQueue()
+    {
+        auto discard = [] (Message && message) {};
+        while (popOne(discard));
+    }
+
+    /* AsyncEventSource interface */
+    virtual int selectFd() const
+    {
+        return wakeup_.fd();
+    }
+
+    virtual bool processOne()
+    {
+        while (wakeup_.tryRead());
+        onNotify();
+
+        return false;
+    }
+
+    virtual void onNotify()
+    {
+        if (onNotify_) {
+            onNotify_();
+        }
+    }
+
+    /* push message into the queue, applying the back-pressure policy when
+     * it is full */
+    bool push_back(Message message)
+    {
+        for (unsigned attempt = 0; !tryPush(message); attempt++) {
+            switch (policy_) {
+            case QueueFullPolicy::Reject:
+                numRejected_.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            case QueueFullPolicy::DropOldest: {
+                auto drop = [] (Message && message) {};
+                if (popOne(drop)) {
+                    numDropped_.fetch_add(1, std::memory_order_relaxed);
+                }
+                break;
+            }
+            case QueueFullPolicy::Block:
+                backoff(attempt);
+                break;
+            }
+        }
+
+        /* pairs with the fence in "clearPending" */
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!pending_.load(std::memory_order_relaxed)) {
+            notify();
+        }
+
+        return true;
+    }
+
+    /* Invoke "onMessage(Message &&)" for up to "number" messages, or until
+     * the queue is empty if 0. Returns the number of messages consumed. */
+    template<typename OnMessage>
+    size_t consume(const OnMessage & onMessage, size_t number = 0)
+    {
+        size_t count(0);
+        while (number == 0 || count < number) {
+            if (!popOne(onMessage)) {
+                clearPending();
+                break;
+            }
+            count++;
+        }
+
+        /* taking exactly the last "number" messages also drains the queue */
+        if (count == number && empty()) {
+            clearPending();
+        }
+
+        return count;
+    }
+
+    /* Move up to "number" messages, or all of them if 0, to the end of
+     * "messages", which can be reused between calls to avoid allocations.
+     * Returns the number of messages moved. */
+    size_t pop_front(std::vector<Message> & messages, size_t number)
+    {
+        return consume([&] (Message && message) {
+            messages.emplace_back(std::move(message));
+        }, number);
+    }
+
+    /* returns up to "number" messages from the queue or all of them if 0 */
+    std::vector<Message> pop_front(size_t number)
+    {
+        std::vector<Message> messages;
+        messages.reserve(number > 0 ? number : size());
+        pop_front(messages, number);
+        return messages;
+    }
+
+    /* approximate number of messages present in the queue */
+    uint64_t size()
+        const
+    {
+        size_t head = head_.load(std::memory_order_relaxed);
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        return tail > head ? tail - head : 0;
+    }
+
+    size_t capacity()
+        const
+    {
+        return mask_ + 1;
+    }
+
+    /* number of messages refused by "push_back" with the Reject policy */
+    uint64_t numRejected()
+        const
+    {
+        return numRejected_.load(std::memory_order_relaxed);
+    }
+
+    /* number of messages discarded with the DropOldest policy */
+    uint64_t numDropped()
+        const
+    {
+        return numDropped_.load(std::memory_order_relaxed);
+    }
+
+private:
+    /* A slot of the ring. "sequence" equals the position of the slot for
+       the next producer when the slot is free, and that position + 1 when
+       it contains a message. */
+    struct Cell {
+        std::atomic<size_t> sequence;
+        typename std::aligned_storage<sizeof(Message),
+                                      alignof(Message)>::type storage;
+
+        Message * message()
+        {
+            return reinterpret_cast<Message *>(&storage);
+        }
+    };
+
+    /* Move "message" into the queue. Returns false when full, leaving
+       "message" untouched. */
+    bool tryPush(Message & message)
+    {
+        Cell * cell;
+        size_t pos = tail_.load(std::memory_order_relaxed);
+        for (;;) {
+            cell = &cells_[pos & mask_];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = intptr_t(seq) - intptr_t(pos);
+            if (diff == 0) {
+                if (tail_.compare_exchange_weak(pos, pos + 1,
+                                                std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+            else if (diff < 0) {
+                return false;
+            }
+            else {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+
+        new (cell->message()) Message(std::move(message));
+        cell->sequence.store(pos + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    /* Take the oldest message and pass it to "onMessage". Returns false
+       when empty. Producers only pop with the DropOldest policy, which is
+       why the head is claimed with a CAS. */
+    template<typename OnMessage>
+    bool popOne(const OnMessage & onMessage)
+    {
+        Cell * cell;
+        size_t pos = head_.load(std::memory_order_relaxed);
+        for (;;) {
+            cell = &cells_[pos & mask_];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = intptr_t(seq) - intptr_t(pos + 1);
+            if (diff == 0) {
+                if (head_.compare_exchange_weak(pos, pos + 1,
+                                                std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+            else if (diff < 0) {
+                return false;
+            }
+            else {
+                pos = head_.load(std::memory_order_relaxed);
+            }
+        }
+
+        /* the slot is released before invoking the callback */
+        Message message(std::move(*cell->message()));
+        cell->message()->~Message();
+        cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+        onMessage(std::move(message));
+
+        return true;
+    }
+
+    bool empty()
+        const
+    {
+        size_t pos = head_.load(std::memory_order_relaxed);
+        const Cell & cell = cells_[pos & mask_];
+        return (cell.sequence.load(std::memory_order_acquire) != pos + 1);
+    }
+
+    void notify()
+    {
+        if (!pending_.exchange(true)) {
+            wakeup_.signal();
+        }
+    }
+
+    /* Invoked by the consumer once the queue has been found empty. A
+       producer may have pushed a message after the queue was found empty
+       but before "pending_" was reset, in which case we signal on its
+       behalf. */
+    void clearPending()
+    {
+        pending_.store(false, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!empty()) {
+            notify();
+        }
+    }
+
+    void backoff(unsigned attempt)
+    {
+        if (attempt < 64) {
+            __builtin_ia32_pause();
+        }
+        else if (attempt < 256) {
+            std::this_thread::yield();
+        }
+        else {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    }
+
+    size_t mask_;
+    std::unique_ptr<Cell[]> cells_;
+    QueueFullPolicy policy_;
+
+    ML::Wakeup_Fd wakeup_;
+
+    /* callback */
+    OnNotify onNotify_;
+
+    /* consumer and producer positions, on separate cache lines */
+    alignas(64) std::atomic<size_t> head_;
+    alignas(64) std::atomic<size_t> tail_;
+
+    /* notifications are pending */
+    alignas(64) std::atomic<bool> pending_;
+
+    std::atomic<uint64_t> numRejected_;
+    std::atomic<uint64_t> numDropped_;
+};
+
 } // namespace Datacratic
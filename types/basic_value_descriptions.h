@@ -64,7 +64,7 @@ struct DefaultDescription<std::string>
     virtual void parseJsonTyped(std::string * val,
                                 JsonParsingContext & context) const
     {
-        *val = context.expectStringAscii();
+        context.expectStringAsciiInto(*val);
     }
 
     virtual void printJsonTyped(const std::string * val,
@@ -390,7 +390,8 @@ struct DefaultDescription<std::unique_ptr<T> >
     virtual void parseJsonTyped(std::unique_ptr<T> * val,
                                 JsonParsingContext & context) const
     {
-        val->reset(new T());
+        if (!context.reuseOutput || !val->get())
+            val->reset(new T());
         inner->parseJsonTyped(val->get(), context);
     }
 
@@ -746,6 +747,136 @@ struct Optional: public std::unique_ptr<T> {
     }
 };
 
+/** Value that is only decoded from JSON when it is first accessed.  Parsing
+    a Lazy<T> records the JSON text of the value, and get() decodes it with
+    the description it was parsed with (the default description of T if
+    the text was given through setJson() alone).  As long as it isn't
+    modified through mutate(), the recorded text is printed back unchanged,
+    so that a value that is only passed along is never decoded.
+
+    get() decodes into the object, so a Lazy<T> must not be accessed by
+    several threads at once even through its const functions.
+*/
+template<typename T>
+struct Lazy {
+    Lazy()
+    {
+    }
+
+    Lazy(T value)
+        : value_(new T(std::move(value)))
+    {
+    }
+
+    Lazy(Lazy && other)
+        : json_(std::move(other.json_)), desc_(std::move(other.desc_)),
+          value_(std::move(other.value_))
+    {
+    }
+
+    Lazy(const Lazy & other)
+        : json_(other.json_), desc_(other.desc_)
+    {
+        if (other.value_)
+            value_.reset(new T(*other.value_));
+    }
+
+    Lazy & operator = (const Lazy & other)
+    {
+        Lazy newMe(other);
+        swap(newMe);
+        return *this;
+    }
+
+    Lazy & operator = (Lazy && other)
+    {
+        Lazy newMe(std::move(other));
+        swap(newMe);
+        return *this;
+    }
+
+    void swap(Lazy & other)
+    {
+        json_.swap(other.json_);
+        desc_.swap(other.desc_);
+        value_.swap(other.value_);
+    }
+
+    /** The value, decoded on the first call. */
+    const T & get() const
+    {
+        if (!value_)
+            decode();
+        return *value_;
+    }
+
+    const T & operator * () const { return get(); }
+    const T * operator -> () const { return &get(); }
+
+    /** The value, to be modified.  The recorded JSON is dropped as it may
+        no longer match.
+    */
+    T & mutate()
+    {
+        get();
+        json_.clear();
+        return *value_;
+    }
+
+    bool isDecoded() const
+    {
+        return value_ != nullptr;
+    }
+
+    /** JSON text recorded when the value was parsed, or empty if there is
+        none or if the value has been modified since.
+    */
+    const std::string & json() const
+    {
+        return json_;
+    }
+
+    /** Record the JSON text of the value, to be decoded with the given
+        description or with the default description of T if there is none.
+    */
+    void setJson(std::string json,
+                 std::shared_ptr<const ValueDescriptionT<T> > desc = nullptr)
+    {
+        json_ = std::move(json);
+        desc_ = std::move(desc);
+        value_.reset();
+    }
+
+private:
+    void decode() const
+    {
+        if (json_.empty()) {
+            value_.reset(new T());
+            return;
+        }
+        if (!desc_) {
+            value_.reset(new T(jsonDecodeStr<T>(json_)));
+            return;
+        }
+
+        std::unique_ptr<T> value(new T());
+        parseJsonIndexed(json_, json_.c_str(), json_.c_str() + json_.size(),
+                         [&] (JsonParsingContext & context)
+                         {
+                             desc_->parseJsonTyped(value.get(), context);
+                         },
+                         [&] ()
+                         {
+                             desc_->setDefaultTyped(value.get());
+                         });
+        value_ = std::move(value);
+    }
+
+    std::string json_;
+    std::shared_ptr<const ValueDescriptionT<T> > desc_;
+    mutable std::unique_ptr<T> value_;
+};
+
 template<typename Cls, int defValue = -1>
 struct TaggedEnum {
     TaggedEnum(int v = defValue)
@@ -1439,7 +1570,8 @@ struct DefaultDescription<Optional<T> >
             val->reset();
             return;
         }
-        val->reset(new T());
+        if (!context.reuseOutput || !val->get())
+            val->reset(new T());
         inner->parseJsonTyped(val->get(), context);
     }
 
@@ -1476,6 +1608,51 @@ struct DefaultDescription<Optional<T> >
     }
 };
 
+template<typename T>
+struct DefaultDescription<Lazy<T> >
+    : public ValueDescriptionI<Lazy<T>, ValueKind::ATOM> {
+
+    DefaultDescription(ValueDescriptionT<T> * inner)
+        : inner(inner)
+    {
+    }
+
+    DefaultDescription(std::shared_ptr<const ValueDescriptionT<T> > inner
+                       = getDefaultDescriptionShared((T *)0))
+        : inner(inner)
+    {
+    }
+
+    /// Description used to decode, print and check the values
+    std::shared_ptr<const ValueDescriptionT<T> > inner;
+
+    virtual void parseJsonTyped(Lazy<T> * val,
+                                JsonParsingContext & context) const
+    {
+        val->setJson(context.expectRawJson(), inner);
+    }
+
+    virtual void printJsonTyped(const Lazy<T> * val,
+                                JsonPrintingContext & context) const
+    {
+        if (!val->json().empty())
+            context.writeRawJson(val->json());
+        else inner->printJsonTyped(&val->get(), context);
+    }
+
+    virtual bool isDefaultTyped(const Lazy<T> * val) const
+    {
+        if (!val->json().empty())
+            return false;
+        return !val->isDecoded() || inner->isDefaultTyped(&val->get());
+    }
+
+    virtual const ValueDescription & contained() const
+    {
+        return *inner;
+    }
+};
+
 template<typename T>
 struct DefaultDescription<List<T> >
     : public ValueDescriptionI<List<T>, ValueKind::ARRAY>,
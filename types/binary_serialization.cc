@@ -0,0 +1,808 @@
+/* binary_serialization.cc
+   Copyright (c) 2015 Datacratic Inc.  All rights reserved.
+
+   Compact binary encoding for value descriptions.
+*/
+
+#include <string.h>
+#include <limits>
+
+#include "jml/arch/format.h"
+#include "jml/utils/exc_assert.h"
+
+#include "binary_serialization.h"
+
+using namespace std;
+
+
+namespace Datacratic {
+
+
+/*****************************************************************************/
+/* BINARY PRINTING CONTEXT                                                   */
+/*****************************************************************************/
+
+BinaryPrintingContext::
+BinaryPrintingContext(std::string & output)
+    : output(output)
+{
+}
+
+void
+BinaryPrintingContext::
+startObject()
+{
+    output.push_back(BT_OBJECT);
+}
+
+void
+BinaryPrintingContext::
+startMember(const std::string & memberName)
+{
+    writeVarint((uint64_t(memberName.size()) << 1) | 1);
+    output.append(memberName);
+}
+
+void
+BinaryPrintingContext::
+startField(const char * fieldName, int fieldNum)
+{
+    ExcAssertGreaterEqual(fieldNum, 0);
+    writeVarint(uint64_t(fieldNum + 1) << 1);
+}
+
+void
+BinaryPrintingContext::
+endObject()
+{
+    output.push_back(0);
+}
+
+void
+BinaryPrintingContext::
+startArray(int knownSize)
+{
+    if (knownSize >= 0) {
+        output.push_back(BT_ARRAY);
+        writeVarint(knownSize);
+    }
+    else output.push_back(BT_LIST);
+    arraySized.push_back(knownSize >= 0);
+}
+
+void
+BinaryPrintingContext::
+newArrayElement()
+{
+}
+
+void
+BinaryPrintingContext::
+endArray()
+{
+    ExcAssert(!arraySized.empty());
+    if (!arraySized.back())
+        output.push_back(BT_END);
+    arraySized.pop_back();
+}
+
+void
+BinaryPrintingContext::
+skip()
+{
+    output.push_back(BT_NULL);
+}
+
+void
+BinaryPrintingContext::
+writeNull()
+{
+    output.push_back(BT_NULL);
+}
+
+void
+BinaryPrintingContext::
+writeInt(int i)
+{
+    writeSigned(i);
+}
+
+void
+BinaryPrintingContext::
+writeUnsignedInt(unsigned int i)
+{
+    writeUnsigned(i);
+}
+
+void
+BinaryPrintingContext::
+writeLong(long int i)
+{
+    writeSigned(i);
+}
+
+void
+BinaryPrintingContext::
+writeUnsignedLong(unsigned long int i)
+{
+    writeUnsigned(i);
+}
+
+void
+BinaryPrintingContext::
+writeLongLong(long long int i)
+{
+    writeSigned(i);
+}
+
+void
+BinaryPrintingContext::
+writeUnsignedLongLong(unsigned long long int i)
+{
+    writeUnsigned(i);
+}
+
+void
+BinaryPrintingContext::
+writeFloat(float f)
+{
+    // Our targets are all little endian, so the memory representation is
+    // the wire representation
+    output.push_back(BT_FLOAT);
+    output.append((const char *)&f, sizeof(f));
+}
+
+void
+BinaryPrintingContext::
+writeDouble(double d)
+{
+    output.push_back(BT_DOUBLE);
+    output.append((const char *)&d, sizeof(d));
+}
+
+void
+BinaryPrintingContext::
+writeString(const std::string & s)
+{
+    writeStringBytes(s.data(), s.size());
+}
+
+void
+BinaryPrintingContext::
+writeStringUtf8(const Utf8String & s)
+{
+    writeStringBytes(s.rawData(), s.rawLength());
+}
+
+void
+BinaryPrintingContext::
+writeJson(const Json::Value & val)
+{
+    switch (val.type()) {
+    case Json::nullValue:
+        writeNull();
+        break;
+    case Json::intValue:
+        writeSigned(val.asInt());
+        break;
+    case Json::uintValue:
+        writeUnsigned(val.asUInt());
+        break;
+    case Json::realValue:
+        writeDouble(val.asDouble());
+        break;
+    case Json::stringValue: {
+        const char * s = val.asCString();
+        writeStringBytes(s, strlen(s));
+        break;
+    }
+    case Json::booleanValue:
+        writeBool(val.asBool());
+        break;
+    case Json::arrayValue:
+        startArray(val.size());
+        for (unsigned i = 0;  i < val.size();  ++i) {
+            newArrayElement();
+            writeJson(val[i]);
+        }
+        endArray();
+        break;
+    case Json::objectValue:
+        startObject();
+        for (auto it = val.begin(), end = val.end();  it != end;  ++it) {
+            startMember(it.memberName());
+            writeJson(*it);
+        }
+        endObject();
+        break;
+    default:
+        throw ML::Exception("unknown JSON value type");
+    }
+}
+
+void
+BinaryPrintingContext::
+writeBool(bool b)
+{
+    output.push_back(b ? BT_TRUE : BT_FALSE);
+}
+
+
+/*****************************************************************************/
+/* BINARY PARSING CONTEXT                                                    */
+/*****************************************************************************/
+
+BinaryParsingContext::
+BinaryParsingContext(const char * start, const char * end)
+    : start(start), current(start), end(end)
+{
+    init();
+}
+
+BinaryParsingContext::
+BinaryParsingContext(const std::string & input)
+    : start(input.data()), current(start), end(start + input.size())
+{
+    init();
+}
+
+void
+BinaryParsingContext::
+init()
+{
+    currentFieldNum = -1;
+    depth = 0;
+
+    // Skip what we don't know about, so that old readers can read data from
+    // newer writers
+    onUnknownFieldHandlers.push_back([=] (const ValueDescription *)
+                                     {
+                                         this->skip();
+                                     });
+}
+
+void
+BinaryParsingContext::
+exception(const std::string & message)
+{
+    throw ML::Exception("at " + printPath() + ": " + message);
+}
+
+std::string
+BinaryParsingContext::
+getContext() const
+{
+    return ML::format("byte %zd", (ssize_t)(current - start))
+        + " at " + printPath();
+}
+
+int
+BinaryParsingContext::
+memberFieldNum() const
+{
+    return currentFieldNum;
+}
+
+bool
+BinaryParsingContext::
+matchInteger(bool & negative, uint64_t & magnitude)
+{
+    if (current == end)
+        return false;
+    int tag = peekTag();
+    if (tag != BT_UINT && tag != BT_NEGINT)
+        return false;
+    ++current;
+    negative = tag == BT_NEGINT;
+    magnitude = expectVarint();
+    return true;
+}
+
+void
+BinaryParsingContext::
+expectInteger(bool & negative, uint64_t & magnitude)
+{
+    if (!matchInteger(negative, magnitude))
+        exception("expected integer");
+}
+
+template<typename Int>
+Int
+BinaryParsingContext::
+expectIntegerOfType(const char * typeName)
+{
+    typedef std::numeric_limits<Int> Limits;
+
+    bool negative;
+    uint64_t magnitude;
+    expectInteger(negative, magnitude);
+
+    // For negative numbers, magnitude is -1 - value
+    if (negative) {
+        if (!Limits::is_signed || magnitude > uint64_t(-(Limits::min() + 1)))
+            exception(string("value is out of range for ") + typeName);
+        return -1 - (Int)magnitude;
+    }
+    if (magnitude > (uint64_t)Limits::max())
+        exception(string("value is out of range for ") + typeName);
+    return magnitude;
+}
+
+int
+BinaryParsingContext::
+expectInt()
+{
+    return expectIntegerOfType<int>("int");
+}
+
+unsigned int
+BinaryParsingContext::
+expectUnsignedInt()
+{
+    return expectIntegerOfType<unsigned int>("unsigned int");
+}
+
+long
+BinaryParsingContext::
+expectLong()
+{
+    return expectIntegerOfType<long>("long");
+}
+
+unsigned long
+BinaryParsingContext::
+expectUnsignedLong()
+{
+    return expectIntegerOfType<unsigned long>("unsigned long");
+}
+
+long long
+BinaryParsingContext::
+expectLongLong()
+{
+    return expectIntegerOfType<long long>("long long");
+}
+
+unsigned long long
+BinaryParsingContext::
+expectUnsignedLongLong()
+{
+    return expectIntegerOfType<unsigned long long>("unsigned long long");
+}
+
+float
+BinaryParsingContext::
+expectFloat()
+{
+    return expectDouble();
+}
+
+double
+BinaryParsingContext::
+expectDouble()
+{
+    double result;
+    if (!matchDouble(result))
+        exception("expected number");
+    return result;
+}
+
+bool
+BinaryParsingContext::
+expectBool()
+{
+    int tag = peekTag();
+    if (tag != BT_TRUE && tag != BT_FALSE)
+        exception("expected boolean");
+    ++current;
+    return tag == BT_TRUE;
+}
+
+bool
+BinaryParsingContext::
+matchUnsignedLongLong(unsigned long long & val)
+{
+    if (current == end || peekTag() != BT_UINT)
+        return false;
+    ++current;
+    val = expectVarint();
+    return true;
+}
+
+bool
+BinaryParsingContext::
+matchLongLong(long long & val)
+{
+    if (current == end)
+        return false;
+
+    const char * before = current;
+    bool negative;
+    uint64_t magnitude;
+    if (!matchInteger(negative, magnitude))
+        return false;
+
+    typedef std::numeric_limits<long long> Limits;
+    if (magnitude > (uint64_t)Limits::max()) {
+        current = before;
+        return false;
+    }
+
+    val = negative ? -1 - (long long)magnitude : (long long)magnitude;
+    return true;
+}
+
+bool
+BinaryParsingContext::
+matchDouble(double & val)
+{
+    if (current == end)
+        return false;
+
+    switch (peekTag()) {
+    case BT_UINT:
+        ++current;
+        val = expectVarint();
+        return true;
+    case BT_NEGINT:
+        ++current;
+        val = -1.0 - expectVarint();
+        return true;
+    case BT_FLOAT: {
+        ++current;
+        float f;
+        memcpy(&f, expectBytes(sizeof(f)), sizeof(f));
+        val = f;
+        return true;
+    }
+    case BT_DOUBLE:
+        ++current;
+        memcpy(&val, expectBytes(sizeof(val)), sizeof(val));
+        return true;
+    default:
+        return false;
+    }
+}
+
+const char *
+BinaryParsingContext::
+expectStringBytes(size_t & len)
+{
+    if (peekTag() != BT_STRING)
+        exception("expected string");
+    ++current;
+    len = expectVarint();
+    return expectBytes(len);
+}
+
+std::string
+BinaryParsingContext::
+expectStringAscii()
+{
+    size_t len;
+    const char * s = expectStringBytes(len);
+    return string(s, len);
+}
+
+ssize_t
+BinaryParsingContext::
+expectStringAscii(char * value, size_t maxLen)
+{
+    // The string must not be consumed if it doesn't fit, as the caller
+    // will then parse it with the other overload
+    const char * before = current;
+    size_t len;
+    const char * s = expectStringBytes(len);
+    if (len >= maxLen) {
+        current = before;
+        return -1;
+    }
+    memcpy(value, s, len);
+    value[len] = 0;
+    return len;
+}
+
+void
+BinaryParsingContext::
+expectStringAsciiInto(std::string & value)
+{
+    size_t len;
+    const char * s = expectStringBytes(len);
+    value.assign(s, len);
+}
+
+Utf8String
+BinaryParsingContext::
+expectStringUtf8()
+{
+    size_t len;
+    const char * s = expectStringBytes(len);
+    return Utf8String(string(s, len));
+}
+
+Json::Value
+BinaryParsingContext::
+expectJson()
+{
+    int tag = peekTag();
+    switch (tag) {
+    case BT_NULL:
+        ++current;
+        return Json::Value();
+    case BT_FALSE:
+    case BT_TRUE:
+        return expectBool();
+    case BT_UINT: {
+        unsigned long long val = expectUnsignedLongLong();
+        return Json::Value((Json::Value::UInt)val);
+    }
+    case BT_NEGINT:
+        return Json::Value((Json::Value::Int)expectLongLong());
+    case BT_FLOAT:
+    case BT_DOUBLE:
+        return expectDouble();
+    case BT_STRING:
+        return expectStringAscii();
+    case BT_ARRAY:
+    case BT_LIST: {
+        Json::Value result(Json::arrayValue);
+        forEachElement([&] () { result.append(this->expectJson()); });
+        return result;
+    }
+    case BT_OBJECT: {
+        Json::Value result(Json::objectValue);
+        forEachMember([&] () { result[this->fieldName()] = this->expectJson(); });
+        return result;
+    }
+    default:
+        exception(ML::format("unknown binary tag %d", tag));
+        return Json::Value();
+    }
+}
+
+void
+BinaryParsingContext::
+expectNull()
+{
+    if (peekTag() != BT_NULL)
+        exception("expected null");
+    ++current;
+}
+
+bool
+BinaryParsingContext::
+isObject() const
+{
+    return peekTag() == BT_OBJECT;
+}
+
+bool
+BinaryParsingContext::
+isString() const
+{
+    return peekTag() == BT_STRING;
+}
+
+bool
+BinaryParsingContext::
+isArray() const
+{
+    int tag = peekTag();
+    return tag == BT_ARRAY || tag == BT_LIST;
+}
+
+bool
+BinaryParsingContext::
+isBool() const
+{
+    int tag = peekTag();
+    return tag == BT_TRUE || tag == BT_FALSE;
+}
+
+bool
+BinaryParsingContext::
+isNumber() const
+{
+    int tag = peekTag();
+    return tag >= BT_UINT && tag <= BT_DOUBLE;
+}
+
+bool
+BinaryParsingContext::
+isNull() const
+{
+    return peekTag() == BT_NULL;
+}
+
+void
+BinaryParsingContext::
+skip()
+{
+    int tag = peekTag();
+    switch (tag) {
+    case BT_NULL:
+    case BT_FALSE:
+    case BT_TRUE:
+        ++current;
+        return;
+    case BT_UINT:
+    case BT_NEGINT:
+        ++current;
+        expectVarint();
+        return;
+    case BT_FLOAT:
+        ++current;
+        expectBytes(4);
+        return;
+    case BT_DOUBLE:
+        ++current;
+        expectBytes(8);
+        return;
+    case BT_STRING: {
+        size_t len;
+        expectStringBytes(len);
+        return;
+    }
+    case BT_ARRAY:
+    case BT_LIST:
+        forEachElement([&] () { this->skip(); });
+        return;
+    case BT_OBJECT:
+        // Skipping everything also skips the members we know about
+        forEachMember([&] () { this->skip(); });
+        return;
+    default:
+        exception(ML::format("unknown binary tag %d", tag));
+    }
+}
+
+std::string
+BinaryParsingContext::
+printCurrent()
+{
+    const char * before = current;
+    try {
+        std::string result = expectJson().toStringNoNewLine();
+        current = before;
+        return result;
+    } catch (const std::exception & exc) {
+        current = before;
+        return ML::format("<binary at byte %zd>", (ssize_t)(current - start));
+    }
+}
+
+void
+BinaryParsingContext::
+forEachMember(const std::function<void ()> & fn)
+{
+    if (peekTag() != BT_OBJECT)
+        exception("expected object");
+    ++current;
+
+    if (memberNames.size() <= (size_t)depth)
+        memberNames.resize(depth + 1);
+    std::string & memberName = memberNames[depth];
+
+    // Like the JSON contexts, take care of popping the path entry and
+    // restoring the depth whatever happens
+    struct DepthPusher {
+        DepthPusher(BinaryParsingContext * context)
+            : context(context), pushed(false)
+        {
+            ++context->depth;
+        }
+
+        ~DepthPusher()
+        {
+            if (pushed)
+                context->popPath();
+            --context->depth;
+        }
+
+        BinaryParsingContext * const context;
+        bool pushed;
+    } pusher(this);
+
+    for (int memberNum = 0;  ;  ++memberNum) {
+        uint64_t key = expectVarint();
+        if (key == 0)
+            break;
+
+        if (key & 1) {
+            size_t len = key >> 1;
+            memberName.assign(expectBytes(len), len);
+            currentFieldNum = -1;
+        }
+        else {
+            uint64_t fieldNum = (key >> 1) - 1;
+            if (fieldNum > std::numeric_limits<int>::max())
+                exception("field number is out of range");
+            currentFieldNum = fieldNum;
+
+            // Name the member #<fieldNum> in the path
+            char digits[16];
+            int numDigits = 0;
+            do {
+                digits[numDigits++] = '0' + fieldNum % 10;
+                fieldNum /= 10;
+            } while (fieldNum);
+            memberName.assign(1, '#');
+            while (numDigits)
+                memberName.push_back(digits[--numDigits]);
+        }
+
+        if (pusher.pushed)
+            popPath();
+        pushPath(memberName.c_str(), memberNum);
+        pusher.pushed = true;
+
+        fn();
+    }
+
+    currentFieldNum = -1;
+}
+
+void
+BinaryParsingContext::
+forEachElement(const std::function<void ()> & fn)
+{
+    int tag = peekTag();
+    if (tag != BT_ARRAY && tag != BT_LIST)
+        exception("expected array");
+    ++current;
+
+    // Elements have no field number
+    currentFieldNum = -1;
+
+    struct PathPopper {
+        PathPopper(BinaryParsingContext * context)
+            : context(context), pushed(false)
+        {
+        }
+
+        ~PathPopper()
+        {
+            if (pushed)
+                context->popPath();
+        }
+
+        BinaryParsingContext * const context;
+        bool pushed;
+    } popper(this);
+
+    auto onElement = [&] (int index)
+        {
+            if (!popper.pushed) {
+                pushPath(index);
+                popper.pushed = true;
+            }
+            else replacePath(index);
+
+            fn();
+        };
+
+    if (tag == BT_ARRAY) {
+        uint64_t count = expectVarint();
+        // Each element takes at least one byte
+        if (count > (size_t)(end - current))
+            exception("array is longer than the input");
+        for (uint64_t i = 0;  i < count;  ++i)
+            onElement(i);
+    }
+    else {
+        for (int i = 0;  peekTag() != BT_END;  ++i)
+            onElement(i);
+        ++current;
+    }
+}
+
+void
+BinaryParsingContext::
+expectEof()
+{
+    if (current != end)
+        exception(ML::format("%zd bytes of trailing binary data",
+                             (ssize_t)(end - current)));
+}
+
+} // namespace Datacratic
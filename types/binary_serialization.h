@@ -0,0 +1,319 @@
+/* binary_serialization.h                                          -*- C++ -*-
+   Copyright (c) 2015 Datacratic Inc.  All rights reserved.
+
+   Compact binary encoding for anything that has a value description.
+
+   The binary contexts implement the same interfaces as the JSON contexts,
+   so every existing value description can be written and read without
+   any change.  The encoding is self-describing: each value starts with a
+   one byte tag (see BinaryTag), integers are varints, strings are length
+   prefixed and structure members are identified by their
+   FieldDescription::fieldNum instead of their name.
+
+   Schema evolution: field numbers are allocated in the order in which
+   fields are added to a structure description, so fields must only ever
+   be added at the end.  A reader skips the fields that it doesn't know
+   about and leaves the fields that are missing from the input untouched.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "soa/types/json_parsing.h"
+#include "soa/types/json_printing.h"
+#include "soa/types/value_description.h"
+
+
+namespace Datacratic {
+
+
+/** Tag that starts each value in the binary encoding. */
+
+enum BinaryTag {
+    BT_NULL = 0,
+    BT_FALSE = 1,
+    BT_TRUE = 2,
+    BT_UINT = 3,        ///< varint value
+    BT_NEGINT = 4,      ///< varint of (-1 - value)
+    BT_FLOAT = 5,       ///< 4 byte little endian IEEE float
+    BT_DOUBLE = 6,      ///< 8 byte little endian IEEE double
+    BT_STRING = 7,      ///< varint length then bytes
+    BT_ARRAY = 8,       ///< varint count then the elements
+    BT_LIST = 9,        ///< elements then BT_END, when the count is unknown
+    BT_END = 10,
+    BT_OBJECT = 11      ///< members then a zero key
+};
+
+/* Object members start with a varint key that is either:
+   - (fieldNum + 1) << 1 for a structure field, or
+   - (length << 1) | 1 followed by the bytes of the member name.
+   A key of zero ends the object.
+*/
+
+
+/*****************************************************************************/
+/* BINARY PRINTING CONTEXT                                                   */
+/*****************************************************************************/
+
+/** Printing context that appends the binary encoding of what is printed to
+    a string.  The string is not cleared, so that the same buffer can be
+    reused for many messages.
+*/
+
+struct BinaryPrintingContext
+    : public JsonPrintingContext {
+
+    BinaryPrintingContext(std::string & output);
+
+    std::string & output;
+
+    /// For each open array, whether it was started with a known size
+    std::vector<char> arraySized;
+
+    virtual void startObject();
+
+    virtual void startMember(const std::string & memberName);
+
+    virtual void startField(const char * fieldName, int fieldNum);
+
+    virtual void endObject();
+
+    virtual void startArray(int knownSize = -1);
+
+    virtual void newArrayElement();
+
+    virtual void endArray();
+
+    virtual void skip();
+
+    virtual void writeNull();
+
+    virtual void writeInt(int i);
+
+    virtual void writeUnsignedInt(unsigned int i);
+
+    virtual void writeLong(long int i);
+
+    virtual void writeUnsignedLong(unsigned long int i);
+
+    virtual void writeLongLong(long long int i);
+
+    virtual void writeUnsignedLongLong(unsigned long long int i);
+
+    virtual void writeFloat(float f);
+
+    virtual void writeDouble(double d);
+
+    virtual void writeString(const std::string & s);
+
+    virtual void writeStringUtf8(const Utf8String & s);
+
+    virtual void writeJson(const Json::Value & val);
+
+    virtual void writeBool(bool b);
+
+private:
+    void writeVarint(uint64_t val)
+    {
+        while (val >= 0x80) {
+            output.push_back((char)(val | 0x80));
+            val >>= 7;
+        }
+        output.push_back((char)val);
+    }
+
+    void writeSigned(long long i)
+    {
+        if (i < 0) {
+            output.push_back(BT_NEGINT);
+            writeVarint(-1 - i);
+        }
+        else {
+            output.push_back(BT_UINT);
+            writeVarint(i);
+        }
+    }
+
+    void writeUnsigned(unsigned long long i)
+    {
+        output.push_back(BT_UINT);
+        writeVarint(i);
+    }
+
+    void writeStringBytes(const char * s, size_t len)
+    {
+        output.push_back(BT_STRING);
+        writeVarint(len);
+        output.append(s, len);
+    }
+};
+
+
+/*****************************************************************************/
+/* BINARY PARSING CONTEXT                                                    */
+/*****************************************************************************/
+
+/** Parsing context that reads the output of a BinaryPrintingContext from
+    a memory buffer, which needs to stay valid while parsing.
+
+    Unknown structure fields are skipped by default; to have them throw like
+    they do when parsing JSON, clear onUnknownFieldHandlers.
+*/
+
+struct BinaryParsingContext
+    : public JsonParsingContext {
+
+    BinaryParsingContext(const char * start, const char * end);
+
+    BinaryParsingContext(const std::string & input);
+
+    const char * start;
+    const char * current;
+    const char * end;
+
+    virtual void exception(const std::string & message);
+
+    virtual std::string getContext() const;
+
+    virtual int memberFieldNum() const;
+
+    virtual int expectInt();
+    virtual unsigned int expectUnsignedInt();
+    virtual long expectLong();
+    virtual unsigned long expectUnsignedLong();
+    virtual long long expectLongLong();
+    virtual unsigned long long expectUnsignedLongLong();
+
+    virtual float expectFloat();
+    virtual double expectDouble();
+    virtual bool expectBool();
+    virtual bool matchUnsignedLongLong(unsigned long long & val);
+    virtual bool matchLongLong(long long & val);
+    virtual bool matchDouble(double & val);
+    virtual std::string expectStringAscii();
+    virtual ssize_t expectStringAscii(char * value, size_t maxLen);
+    virtual void expectStringAsciiInto(std::string & value);
+    virtual Utf8String expectStringUtf8();
+    virtual Json::Value expectJson();
+    virtual void expectNull();
+    virtual bool isObject() const;
+    virtual bool isString() const;
+    virtual bool isArray() const;
+    virtual bool isBool() const;
+    virtual bool isNumber() const;
+    virtual bool isNull() const;
+    virtual void skip();
+
+    virtual std::string printCurrent();
+
+    virtual void forEachMember(const std::function<void ()> & fn);
+    virtual void forEachElement(const std::function<void ()> & fn);
+
+    /** Check that the whole input was consumed. */
+    void expectEof();
+
+private:
+    void init();
+
+    /// Tag of the next value, without consuming it
+    int peekTag() const
+    {
+        if (current == end)
+            const_cast<BinaryParsingContext *>(this)
+                ->exception("unexpected end of binary input");
+        return (unsigned char)*current;
+    }
+
+    uint64_t expectVarint()
+    {
+        uint64_t result = 0;
+        for (int shift = 0;  shift < 64;  shift += 7) {
+            if (current == end)
+                exception("unexpected end of binary input");
+            unsigned char c = *current++;
+            result |= uint64_t(c & 0x7f) << shift;
+            if (!(c & 0x80))
+                return result;
+        }
+        exception("varint is too long");
+        return 0;
+    }
+
+    const char * expectBytes(size_t len)
+    {
+        if (len > (size_t)(end - current))
+            exception("unexpected end of binary input");
+        const char * result = current;
+        current += len;
+        return result;
+    }
+
+    /// Read a string, returning the bytes which point into the input
+    const char * expectStringBytes(size_t & len);
+
+    /// Read an integer as a sign and magnitude
+    bool matchInteger(bool & negative, uint64_t & magnitude);
+    void expectInteger(bool & negative, uint64_t & magnitude);
+
+    template<typename Int>
+    Int expectIntegerOfType(const char * typeName);
+
+    /// Field number of the member being parsed, or -1 if it has a name
+    int currentFieldNum;
+
+    /// Member names at each depth, so that paths can point to them
+    std::deque<std::string> memberNames;
+    int depth;
+};
+
+
+/*****************************************************************************/
+/* CONVERSION FUNCTIONS                                                      */
+/*****************************************************************************/
+
+/** Append the binary encoding of obj to output. */
+template<typename T>
+void binaryEncode(const T & obj, std::string & output)
+{
+    static auto desc = getDefaultDescriptionShared<T>();
+    BinaryPrintingContext context(output);
+    desc->printJson(&obj, context);
+}
+
+template<typename T>
+std::string binaryEncode(const T & obj)
+{
+    std::string result;
+    binaryEncode(obj, result);
+    return result;
+}
+
+/** Decode the binary encoding in [start, end) into val. */
+template<typename T>
+void binaryDecode(const char * start, const char * end, T & val)
+{
+    static auto desc = getDefaultDescriptionShared<T>();
+    BinaryParsingContext context(start, end);
+    desc->parseJson(&val, context);
+    context.expectEof();
+}
+
+template<typename T>
+void binaryDecode(const std::string & input, T & val)
+{
+    binaryDecode(input.data(), input.data() + input.size(), val);
+}
+
+template<typename T>
+T binaryDecode(const std::string & input, T * = 0)
+{
+    T result;
+    binaryDecode(input, result);
+    return result;
+}
+
+} // namespace Datacratic
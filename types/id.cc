@@ -5,10 +5,15 @@
 */
 
 #include <boost/algorithm/string.hpp>
+#include <atomic>
+#include <mutex>
+#include <stddef.h>
+#include <vector>
 #include "id.h"
 #include "jml/arch/bit_range_ops.h"
 #include "jml/arch/format.h"
 #include "jml/arch/exception.h"
+#include "jml/arch/spinlock.h"
 #include "jml/db/persistent.h"
 #include "jml/utils/exc_assert.h"
 #include "soa/jsoncpp/value.h"
@@ -20,10 +25,221 @@ using namespace std;
 namespace Datacratic {
 
 
+/*****************************************************************************/
+/* SHARED STORAGE                                                            */
+/*****************************************************************************/
+
+namespace {
+
+/** Characters of a STR Id that don't fit in place.  There is only one of
+    these per distinct string at a time, found through the intern table,
+    and it is freed with the last Id that refers to it.
+*/
+struct SharedString {
+    std::atomic<uint64_t> refs;
+    uint64_t hash;
+    uint64_t len;
+    SharedString * next;   ///< next in the intern table bucket
+    char chars[1];         ///< actually len characters
+
+    static SharedString * create(const char * s, size_t len, uint64_t hash)
+    {
+        void * mem = ::operator new(std::max(sizeof(SharedString),
+                                             offsetof(SharedString, chars)
+                                             + len));
+        SharedString * result = new (mem) SharedString();
+        result->refs = 1;
+        result->hash = hash;
+        result->len = len;
+        result->next = nullptr;
+        std::copy(s, s + len, result->chars);
+        return result;
+    }
+
+    static void destroy(SharedString * str)
+    {
+        str->~SharedString();
+        ::operator delete(str);
+    }
+
+    static SharedString * fromChars(const char * chars)
+    {
+        return (SharedString *)(chars - offsetof(SharedString, chars));
+    }
+};
+
+/** Table of the SharedStrings in use.  It is split into shards, each with
+    its own lock, which is only taken to create a STR Id and to drop the
+    last reference to one.  Copying, comparing, hashing and destroying
+    other references are lock free.
+*/
+struct InternTable {
+
+    SharedString * intern(const char * s, size_t len)
+    {
+        uint64_t hash = CityHash64(s, len);
+        Shard & shard = shardOf(hash);
+        std::lock_guard<ML::Spinlock> guard(shard.lock);
+
+        SharedString * & head
+            = shard.buckets[hash & (shard.buckets.size() - 1)];
+        for (SharedString * str = head;  str;  str = str->next) {
+            if (str->hash == hash && str->len == len
+                && std::equal(s, s + len, str->chars)) {
+                str->refs.fetch_add(1, std::memory_order_relaxed);
+                return str;
+            }
+        }
+
+        SharedString * str = SharedString::create(s, len, hash);
+        str->next = head;
+        head = str;
+
+        if (++shard.size > shard.buckets.size())
+            shard.grow();
+
+        return str;
+    }
+
+    void release(SharedString * str)
+    {
+        // Only the last reference needs the lock, so that it can't race
+        // with intern() handing out a new one
+        uint64_t refs = str->refs.load(std::memory_order_relaxed);
+        while (refs > 1) {
+            if (str->refs.compare_exchange_weak(refs, refs - 1,
+                                                std::memory_order_acq_rel))
+                return;
+        }
+
+        Shard & shard = shardOf(str->hash);
+        {
+            std::lock_guard<ML::Spinlock> guard(shard.lock);
+            if (str->refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+                return;
+
+            SharedString ** link
+                = &shard.buckets[str->hash & (shard.buckets.size() - 1)];
+            while (*link != str)
+                link = &(*link)->next;
+            *link = str->next;
+            --shard.size;
+        }
+
+        SharedString::destroy(str);
+    }
+
+private:
+    enum { NumShards = 64 };
+
+    struct Shard {
+        Shard()
+            : buckets(16), size(0)
+        {
+        }
+
+        void grow()
+        {
+            std::vector<SharedString *> newBuckets(buckets.size() * 2);
+            for (SharedString * str: buckets) {
+                while (str) {
+                    SharedString * next = str->next;
+                    SharedString * & head
+                        = newBuckets[str->hash & (newBuckets.size() - 1)];
+                    str->next = head;
+                    head = str;
+                    str = next;
+                }
+            }
+            buckets.swap(newBuckets);
+        }
+
+        ML::Spinlock lock;
+        std::vector<SharedString *> buckets;
+        size_t size;
+    };
+
+    Shard shards[NumShards];
+
+    /// The high bits select the shard and the low ones the bucket
+    Shard & shardOf(uint64_t hash)
+    {
+        return shards[hash >> 58];
+    }
+};
+
+/// Never destroyed, as Ids in static storage may outlive it otherwise
+InternTable & internTable()
+{
+    static InternTable * table = new InternTable();
+    return *table;
+}
+
+/** Both halves of a COMPOUND2 Id, in one allocation shared by its copies.
+    The hash is computed once for all of them.
+*/
+struct SharedCompound {
+    SharedCompound(const Id & id1, const Id & id2)
+        : ids { id1, id2 }, refs(1),
+          hash(Hash128to64(make_pair(id1.hash(), id2.hash())))
+    {
+    }
+
+    Id ids[2];
+    std::atomic<uint64_t> refs;
+    uint64_t hash;
+
+    static SharedCompound * fromIds(const Id * ids)
+    {
+        return (SharedCompound *)((const char *)ids
+                                  - offsetof(SharedCompound, ids));
+    }
+};
+
+} // file scope
+
+
 /*****************************************************************************/
 /* ID                                                                        */
 /*****************************************************************************/
 
+void
+Id::
+makeString(const char * value, size_t len)
+{
+    if (type >= STR)
+        complexDestroy();
+
+    type = STR;
+    val1 = val2 = 0;
+
+    if (len > 0 && len <= sizeof(shortStr)) {
+        shortLen = len;
+        std::copy(value, value + len, shortStr);
+    }
+    else {
+        shortLen = 0;
+        SharedString * shared = internTable().intern(value, len);
+        this->len = len;
+        str = shared->chars;
+    }
+}
+
+void
+Id::
+makeCompound(const Id & underlying1, const Id & underlying2)
+{
+    SharedCompound * shared = new SharedCompound(underlying1, underlying2);
+
+    if (type >= STR)
+        complexDestroy();
+
+    type = COMPOUND2;
+    shortLen = 0;
+    cmp1 = &shared->ids[0];
+    cmp2 = &shared->ids[1];
+}
+
 
 static const size_t max64_base10_len = sizeof("9223372036854775807") - 1;
 
@@ -356,16 +572,7 @@ parse(const char * value, size_t len, Type type)
     }
 
     // Fall back to string
-    r.type = STR;
-    r.len = len;
-    char * s = new char[r.len];
-    r.str = s;
-    r.ownstr = true;
-#if 0
-    memcpy(s, value, len);
-#else
-    std::copy(value, value + len, s);
-#endif
+    r.makeString(value, len);
     finish();
     return;
 }
@@ -479,7 +686,7 @@ toString() const
     case COMPOUND2:
         return compoundId1().toString() + ":" + compoundId2().toString();
     case STR:
-        return std::string(str, str + len);
+        return std::string(stringData(), stringLength());
     default:
         throw ML::Exception("unknown ID type");
     }
@@ -489,9 +696,18 @@ bool
 Id::
 complexEqual(const Id & other) const
 {
-    if (type == STR)
-        return len == other.len && (str == other.str || std::equal(str, str + len, other.str));
+    if (type == STR) {
+        if (shortLen != other.shortLen)
+            return false;
+        // Short strings are padded with zeros, and longer ones are
+        // interned so that equal strings have the same storage
+        if (shortLen)
+            return val == other.val;
+        return str == other.str;
+    }
     else if (type == COMPOUND2) {
+        if (cmp1 == other.cmp1)
+            return true;
         return compoundId1() == other.compoundId1()
             && compoundId2() == other.compoundId2();
     }
@@ -502,9 +718,11 @@ bool
 Id::
 complexLess(const Id & other) const
 {
-    if (type == STR)
-        return std::lexicographical_compare(str, str + len,
-                                            other.str, other.str + other.len);
+    if (type == STR) {
+        const char * s1 = stringData(), * s2 = other.stringData();
+        return std::lexicographical_compare(s1, s1 + stringLength(),
+                                            s2, s2 + other.stringLength());
+    }
     else if (type == COMPOUND2) {
         return ML::less_all(compoundId1(), other.compoundId1(),
                             compoundId2(), other.compoundId2());
@@ -520,12 +738,13 @@ complexHash() const
     std::string converted = toString();
     return CityHash64(converted.c_str(), converted.size());
 #else
-    if (type == STR)
-        return CityHash64(str, len);
-    else if (type == COMPOUND2) {
-        return Hash128to64(make_pair(compoundId1().hash(),
-                                     compoundId2().hash()));
+    if (type == STR) {
+        if (shortLen)
+            return CityHash64(shortStr, shortLen);
+        return SharedString::fromChars(str)->hash;
     }
+    else if (type == COMPOUND2)
+        return SharedCompound::fromIds(cmp1)->hash;
     //else if (type == CUSTOM)
     //    return controlFn(CF_HASH, data);
     else throw ML::Exception("unknown Id type");
@@ -538,13 +757,17 @@ complexDestroy()
 {
     if (type < STR) return;
     if (type == STR) {
-        if (ownstr) delete[] str;
-        str = 0;
-        ownstr = false;
+        if (!shortLen && str)
+            internTable().release(SharedString::fromChars(str));
+        val1 = val2 = 0;
+        shortLen = 0;
     }
     else if (type == COMPOUND2) {
-        delete cmp1;
-        delete cmp2;
+        if (cmp1) {
+            SharedCompound * shared = SharedCompound::fromIds(cmp1);
+            if (shared->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                delete shared;
+        }
         cmp1 = cmp2 = 0;
     }
     //else if (type == CUSTOM)
@@ -557,17 +780,13 @@ Id::
 complexFinishCopy()
 {
     if (type == STR) {
-        if (!ownstr) return;
-        const char * oldStr = str;
-        char * s = new char[len];
-        str = s;
-        std::copy(oldStr, oldStr + len, s);
+        if (!shortLen)
+            SharedString::fromChars(str)->refs
+                .fetch_add(1, std::memory_order_relaxed);
     }
     else if (type == COMPOUND2) {
-        //cerr << "cmp1 = " << cmp1 << " cmp2 = " << cmp2 << " type = "
-        //     << (int)type << endl;
-        cmp1 = new Id(compoundId1());
-        cmp2 = new Id(compoundId2());
+        SharedCompound::fromIds(cmp1)->refs
+            .fetch_add(1, std::memory_order_relaxed);
     }
     //else if (type == CUSTOM)
     //    data = (void *)controlFn(CF_COPY, data);
@@ -599,7 +818,7 @@ serialize(ML::DB::Store_Writer & store) const
         store.save_binary(&val2, 8);
         break;
     case STR:
-        store << string(str, str + len);
+        store << string(stringData(), stringLength());
         break;
     case COMPOUND2:
         compoundId1().serialize(store);
@@ -668,18 +887,13 @@ reconstitute(ML::DB::Store_Reader & store)
     case STR: {
         std::string s;
         store >> s;
-        r.len = s.size();
-        r.ownstr = true;
-        char * s2 = new char[s.size()];
-        r.str = s2;
-        std::copy(s.begin(), s.end(), s2);
+        r.makeString(s.data(), s.size());
         break;
     }
     case COMPOUND2: {
-        unique_ptr<Id> id1(new Id()), id2(new Id());
-        store >> *id1 >> *id2;
-        r.cmp1 = id1.release();
-        r.cmp2 = id2.release();
+        Id id1, id2;
+        store >> id1 >> id2;
+        r.makeCompound(id1, id2);
         break;
     }
     default:
@@ -69,7 +69,7 @@ struct Id {
     };
 
     Id()
-        : type(NONE), val1(0), val2(0)
+        : type(NONE), shortLen(0), val1(0), val2(0)
     {
     }
 
@@ -81,20 +81,20 @@ struct Id {
 
     explicit Id(const std::string & value,
                 Type type = UNKNOWN)
-        : type(NONE), val1(0), val2(0)
+        : type(NONE), shortLen(0), val1(0), val2(0)
     {
         parse(value, type);
     }
     
     explicit Id(const char * value, size_t len,
                 Type type = UNKNOWN)
-        : type(NONE), val1(0), val2(0)
+        : type(NONE), shortLen(0), val1(0), val2(0)
     {
         parse(value, len, type);
     }
     
     explicit Id(uint64_t value):
-    		type(BIGDEC),
+    		type(BIGDEC), shortLen(0),
     		val1(value),val2(0)
     {
     }
@@ -102,21 +102,20 @@ struct Id {
 
     // Construct a compound ID from two others
     Id(const Id & underlying1, const Id & underlying2)
-        : type(COMPOUND2),
-          cmp1(new Id(underlying1)),
-          cmp2(new Id(underlying2))
+        : type(NONE), shortLen(0), val1(0), val2(0)
     {
+        makeCompound(underlying1, underlying2);
     }
 
     Id(Id && other)
-        : type(other.type),
+        : type(other.type), shortLen(other.shortLen),
           val1(other.val1), val2(other.val2)
     {
         other.type = NONE;
     }
 
     Id(const Id & other)
-        : type(other.type),
+        : type(other.type), shortLen(other.shortLen),
           val1(other.val1), val2(other.val2)
     {
         if (other.type >= STR)
@@ -128,6 +127,7 @@ struct Id {
         if (type >= STR)
             complexDestroy();
         type = other.type;
+        shortLen = other.shortLen;
         val1 = other.val1;
         val2 = other.val2;
         other.type = NONE;
@@ -139,6 +139,7 @@ struct Id {
         if (type >= STR)
             complexDestroy();
         type = other.type;
+        shortLen = other.shortLen;
         val1 = other.val1;
         val2 = other.val2;
         if (other.type >= STR)
@@ -207,7 +208,7 @@ struct Id {
         if (type == NONE || type == NULLID) return 0;
 #if ID_HASH_AS_STRING
         if (type == STR)
-            return CityHash64(str, len);
+            return CityHash64(stringData(), stringLength());
         return complexHash();
 #else
         if (JML_UNLIKELY(type >= STR)) return complexHash();
@@ -221,8 +222,31 @@ struct Id {
     void complexDestroy();
     void complexFinishCopy();
 
+    /** Characters of a STR Id.  Up to 16 of them are stored in place;
+        longer ones are interned in a table shared by all the Ids, along
+        with their hash, so that Ids parsed from the same string share
+        their storage and copying one only counts a reference.
+    */
+    const char * stringData() const
+    {
+        return shortLen ? shortStr : str;
+    }
+
+    size_t stringLength() const
+    {
+        return shortLen ? shortLen : len;
+    }
+
+    /// Make this a STR Id for the given characters
+    void makeString(const char * value, size_t len);
+
+    /// Make this a COMPOUND2 Id; both halves share one reference counted
+    /// allocation that copies of this Id also share
+    void makeCompound(const Id & underlying1, const Id & underlying2);
+
     uint8_t type;
-    uint8_t unused[3];
+    uint8_t shortLen;   ///< STR: number of characters in shortStr, or 0
+    uint8_t unused[2];
 
     union {
         // 128 byte integer
@@ -247,13 +271,15 @@ struct Id {
             uint64_t f5:48;
         };
 
-        // string
+        // string longer than 16 characters (or empty), in the intern table
         struct {
-            uint64_t len:56;
-            uint64_t ownstr:8;
+            uint64_t len;
             const char * str;
         };
 
+        // string of up to 16 characters, padded with zeros
+        char shortStr[16];
+
         // compound2
         struct {
             Id * cmp1;
@@ -0,0 +1,1286 @@
+/* json_indexed_parsing.cc
+   Copyright (c) 2015 Datacratic Inc.  All rights reserved.
+
+   Two stage JSON parsing of in-memory documents.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+
+#include "jml/arch/exception.h"
+
+#include "json_indexed_parsing.h"
+
+using namespace std;
+
+
+/*****************************************************************************/
+/* JSON STRUCTURAL INDEX                                                     */
+/*****************************************************************************/
+
+namespace {
+
+using Datacratic::JsonIndexer;
+
+typedef bool (*IndexFn)(const char * data, size_t size,
+                        std::vector<uint32_t> & offsets);
+
+inline bool isStructural(char c)
+{
+    return c == '{' || c == '}' || c == '[' || c == ']'
+        || c == ':' || c == ',';
+}
+
+/* Reference implementation, one character at a time.  A backslash escapes
+   the following character wherever it is, like in the block version, so
+   that both produce the same index for any input. */
+
+bool
+indexScalar(const char * data, size_t size, std::vector<uint32_t> & offsets)
+{
+    bool inString = false;
+    bool escaped = false;
+
+    for (size_t i = 0;  i < size;  ++i) {
+        char c = data[i];
+        bool isEscaped = escaped;
+        escaped = (c == '\\' && !isEscaped);
+
+        if (c == '"' && !isEscaped) {
+            inString = !inString;
+            offsets.push_back(i);
+        }
+        else if (!inString && isStructural(c))
+            offsets.push_back(i);
+    }
+
+    offsets.push_back(size);
+    return !inString;
+}
+
+#if defined(__x86_64__)
+
+/* The block versions compute, for 64 characters at a time, bitmasks of the
+   quotes, backslashes and structural characters; the rest of the work is
+   done on the bitmasks with integer instructions. */
+
+struct BlockState {
+    BlockState()
+        : escapedCarry(0), inStringCarry(0), count(0)
+    {
+    }
+
+    uint64_t escapedCarry;   ///< 1 if the next block starts escaped
+    uint64_t inStringCarry;  ///< all ones if it starts inside a string
+    size_t count;            ///< offsets found so far
+};
+
+/* Characters that are escaped by a backslash.  A run of backslashes
+   escapes the character after it when it has an odd length; runs are
+   found by adding their starting bits, which carries through the run. */
+
+inline uint64_t
+findEscaped(uint64_t backslashes, uint64_t & carry)
+{
+    const uint64_t evenBits = 0x5555555555555555ULL;
+
+    backslashes &= ~carry;
+    uint64_t followsEscape = (backslashes << 1) | carry;
+    uint64_t oddStarts = backslashes & ~evenBits & ~followsEscape;
+
+    unsigned long long evenStarts;
+    carry = __builtin_uaddll_overflow(oddStarts, backslashes, &evenStarts);
+    uint64_t invert = (uint64_t)evenStarts << 1;
+
+    return (evenBits ^ invert) & followsEscape;
+}
+
+/* Bit i of the result is the parity of bits 0 to i of x. */
+
+inline uint64_t
+prefixXor(uint64_t x)
+{
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+}
+
+inline void
+addBlock(uint64_t quotes, uint64_t backslashes, uint64_t structurals,
+         uint32_t base, BlockState & state, std::vector<uint32_t> & offsets)
+{
+    quotes &= ~findEscaped(backslashes, state.escapedCarry);
+
+    // Opening quotes are inside the string and closing ones are not
+    uint64_t inString = prefixXor(quotes) ^ state.inStringCarry;
+    state.inStringCarry = (uint64_t)((int64_t)inString >> 63);
+
+    uint64_t found = (structurals & ~inString) | quotes;
+
+    if (state.count + 64 > offsets.size())
+        offsets.resize(std::max(offsets.size() * 2, state.count + 64));
+
+    uint32_t * out = offsets.data() + state.count;
+    while (found) {
+        *out++ = base + __builtin_ctzll(found);
+        found &= found - 1;
+    }
+    state.count = out - offsets.data();
+}
+
+inline bool
+finishBlocks(size_t size, const BlockState & state,
+             std::vector<uint32_t> & offsets)
+{
+    offsets.resize(state.count);
+    offsets.push_back(size);
+    return state.inStringCarry == 0;
+}
+
+/* The last partial block is copied into a buffer padded with spaces, since
+   reading past the end could cross into an unmapped page. */
+
+inline void
+copyTail(char * tail, const char * data, size_t size)
+{
+    memset(tail, ' ', 64);
+    memcpy(tail, data, size);
+}
+
+/* Braces and brackets differ only by bit 5, so both are matched by
+   comparing with that bit set. */
+
+inline void
+masksSse2(const char * block, uint64_t & quotes, uint64_t & backslashes,
+          uint64_t & structurals)
+{
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i bit5 = _mm_set1_epi8(0x20);
+    const __m128i open = _mm_set1_epi8('{');
+    const __m128i close = _mm_set1_epi8('}');
+    const __m128i colon = _mm_set1_epi8(':');
+    const __m128i comma = _mm_set1_epi8(',');
+
+    quotes = backslashes = structurals = 0;
+
+    for (int i = 0;  i < 4;  ++i) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (block + 16 * i));
+        __m128i folded = _mm_or_si128(v, bit5);
+        __m128i s = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(folded, open),
+                                              _mm_cmpeq_epi8(folded, close)),
+                                 _mm_or_si128(_mm_cmpeq_epi8(v, colon),
+                                              _mm_cmpeq_epi8(v, comma)));
+
+        int shift = 16 * i;
+        quotes |= (uint64_t)(uint16_t)
+            _mm_movemask_epi8(_mm_cmpeq_epi8(v, quote)) << shift;
+        backslashes |= (uint64_t)(uint16_t)
+            _mm_movemask_epi8(_mm_cmpeq_epi8(v, backslash)) << shift;
+        structurals |= (uint64_t)(uint16_t)_mm_movemask_epi8(s) << shift;
+    }
+}
+
+bool
+indexSse2(const char * data, size_t size, std::vector<uint32_t> & offsets)
+{
+    BlockState state;
+    uint64_t quotes, backslashes, structurals;
+
+    size_t i = 0;
+    for (;  i + 64 <= size;  i += 64) {
+        masksSse2(data + i, quotes, backslashes, structurals);
+        addBlock(quotes, backslashes, structurals, i, state, offsets);
+    }
+
+    if (i < size) {
+        char tail[64];
+        copyTail(tail, data + i, size - i);
+        masksSse2(tail, quotes, backslashes, structurals);
+        addBlock(quotes, backslashes, structurals, i, state, offsets);
+    }
+
+    return finishBlocks(size, state, offsets);
+}
+
+__attribute__((target("avx2")))
+inline void
+masksAvx2(const char * block, uint64_t & quotes, uint64_t & backslashes,
+          uint64_t & structurals)
+{
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i bit5 = _mm256_set1_epi8(0x20);
+    const __m256i open = _mm256_set1_epi8('{');
+    const __m256i close = _mm256_set1_epi8('}');
+    const __m256i colon = _mm256_set1_epi8(':');
+    const __m256i comma = _mm256_set1_epi8(',');
+
+    quotes = backslashes = structurals = 0;
+
+    for (int i = 0;  i < 2;  ++i) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (block + 32 * i));
+        __m256i folded = _mm256_or_si256(v, bit5);
+        __m256i s
+            = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(folded, open),
+                                              _mm256_cmpeq_epi8(folded, close)),
+                              _mm256_or_si256(_mm256_cmpeq_epi8(v, colon),
+                                              _mm256_cmpeq_epi8(v, comma)));
+
+        int shift = 32 * i;
+        quotes |= (uint64_t)(uint32_t)
+            _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, quote)) << shift;
+        backslashes |= (uint64_t)(uint32_t)
+            _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, backslash)) << shift;
+        structurals |= (uint64_t)(uint32_t)_mm256_movemask_epi8(s) << shift;
+    }
+}
+
+__attribute__((target("avx2")))
+bool
+indexAvx2(const char * data, size_t size, std::vector<uint32_t> & offsets)
+{
+    BlockState state;
+    uint64_t quotes, backslashes, structurals;
+
+    size_t i = 0;
+    for (;  i + 64 <= size;  i += 64) {
+        masksAvx2(data + i, quotes, backslashes, structurals);
+        addBlock(quotes, backslashes, structurals, i, state, offsets);
+    }
+
+    if (i < size) {
+        char tail[64];
+        copyTail(tail, data + i, size - i);
+        masksAvx2(tail, quotes, backslashes, structurals);
+        addBlock(quotes, backslashes, structurals, i, state, offsets);
+    }
+
+    return finishBlocks(size, state, offsets);
+}
+
+bool
+isSupported(JsonIndexer indexer)
+{
+    switch (indexer) {
+    case JsonIndexer::Scalar:
+    case JsonIndexer::Sse2:
+        return true;
+    case JsonIndexer::Avx2:
+        /* may run during static initialization, before the cpu model used
+           by __builtin_cpu_supports is set up */
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+    }
+
+    return false;
+}
+
+IndexFn
+indexFunction(JsonIndexer indexer)
+{
+    switch (indexer) {
+    case JsonIndexer::Sse2:
+        return indexSse2;
+    case JsonIndexer::Avx2:
+        return indexAvx2;
+    default:
+        return indexScalar;
+    }
+}
+
+#else /* __x86_64__ */
+
+bool
+isSupported(JsonIndexer indexer)
+{
+    return (indexer == JsonIndexer::Scalar);
+}
+
+IndexFn
+indexFunction(JsonIndexer indexer)
+{
+    return indexScalar;
+}
+
+#endif /* __x86_64__ */
+
+JsonIndexer
+bestIndexer()
+{
+    if (isSupported(JsonIndexer::Avx2)) {
+        return JsonIndexer::Avx2;
+    }
+    if (isSupported(JsonIndexer::Sse2)) {
+        return JsonIndexer::Sse2;
+    }
+    return JsonIndexer::Scalar;
+}
+
+/* Indexer in use, changed by setJsonIndexer while parsers may be running.
+   Selected on first use so that documents parsed during the static
+   initialization of other files are indexed too. */
+struct IndexerSelection {
+    IndexerSelection()
+        : indexer(bestIndexer()), fn(indexFunction(indexer))
+    {
+    }
+
+    std::atomic<JsonIndexer> indexer;
+    std::atomic<IndexFn> fn;
+};
+
+IndexerSelection &
+currentIndexer()
+{
+    static IndexerSelection selection;
+    return selection;
+}
+
+bool
+doIndex(IndexFn fn, const char * start, const char * end,
+        std::vector<uint32_t> & offsets)
+{
+    size_t size = end - start;
+    offsets.clear();
+    if (size >= std::numeric_limits<uint32_t>::max())
+        return false;
+
+    // Typical documents have a structural character every 6 to 10 bytes
+    offsets.reserve(size / 4 + 64);
+    return fn(start, size, offsets);
+}
+
+} // file scope
+
+
+namespace Datacratic {
+
+JsonIndexer
+jsonIndexer()
+{
+    return currentIndexer().indexer;
+}
+
+bool
+setJsonIndexer(JsonIndexer indexer)
+{
+    if (!isSupported(indexer)) {
+        return false;
+    }
+    IndexerSelection & selection = currentIndexer();
+    selection.fn = indexFunction(indexer);
+    selection.indexer = indexer;
+
+    return true;
+}
+
+bool
+JsonStructuralIndex::
+index(const char * start, const char * end)
+{
+    return doIndex(currentIndexer().fn.load(std::memory_order_relaxed),
+                   start, end, offsets);
+}
+
+bool
+JsonStructuralIndex::
+index(const char * start, const char * end, JsonIndexer indexer)
+{
+    if (!isSupported(indexer))
+        throw ML::Exception("JSON indexer is not supported by this CPU");
+    return doIndex(indexFunction(indexer), start, end, offsets);
+}
+
+
+/*****************************************************************************/
+/* INDEXED JSON PARSING CONTEXT                                              */
+/*****************************************************************************/
+
+namespace {
+
+inline bool isJsonWhitespace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+inline bool isDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+/* First character of [p, e) that needs more than a copy: a backslash, a
+   control character or a byte of a multi-byte UTF-8 sequence. */
+
+const char *
+findSpecial(const char * p, const char * e)
+{
+#if defined(__x86_64__)
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i space = _mm_set1_epi8(' ');
+
+    // Bytes from 0x80 are negative, so the signed comparison finds them
+    for (;  p + 16 <= e;  p += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) p);
+        __m128i special = _mm_or_si128(_mm_cmpeq_epi8(v, backslash),
+                                       _mm_cmplt_epi8(v, space));
+        int mask = _mm_movemask_epi8(special);
+        if (mask != 0)
+            return p + __builtin_ctz(mask);
+    }
+#endif /* __x86_64__ */
+
+    for (;  p < e;  ++p) {
+        unsigned char c = *p;
+        if (c == '\\' || c < ' ' || c >= 0x80)
+            return p;
+    }
+
+    return e;
+}
+
+inline int
+hexDigit(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+} // file scope
+
+IndexedJsonParsingContext::
+IndexedJsonParsingContext(const std::string & filename,
+                          const char * start, const char * end,
+                          const JsonStructuralIndex & index)
+    : filename(filename), start(start), end(end),
+      current(start), next(index.offsets.data()), depth(0), failed_(false)
+{
+    if (index.offsets.empty() || index.offsets.back() != end - start)
+        throw ML::Exception("structural index doesn't match the document");
+}
+
+void
+IndexedJsonParsingContext::
+exception(const std::string & message)
+{
+    failed_ = true;
+    throw ML::Exception("at " + printPath() + ": " + message);
+}
+
+std::string
+IndexedJsonParsingContext::
+getContext() const
+{
+    int line = 1, col = 1;
+    for (const char * p = start;  p < current;  ++p) {
+        if (*p == '\n') {
+            ++line;
+            col = 1;
+        }
+        else ++col;
+    }
+
+    return filename + ":" + std::to_string(line) + ":" + std::to_string(col)
+        + " at " + printPath();
+}
+
+void
+IndexedJsonParsingContext::
+skipWhitespace() const
+{
+    while (current < end && isJsonWhitespace(*current))
+        ++current;
+}
+
+char
+IndexedJsonParsingContext::
+peek() const
+{
+    skipWhitespace();
+    if (current == end)
+        const_cast<IndexedJsonParsingContext *>(this)
+            ->exception("unexpected end of input");
+    return *current;
+}
+
+void
+IndexedJsonParsingContext::
+expectStructural(char c)
+{
+    skipWhitespace();
+    if (current == end || current != start + *next || *current != c)
+        exception(std::string("expected '") + c + "'");
+    ++next;
+    ++current;
+}
+
+bool
+IndexedJsonParsingContext::
+matchStructural(char c)
+{
+    skipWhitespace();
+    if (current == end || current != start + *next || *current != c)
+        return false;
+    ++next;
+    ++current;
+    return true;
+}
+
+IndexedJsonParsingContext::TokenType
+IndexedJsonParsingContext::
+scalarBounds(const char * & first, const char * & last) const
+{
+    skipWhitespace();
+
+    // A scalar goes up to the next structural character or whitespace
+    const char * limit = start + *next;
+    first = last = current;
+    while (last < limit && !isJsonWhitespace(*last))
+        ++last;
+
+    auto invalid = [&] ()
+        {
+            const_cast<IndexedJsonParsingContext *>(this)
+                ->exception("invalid JSON value");
+        };
+
+    size_t len = last - first;
+    if (len == 4 && strncmp(first, "true", 4) == 0)
+        return TOK_TRUE;
+    if (len == 5 && strncmp(first, "false", 5) == 0)
+        return TOK_FALSE;
+    if (len == 4 && strncmp(first, "null", 4) == 0)
+        return TOK_NULL;
+
+    // -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?
+    const char * p = first;
+    if (p < last && *p == '-')
+        ++p;
+    if (p == last)
+        invalid();
+    if (*p == '0')
+        ++p;
+    else if (isDigit(*p)) {
+        while (p < last && isDigit(*p))
+            ++p;
+    }
+    else invalid();
+
+    TokenType result = TOK_INTEGER;
+
+    if (p < last && *p == '.') {
+        ++p;
+        if (p == last || !isDigit(*p))
+            invalid();
+        while (p < last && isDigit(*p))
+            ++p;
+        result = TOK_FLOAT;
+    }
+
+    if (p < last && (*p == 'e' || *p == 'E')) {
+        ++p;
+        if (p < last && (*p == '+' || *p == '-'))
+            ++p;
+        if (p == last || !isDigit(*p))
+            invalid();
+        while (p < last && isDigit(*p))
+            ++p;
+        result = TOK_FLOAT;
+    }
+
+    if (p != last)
+        invalid();
+
+    return result;
+}
+
+IndexedJsonParsingContext::TokenType
+IndexedJsonParsingContext::
+expectScalar(const char * & first, const char * & last)
+{
+    TokenType result = scalarBounds(first, last);
+    current = last;
+    return result;
+}
+
+void
+IndexedJsonParsingContext::
+expectString(StringMode mode, const char * & first, const char * & last)
+{
+    skipWhitespace();
+    if (current == end || current != start + *next || *current != '"')
+        exception("expected string");
+
+    // The index guarantees that the next structural is the closing quote
+    const char * p = current + 1;
+    const char * e = start + next[1];
+    next += 2;
+    current = e + 1;
+
+    const char * special = findSpecial(p, e);
+    if (special == e) {
+        first = p;
+        last = e;
+        return;
+    }
+
+    scratch.assign(p, special);
+    p = special;
+
+    while (p < e) {
+        unsigned char c = *p;
+
+        if (c >= 0x80) {
+            if (mode == STR_ASCII)
+                exception("non-ASCII character in string");
+
+            // A run of bytes from 0x80 is made of whole code points
+            const char * q = p;
+            while (q < e && (unsigned char)*q >= 0x80)
+                ++q;
+            if (!utf8::is_valid(p, q))
+                exception("invalid UTF-8 in string");
+            scratch.append(p, q);
+            p = q;
+            continue;
+        }
+
+        ++p;
+
+        if (c != '\\') {
+            if (c < ' ' && mode != STR_UTF8)
+                exception("control character in string");
+            scratch.push_back(c);
+            continue;
+        }
+
+        if (p == e)
+            exception("invalid escaped char");
+        c = *p++;
+
+        switch (c) {
+        case 't': scratch.push_back('\t');  break;
+        case 'n': scratch.push_back('\n');  break;
+        case 'r': scratch.push_back('\r');  break;
+        case 'f': scratch.push_back('\f');  break;
+        case 'b': scratch.push_back('\b');  break;
+        case '/': scratch.push_back('/');   break;
+        case '\\':scratch.push_back('\\');  break;
+        case '"': scratch.push_back('"');   break;
+        case 'u': {
+            if (mode != STR_UTF8 || e - p < 4)
+                exception("unhandled unicode escape");
+            int code = 0;
+            for (int i = 0;  i < 4;  ++i) {
+                int digit = hexDigit(*p++);
+                if (digit < 0)
+                    exception("invalid unicode escape");
+                code = code * 16 + digit;
+            }
+            if (code >= 0xd800 && code <= 0xdfff)
+                exception("surrogate in unicode escape");
+
+            if (code < ' ' || code >= 127)
+                utf8::append(code, std::back_inserter(scratch));
+            else scratch.push_back(code);
+            break;
+        }
+        default:
+            exception("invalid escaped char");
+        }
+    }
+
+    first = scratch.data();
+    last = first + scratch.size();
+}
+
+void
+IndexedJsonParsingContext::
+expectInteger(bool & negative, unsigned long long & magnitude)
+{
+    const char * first, * last;
+    if (expectScalar(first, last) != TOK_INTEGER)
+        exception("expected integer");
+
+    negative = (*first == '-');
+    magnitude = 0;
+
+    for (const char * p = first + negative;  p < last;  ++p) {
+        unsigned digit = *p - '0';
+        if (magnitude > (std::numeric_limits<unsigned long long>::max()
+                         - digit) / 10)
+            exception("integer is too large");
+        magnitude = magnitude * 10 + digit;
+    }
+}
+
+template<typename Int>
+Int
+IndexedJsonParsingContext::
+expectIntegerOfType()
+{
+    bool negative;
+    unsigned long long magnitude;
+    expectInteger(negative, magnitude);
+
+    if (negative) {
+        if (!std::numeric_limits<Int>::is_signed)
+            exception("expected unsigned integer");
+        if (magnitude == 0)
+            return 0;
+        if (magnitude - 1 > (unsigned long long)std::numeric_limits<Int>::max())
+            exception("integer is out of range");
+        return -(Int)(magnitude - 1) - 1;
+    }
+
+    if (magnitude > (unsigned long long)std::numeric_limits<Int>::max())
+        exception("integer is out of range");
+    return magnitude;
+}
+
+int
+IndexedJsonParsingContext::
+expectInt()
+{
+    return expectIntegerOfType<int>();
+}
+
+unsigned int
+IndexedJsonParsingContext::
+expectUnsignedInt()
+{
+    return expectIntegerOfType<unsigned int>();
+}
+
+long
+IndexedJsonParsingContext::
+expectLong()
+{
+    return expectIntegerOfType<long>();
+}
+
+unsigned long
+IndexedJsonParsingContext::
+expectUnsignedLong()
+{
+    return expectIntegerOfType<unsigned long>();
+}
+
+long long
+IndexedJsonParsingContext::
+expectLongLong()
+{
+    return expectIntegerOfType<long long>();
+}
+
+unsigned long long
+IndexedJsonParsingContext::
+expectUnsignedLongLong()
+{
+    return expectIntegerOfType<unsigned long long>();
+}
+
+double
+IndexedJsonParsingContext::
+expectNumber()
+{
+    const char * first, * last;
+    TokenType type = expectScalar(first, last);
+    if (type != TOK_INTEGER && type != TOK_FLOAT)
+        exception("expected number");
+
+    char buffer[64];
+    size_t len = last - first;
+    if (len >= sizeof(buffer))
+        exception("number is too long");
+    memcpy(buffer, first, len);
+    buffer[len] = 0;
+
+    return strtod(buffer, nullptr);
+}
+
+float
+IndexedJsonParsingContext::
+expectFloat()
+{
+    const char * first, * last;
+    TokenType type = expectScalar(first, last);
+    if (type != TOK_INTEGER && type != TOK_FLOAT)
+        exception("expected number");
+
+    char buffer[64];
+    size_t len = last - first;
+    if (len >= sizeof(buffer))
+        exception("number is too long");
+    memcpy(buffer, first, len);
+    buffer[len] = 0;
+
+    return strtof(buffer, nullptr);
+}
+
+double
+IndexedJsonParsingContext::
+expectDouble()
+{
+    return expectNumber();
+}
+
+bool
+IndexedJsonParsingContext::
+expectBool()
+{
+    const char * first, * last;
+    TokenType type = expectScalar(first, last);
+    if (type != TOK_TRUE && type != TOK_FALSE)
+        exception("expected boolean");
+    return type == TOK_TRUE;
+}
+
+void
+IndexedJsonParsingContext::
+expectNull()
+{
+    const char * first, * last;
+    if (expectScalar(first, last) != TOK_NULL)
+        exception("expected null");
+}
+
+/* The match functions don't consume anything when they return false.
+   Numbers of the wrong kind throw instead, since the streaming context may
+   match part of them. */
+
+bool
+IndexedJsonParsingContext::
+matchUnsignedLongLong(unsigned long long & val)
+{
+    if (!isNumber())
+        return false;
+
+    const char * first, * last;
+    TokenType type = scalarBounds(first, last);
+    if (type != TOK_INTEGER)
+        exception("expected integer");
+    if (*first == '-')
+        return false;
+
+    val = expectUnsignedLongLong();
+    return true;
+}
+
+bool
+IndexedJsonParsingContext::
+matchLongLong(long long & val)
+{
+    if (!isNumber())
+        return false;
+
+    const char * first, * last;
+    TokenType type = scalarBounds(first, last);
+    if (type != TOK_INTEGER)
+        exception("expected integer");
+
+    val = expectLongLong();
+    return true;
+}
+
+bool
+IndexedJsonParsingContext::
+matchDouble(double & val)
+{
+    if (!isNumber())
+        return false;
+    val = expectNumber();
+    return true;
+}
+
+std::string
+IndexedJsonParsingContext::
+expectStringAscii()
+{
+    const char * first, * last;
+    expectString(STR_ASCII, first, last);
+    return std::string(first, last);
+}
+
+ssize_t
+IndexedJsonParsingContext::
+expectStringAscii(char * value, size_t maxLen)
+{
+    const char * oldCurrent = current;
+    const uint32_t * oldNext = next;
+
+    const char * first, * last;
+    expectString(STR_ASCII, first, last);
+
+    size_t len = last - first;
+    if (len >= maxLen) {
+        current = oldCurrent;
+        next = oldNext;
+        return -1;
+    }
+
+    memcpy(value, first, len);
+    value[len] = 0;
+    return len;
+}
+
+void
+IndexedJsonParsingContext::
+expectStringAsciiInto(std::string & value)
+{
+    const char * first, * last;
+    expectString(STR_ASCII, first, last);
+    value.assign(first, last);
+}
+
+Utf8String
+IndexedJsonParsingContext::
+expectStringUtf8()
+{
+    const char * first, * last;
+    expectString(STR_UTF8, first, last);
+    return Utf8String(std::string(first, last));
+}
+
+Json::Value
+IndexedJsonParsingContext::
+expectJsonScalar()
+{
+    const char * first, * last;
+    switch (scalarBounds(first, last)) {
+    case TOK_TRUE:
+        current = last;
+        return Json::Value(true);
+    case TOK_FALSE:
+        current = last;
+        return Json::Value(false);
+    case TOK_NULL:
+        current = last;
+        return Json::Value();
+    case TOK_FLOAT:
+        return Json::Value(expectNumber());
+    case TOK_INTEGER:
+        break;
+    }
+
+    bool negative;
+    unsigned long long magnitude;
+    expectInteger(negative, magnitude);
+
+    if (!negative)
+        return Json::Value((Json::UInt)magnitude);
+    if (magnitude == 0)
+        return Json::Value((Json::Int)0);
+    if (magnitude - 1 > (unsigned long long)std::numeric_limits<Json::Int>::max())
+        exception("integer is out of range");
+    return Json::Value(-(Json::Int)(magnitude - 1) - 1);
+}
+
+Json::Value
+IndexedJsonParsingContext::
+expectJson()
+{
+    const char * first, * last;
+
+    switch (peek()) {
+    case '"':
+        expectString(STR_JSON, first, last);
+        return Json::Value(std::string(first, last));
+
+    case '[': {
+        Json::Value result(Json::arrayValue);
+        expectStructural('[');
+        if (matchStructural(']'))
+            return result;
+        int index = 0;
+        do {
+            result[index++] = expectJson();
+        } while (matchStructural(','));
+        expectStructural(']');
+        return result;
+    }
+
+    case '{': {
+        Json::Value result(Json::objectValue);
+        expectStructural('{');
+        if (matchStructural('}'))
+            return result;
+        do {
+            expectString(STR_JSON, first, last);
+            std::string key(first, last);
+            expectStructural(':');
+            result[key] = expectJson();
+        } while (matchStructural(','));
+        expectStructural('}');
+        return result;
+    }
+
+    default:
+        return expectJsonScalar();
+    }
+}
+
+bool
+IndexedJsonParsingContext::
+isObject() const
+{
+    return peek() == '{';
+}
+
+bool
+IndexedJsonParsingContext::
+isString() const
+{
+    return peek() == '"';
+}
+
+bool
+IndexedJsonParsingContext::
+isArray() const
+{
+    return peek() == '[';
+}
+
+bool
+IndexedJsonParsingContext::
+isBool() const
+{
+    char c = peek();
+    if (c == '{' || c == '[' || c == '"')
+        return false;
+    const char * first, * last;
+    TokenType type = scalarBounds(first, last);
+    return type == TOK_TRUE || type == TOK_FALSE;
+}
+
+bool
+IndexedJsonParsingContext::
+isNumber() const
+{
+    char c = peek();
+    if (c == '{' || c == '[' || c == '"')
+        return false;
+    const char * first, * last;
+    TokenType type = scalarBounds(first, last);
+    return type == TOK_INTEGER || type == TOK_FLOAT;
+}
+
+bool
+IndexedJsonParsingContext::
+isNull() const
+{
+    char c = peek();
+    if (c == '{' || c == '[' || c == '"')
+        return false;
+    const char * first, * last;
+    return scalarBounds(first, last) == TOK_NULL;
+}
+
+void
+IndexedJsonParsingContext::
+skipValue()
+{
+    const char * first, * last;
+
+    switch (peek()) {
+    case '"':
+        expectString(STR_JSON, first, last);
+        return;
+
+    case '[':
+        expectStructural('[');
+        if (matchStructural(']'))
+            return;
+        do {
+            skipValue();
+        } while (matchStructural(','));
+        expectStructural(']');
+        return;
+
+    case '{':
+        expectStructural('{');
+        if (matchStructural('}'))
+            return;
+        do {
+            expectString(STR_JSON, first, last);
+            expectStructural(':');
+            skipValue();
+        } while (matchStructural(','));
+        expectStructural('}');
+        return;
+
+    default:
+        expectJsonScalar();
+    }
+}
+
+std::string
+IndexedJsonParsingContext::
+expectRawJson()
+{
+    skipWhitespace();
+    const char * first = current;
+    skipValue();
+    return std::string(first, current);
+}
+
+void
+IndexedJsonParsingContext::
+skip()
+{
+    skipValue();
+}
+
+std::string
+IndexedJsonParsingContext::
+printCurrent()
+{
+    const char * oldCurrent = current;
+    const uint32_t * oldNext = next;
+    bool oldFailed = failed_;
+
+    std::string result;
+    try {
+        result = boost::trim_copy(expectJson().toString());
+    } catch (const std::exception &) {
+        const char * eol = std::find(oldCurrent, end, '\n');
+        result = std::string(oldCurrent, eol);
+    }
+
+    current = oldCurrent;
+    next = oldNext;
+    failed_ = oldFailed;
+    return result;
+}
+
+void
+IndexedJsonParsingContext::
+forEachMember(const std::function<void ()> & fn)
+{
+    expectStructural('{');
+    if (matchStructural('}'))
+        return;
+
+    if (depth == (int)memberNames.size())
+        memberNames.emplace_back();
+    std::string & memberName = memberNames[depth];
+
+    int memberNum = 0;
+
+    do {
+        const char * first, * last;
+        expectString(STR_ASCII, first, last);
+        memberName.assign(first, last);
+        expectStructural(':');
+
+        // Same as in the streaming context: the member is popped from the
+        // path no matter what
+        struct PathPusher {
+            PathPusher(const char * memberName,
+                       int memberNum,
+                       IndexedJsonParsingContext * context)
+                : context(context)
+            {
+                context->pushPath(memberName, memberNum);
+                ++context->depth;
+            }
+
+            ~PathPusher()
+            {
+                --context->depth;
+                context->popPath();
+            }
+
+            IndexedJsonParsingContext * const context;
+        } pusher(memberName.c_str(), memberNum++, this);
+
+        fn();
+    } while (matchStructural(','));
+
+    expectStructural('}');
+}
+
+void
+IndexedJsonParsingContext::
+forEachElement(const std::function<void ()> & fn)
+{
+    expectStructural('[');
+    if (matchStructural(']'))
+        return;
+
+    int index = 0;
+
+    do {
+        if (index == 0)
+            pushPath(index);
+        else replacePath(index);
+
+        fn();
+
+        ++index;
+    } while (matchStructural(','));
+
+    expectStructural(']');
+    popPath();
+}
+
+
+/*****************************************************************************/
+/* PARSE JSON INDEXED                                                        */
+/*****************************************************************************/
+
+void
+parseJsonIndexed(const std::string & filename,
+                 const char * start, const char * end,
+                 const std::function<void (JsonParsingContext &)> & parse,
+                 const std::function<void ()> & reset)
+{
+    JsonStructuralIndex index;
+    parseJsonIndexed(filename, start, end, parse, reset, index);
+}
+
+void
+parseJsonIndexed(const std::string & filename,
+                 const char * start, const char * end,
+                 const std::function<void (JsonParsingContext &)> & parse,
+                 const std::function<void ()> & reset,
+                 JsonStructuralIndex & index)
+{
+    if (index.index(start, end)) {
+        IndexedJsonParsingContext context(filename, start, end, index);
+        try {
+            parse(context);
+            return;
+        } catch (...) {
+            // The descriptions may wrap the error in another exception, so
+            // ask the context rather than looking at the type
+            if (!context.failed())
+                throw;
+        }
+
+        // Start again so that the result is exactly what the streaming
+        // context gives, including the error message if any
+        reset();
+    }
+
+    StreamingJsonParsingContext context(filename, start, end);
+    parse(context);
+}
+
+} // namespace Datacratic
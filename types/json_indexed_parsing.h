@@ -0,0 +1,220 @@
+/* json_indexed_parsing.h                                          -*- C++ -*-
+   Copyright (c) 2015 Datacratic Inc.  All rights reserved.
+
+   JSON parsing of an in-memory document in two stages.  The first stage
+   finds the offsets of all of the structural characters of the document
+   (braces, brackets, colons, commas and the quotes around strings) in
+   64 byte blocks with SIMD instructions.  The second stage is a parsing
+   context that jumps between those offsets instead of looking at each
+   character in turn.
+
+   The indexed context only accepts strictly valid JSON and only handles
+   the cases where its result is known to be the same as the streaming
+   context's.  For anything else, including all parse errors,
+   parseJsonIndexed() starts over with a StreamingJsonParsingContext, so
+   that the result and the error messages are exactly the same as the
+   streaming context's.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "soa/types/json_parsing.h"
+
+
+namespace Datacratic {
+
+
+/*****************************************************************************/
+/* JSON STRUCTURAL INDEX                                                     */
+/*****************************************************************************/
+
+/* Implementation used to find the structural characters.  The fastest one
+   supported by the CPU is selected at startup. */
+
+enum class JsonIndexer {
+    Scalar,
+    Sse2,
+    Avx2
+};
+
+JsonIndexer jsonIndexer();
+
+/* Select the indexer to use, for example for benchmarking.  Returns "false"
+   and leaves the current indexer unchanged when "indexer" is not supported
+   by the CPU. */
+bool setJsonIndexer(JsonIndexer indexer);
+
+struct JsonStructuralIndex {
+
+    /** Offsets of the structural characters of the document, followed by
+        the length of the document.  Braces, brackets, colons and commas
+        inside strings are not structural.
+    */
+    std::vector<uint32_t> offsets;
+
+    /** Index the document in [start, end).  Returns false when the document
+        can't be indexed, because a string is not terminated or the document
+        is 4GB or more.
+    */
+    bool index(const char * start, const char * end);
+
+    /** Same, with the given implementation. */
+    bool index(const char * start, const char * end, JsonIndexer indexer);
+};
+
+
+/*****************************************************************************/
+/* INDEXED JSON PARSING CONTEXT                                              */
+/*****************************************************************************/
+
+/** Parsing context that uses a structural index of the document.  Any
+    input that it doesn't handle in exactly the same way as the
+    StreamingJsonParsingContext, valid or not, makes it throw; use it through
+    parseJsonIndexed() which takes care of starting over with the streaming
+    context.
+*/
+
+struct IndexedJsonParsingContext
+    : public JsonParsingContext {
+
+    /** The document and the index must stay valid while parsing. */
+    IndexedJsonParsingContext(const std::string & filename,
+                              const char * start, const char * end,
+                              const JsonStructuralIndex & index);
+
+    virtual void exception(const std::string & message);
+
+    /** Whether exception() was called, ie whether an exception thrown while
+        parsing comes from the document rather than from elsewhere.
+    */
+    bool failed() const
+    {
+        return failed_;
+    }
+
+    virtual std::string getContext() const;
+
+    virtual int expectInt();
+    virtual unsigned int expectUnsignedInt();
+    virtual long expectLong();
+    virtual unsigned long expectUnsignedLong();
+    virtual long long expectLongLong();
+    virtual unsigned long long expectUnsignedLongLong();
+
+    virtual float expectFloat();
+    virtual double expectDouble();
+    virtual bool expectBool();
+    virtual bool matchUnsignedLongLong(unsigned long long & val);
+    virtual bool matchLongLong(long long & val);
+    virtual bool matchDouble(double & val);
+    virtual std::string expectStringAscii();
+    virtual ssize_t expectStringAscii(char * value, size_t maxLen);
+    virtual void expectStringAsciiInto(std::string & value);
+    virtual Utf8String expectStringUtf8();
+    virtual Json::Value expectJson();
+    virtual std::string expectRawJson();
+    virtual void expectNull();
+    virtual bool isObject() const;
+    virtual bool isString() const;
+    virtual bool isArray() const;
+    virtual bool isBool() const;
+    virtual bool isNumber() const;
+    virtual bool isNull() const;
+    virtual void skip();
+
+    virtual std::string printCurrent();
+
+    virtual void forEachMember(const std::function<void ()> & fn);
+    virtual void forEachElement(const std::function<void ()> & fn);
+
+private:
+    enum TokenType {
+        TOK_TRUE,
+        TOK_FALSE,
+        TOK_NULL,
+        TOK_INTEGER,       ///< Number with no fraction or exponent
+        TOK_FLOAT          ///< Any other number
+    };
+
+    /// Which strings are accepted, to match the streaming context's
+    /// functions for each case
+    enum StringMode {
+        STR_ASCII,         ///< expectJsonStringAscii
+        STR_UTF8,          ///< StreamingJsonParsingContext::expectStringUtf8
+        STR_JSON           ///< expectJsonStringUTF8
+    };
+
+    std::string filename;
+    const char * start;
+    const char * end;
+
+    mutable const char * current;    ///< Position in the document
+    const uint32_t * next;           ///< Next structural character
+
+    /// Member names at each depth, so that paths can point to them
+    std::deque<std::string> memberNames;
+    int depth;
+
+    /// Strings with escapes are unescaped into this buffer
+    std::string scratch;
+
+    bool failed_;
+
+    void skipWhitespace() const;
+    char peek() const;
+    void expectStructural(char c);
+    bool matchStructural(char c);
+
+    /// Bounds of the scalar at the current position
+    TokenType scalarBounds(const char * & first, const char * & last) const;
+    TokenType expectScalar(const char * & first, const char * & last);
+
+    /// Read a string into [first, last), which points either into the
+    /// document or into scratch
+    void expectString(StringMode mode, const char * & first,
+                      const char * & last);
+
+    void expectInteger(bool & negative, unsigned long long & magnitude);
+
+    template<typename Int>
+    Int expectIntegerOfType();
+
+    double expectNumber();
+    Json::Value expectJsonScalar();
+    void skipValue();
+};
+
+
+/*****************************************************************************/
+/* PARSE JSON INDEXED                                                        */
+/*****************************************************************************/
+
+/** Parse the JSON document in [start, end) by calling parse with an
+    IndexedJsonParsingContext.  If the context raises an error, reset is
+    called and then parse again with a StreamingJsonParsingContext on the
+    same document, so that the result or the exception is the same as with
+    the streaming context alone.  The hooks of the value descriptions may
+    therefore be called twice for invalid documents.  Any other exception,
+    for example from parse itself, is passed on without parsing again.
+*/
+void parseJsonIndexed(const std::string & filename,
+                      const char * start, const char * end,
+                      const std::function<void (JsonParsingContext &)> & parse,
+                      const std::function<void ()> & reset);
+
+/** Same, using the given index for the document so that its memory is
+    reused from one document to the next.
+*/
+void parseJsonIndexed(const std::string & filename,
+                      const char * start, const char * end,
+                      const std::function<void (JsonParsingContext &)> & parse,
+                      const std::function<void ()> & reset,
+                      JsonStructuralIndex & index);
+
+} // namespace Datacratic
@@ -154,8 +154,23 @@ struct JsonPath: public ML::compact_vector<JsonPathEntry, 8> {
 
 struct JsonParsingContext {
 
+    JsonParsingContext()
+        : reuseOutput(false)
+    {
+    }
+
     JsonPath path;
 
+    /** When set, the values being parsed into may hold a previous result
+        whose memory is reused: strings and vectors keep their capacity and
+        the elements of vectors, the pointees of Optional and unique_ptr
+        and the members of structures are parsed in place.  The result is
+        the same as parsing into a default constructed value, as long as
+        the descriptions overwrite the whole value that they parse into,
+        which all of the standard ones do.
+    */
+    bool reuseOutput;
+
     std::string printPath() const
     {
         return path.print();
@@ -200,6 +215,15 @@ struct JsonParsingContext {
         at, for example line number and column.
     */
     virtual std::string getContext() const = 0;
+
+    /** Field number of the member being parsed, for contexts that identify
+        structure fields by number rather than by name.  Returns -1 when the
+        member is identified by its name.
+    */
+    virtual int memberFieldNum() const
+    {
+        return -1;
+    }
     
     virtual int expectInt() = 0;
     virtual unsigned int expectUnsignedInt() = 0;
@@ -216,8 +240,27 @@ struct JsonParsingContext {
     virtual bool matchDouble(double & val) = 0;
     virtual std::string expectStringAscii() = 0;
     virtual ssize_t expectStringAscii(char * value, size_t maxLen) = 0;
+
+    /** Same as expectStringAscii(), but assigns to value so that the memory
+        it already holds is reused.
+    */
+    virtual void expectStringAsciiInto(std::string & value)
+    {
+        value = expectStringAscii();
+    }
+
     virtual Utf8String expectStringUtf8() = 0;
     virtual Json::Value expectJson() = 0;
+
+    /** Return the JSON text of the current value and move past it.  The
+        text is taken as is from the document when the context has it, and
+        otherwise is the value printed back as JSON.
+    */
+    virtual std::string expectRawJson()
+    {
+        return expectJson().toStringNoNewLine();
+    }
+
     virtual void expectNull() = 0;
     virtual bool isObject() const = 0;
     virtual bool isString() const = 0;
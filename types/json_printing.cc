@@ -5,8 +5,20 @@
    Functionality to print JSON values.
 */
 
+#include <stdint.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif /* __SSE2__ */
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
 #include "jml/utils/exc_assert.h"
 
+#include "soa/jsoncpp/reader.h"
+
 #include "json_printing.h"
 #include "dtoa.h"
 
@@ -16,6 +28,18 @@ using namespace std;
 namespace Datacratic {
 
 
+/*****************************************************************************/
+/* JSON PRINTING CONTEXT                                                     */
+/*****************************************************************************/
+
+void
+JsonPrintingContext::
+writeRawJson(const std::string & json)
+{
+    writeJson(Json::parse(json));
+}
+
+
 void
 StreamJsonPrintingContext::
 writeStringUtf8(const Utf8String & s)
@@ -216,6 +240,13 @@ writeJson(const Json::Value & val)
     stream << val.toStringNoNewLine();
 }
 
+void
+StreamJsonPrintingContext::
+writeRawJson(const std::string & json)
+{
+    stream << json;
+}
+
 void
 StreamJsonPrintingContext::
 writeBool(bool b)
@@ -224,6 +255,504 @@ writeBool(bool b)
 }
 
 
+/*****************************************************************************/
+/* STRING JSON PRINTING CONTEXT                                              */
+/*****************************************************************************/
+
+namespace {
+
+const char digitPairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+/* Entry 0 is 0 rather than 1 so that 0 has one digit */
+const uint64_t digitThresholds[20] = {
+    0ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+    10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL,
+    100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+    100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+    100000000000000000ULL, 1000000000000000000ULL,
+    10000000000000000000ULL
+};
+
+inline int numDigits(uint64_t v)
+{
+    // floor(log10(2) * bits) is either the number of digits or one less
+    int t = ((64 - __builtin_clzll(v | 1)) * 1233) >> 12;
+    return t + (v >= digitThresholds[t]);
+}
+
+/* Writes the decimal digits of v two at a time from the end, and returns
+   the end of the output.  At most 20 characters are written. */
+char * formatUnsigned(char * out, uint64_t v)
+{
+    char * end = out + numDigits(v);
+    char * p = end;
+    while (v >= 100) {
+        unsigned i = (v % 100) * 2;
+        v /= 100;
+        p -= 2;
+        memcpy(p, digitPairs + i, 2);
+    }
+    if (v >= 10) {
+        p -= 2;
+        memcpy(p, digitPairs + v * 2, 2);
+    }
+    else *--p = '0' + v;
+    return end;
+}
+
+char * formatSigned(char * out, int64_t v)
+{
+    uint64_t magnitude = v;
+    if (v < 0) {
+        *out++ = '-';
+        magnitude = -magnitude;
+    }
+    return formatUnsigned(out, magnitude);
+}
+
+const double exactPowersOf10[23] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/* Find the shortest digits that read back as d, for the common case of a
+   number with few significant digits, without the big integer arithmetic
+   of dtoa.  d must be finite and positive.
+
+   d is scaled by increasing powers of 10 until the nearest integer m reads
+   back as d.  Both m and the power of 10 are exact doubles, so m / 10^k is
+   correctly rounded like strtod() is, which makes the check exact.  When
+   m - 1 or m + 1 also read back as d, dtoa's choice of the closest one
+   would need more precision, so the caller falls back to it. */
+bool shortestDigits(double d, uint64_t & digits, int & decpt)
+{
+    for (int k = 0;  k < 23;  ++k) {
+        double scaled = d * exactPowersOf10[k];
+        if (scaled >= 9007199254740992.0)  // 2^53
+            return false;
+
+        uint64_t m = scaled + 0.5;
+        if (m / exactPowersOf10[k] != d)
+            continue;
+
+        if ((m + 1) / exactPowersOf10[k] == d
+            || (m > 0 && (m - 1) / exactPowersOf10[k] == d))
+            return false;
+
+        decpt = numDigits(m) - k;
+        while (m % 10 == 0)
+            m /= 10;
+        digits = m;
+        return true;
+    }
+
+    return false;
+}
+
+/* Lays out the digits like Datacratic::dtoa() does.  At most 32 characters
+   are written. */
+char * formatDecimal(char * out, bool negative,
+                     const char * digits, int n, int decpt)
+{
+    if (negative)
+        *out++ = '-';
+
+    if (decpt > 0 && decpt <= n) {
+        memcpy(out, digits, decpt);
+        out += decpt;
+        if (decpt < n) {
+            *out++ = '.';
+            memcpy(out, digits + decpt, n - decpt);
+            out += n - decpt;
+        }
+    }
+    else if (decpt <= 0 && decpt > -6) {
+        *out++ = '0';
+        *out++ = '.';
+        for (int i = 0;  i < -decpt;  ++i)
+            *out++ = '0';
+        memcpy(out, digits, n);
+        out += n;
+    }
+    else {
+        *out++ = digits[0];
+        if (n > 1) {
+            *out++ = '.';
+            memcpy(out, digits + 1, n - 1);
+            out += n - 1;
+        }
+        *out++ = 'e';
+        out = formatSigned(out, decpt - 1);
+    }
+
+    return out;
+}
+
+/* Same output as Datacratic::dtoa(d) for a finite d */
+char * formatDouble(char * out, double d)
+{
+    bool negative = std::signbit(d);
+    if (d == 0) {
+        if (negative)
+            *out++ = '-';
+        *out++ = '0';
+        return out;
+    }
+
+    uint64_t value;
+    int decpt;
+    if (shortestDigits(std::fabs(d), value, decpt)) {
+        char digits[20];
+        int n = formatUnsigned(digits, value) - digits;
+        return formatDecimal(out, negative, digits, n, decpt);
+    }
+
+    int sign;
+    char * last;
+    char * digits = soa_dtoa(d, 1, -1 /* ndigits */, &decpt, &sign, &last);
+    out = formatDecimal(out, sign, digits, last - digits, decpt);
+    soa_freedtoa(digits);
+    return out;
+}
+
+/* Same output as the stream context for infinities and NaN */
+const char * nonFiniteString(double d)
+{
+    if (std::isnan(d))
+        return std::signbit(d) ? "\"-nan\"" : "\"nan\"";
+    return d < 0 ? "\"-inf\"" : "\"inf\"";
+}
+
+} // file scope
+
+StringJsonPrintingContext::
+StringJsonPrintingContext()
+    : writeUtf8(true), buffer(new char[256]),
+      pos(buffer.get()), end(buffer.get() + 256)
+{
+}
+
+void
+StringJsonPrintingContext::
+clear()
+{
+    path.clear();
+    pos = buffer.get();
+}
+
+void
+StringJsonPrintingContext::
+grow(size_t n)
+{
+    size_t used = size();
+    size_t capacity = std::max<size_t>(2 * (end - buffer.get()), used + n);
+    std::unique_ptr<char[]> newBuffer(new char[capacity]);
+    memcpy(newBuffer.get(), buffer.get(), used);
+    buffer = std::move(newBuffer);
+    pos = buffer.get() + used;
+    end = buffer.get() + capacity;
+}
+
+void
+StringJsonPrintingContext::
+write(const char * s, size_t n)
+{
+    memcpy(reserve(n), s, n);
+    pos += n;
+}
+
+void
+StringJsonPrintingContext::
+writeCodePoint(int c)
+{
+    if (writeUtf8) {
+        pos = utf8::unchecked::append(c, reserve(4));
+        return;
+    }
+    ExcAssert(c >= 0 && c < 65536);
+    char * out = reserve(6);
+    static const char hex[] = "0123456789abcdef";
+    out[0] = '\\';
+    out[1] = 'u';
+    out[2] = hex[(c >> 12) & 15];
+    out[3] = hex[(c >> 8) & 15];
+    out[4] = hex[(c >> 4) & 15];
+    out[5] = hex[c & 15];
+    pos += 6;
+}
+
+/* Copies the characters that don't need escaping 16 at a time where SSE2 is
+   available, one at a time otherwise.  Strings are escaped like
+   ML::jsonEscape does, which is left to deal with anything that isn't
+   printable ASCII; Utf8 strings like writeStringUtf8() of the stream
+   context. */
+void
+StringJsonPrintingContext::
+writeEscaped(const char * s, size_t n, bool isUtf8)
+{
+    const char * p = s;
+    const char * e = s + n;
+
+#if defined(__SSE2__)
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i del = _mm_set1_epi8(127);
+#endif /* __SSE2__ */
+
+    // Every character might become a 6 character escape; reserve for the
+    // common case and again when one is found
+    reserve(n + 2);
+
+    for (;;) {
+#if defined(__SSE2__)
+        while (e - p >= 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *) p);
+            // Signed comparison, so that bytes >= 128 are below the space
+            __m128i special
+                = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote),
+                                            _mm_cmpeq_epi8(v, backslash)),
+                               _mm_or_si128(_mm_cmplt_epi8(v, space),
+                                            _mm_cmpeq_epi8(v, del)));
+            int mask = _mm_movemask_epi8(special);
+            int len = mask ? __builtin_ctz(mask) : 16;
+            memcpy(pos, p, 16);
+            pos += len;
+            p += len;
+            if (mask)
+                break;
+            reserve(e - p + 2);
+        }
+#endif /* __SSE2__ */
+
+        while (p < e) {
+            char c = *p;
+            if (c >= ' ' && c < 127 && c != '\"' && c != '\\') {
+                *pos++ = c;
+                ++p;
+            }
+            else break;
+        }
+
+        if (p == e)
+            return;
+
+        char c = *p;
+        const char * escape = nullptr;
+        switch (c) {
+        case '\t': escape = "\\t";  break;
+        case '\n': escape = "\\n";  break;
+        case '\r': escape = "\\r";  break;
+        case '\b': escape = "\\b";  break;
+        case '\f': escape = "\\f";  break;
+        case '\\': escape = "\\\\";  break;
+        case '\"': escape = "\\\"";  break;
+        }
+
+        if (escape) {
+            write(escape, 2);
+            ++p;
+        }
+        else if (isUtf8) {
+            writeCodePoint(utf8::unchecked::next(p));
+        }
+        else {
+            std::ostringstream stream;
+            ML::jsonEscape(std::string(p, e), stream);
+            std::string rest = stream.str();
+            write(rest.data(), rest.size());
+            return;
+        }
+
+        reserve(e - p + 2);
+    }
+}
+
+void
+StringJsonPrintingContext::
+startObject()
+{
+    path.push_back(true /* isObject */);
+    write('{');
+}
+
+void
+StringJsonPrintingContext::
+startMember(const std::string & memberName)
+{
+    ExcAssert(path.back().isObject);
+    ++path.back().memberNum;
+    if (path.back().memberNum != 0)
+        write(',');
+    write('\"');
+    writeEscaped(memberName.data(), memberName.size(), false);
+    write("\":", 2);
+}
+
+void
+StringJsonPrintingContext::
+endObject()
+{
+    ExcAssert(path.back().isObject);
+    path.pop_back();
+    write('}');
+}
+
+void
+StringJsonPrintingContext::
+startArray(int knownSize)
+{
+    path.push_back(false /* isObject */);
+    write('[');
+}
+
+void
+StringJsonPrintingContext::
+newArrayElement()
+{
+    ExcAssert(!path.back().isObject);
+    ++path.back().memberNum;
+    if (path.back().memberNum != 0)
+        write(',');
+}
+
+void
+StringJsonPrintingContext::
+endArray()
+{
+    ExcAssert(!path.back().isObject);
+    path.pop_back();
+    write(']');
+}
+    
+void
+StringJsonPrintingContext::
+skip()
+{
+    write("null", 4);
+}
+
+void
+StringJsonPrintingContext::
+writeNull()
+{
+    write("null", 4);
+}
+
+void
+StringJsonPrintingContext::
+writeInt(int i)
+{
+    pos = formatSigned(reserve(24), i);
+}
+
+void
+StringJsonPrintingContext::
+writeUnsignedInt(unsigned int i)
+{
+    pos = formatUnsigned(reserve(24), i);
+}
+
+void
+StringJsonPrintingContext::
+writeLong(long int i)
+{
+    pos = formatSigned(reserve(24), i);
+}
+
+void
+StringJsonPrintingContext::
+writeUnsignedLong(unsigned long int i)
+{
+    pos = formatUnsigned(reserve(24), i);
+}
+
+void
+StringJsonPrintingContext::
+writeLongLong(long long int i)
+{
+    pos = formatSigned(reserve(24), i);
+}
+
+void
+StringJsonPrintingContext::
+writeUnsignedLongLong(unsigned long long int i)
+{
+    pos = formatUnsigned(reserve(24), i);
+}
+
+void
+StringJsonPrintingContext::
+writeFloat(float f)
+{
+    writeDouble(f);
+}
+
+void
+StringJsonPrintingContext::
+writeDouble(double d)
+{
+    if (std::isfinite(d))
+        pos = formatDouble(reserve(32), d);
+    else {
+        const char * s = nonFiniteString(d);
+        write(s, strlen(s));
+    }
+}
+
+void
+StringJsonPrintingContext::
+writeString(const std::string & s)
+{
+    write('\"');
+    writeEscaped(s.data(), s.size(), false);
+    write('\"');
+}
+
+void
+StringJsonPrintingContext::
+writeStringUtf8(const Utf8String & s)
+{
+    write('\"');
+    writeEscaped(s.rawData(), s.rawLength(), true);
+    write('\"');
+}
+
+void
+StringJsonPrintingContext::
+writeJson(const Json::Value & val)
+{
+    std::string s = val.toStringNoNewLine();
+    write(s.data(), s.size());
+}
+
+void
+StringJsonPrintingContext::
+writeRawJson(const std::string & json)
+{
+    write(json.data(), json.size());
+}
+
+void
+StringJsonPrintingContext::
+writeBool(bool b)
+{
+    if (b)
+        write("true", 4);
+    else write("false", 5);
+}
+
+
 /*****************************************************************************/
 /* STRUCTURED JSON PRINTING CONTEXT                                          */
 /*****************************************************************************/
@@ -7,8 +7,10 @@
 
 #pragma once
 
+#include <memory>
 #include <string>
 #include <ostream>
+#include <vector>
 
 #include "jml/utils/exc_assert.h"
 #include "jml/utils/json_parsing.h"
@@ -34,6 +36,14 @@ struct JsonPrintingContext {
     virtual void startMember(const std::string & memberName) = 0;
     virtual void endObject() = 0;
 
+    /** Start a structure member, which also has a field number.  Contexts
+        that identify members by name just call startMember().
+    */
+    virtual void startField(const char * fieldName, int fieldNum)
+    {
+        startMember(fieldName);
+    }
+
     virtual void startArray(int knownSize = -1) = 0;
     virtual void newArrayElement() = 0;
     virtual void endArray() = 0;
@@ -52,6 +62,12 @@ struct JsonPrintingContext {
     virtual void writeNull() = 0;
 
     virtual void writeJson(const Json::Value & val) = 0;
+
+    /** Write a value that is already printed as JSON, which must be valid.
+        Contexts that print JSON text copy it unchanged.
+    */
+    virtual void writeRawJson(const std::string & json);
+
     virtual void skip() = 0;
 };
 
@@ -119,7 +135,119 @@ struct StreamJsonPrintingContext
 
     virtual void writeJson(const Json::Value & val);
 
+    virtual void writeRawJson(const std::string & json);
+
+    virtual void writeBool(bool b);
+};
+
+
+/*****************************************************************************/
+/* STRING JSON PRINTING CONTEXT                                              */
+/*****************************************************************************/
+
+/** JSON printing context that prints into a memory buffer.  The output is
+    the same as the StreamJsonPrintingContext's, but numbers are formatted
+    directly into the buffer and strings are copied 16 characters at a time
+    up to the next one that needs to be escaped.
+
+    clear() keeps the memory of the buffer, so that the same context can
+    print many values without allocating.
+*/
+
+struct StringJsonPrintingContext
+    : public JsonPrintingContext {
+
+    StringJsonPrintingContext();
+
+    bool writeUtf8;          ///< If true, utf8 chars in binary.  False: escaped ASCII
+
+    /// Output printed so far, which is not null terminated
+    const char * data() const { return buffer.get(); }
+    size_t size() const { return pos - buffer.get(); }
+
+    std::string str() const { return std::string(data(), size()); }
+
+    /** Forget the output, keeping the buffer for the next one. */
+    void clear();
+
+    virtual void startObject();
+
+    virtual void startMember(const std::string & memberName);
+
+    virtual void endObject();
+
+    virtual void startArray(int knownSize = -1);
+
+    virtual void newArrayElement();
+
+    virtual void endArray();
+    
+    virtual void skip();
+
+    virtual void writeNull();
+
+    virtual void writeInt(int i);
+
+    virtual void writeUnsignedInt(unsigned int i);
+
+    virtual void writeLong(long int i);
+
+    virtual void writeUnsignedLong(unsigned long int i);
+
+    virtual void writeLongLong(long long int i);
+
+    virtual void writeUnsignedLongLong(unsigned long long int i);
+
+    virtual void writeFloat(float f);
+
+    virtual void writeDouble(double d);
+
+    virtual void writeString(const std::string & s);
+
+    virtual void writeStringUtf8(const Utf8String & s);
+
+    virtual void writeJson(const Json::Value & val);
+
+    virtual void writeRawJson(const std::string & json);
+
     virtual void writeBool(bool b);
+
+private:
+    struct PathEntry {
+        PathEntry(bool isObject)
+            : isObject(isObject), memberNum(-1)
+        {
+        }
+
+        bool isObject;
+        int memberNum;
+    };
+
+    std::vector<PathEntry> path;
+
+    std::unique_ptr<char[]> buffer;
+    char * pos;                      ///< End of the output in buffer
+    char * end;                      ///< End of buffer
+
+    /// Make room for n more characters and return where they go
+    char * reserve(size_t n)
+    {
+        if ((size_t)(end - pos) < n)
+            grow(n);
+        return pos;
+    }
+
+    void grow(size_t n);
+
+    void write(char c)
+    {
+        *reserve(1) = c;
+        ++pos;
+    }
+
+    void write(const char * s, size_t n);
+    void writeEscaped(const char * s, size_t n, bool isUtf8);
+    void writeCodePoint(int c);
 };
 
 
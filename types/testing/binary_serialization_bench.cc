@@ -0,0 +1,231 @@
+/* binary_serialization_bench.cc
+   Copyright (c) 2015 Datacratic Inc.  All rights reserved.
+
+   Encoding and decoding speed and size of a typical message with the
+   binary contexts, compared to the streaming JSON contexts.
+
+   Usage: binary_serialization_bench [messages] [iterations]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "soa/types/basic_value_descriptions.h"
+#include "soa/types/binary_serialization.h"
+
+using namespace std;
+using namespace Datacratic;
+
+
+namespace {
+
+/* A message like the ones our services exchange */
+
+struct BenchSlot {
+    BenchSlot()
+        : width(0), height(0), reservePrice(0)
+    {
+    }
+
+    Id id;
+    int width;
+    int height;
+    double reservePrice;
+    vector<string> formats;
+};
+
+CREATE_STRUCTURE_DESCRIPTION(BenchSlot);
+
+BenchSlotDescription::
+BenchSlotDescription()
+{
+    addField("id", &BenchSlot::id, "slot id");
+    addField("width", &BenchSlot::width, "width in pixels");
+    addField("height", &BenchSlot::height, "height in pixels");
+    addField("reservePrice", &BenchSlot::reservePrice, "reserve price");
+    addField("formats", &BenchSlot::formats, "accepted formats");
+}
+
+struct BenchMessage {
+    BenchMessage()
+        : timestamp(0), userAge(0), secure(false)
+    {
+    }
+
+    Id id;
+    double timestamp;
+    string exchange;
+    string url;
+    string userAgent;
+    long long userAge;
+    bool secure;
+    vector<BenchSlot> slots;
+    map<string, string> segments;
+    vector<double> scores;
+};
+
+CREATE_STRUCTURE_DESCRIPTION(BenchMessage);
+
+BenchMessageDescription::
+BenchMessageDescription()
+{
+    addField("id", &BenchMessage::id, "message id");
+    addField("timestamp", &BenchMessage::timestamp, "seconds since epoch");
+    addField("exchange", &BenchMessage::exchange, "source exchange");
+    addField("url", &BenchMessage::url, "page url");
+    addField("userAgent", &BenchMessage::userAgent, "user agent");
+    addField("userAge", &BenchMessage::userAge, "age of the user id");
+    addField("secure", &BenchMessage::secure, "https page");
+    addField("slots", &BenchMessage::slots, "ad slots");
+    addField("segments", &BenchMessage::segments, "segments of the user");
+    addField("scores", &BenchMessage::scores, "model scores");
+}
+
+vector<BenchMessage> makeMessages(int numMessages)
+{
+    mt19937 rng(1);
+    vector<BenchMessage> result(numMessages);
+
+    for (int i = 0;  i < numMessages;  ++i) {
+        BenchMessage & msg = result[i];
+        msg.id = Id(1000000 + i);
+        msg.timestamp = 1420070400.0 + i * 0.001;
+        msg.exchange = "exchange" + to_string(rng() % 10);
+        msg.url = "http://www.example.com/section/" + to_string(rng())
+            + "/article.html";
+        msg.userAgent = "Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36"
+            " (KHTML, like Gecko) Chrome/41.0.2272.89 Safari/537.36";
+        msg.userAge = rng() % 100000;
+        msg.secure = rng() % 2;
+
+        msg.slots.resize(1 + rng() % 3);
+        for (unsigned j = 0;  j < msg.slots.size();  ++j) {
+            BenchSlot & slot = msg.slots[j];
+            slot.id = Id(j + 1);
+            slot.width = 300;
+            slot.height = 250;
+            slot.reservePrice = (rng() % 1000) * 0.001;
+            slot.formats = { "300x250", "320x50" };
+        }
+
+        for (int j = 0, n = rng() % 8;  j < n;  ++j)
+            msg.segments["segment" + to_string(rng() % 100)]
+                = to_string(rng() % 1000);
+
+        for (int j = 0;  j < 4;  ++j)
+            msg.scores.push_back((rng() % 1000000) / 1000000.0);
+    }
+
+    return result;
+}
+
+double seconds(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now()
+                                    - start).count();
+}
+
+struct Result {
+    double bytesPerMessage;
+    double encodeNs;
+    double decodeNs;
+};
+
+Result benchJson(const vector<BenchMessage> & messages, int iterations)
+{
+    static auto desc = getDefaultDescriptionShared<BenchMessage>();
+    Result result;
+
+    vector<string> encoded(messages.size());
+    auto start = chrono::steady_clock::now();
+    for (int it = 0;  it < iterations;  ++it) {
+        for (unsigned i = 0;  i < messages.size();  ++i) {
+            std::ostringstream stream;
+            StreamJsonPrintingContext context(stream);
+            desc->printJson(&messages[i], context);
+            encoded[i] = stream.str();
+        }
+    }
+    result.encodeNs = seconds(start) * 1e9 / iterations / messages.size();
+
+    size_t bytes = 0;
+    start = chrono::steady_clock::now();
+    for (int it = 0;  it < iterations;  ++it) {
+        for (unsigned i = 0;  i < messages.size();  ++i) {
+            const string & json = encoded[i];
+            BenchMessage msg;
+            StreamingJsonParsingContext context(json, json.c_str(),
+                                                json.c_str() + json.size());
+            desc->parseJson(&msg, context);
+            bytes += json.size();
+        }
+    }
+    result.decodeNs = seconds(start) * 1e9 / iterations / messages.size();
+    result.bytesPerMessage = 1.0 * bytes / iterations / messages.size();
+
+    return result;
+}
+
+Result benchBinary(const vector<BenchMessage> & messages, int iterations)
+{
+    static auto desc = getDefaultDescriptionShared<BenchMessage>();
+    Result result;
+
+    vector<string> encoded(messages.size());
+    auto start = chrono::steady_clock::now();
+    for (int it = 0;  it < iterations;  ++it) {
+        for (unsigned i = 0;  i < messages.size();  ++i) {
+            encoded[i].clear();
+            BinaryPrintingContext context(encoded[i]);
+            desc->printJson(&messages[i], context);
+        }
+    }
+    result.encodeNs = seconds(start) * 1e9 / iterations / messages.size();
+
+    size_t bytes = 0;
+    start = chrono::steady_clock::now();
+    for (int it = 0;  it < iterations;  ++it) {
+        for (unsigned i = 0;  i < messages.size();  ++i) {
+            BenchMessage msg;
+            BinaryParsingContext context(encoded[i]);
+            desc->parseJson(&msg, context);
+            bytes += encoded[i].size();
+        }
+    }
+    result.decodeNs = seconds(start) * 1e9 / iterations / messages.size();
+    result.bytesPerMessage = 1.0 * bytes / iterations / messages.size();
+
+    return result;
+}
+
+void print(const char * name, const Result & result)
+{
+    ::printf("%-10s %12.1f %12.1f %12.1f\n",
+             name, result.bytesPerMessage, result.encodeNs, result.decodeNs);
+}
+
+} // file scope
+
+
+int main(int argc, char ** argv)
+{
+    int numMessages = argc > 1 ? atoi(argv[1]) : 10000;
+    int iterations = argc > 2 ? atoi(argv[2]) : 10;
+
+    vector<BenchMessage> messages = makeMessages(numMessages);
+
+    ::printf("%d messages, %d iterations\n\n", numMessages, iterations);
+    ::printf("%-10s %12s %12s %12s\n", "", "bytes/msg", "encode ns",
+             "decode ns");
+
+    print("json", benchJson(messages, iterations));
+    print("binary", benchBinary(messages, iterations));
+
+    return 0;
+}
@@ -0,0 +1,239 @@
+/* binary_serialization_test.cc
+   Copyright (c) 2015 Datacratic Inc.  All rights reserved.
+
+   Tests for the binary encoding of value descriptions.
+*/
+
+#define BOOST_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+
+#include "soa/types/basic_value_descriptions.h"
+#include "soa/types/binary_serialization.h"
+
+
+using namespace std;
+using namespace Datacratic;
+
+
+struct BinaryInner {
+    BinaryInner()
+        : weight(0)
+    {
+    }
+
+    string name;
+    double weight;
+
+    bool operator == (const BinaryInner & other) const
+    {
+        return name == other.name && weight == other.weight;
+    }
+};
+
+CREATE_STRUCTURE_DESCRIPTION(BinaryInner);
+
+BinaryInnerDescription::
+BinaryInnerDescription()
+{
+    addField("name", &BinaryInner::name, "");
+    addField("weight", &BinaryInner::weight, "");
+}
+
+struct BinaryMessage {
+    BinaryMessage()
+        : small(0), big(0), negative(0), flag(false), ratio(0)
+    {
+    }
+
+    int small;
+    unsigned long long big;
+    long long negative;
+    bool flag;
+    float ratio;
+    string text;
+    Utf8String utf8;
+    vector<int> numbers;
+    map<string, BinaryInner> inners;
+    vector<BinaryInner> innerList;
+    Json::Value json;
+};
+
+CREATE_STRUCTURE_DESCRIPTION(BinaryMessage);
+
+BinaryMessageDescription::
+BinaryMessageDescription()
+{
+    addField("small", &BinaryMessage::small, "");
+    addField("big", &BinaryMessage::big, "");
+    addField("negative", &BinaryMessage::negative, "");
+    addField("flag", &BinaryMessage::flag, "");
+    addField("ratio", &BinaryMessage::ratio, "");
+    addField("text", &BinaryMessage::text, "");
+    addField("utf8", &BinaryMessage::utf8, "");
+    addField("numbers", &BinaryMessage::numbers, "");
+    addField("inners", &BinaryMessage::inners, "");
+    addField("innerList", &BinaryMessage::innerList, "");
+    addField("json", &BinaryMessage::json, "");
+}
+
+BOOST_AUTO_TEST_CASE( test_binary_round_trip )
+{
+    BinaryMessage msg;
+    msg.small = 3;
+    msg.big = 0xfedcba9876543210ULL;
+    msg.negative = -(1LL << 62);
+    msg.flag = true;
+    msg.ratio = 0.25;
+    msg.text = string("with a \0 inside", 15);
+    msg.utf8 = Utf8String("caf\xc3\xa9");
+    msg.numbers = { 0, -1, 127, 128, -129, 1 << 30 };
+    msg.inners["one"].name = "first";
+    msg.inners["one"].weight = 1.5;
+    msg.inners["two"].name = "second";
+    msg.innerList.resize(2);
+    msg.innerList[1].weight = -2.0;
+    msg.json["hello"] = "world";
+    msg.json["list"][0] = Json::Value::UInt(1);
+    msg.json["list"][1] = -1.5;
+    msg.json["list"][2] = Json::Value();
+
+    string encoded = binaryEncode(msg);
+    BinaryMessage decoded = binaryDecode<BinaryMessage>(encoded);
+
+    BOOST_CHECK_EQUAL(decoded.small, msg.small);
+    BOOST_CHECK_EQUAL(decoded.big, msg.big);
+    BOOST_CHECK_EQUAL(decoded.negative, msg.negative);
+    BOOST_CHECK_EQUAL(decoded.flag, msg.flag);
+    BOOST_CHECK_EQUAL(decoded.ratio, msg.ratio);
+    BOOST_CHECK_EQUAL(decoded.text, msg.text);
+    BOOST_CHECK_EQUAL(decoded.utf8, msg.utf8);
+    BOOST_CHECK(decoded.numbers == msg.numbers);
+    BOOST_CHECK(decoded.inners == msg.inners);
+    BOOST_CHECK(decoded.innerList == msg.innerList);
+    BOOST_CHECK_EQUAL(decoded.json, msg.json);
+
+    // The encoding is smaller than the JSON for the same message
+    std::ostringstream stream;
+    StreamJsonPrintingContext context(stream);
+    getDefaultDescriptionShared<BinaryMessage>()->printJson(&msg, context);
+    BOOST_CHECK_LT(encoded.size(), stream.str().size());
+}
+
+BOOST_AUTO_TEST_CASE( test_binary_default_fields_omitted )
+{
+    // Like with JSON, the empty name is not written
+    BinaryInner inner;
+    inner.weight = 1.0;
+    string encoded = binaryEncode(inner);
+
+    BOOST_REQUIRE_EQUAL(encoded.size(), 12);
+    BOOST_CHECK_EQUAL(encoded[0], BT_OBJECT);
+    BOOST_CHECK_EQUAL(encoded[1], 4);  // field 1
+    BOOST_CHECK_EQUAL(encoded[2], BT_DOUBLE);
+    BOOST_CHECK_EQUAL(encoded[11], 0);
+}
+
+BOOST_AUTO_TEST_CASE( test_binary_errors )
+{
+    BinaryMessage msg;
+    msg.text = "hello";
+    msg.numbers = { 1, 2, 3 };
+    string encoded = binaryEncode(msg);
+
+    // Every truncation of the input must be detected
+    for (size_t i = 0;  i < encoded.size();  ++i) {
+        BinaryMessage decoded;
+        BOOST_CHECK_THROW(binaryDecode(encoded.data(), encoded.data() + i,
+                                       decoded),
+                          ML::Exception);
+    }
+
+    BOOST_CHECK_THROW(binaryDecode<BinaryMessage>(encoded + "x"),
+                      ML::Exception);
+
+    // Values out of range for the type they are read into
+    BOOST_CHECK_THROW(binaryDecode<int>(binaryEncode(1LL << 40)),
+                      ML::Exception);
+    BOOST_CHECK_THROW(binaryDecode<unsigned long>(binaryEncode(-1LL)),
+                      ML::Exception);
+    BOOST_CHECK_THROW(binaryDecode<string>(binaryEncode(1)),
+                      ML::Exception);
+}
+
+/* A newer version of BinaryInner, with two more fields */
+
+struct BinaryInnerV2 : public BinaryInner {
+    BinaryInnerV2()
+        : count(0)
+    {
+    }
+
+    vector<string> tags;
+    int count;
+};
+
+CREATE_STRUCTURE_DESCRIPTION(BinaryInnerV2);
+
+BinaryInnerV2Description::
+BinaryInnerV2Description()
+{
+    addParent<BinaryInner>();
+    addField("tags", &BinaryInnerV2::tags, "");
+    addField("count", &BinaryInnerV2::count, "");
+}
+
+BOOST_AUTO_TEST_CASE( test_binary_schema_evolution )
+{
+    BinaryInnerV2 v2;
+    v2.name = "new";
+    v2.weight = 2.5;
+    v2.tags = { "a", "b" };
+    v2.count = 12;
+
+    // An old reader skips the fields it doesn't know about
+    BinaryInner v1 = binaryDecode<BinaryInner>(binaryEncode(v2));
+    BOOST_CHECK_EQUAL(v1.name, "new");
+    BOOST_CHECK_EQUAL(v1.weight, 2.5);
+
+    // Unless asked not to
+    {
+        string encoded = binaryEncode(v2);
+        BinaryParsingContext context(encoded);
+        context.onUnknownFieldHandlers.clear();
+        BinaryInner strict;
+        BOOST_CHECK_THROW(getDefaultDescriptionShared<BinaryInner>()
+                          ->parseJson(&strict, context),
+                          ML::Exception);
+    }
+
+    // A new reader leaves the new fields at their default
+    BinaryInnerV2 fromV1 = binaryDecode<BinaryInnerV2>(binaryEncode(v1));
+    BOOST_CHECK_EQUAL(fromV1.name, "new");
+    BOOST_CHECK_EQUAL(fromV1.weight, 2.5);
+    BOOST_CHECK(fromV1.tags.empty());
+    BOOST_CHECK_EQUAL(fromV1.count, 0);
+}
+
+BOOST_AUTO_TEST_CASE( test_binary_named_members )
+{
+    // Structures can also be read from an object with named members, like
+    // what a map or a Json::Value produces
+    Json::Value json;
+    json["name"] = "named";
+    json["weight"] = 4;
+
+    BinaryInner inner = binaryDecode<BinaryInner>(binaryEncode(json));
+    BOOST_CHECK_EQUAL(inner.name, "named");
+    BOOST_CHECK_EQUAL(inner.weight, 4);
+
+    // And a structure can be read as JSON
+    Json::Value back = binaryDecode<Json::Value>(binaryEncode(inner));
+    BOOST_CHECK_EQUAL(back["#0"], "named");
+    BOOST_CHECK_EQUAL(back["#1"], 4.0);
+}
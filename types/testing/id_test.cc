@@ -8,7 +8,9 @@
 #define BOOST_TEST_DYN_LINK
 
 #include <boost/test/unit_test.hpp>
+#include <atomic>
 #include <iostream>
+#include <thread>
 #include "soa/types/id.h"
 #include "jml/db/persistent.h"
 #include "soa/types/date.h"
@@ -344,9 +346,104 @@ BOOST_AUTO_TEST_CASE( test_id_sorting )
     }
 }
 
+BOOST_AUTO_TEST_CASE( test_short_and_long_string_ids )
+{
+    // Up to 16 characters are stored in place, longer strings are interned
+    for (string s: { "a", "hello", "0123456789abcde!", "0123456789abcdef!",
+                     "a rather longer string that has to be shared" }) {
+        Id id(s);
+        BOOST_CHECK_EQUAL(id.type, Id::STR);
+        BOOST_CHECK_EQUAL(id.toString(), s);
+        BOOST_CHECK_EQUAL(id.stringLength(), s.size());
+        BOOST_CHECK_EQUAL(id.hash(), CityHash64(s.c_str(), s.size()));
+        BOOST_CHECK_EQUAL(id.shortLen != 0, s.size() <= 16);
+        checkSerializeReconstitute(id);
+
+        Id copy(id);
+        BOOST_CHECK_EQUAL(copy, id);
+        BOOST_CHECK_EQUAL(copy.hash(), id.hash());
+        BOOST_CHECK(!(copy < id));
+    }
+
+    Id empty(string(), Id::STR);
+    BOOST_CHECK_EQUAL(empty.type, Id::STR);
+    BOOST_CHECK_EQUAL(empty.toString(), "");
+    checkSerializeReconstitute(empty);
+
+    BOOST_CHECK_LT(Id("hello"), Id("hello world, again and again"));
+    BOOST_CHECK_LT(Id("hello world, again and again"), Id("help"));
+    BOOST_CHECK_NE(Id("hello world, again and again"),
+                   Id("hello world, again and agaiN"));
+}
+
+BOOST_AUTO_TEST_CASE( test_string_id_interning )
+{
+    string s = "a string that is too long to fit in place";
+
+    const char * storage;
+    {
+        Id id1(s);
+        Id id2(s);
+        Id id3(id1);
+        storage = id1.stringData();
+        BOOST_CHECK_EQUAL((const void *)id2.stringData(), storage);
+        BOOST_CHECK_EQUAL((const void *)id3.stringData(), storage);
+        BOOST_CHECK_EQUAL(id1, id2);
+
+        id1 = Id("something else that is too long to fit");
+        Id id4(s);
+        BOOST_CHECK_EQUAL((const void *)id4.stringData(), storage);
+        BOOST_CHECK_EQUAL(id4.toString(), s);
+    }
+
+    // Still usable once its last Id is gone
+    Id id5(s);
+    BOOST_CHECK_EQUAL(id5.toString(), s);
+    BOOST_CHECK_EQUAL(id5.hash(), CityHash64(s.c_str(), s.size()));
+}
+
+BOOST_AUTO_TEST_CASE( test_string_id_interning_threads )
+{
+    // Threads racing to create and drop the last reference to the same
+    // strings
+    std::atomic<int> errors(0);
+    auto work = [&] (int thread)
+        {
+            for (unsigned i = 0;  i < 20000;  ++i) {
+                string s = "a string that is too long to fit in place "
+                    + to_string(i % 10);
+                Id id(s);
+                Id copy(id);
+                if (copy.toString() != s)
+                    ++errors;
+            }
+        };
+
+    std::vector<std::thread> threads;
+    for (unsigned i = 0;  i < 4;  ++i)
+        threads.emplace_back(work, i);
+    for (auto & t: threads)
+        t.join();
+
+    BOOST_CHECK_EQUAL(errors, 0);
+}
+
 BOOST_AUTO_TEST_CASE( test_compound_id )
 {
     Id id(Id("hello"), Id("world"));
+    BOOST_CHECK_EQUAL(id.type, Id::COMPOUND2);
+    BOOST_CHECK_EQUAL(id.toString(), "hello:world");
+
+    Id copy(id);
+    BOOST_CHECK_EQUAL(copy, id);
+    BOOST_CHECK_EQUAL(copy.hash(), id.hash());
+    BOOST_CHECK_EQUAL(&copy.compoundId1(), &id.compoundId1());
+
+    Id other(Id("hello"), Id("world"));
+    BOOST_CHECK_EQUAL(other, id);
+    BOOST_CHECK_EQUAL(other.hash(), id.hash());
+    BOOST_CHECK_LT(id, Id(Id("hello"), Id("worlds")));
+    checkSerializeReconstitute(id);
 }
 
 #if ID_HASH_AS_STRING
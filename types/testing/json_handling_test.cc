@@ -8,8 +8,11 @@
 #define BOOST_TEST_MAIN
 #define BOOST_TEST_DYN_LINK
 
+#include <string.h>
 #include <boost/test/unit_test.hpp>
 #include <iostream>
+#include <limits>
+#include <random>
 #include "jml/db/persistent.h"
 #include "soa/types/string.h"
 #include "soa/types/json_parsing.h"
@@ -63,3 +66,135 @@ BOOST_AUTO_TEST_CASE(test_utf8_round_trip_streaming_ascii)
         BOOST_CHECK_EQUAL(str, str2);
     }
 }
+
+namespace {
+
+/* Print with both contexts, which must give the same output */
+template<typename Fn>
+void checkSameAsStream(const Fn & print)
+{
+    std::ostringstream stream;
+    StreamJsonPrintingContext streamContext(stream);
+    print(streamContext);
+
+    StringJsonPrintingContext stringContext;
+    print(stringContext);
+
+    BOOST_REQUIRE_EQUAL(stringContext.str(), stream.str());
+}
+
+} // file scope
+
+BOOST_AUTO_TEST_CASE(test_string_printing_context_numbers)
+{
+    mt19937_64 rng(1);
+    const double powers[] = { 1, 10, 1000, 1e6, 1e9 };
+
+    vector<double> doubles = {
+        0.0, -0.0, 1.0, -1.0, 0.1, 0.5, 100.0, 1e21, 1e22, 1e23, 1e-5, 1e-6,
+        1e-7, 123456.789, 5e-324, 1.7976931348623157e308,
+        9007199254740993.0, 0.30000000000000004, 8811682.030000001,
+        numeric_limits<double>::infinity(),
+        -numeric_limits<double>::infinity(),
+        numeric_limits<double>::quiet_NaN()
+    };
+
+    for (int i = 0;  i < 100000;  ++i) {
+        uint64_t bits = rng();
+        double d;
+        memcpy(&d, &bits, sizeof(d));
+        doubles.push_back(d);
+        doubles.push_back((int64_t)(rng() % 100000000) / powers[rng() % 5]);
+        doubles.push_back((rng() % 1000000) * powers[rng() % 5]);
+        doubles.push_back((float)((rng() % 1000000007) * 1e-9));
+    }
+
+    for (double d: doubles) {
+        checkSameAsStream([&] (JsonPrintingContext & context)
+                          {
+                              context.writeDouble(d);
+                          });
+        checkSameAsStream([&] (JsonPrintingContext & context)
+                          {
+                              context.writeFloat(d);
+                          });
+    }
+
+    vector<long long> ints = {
+        0, 1, -1, 9, 10, 99, 100,
+        numeric_limits<int>::min(), numeric_limits<int>::max(),
+        numeric_limits<long long>::min(), numeric_limits<long long>::max()
+    };
+    for (int i = 0;  i < 64;  ++i) {
+        ints.push_back(1ULL << i);
+        ints.push_back((1ULL << i) - 1);
+    }
+
+    for (long long i: ints) {
+        checkSameAsStream([&] (JsonPrintingContext & context)
+                          {
+                              context.startArray();
+                              context.newArrayElement();
+                              context.writeInt(i);
+                              context.newArrayElement();
+                              context.writeUnsignedInt(i);
+                              context.newArrayElement();
+                              context.writeLongLong(i);
+                              context.newArrayElement();
+                              context.writeUnsignedLongLong(i);
+                              context.endArray();
+                          });
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_string_printing_context_strings)
+{
+    vector<string> strings = {
+        "", "a", "with \"quotes\" and \\ backslashes",
+        "tab\tnew line\n", "a string that is longer than sixteen characters",
+        string(100, 'x') + "\"" + string(15, 'y') + "\\" + string(17, 'z')
+    };
+
+    for (const string & s: strings) {
+        checkSameAsStream([&] (JsonPrintingContext & context)
+                          {
+                              context.startObject();
+                              context.startMember(s);
+                              context.writeString(s);
+                              context.startMember("utf8");
+                              context.writeStringUtf8(Utf8String(s));
+                              context.endObject();
+                          });
+    }
+
+    vector<Utf8String> utf8Strings = {
+        Utf8String("\xe2\x80\xa2skin"),
+        Utf8String("caf\xc3\xa9 \x01\x7f control characters\r\b\f/"),
+        Utf8String(string(40, 'a') + "\xe2\x80\xa2" + string(40, 'b'))
+    };
+
+    for (bool writeUtf8: { true, false }) {
+        for (const Utf8String & s: utf8Strings) {
+            std::ostringstream stream;
+            StreamJsonPrintingContext streamContext(stream);
+            streamContext.writeUtf8 = writeUtf8;
+            streamContext.writeStringUtf8(s);
+
+            StringJsonPrintingContext stringContext;
+            stringContext.writeUtf8 = writeUtf8;
+            stringContext.writeStringUtf8(s);
+
+            BOOST_CHECK_EQUAL(stringContext.str(), stream.str());
+        }
+    }
+
+    // The buffer is kept after clear()
+    StringJsonPrintingContext context;
+    context.writeString(string(1000, 'x'));
+    const char * data = context.data();
+    context.clear();
+    BOOST_CHECK_EQUAL(context.size(), 0);
+    context.writeString("abc");
+    BOOST_CHECK_EQUAL(context.str(), "\"abc\"");
+    BOOST_CHECK_EQUAL((const void *)context.data(), (const void *)data);
+}
@@ -0,0 +1,246 @@
+/* json_indexed_parsing_bench.cc
+   Copyright (c) 2015 Datacratic Inc.  All rights reserved.
+
+   Decoding speed of a typical message with the indexed JSON parser, for
+   each indexer, compared to the streaming JSON parser, and with a
+   JsonDecoder that reuses the previous message.
+
+   Usage: json_indexed_parsing_bench [messages] [iterations]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "soa/types/basic_value_descriptions.h"
+#include "soa/types/json_indexed_parsing.h"
+
+using namespace std;
+using namespace Datacratic;
+
+
+namespace {
+
+struct BenchSlot {
+    BenchSlot()
+        : width(0), height(0), reservePrice(0)
+    {
+    }
+
+    Id id;
+    int width;
+    int height;
+    double reservePrice;
+    vector<string> formats;
+};
+
+CREATE_STRUCTURE_DESCRIPTION(BenchSlot);
+
+BenchSlotDescription::
+BenchSlotDescription()
+{
+    addField("id", &BenchSlot::id, "slot id");
+    addField("width", &BenchSlot::width, "width in pixels");
+    addField("height", &BenchSlot::height, "height in pixels");
+    addField("reservePrice", &BenchSlot::reservePrice, "reserve price");
+    addField("formats", &BenchSlot::formats, "accepted formats");
+}
+
+struct BenchMessage {
+    BenchMessage()
+        : timestamp(0), userAge(0), secure(false)
+    {
+    }
+
+    Id id;
+    double timestamp;
+    string exchange;
+    string url;
+    string userAgent;
+    long long userAge;
+    bool secure;
+    vector<BenchSlot> slots;
+    map<string, string> segments;
+    Json::Value ext;
+};
+
+CREATE_STRUCTURE_DESCRIPTION(BenchMessage);
+
+BenchMessageDescription::
+BenchMessageDescription()
+{
+    addField("id", &BenchMessage::id, "message id");
+    addField("timestamp", &BenchMessage::timestamp, "seconds since epoch");
+    addField("exchange", &BenchMessage::exchange, "source exchange");
+    addField("url", &BenchMessage::url, "page url");
+    addField("userAgent", &BenchMessage::userAgent, "user agent");
+    addField("userAge", &BenchMessage::userAge, "age of the user id");
+    addField("secure", &BenchMessage::secure, "https page");
+    addField("slots", &BenchMessage::slots, "ad slots");
+    addField("segments", &BenchMessage::segments, "segments of the user");
+    addField("ext", &BenchMessage::ext, "exchange specific fields");
+}
+
+vector<string> makeMessages(int numMessages)
+{
+    mt19937 rng(1);
+    vector<string> result(numMessages);
+
+    for (int i = 0;  i < numMessages;  ++i) {
+        BenchMessage msg;
+        msg.id = Id(1000000 + i);
+        msg.timestamp = 1420070400.0 + i * 0.001;
+        msg.exchange = "exchange" + to_string(rng() % 10);
+        msg.url = "http://www.example.com/section/" + to_string(rng())
+            + "/article.html?ref=\"home\"";
+        msg.userAgent = "Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36"
+            " (KHTML, like Gecko) Chrome/41.0.2272.89 Safari/537.36";
+        msg.userAge = rng() % 100000;
+        msg.secure = rng() % 2;
+
+        msg.slots.resize(1 + rng() % 3);
+        for (unsigned j = 0;  j < msg.slots.size();  ++j) {
+            BenchSlot & slot = msg.slots[j];
+            slot.id = Id(j + 1);
+            slot.width = 300;
+            slot.height = 250;
+            slot.reservePrice = (rng() % 1000) * 0.001;
+            slot.formats = { "300x250", "320x50" };
+        }
+
+        for (int j = 0, n = rng() % 8;  j < n;  ++j)
+            msg.segments["segment" + to_string(rng() % 100)]
+                = to_string(rng() % 1000);
+
+        msg.ext["publisher"]["id"] = to_string(rng() % 1000);
+        msg.ext["publisher"]["categories"][0] = "IAB1";
+        msg.ext["publisher"]["categories"][1] = "IAB12";
+        msg.ext["bidFloor"] = (rng() % 100) * 0.01;
+
+        result[i] = jsonEncode(msg).toStringNoNewLine();
+    }
+
+    return result;
+}
+
+double seconds(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now()
+                                    - start).count();
+}
+
+size_t totalBytes(const vector<string> & messages)
+{
+    size_t result = 0;
+    for (auto & m: messages)
+        result += m.size();
+    return result;
+}
+
+void print(const char * name, const vector<string> & messages,
+           int iterations, double elapsed)
+{
+    double mb = 1e-6 * totalBytes(messages) * iterations;
+    ::printf("%-16s %12.1f %12.1f\n", name,
+             elapsed * 1e9 / iterations / messages.size(), mb / elapsed);
+}
+
+void benchStreaming(const vector<string> & messages, int iterations)
+{
+    static auto desc = getDefaultDescriptionShared<BenchMessage>();
+
+    auto start = chrono::steady_clock::now();
+    for (int it = 0;  it < iterations;  ++it) {
+        for (const string & json: messages) {
+            BenchMessage msg;
+            StreamingJsonParsingContext context(json, json.c_str(),
+                                                json.c_str() + json.size());
+            desc->parseJson(&msg, context);
+        }
+    }
+
+    print("streaming", messages, iterations, seconds(start));
+}
+
+void benchIndexOnly(const char * name, JsonIndexer indexer,
+                    const vector<string> & messages, int iterations)
+{
+    if (!setJsonIndexer(indexer)) {
+        ::printf("%-16s %12s\n", name, "unsupported");
+        return;
+    }
+
+    JsonStructuralIndex index;
+    auto start = chrono::steady_clock::now();
+    for (int it = 0;  it < iterations;  ++it) {
+        for (const string & json: messages)
+            index.index(json.c_str(), json.c_str() + json.size());
+    }
+
+    print(name, messages, iterations, seconds(start));
+}
+
+void benchIndexed(const char * name, JsonIndexer indexer,
+                  const vector<string> & messages, int iterations)
+{
+    if (!setJsonIndexer(indexer))
+        return;
+
+    auto start = chrono::steady_clock::now();
+    for (int it = 0;  it < iterations;  ++it) {
+        for (const string & json: messages)
+            jsonDecodeStr<BenchMessage>(json);
+    }
+
+    print(name, messages, iterations, seconds(start));
+}
+
+void benchDecoder(const vector<string> & messages, int iterations)
+{
+    JsonDecoder<BenchMessage> decoder;
+    BenchMessage msg;
+
+    auto start = chrono::steady_clock::now();
+    for (int it = 0;  it < iterations;  ++it) {
+        for (const string & json: messages)
+            decoder.decode(json, msg);
+    }
+
+    print("reusing decoder", messages, iterations, seconds(start));
+}
+
+} // file scope
+
+
+int main(int argc, char ** argv)
+{
+    int numMessages = argc > 1 ? atoi(argv[1]) : 10000;
+    int iterations = argc > 2 ? atoi(argv[2]) : 10;
+
+    vector<string> messages = makeMessages(numMessages);
+    JsonIndexer bestIndexer = jsonIndexer();
+
+    ::printf("%d messages, %d iterations, %.1f bytes/msg\n\n",
+             numMessages, iterations,
+             1.0 * totalBytes(messages) / messages.size());
+    ::printf("%-16s %12s %12s\n", "", "ns/msg", "MB/s");
+
+    benchStreaming(messages, iterations);
+
+    benchIndexOnly("index scalar", JsonIndexer::Scalar, messages, iterations);
+    benchIndexOnly("index sse2", JsonIndexer::Sse2, messages, iterations);
+    benchIndexOnly("index avx2", JsonIndexer::Avx2, messages, iterations);
+
+    benchIndexed("indexed scalar", JsonIndexer::Scalar, messages, iterations);
+    benchIndexed("indexed sse2", JsonIndexer::Sse2, messages, iterations);
+    benchIndexed("indexed avx2", JsonIndexer::Avx2, messages, iterations);
+
+    setJsonIndexer(bestIndexer);
+    benchDecoder(messages, iterations);
+
+    return 0;
+}
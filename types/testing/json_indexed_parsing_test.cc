@@ -0,0 +1,331 @@
+/* json_indexed_parsing_test.cc
+   Copyright (c) 2015 Datacratic Inc.  All rights reserved.
+
+   Tests for the indexed JSON parser, which must give exactly the same
+   results and errors as the streaming parser.
+*/
+
+#define BOOST_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+
+#include "soa/types/basic_value_descriptions.h"
+#include "soa/types/json_indexed_parsing.h"
+
+
+using namespace std;
+using namespace Datacratic;
+
+
+BOOST_AUTO_TEST_CASE( test_indexers_agree )
+{
+    // Random documents made of the characters that matter to the index,
+    // with long runs of backslashes to cross block boundaries
+    const char alphabet[] = "{}[]:,\"\\\\\\ ab";
+    mt19937 rng(1);
+
+    vector<JsonIndexer> indexers = { JsonIndexer::Sse2, JsonIndexer::Avx2 };
+
+    for (int i = 0;  i < 20000;  ++i) {
+        string doc;
+        for (int j = 0, n = rng() % 300;  j < n;  ++j)
+            doc += alphabet[rng() % (sizeof(alphabet) - 1)];
+
+        JsonStructuralIndex expected;
+        bool expectedOk = expected.index(doc.data(), doc.data() + doc.size(),
+                                         JsonIndexer::Scalar);
+
+        for (JsonIndexer indexer: indexers) {
+            if (!setJsonIndexer(indexer))
+                continue;
+            JsonStructuralIndex index;
+            bool ok = index.index(doc.data(), doc.data() + doc.size());
+            BOOST_REQUIRE_EQUAL(ok, expectedOk);
+            BOOST_REQUIRE(index.offsets == expected.offsets);
+        }
+    }
+
+    JsonStructuralIndex index;
+    string doc = "{\"a\\\"{\":[1, \"x\\\\\"]}";
+    BOOST_CHECK(index.index(doc.data(), doc.data() + doc.size()));
+    vector<uint32_t> expected = { 0, 1, 6, 7, 8, 10, 12, 16, 17, 18, 19 };
+    BOOST_CHECK(index.offsets == expected);
+
+    doc = "[\"unterminated]";
+    BOOST_CHECK(!index.index(doc.data(), doc.data() + doc.size()));
+}
+
+struct IndexedInner {
+    IndexedInner()
+        : weight(0)
+    {
+    }
+
+    string name;
+    double weight;
+};
+
+CREATE_STRUCTURE_DESCRIPTION(IndexedInner);
+
+IndexedInnerDescription::
+IndexedInnerDescription()
+{
+    addField("name", &IndexedInner::name, "");
+    addField("weight", &IndexedInner::weight, "");
+}
+
+struct IndexedMessage {
+    IndexedMessage()
+        : small(0), big(0), negative(0), flag(false), ratio(0)
+    {
+    }
+
+    Id id;
+    int small;
+    unsigned long long big;
+    long long negative;
+    bool flag;
+    float ratio;
+    string text;
+    Utf8String utf8;
+    vector<int> numbers;
+    map<string, IndexedInner> inners;
+    vector<IndexedInner> innerList;
+    Optional<IndexedInner> optional;
+    Json::Value json;
+};
+
+CREATE_STRUCTURE_DESCRIPTION(IndexedMessage);
+
+IndexedMessageDescription::
+IndexedMessageDescription()
+{
+    addField("id", &IndexedMessage::id, "");
+    addField("small", &IndexedMessage::small, "");
+    addField("big", &IndexedMessage::big, "");
+    addField("negative", &IndexedMessage::negative, "");
+    addField("flag", &IndexedMessage::flag, "");
+    addField("ratio", &IndexedMessage::ratio, "");
+    addField("text", &IndexedMessage::text, "");
+    addField("utf8", &IndexedMessage::utf8, "");
+    addField("numbers", &IndexedMessage::numbers, "");
+    addField("inners", &IndexedMessage::inners, "");
+    addField("innerList", &IndexedMessage::innerList, "");
+    addField("optional", &IndexedMessage::optional, "");
+    addField("json", &IndexedMessage::json, "");
+}
+
+namespace {
+
+Json::Value parseStreaming(const string & json)
+{
+    static auto desc = getDefaultDescriptionShared<IndexedMessage>();
+    IndexedMessage result;
+    StreamingJsonParsingContext context(json, json.c_str(),
+                                        json.c_str() + json.size());
+    desc->parseJson(&result, context);
+    return jsonEncode(result);
+}
+
+/* Parse with the indexed context only, without falling back */
+Json::Value parseIndexedOnly(const string & json)
+{
+    static auto desc = getDefaultDescriptionShared<IndexedMessage>();
+    IndexedMessage result;
+    JsonStructuralIndex index;
+    BOOST_REQUIRE(index.index(json.c_str(), json.c_str() + json.size()));
+    IndexedJsonParsingContext context(json, json.c_str(),
+                                      json.c_str() + json.size(), index);
+    desc->parseJson(&result, context);
+    return jsonEncode(result);
+}
+
+string streamingError(const string & json)
+{
+    try {
+        parseStreaming(json);
+    } catch (const std::exception & exc) {
+        return exc.what();
+    }
+    return "";
+}
+
+string indexedError(const string & json)
+{
+    try {
+        jsonDecodeStr<IndexedMessage>(json);
+    } catch (const std::exception & exc) {
+        return exc.what();
+    }
+    return "";
+}
+
+/* The indexed parse must give the same result or the same error as the
+   streaming one, whatever the indexed context does with the document */
+void checkSameAsStreaming(const string & doc)
+{
+    BOOST_TEST_CHECKPOINT(doc);
+    string expected = streamingError(doc);
+    BOOST_CHECK_EQUAL(indexedError(doc), expected);
+    if (expected.empty())
+        BOOST_CHECK_EQUAL(jsonEncode(jsonDecodeStr<IndexedMessage>(doc)),
+                          parseStreaming(doc));
+}
+
+} // file scope
+
+BOOST_AUTO_TEST_CASE( test_indexed_matches_streaming )
+{
+    vector<string> docs = {
+        "{}",
+        " { \"small\" : 3 , \"flag\":true }\n",
+        "{\"id\":7,\"small\":-2147483648,\"big\":18446744073709551615,"
+        "\"negative\":-9223372036854775808,\"flag\":false,\"ratio\":0.1,"
+        "\"text\":\"with \\\"quotes\\\", \\\\ and \\/ [brackets] {}\","
+        "\"numbers\":[1,2,3],\"inners\":{\"a\":{\"name\":\"x\",\"weight\":1e3},"
+        "\"b\":{}},\"innerList\":[{\"weight\":-0.5},{\"name\":\"\"}],"
+        "\"json\":{\"a\":[1,-1,1.5,null,true,\"s\"],\"b\":{}}}",
+        "{\"id\":42,\"numbers\":[],\"innerList\":[]}",
+        "{\"id\":12,\"utf8\":\"caf\xc3\xa9 \\u00e9 \\t\"}",
+        "{\"json\":\"caf\xc3\xa9\"}",
+        "{\r\n\t\"small\": 1,\r\n\t\"numbers\": [ 1 , 2 ]\r\n}",
+    };
+
+    for (const string & doc: docs) {
+        BOOST_TEST_CHECKPOINT(doc);
+        Json::Value expected = parseStreaming(doc);
+        BOOST_CHECK_EQUAL(parseIndexedOnly(doc), expected);
+        BOOST_CHECK_EQUAL(jsonEncode(jsonDecodeStr<IndexedMessage>(doc)),
+                          expected);
+    }
+
+    // Documents that the indexed context leaves to the streaming one
+    vector<string> fallbacks = {
+        "{\"text\":\"\\u0041\"}",
+        "{\"id\":1.0}",
+        "{\"json\":\"\\u00e9\"}",
+        "{\"small\":1, \"text\":\"unterminated}",
+    };
+
+    for (const string & doc: fallbacks)
+        checkSameAsStreaming(doc);
+}
+
+BOOST_AUTO_TEST_CASE( test_indexed_errors )
+{
+    vector<string> docs = {
+        "",
+        "{",
+        "{\"small\":}",
+        "{\"small\":1,}",
+        "{\"small\" 1}",
+        "{\"small\":1 2}",
+        "{\"small\":01}",
+        "{\"small\":1.5}",
+        "{\"small\":4294967296}",
+        "{\"big\":-1}",
+        "{\"flag\":tru}",
+        "{\"flag\":truex}",
+        "{\"unknown\":1}",
+        "{\"numbers\":[1,,2]}",
+        "{\"numbers\":[1 2]}",
+        "{\"inners\":{\"a\":{\"weight\":\"x\"}}}",
+        "{\"text\":\"bad \\q escape\"}",
+        "{\"json\":[1,}",
+        "[1,2]",
+    };
+
+    for (const string & doc: docs)
+        checkSameAsStreaming(doc);
+}
+
+BOOST_AUTO_TEST_CASE( test_indexed_other_errors )
+{
+    // Exceptions that don't come from the document are passed on as is,
+    // without parsing a second time
+    string doc = "{\"small\":1}";
+    int numParses = 0, numResets = 0;
+    auto parse = [&] (JsonParsingContext & context)
+        {
+            ++numParses;
+            context.skip();
+            throw std::bad_alloc();
+        };
+    auto reset = [&] () { ++numResets; };
+
+    BOOST_CHECK_THROW(parseJsonIndexed(doc, doc.c_str(),
+                                       doc.c_str() + doc.size(),
+                                       parse, reset),
+                      std::bad_alloc);
+    BOOST_CHECK_EQUAL(numParses, 1);
+    BOOST_CHECK_EQUAL(numResets, 0);
+
+    // Errors in the document still start over with the streaming context
+    doc = "1.5";
+    numParses = 0;
+    auto parseInt = [&] (JsonParsingContext & context)
+        {
+            ++numParses;
+            context.expectInt();
+        };
+
+    BOOST_CHECK_THROW(parseJsonIndexed(doc, doc.c_str(),
+                                       doc.c_str() + doc.size(),
+                                       parseInt, reset),
+                      std::exception);
+    BOOST_CHECK_EQUAL(numParses, 2);
+    BOOST_CHECK_EQUAL(numResets, 1);
+}
+
+BOOST_AUTO_TEST_CASE( test_decoder_reuses_output )
+{
+    // Each document must give the same result as a fresh decode, whatever
+    // the previous one left in the output
+    vector<string> docs = {
+        "{\"small\":1,\"text\":\"a long enough string to be on the heap\","
+        "\"numbers\":[1,2,3],\"innerList\":[{\"name\":\"first inner name "
+        "on the heap\",\"weight\":2},{\"name\":\"y\"}],"
+        "\"optional\":{\"name\":\"z\",\"weight\":3},\"json\":[1]}",
+        "{\"text\":\"short\",\"innerList\":[{\"weight\":1}],"
+        "\"optional\":{\"name\":\"w\"}}",
+        "{}",
+        "{\"numbers\":[4,5,6,7],\"optional\":null,\"inners\":{\"a\":{}}}",
+        "{\"text\":\"\\u0041 falls back to streaming\",\"numbers\":[8]}",
+        "{\"innerList\":[{\"name\":\"a\"},{\"weight\":4},{}]}",
+    };
+
+    JsonDecoder<IndexedMessage> decoder;
+    IndexedMessage result;
+
+    for (const string & doc: docs) {
+        BOOST_TEST_CHECKPOINT(doc);
+        decoder.decode(doc, result);
+        BOOST_CHECK_EQUAL(jsonEncode(result),
+                          jsonEncode(jsonDecodeStr<IndexedMessage>(doc)));
+    }
+
+    // The memory of the previous result is reused
+    decoder.decode(docs[0], result);
+    const char * text = result.text.data();
+    const char * innerName = result.innerList[0].name.data();
+    const IndexedInner * optional = result.optional.get();
+
+    decoder.decode(docs[1], result);
+    BOOST_CHECK_EQUAL(result.text, "short");
+    BOOST_CHECK_EQUAL(result.text.data(), text);
+    BOOST_CHECK_EQUAL(result.innerList.size(), 1);
+    BOOST_CHECK_EQUAL(result.innerList[0].name, "");
+    BOOST_CHECK_EQUAL(result.innerList[0].name.data(), innerName);
+    BOOST_CHECK_EQUAL(result.optional.get(), optional);
+    BOOST_CHECK_EQUAL(result.optional->weight, 0);
+
+    // Errors are the same as for a fresh decode
+    string doc = "{\"small\":1.5}";
+    BOOST_CHECK_THROW(decoder.decode(doc, result), std::exception);
+    BOOST_CHECK_EQUAL(indexedError(doc), streamingError(doc));
+}
@@ -0,0 +1,228 @@
+/* json_printing_bench.cc
+   Copyright (c) 2015 Datacratic Inc.  All rights reserved.
+
+   Printing speed of a typical message and of numbers and strings on their
+   own, with the stream and the string JSON printing contexts.
+
+   Usage: json_printing_bench [messages] [iterations]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "soa/types/basic_value_descriptions.h"
+#include "soa/types/json_printing.h"
+
+using namespace std;
+using namespace Datacratic;
+
+
+namespace {
+
+struct BenchSlot {
+    BenchSlot()
+        : width(0), height(0), reservePrice(0)
+    {
+    }
+
+    int width;
+    int height;
+    double reservePrice;
+    vector<string> formats;
+};
+
+CREATE_STRUCTURE_DESCRIPTION(BenchSlot);
+
+BenchSlotDescription::
+BenchSlotDescription()
+{
+    addField("width", &BenchSlot::width, "width in pixels");
+    addField("height", &BenchSlot::height, "height in pixels");
+    addField("reservePrice", &BenchSlot::reservePrice, "reserve price");
+    addField("formats", &BenchSlot::formats, "accepted formats");
+}
+
+struct BenchMessage {
+    BenchMessage()
+        : timestamp(0), userAge(0), secure(false)
+    {
+    }
+
+    double timestamp;
+    string exchange;
+    string url;
+    string userAgent;
+    long long userAge;
+    bool secure;
+    vector<BenchSlot> slots;
+    map<string, string> segments;
+};
+
+CREATE_STRUCTURE_DESCRIPTION(BenchMessage);
+
+BenchMessageDescription::
+BenchMessageDescription()
+{
+    addField("timestamp", &BenchMessage::timestamp, "seconds since epoch");
+    addField("exchange", &BenchMessage::exchange, "source exchange");
+    addField("url", &BenchMessage::url, "page url");
+    addField("userAgent", &BenchMessage::userAgent, "user agent");
+    addField("userAge", &BenchMessage::userAge, "age of the user id");
+    addField("secure", &BenchMessage::secure, "https page");
+    addField("slots", &BenchMessage::slots, "ad slots");
+    addField("segments", &BenchMessage::segments, "segments of the user");
+}
+
+vector<BenchMessage> makeMessages(int numMessages)
+{
+    mt19937 rng(1);
+    vector<BenchMessage> result(numMessages);
+
+    for (int i = 0;  i < numMessages;  ++i) {
+        BenchMessage & msg = result[i];
+        msg.timestamp = 1420070400.0 + i * 0.001;
+        msg.exchange = "exchange" + to_string(rng() % 10);
+        msg.url = "http://www.example.com/section/" + to_string(rng())
+            + "/article.html?ref=\"home\"";
+        msg.userAgent = "Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36"
+            " (KHTML, like Gecko) Chrome/41.0.2272.89 Safari/537.36";
+        msg.userAge = rng() % 100000;
+        msg.secure = rng() % 2;
+
+        msg.slots.resize(1 + rng() % 3);
+        for (BenchSlot & slot: msg.slots) {
+            slot.width = 300;
+            slot.height = 250;
+            slot.reservePrice = (rng() % 1000) * 0.001;
+            slot.formats = { "300x250", "320x50" };
+        }
+
+        for (int j = 0, n = rng() % 8;  j < n;  ++j)
+            msg.segments["segment" + to_string(rng() % 100)]
+                = to_string(rng() % 1000);
+    }
+
+    return result;
+}
+
+double seconds(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now()
+                                    - start).count();
+}
+
+void print(const char * name, size_t count, size_t bytes, double elapsed)
+{
+    ::printf("%-24s %12.1f %12.1f\n", name, elapsed * 1e9 / count,
+             1e-6 * bytes / elapsed);
+}
+
+/* Print each value with a fresh stream context, like jsonEncodeToStream() */
+template<typename Values, typename Fn>
+void benchStream(const char * name, const Values & values, int iterations,
+                 const Fn & printOne)
+{
+    size_t bytes = 0;
+    auto start = chrono::steady_clock::now();
+    for (int it = 0;  it < iterations;  ++it) {
+        for (auto & v: values) {
+            ostringstream stream;
+            StreamJsonPrintingContext context(stream);
+            printOne(v, context);
+            bytes += stream.str().size();
+        }
+    }
+    print(name, values.size() * iterations, bytes, seconds(start));
+}
+
+/* Print each value with the same string context, cleared in between */
+template<typename Values, typename Fn>
+void benchString(const char * name, const Values & values, int iterations,
+                 const Fn & printOne)
+{
+    StringJsonPrintingContext context;
+    size_t bytes = 0;
+    auto start = chrono::steady_clock::now();
+    for (int it = 0;  it < iterations;  ++it) {
+        for (auto & v: values) {
+            context.clear();
+            printOne(v, context);
+            bytes += context.size();
+        }
+    }
+    print(name, values.size() * iterations, bytes, seconds(start));
+}
+
+template<typename Values, typename Fn>
+void bench(const char * name, const Values & values, int iterations,
+           const Fn & printOne)
+{
+    benchStream((string(name) + " stream").c_str(), values, iterations,
+                printOne);
+    benchString((string(name) + " string").c_str(), values, iterations,
+                printOne);
+}
+
+} // file scope
+
+
+int main(int argc, char ** argv)
+{
+    int numMessages = argc > 1 ? atoi(argv[1]) : 10000;
+    int iterations = argc > 2 ? atoi(argv[2]) : 10;
+
+    vector<BenchMessage> messages = makeMessages(numMessages);
+
+    mt19937 rng(2);
+    vector<double> doubles, prices;
+    vector<long long> ints;
+    vector<string> strings;
+    for (int i = 0;  i < numMessages;  ++i) {
+        doubles.push_back(uniform_real_distribution<double>(-1e6, 1e6)(rng));
+        prices.push_back((rng() % 100000) * 0.01);
+        ints.push_back((long long)rng() * rng());
+        strings.push_back(messages[i].url);
+    }
+
+    ::printf("%d values, %d iterations\n\n", numMessages, iterations);
+    ::printf("%-24s %12s %12s\n", "", "ns/value", "MB/s");
+
+    static auto desc = getDefaultDescriptionShared<BenchMessage>();
+    bench("message", messages, iterations,
+          [&] (const BenchMessage & msg, JsonPrintingContext & context)
+          {
+              desc->printJson(&msg, context);
+          });
+
+    bench("random double", doubles, iterations,
+          [] (double d, JsonPrintingContext & context)
+          {
+              context.writeDouble(d);
+          });
+
+    bench("price", prices, iterations,
+          [] (double d, JsonPrintingContext & context)
+          {
+              context.writeDouble(d);
+          });
+
+    bench("long long", ints, iterations,
+          [] (long long i, JsonPrintingContext & context)
+          {
+              context.writeLongLong(i);
+          });
+
+    bench("string", strings, iterations,
+          [] (const string & s, JsonPrintingContext & context)
+          {
+              context.writeString(s);
+          });
+
+    return 0;
+}
@@ -5,5 +5,10 @@ $(eval $(call test,string_test,types arch utils boost_regex,boost))
 $(eval $(call test,json_handling_test,types arch utils value_description,boost))
 $(eval $(call test,value_description_test,types arch utils value_description,boost))
 $(eval $(call test,value_instance_test,types arch utils value_description,boost))
+$(eval $(call test,binary_serialization_test,types arch utils value_description,boost))
+$(eval $(call test,json_indexed_parsing_test,types arch utils value_description,boost))
 $(eval $(call test,periodic_utils_test,types,boost))
 $(eval $(call program,id_profile,types))
+$(eval $(call program,binary_serialization_bench,types value_description))
+$(eval $(call program,json_indexed_parsing_bench,types value_description))
+$(eval $(call program,json_printing_bench,types value_description))
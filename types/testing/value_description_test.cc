@@ -372,6 +372,187 @@ BOOST_AUTO_TEST_CASE( test_structure_description )
     BOOST_CHECK_EQUAL(keys[2], "LARGE");
 }
 
+BOOST_AUTO_TEST_CASE( test_structure_field_table )
+{
+    // Many names with the same lengths, prefixes and suffixes
+    vector<string> names = { "", "f", "field", "fieldfield" };
+    for (int i = 0;  i < 200;  ++i)
+        names.push_back("field" + to_string(i));
+
+    StructureDescriptionBase::Fields fields;
+    for (auto & name: names)
+        fields[name.c_str()].fieldName = name;
+
+    StructureDescriptionBase::FieldTable table;
+    BOOST_REQUIRE(table.build(fields));
+
+    for (auto & name: names) {
+        const ValueDescription::FieldDescription * fd = table.find(name.c_str());
+        BOOST_REQUIRE(fd);
+        BOOST_CHECK_EQUAL(fd->fieldName, name);
+    }
+
+    for (const char * name: { "fiel", "field200", "field1 ", "Field1", "g" })
+        BOOST_CHECK(!table.find(name));
+
+    // The descriptions use it for their lookups
+    std::shared_ptr<const ValueDescription> vd =
+        ValueDescription::get("SomeTestStructure");
+    auto structDesc = dynamic_cast<const StructureDescriptionBase *>(vd.get());
+    BOOST_REQUIRE(structDesc);
+    BOOST_CHECK(!structDesc->fieldTable.empty());
+    BOOST_CHECK(vd->hasField(nullptr, "someText"));
+    BOOST_CHECK(!vd->hasField(nullptr, "someTex"));
+}
+
+BOOST_AUTO_TEST_CASE( test_structure_member_stats )
+{
+    auto desc = getDefaultDescriptionShared<SomeTestStructure>();
+    auto structDesc = dynamic_cast<const StructureDescriptionBase *>(desc.get());
+    BOOST_REQUIRE(structDesc);
+    structDesc->resetMemberStats();
+
+    Json::Value json;
+    json["someId"] = 1;
+    json["someText"] = "hello";
+    jsonDecode<SomeTestStructure>(json);
+
+    BOOST_CHECK_EQUAL(structDesc->memberStats().members, 2);
+    BOOST_CHECK_EQUAL(structDesc->memberStats().unknownMembers, 0);
+
+    // Unknown members are counted even when they make parsing fail
+    json["someOtherText"] = "world";
+    BOOST_CHECK_THROW(jsonDecode<SomeTestStructure>(json), ML::Exception);
+
+    BOOST_CHECK_EQUAL(structDesc->memberStats().members, 4);
+    BOOST_CHECK_EQUAL(structDesc->memberStats().unknownMembers, 1);
+}
+
+struct LazyInner {
+    LazyInner()
+        : a(0)
+    {
+    }
+
+    int a;
+    vector<int> b;
+};
+
+CREATE_STRUCTURE_DESCRIPTION(LazyInner);
+
+LazyInnerDescription::
+LazyInnerDescription()
+{
+    addField("a", &LazyInner::a, "");
+    addField("b", &LazyInner::b, "");
+}
+
+struct LazyOuter {
+    LazyOuter()
+        : id(0)
+    {
+    }
+
+    int id;
+    Lazy<LazyInner> ext;
+};
+
+CREATE_STRUCTURE_DESCRIPTION(LazyOuter);
+
+LazyOuterDescription::
+LazyOuterDescription()
+{
+    addField("id", &LazyOuter::id, "");
+    addField("ext", &LazyOuter::ext, "");
+}
+
+BOOST_AUTO_TEST_CASE( test_lazy_value_description )
+{
+    // The value is recorded as is and printed back unchanged
+    string doc = "{\"id\":1,\"ext\":{\"a\": 2 , \"b\":[3,4]}}";
+    LazyOuter outer = jsonDecodeStr<LazyOuter>(doc);
+    BOOST_CHECK_EQUAL(outer.ext.json(), "{\"a\": 2 , \"b\":[3,4]}");
+    BOOST_CHECK(!outer.ext.isDecoded());
+    BOOST_CHECK_EQUAL(jsonEncodeStr(outer), doc);
+
+    // Decoded on access, still printed unchanged
+    BOOST_CHECK_EQUAL(outer.ext->a, 2);
+    BOOST_CHECK_EQUAL(outer.ext->b.size(), 2);
+    BOOST_CHECK(outer.ext.isDecoded());
+    BOOST_CHECK_EQUAL(jsonEncodeStr(outer), doc);
+
+    // Printed from the value once modified
+    outer.ext.mutate().a = 5;
+    BOOST_CHECK_EQUAL(jsonEncodeStr(outer),
+                      "{\"id\":1,\"ext\":{\"a\":5,\"b\":[3,4]}}");
+
+    // Copies keep both the text and the value
+    LazyOuter copy = jsonDecodeStr<LazyOuter>(doc);
+    copy.ext.get();
+    LazyOuter copy2 = copy;
+    BOOST_CHECK_EQUAL(copy2.ext.json(), copy.ext.json());
+    BOOST_CHECK_EQUAL(copy2.ext->a, 2);
+
+    // Contexts without the text of the document print the value back
+    Json::Value json = jsonDecodeStr<Json::Value>(doc);
+    LazyOuter structured = jsonDecode<LazyOuter>(json);
+    BOOST_CHECK_EQUAL(structured.ext.json(), "{\"a\":2,\"b\":[3,4]}");
+    BOOST_CHECK_EQUAL(structured.ext->b[1], 4);
+
+    // Empty values are not printed
+    LazyOuter empty;
+    BOOST_CHECK_EQUAL(jsonEncodeStr(empty), "{\"id\":0}");
+    BOOST_CHECK_EQUAL(empty.ext->a, 0);
+
+    // Errors in the value only show up when it is decoded
+    LazyOuter invalid = jsonDecodeStr<LazyOuter>("{\"ext\":{\"a\":\"x\"}}");
+    BOOST_CHECK_THROW(invalid.ext.get(), std::exception);
+    BOOST_CHECK_THROW(jsonDecodeStr<LazyOuter>("{\"ext\":{\"a\":tru}}"),
+                      std::exception);
+}
+
+struct LazyInnerRenamedDescription
+    : public StructureDescription<LazyInner> {
+    LazyInnerRenamedDescription()
+    {
+        addField("alpha", &LazyInner::a, "");
+    }
+};
+
+struct LazyRenamed {
+    Lazy<LazyInner> ext;
+};
+
+CREATE_STRUCTURE_DESCRIPTION(LazyRenamed);
+
+LazyRenamedDescription::
+LazyRenamedDescription()
+{
+    addField("ext", &LazyRenamed::ext, "",
+             new DefaultDescription<Lazy<LazyInner> >
+                 (new LazyInnerRenamedDescription()));
+}
+
+BOOST_AUTO_TEST_CASE( test_lazy_custom_description )
+{
+    // The value is decoded with the same description it is printed with
+    string doc = "{\"ext\":{\"alpha\":3}}";
+    LazyRenamed renamed = jsonDecodeStr<LazyRenamed>(doc);
+    BOOST_CHECK_EQUAL(renamed.ext->a, 3);
+
+    renamed.ext.mutate().a = 4;
+    BOOST_CHECK_EQUAL(jsonEncodeStr(renamed), "{\"ext\":{\"alpha\":4}}");
+
+    // The description goes along with copies of the recorded text
+    LazyRenamed copy = jsonDecodeStr<LazyRenamed>(doc);
+    LazyRenamed copy2 = copy;
+    BOOST_CHECK_EQUAL(copy2.ext->a, 3);
+
+    BOOST_CHECK_THROW(jsonDecodeStr<LazyRenamed>("{\"ext\":{\"a\":3}}")
+                      .ext.get(),
+                      std::exception);
+}
+
 struct S1 {
     string val1;
 };
@@ -33,6 +33,8 @@ LIBVALUE_DESCRIPTION_SOURCES := \
 	value_description.cc \
 	json_parsing.cc \
 	json_printing.cc \
+	json_indexed_parsing.cc \
+	binary_serialization.cc \
 	periodic_utils_value_descriptions.cc
 
 LIBVALUE_DESCRIPTION_LINK := \
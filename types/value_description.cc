@@ -7,6 +7,7 @@
 */
 
 
+#include <algorithm>
 #include <mutex>
 #if 0
 #include "jml/arch/demangle.h"
@@ -136,6 +137,8 @@ operator = (const StructureDescriptionBase & other)
             .first;
         orderedFields.push_back(it);
     }
+
+    updateFieldTable();
 }
 
 void
@@ -148,7 +151,125 @@ operator = (StructureDescriptionBase && other)
     fields = std::move(other.fields);
     fieldNames = std::move(other.fieldNames);
     orderedFields = std::move(other.orderedFields);
+    updateFieldTable();
     // don't set owner
 }
 
+void
+StructureDescriptionBase::
+resetUnseenFields(void * output, const SeenFields & seen) const
+{
+    const void * defaultStruct = defaultInstance();
+
+    for (auto & it: orderedFields) {
+        const FieldDescription & fd = it->second;
+        if (seen.contains(fd.fieldNum))
+            continue;
+
+        void * field = addOffset(output, fd.offset);
+        if (defaultStruct)
+            fd.description->resetValue(field,
+                                       addOffset(defaultStruct, fd.offset));
+        else fd.description->setDefault(field);
+    }
+}
+
+bool
+StructureDescriptionBase::FieldTable::
+build(const Fields & fields)
+{
+    entries.clear();
+    displacements.clear();
+
+    size_t n = fields.size();
+    if (n == 0)
+        return true;
+
+    // Around 1.25 entries per field and 2 fields per bucket, both rounded up
+    // to a power of two so that they can be masked
+    size_t numEntries = 1, numBuckets = 1;
+    while (numEntries < n + n / 4)
+        numEntries *= 2;
+    while (numBuckets * 2 < n)
+        numBuckets *= 2;
+
+    struct Key {
+        const char * name;
+        size_t length;
+        uint64_t hash;
+        const FieldDescription * field;
+    };
+
+    for (seed = 0;  seed < 16;  ++seed) {
+        entries.assign(numEntries, Entry());
+        displacements.assign(numBuckets, 0);
+
+        std::vector<std::vector<Key> > buckets(numBuckets);
+        for (auto & f: fields) {
+            Key key;
+            key.name = f.first;
+            key.hash = hash(f.first, key.length, seed);
+            key.field = &f.second;
+            buckets[(key.hash >> 32) & (numBuckets - 1)].push_back(key);
+        }
+
+        // Place the largest buckets first, while there is the most room
+        std::vector<size_t> order(numBuckets);
+        for (size_t i = 0;  i < numBuckets;  ++i)
+            order[i] = i;
+        std::stable_sort(order.begin(), order.end(),
+                         [&] (size_t b1, size_t b2)
+                         {
+                             return buckets[b1].size() > buckets[b2].size();
+                         });
+
+        bool placedAll = true;
+        std::vector<size_t> slots;
+
+        for (size_t b: order) {
+            const std::vector<Key> & bucket = buckets[b];
+            if (bucket.empty())
+                break;
+
+            bool placed = false;
+            for (uint32_t d = 0;  d < 65536 && !placed;  ++d) {
+                slots.clear();
+                placed = true;
+                for (const Key & key: bucket) {
+                    size_t s = slot(key.hash, d, numEntries - 1);
+                    if (entries[s].field
+                        || std::find(slots.begin(), slots.end(), s)
+                           != slots.end()) {
+                        placed = false;
+                        break;
+                    }
+                    slots.push_back(s);
+                }
+
+                if (placed) {
+                    displacements[b] = d;
+                    for (size_t i = 0;  i < bucket.size();  ++i) {
+                        Entry & entry = entries[slots[i]];
+                        entry.name = bucket[i].name;
+                        entry.length = bucket[i].length;
+                        entry.field = bucket[i].field;
+                    }
+                }
+            }
+
+            if (!placed) {
+                placedAll = false;
+                break;
+            }
+        }
+
+        if (placedAll)
+            return true;
+    }
+
+    entries.clear();
+    displacements.clear();
+    return false;
+}
+
 } // namespace Datacratic
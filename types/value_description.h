@@ -10,6 +10,7 @@
 
 #include <string.h>
 #include <string>
+#include <atomic>
 #include <memory>
 #include <unordered_map>
 #include <set>
@@ -20,6 +21,7 @@
 #include "jml/utils/filter_streams.h"
 #include "jml/utils/smart_ptr_utils.h"
 #include "json_parsing.h"
+#include "json_indexed_parsing.h"
 #include "json_printing.h"
 #include "value_description_fwd.h"
 #include "soa/utils/type_traits.h"
@@ -110,6 +112,13 @@ struct ValueDescription {
     virtual void printJson(const void * val, JsonPrintingContext & context) const = 0;
     virtual bool isDefault(const void * val) const = 0;
     virtual void setDefault(void * val) const = 0;
+
+    /** Make val equal to defaultVal, reusing the memory that val already
+        holds.  Types that can't be copied are set to their default value
+        instead.
+    */
+    virtual void resetValue(void * val, const void * defaultVal) const = 0;
+
     virtual void copyValue(const void * from, void * to) const = 0;
     virtual void moveValue(void * from, void * to) const = 0;
     virtual void swapValues(void * from, void * to) const = 0;
@@ -354,6 +363,7 @@ struct PureValueDescription : public ValueDescription {
     virtual void printJson(const void * val, JsonPrintingContext & context) const {};
     virtual bool isDefault(const void * val) const { return false; }
     virtual void setDefault(void * val) const {}
+    virtual void resetValue(void * val, const void * defaultVal) const {}
     virtual void copyValue(const void * from, void * to) const {}
     virtual void moveValue(void * from, void * to) const {}
     virtual void swapValues(void * from, void * to) const {}
@@ -422,6 +432,12 @@ struct ValueDescriptionT : public ValueDescription {
         *val = T();
     }
 
+    virtual void resetValue(void * val, const void * defaultVal) const
+    {
+        resetValue(val, defaultVal,
+                   typename Datacratic::is_copy_assignable<T>::type());
+    }
+
     virtual void copyValue(const void * from, void * to) const
     {
         copyValue(to, from, typename Datacratic::is_copy_assignable<T>::type());
@@ -494,6 +510,16 @@ private:
         throw ML::Exception("type is not copy assignable");
     }
 
+    void resetValue(void * val, const void * defaultVal, std::true_type) const
+    {
+        copyValue(val, defaultVal, std::true_type());
+    }
+
+    void resetValue(void * val, const void * defaultVal, std::false_type) const
+    {
+        setDefault(val);
+    }
+
 
     void moveValue(void* obj, void* value, std::true_type) const
     {
@@ -751,7 +777,9 @@ struct StructureDescriptionBase {
         : type(type),
           structName(structName.empty() ? ML::demangle(type->name()) : structName),
           nullAccepted(nullAccepted),
-          owner(owner)
+          owner(owner),
+          numMembers(0),
+          numUnknownMembers(0)
     {
     }
 
@@ -806,6 +834,169 @@ struct StructureDescriptionBase {
 
     std::vector<Fields::const_iterator> orderedFields;
 
+    /** Perfect hash table from member name to field, so that dispatching a
+        member while parsing takes a single probe instead of a walk down the
+        fields map.  It uses hash and displace: the name is hashed once, the
+        hash selects a bucket, and the displacement of that bucket places
+        its names into distinct entries.  It is rebuilt whenever a field is
+        added.
+    */
+    struct FieldTable {
+        FieldTable()
+            : seed(0)
+        {
+        }
+
+        struct Entry {
+            Entry()
+                : name(nullptr), length(0), field(nullptr)
+            {
+            }
+
+            const char * name;
+            size_t length;
+            const FieldDescription * field;
+        };
+
+        std::vector<Entry> entries;
+        std::vector<uint32_t> displacements;
+        uint64_t seed;
+
+        /** Build the table for the given fields.  Returns false if no
+            perfect hash was found, in which case find() can't be used.
+        */
+        bool build(const Fields & fields);
+
+        bool empty() const
+        {
+            return entries.empty();
+        }
+
+        static uint64_t hash(const char * name, size_t & length,
+                             uint64_t seed)
+        {
+            uint64_t result = seed ^ 0xcbf29ce484222325ULL;
+            const char * p = name;
+            for (;  *p;  ++p)
+                result = (result ^ (unsigned char)*p) * 0x100000001b3ULL;
+            length = p - name;
+
+            // The last characters only reach the low bits; mix them up
+            // since the bucket is taken from the high bits
+            result ^= result >> 29;
+            result *= 0xbf58476d1ce4e5b9ULL;
+            result ^= result >> 32;
+            return result;
+        }
+
+        static size_t slot(uint64_t hash, uint32_t displacement, size_t mask)
+        {
+            uint64_t h = hash + displacement * 0x9e3779b97f4a7c15ULL;
+            h ^= h >> 33;
+            h *= 0xff51afd7ed558ccdULL;
+            h ^= h >> 33;
+            return h & mask;
+        }
+
+        const FieldDescription * find(const char * name) const
+        {
+            size_t length;
+            uint64_t h = hash(name, length, seed);
+            uint32_t d = displacements[(h >> 32) & (displacements.size() - 1)];
+            const Entry & entry = entries[slot(h, d, entries.size() - 1)];
+            if (entry.field && entry.length == length
+                && memcmp(entry.name, name, length) == 0)
+                return entry.field;
+            return nullptr;
+        }
+    };
+
+    FieldTable fieldTable;
+
+    /** Rebuild fieldTable after the fields have changed. */
+    void updateFieldTable()
+    {
+        if (!fieldTable.build(fields))
+            fieldTable = FieldTable();
+    }
+
+    /** Look up a field by name. */
+    const FieldDescription * findField(const char * name) const
+    {
+        if (!fieldTable.empty())
+            return fieldTable.find(name);
+        auto it = fields.find(name);
+        if (it != fields.end())
+            return &it->second;
+        return nullptr;
+    }
+
+    /** Number of members parsed into this structure, and how many of those
+        were not known fields, for monitoring the unknown field rate.
+        Documents that parseJsonIndexed() parses a second time are counted
+        twice.
+    */
+    struct MemberStats {
+        uint64_t members;
+        uint64_t unknownMembers;
+    };
+
+    MemberStats memberStats() const
+    {
+        return { numMembers.load(std::memory_order_relaxed),
+                 numUnknownMembers.load(std::memory_order_relaxed) };
+    }
+
+    void resetMemberStats() const
+    {
+        numMembers = 0;
+        numUnknownMembers = 0;
+    }
+
+    // Members are counted once per object, to keep the shared counters
+    // off the per member path
+    mutable std::atomic<uint64_t> numMembers;
+    mutable std::atomic<uint64_t> numUnknownMembers;
+
+    /** Default constructed structure that the fields are reset from when
+        parsing with JsonParsingContext::reuseOutput, or null if the
+        structure can't be default constructed.
+    */
+    virtual const void * defaultInstance() const = 0;
+
+    /// Fields found while parsing a structure in place
+    struct SeenFields {
+        SeenFields(size_t numFields)
+            : small(0)
+        {
+            if (numFields > 64)
+                large.resize(numFields);
+        }
+
+        void insert(int fieldNum)
+        {
+            if (large.empty())
+                small |= uint64_t(1) << fieldNum;
+            else large[fieldNum] = true;
+        }
+
+        bool contains(int fieldNum) const
+        {
+            if (large.empty())
+                return small & (uint64_t(1) << fieldNum);
+            return large[fieldNum];
+        }
+
+        uint64_t small;
+        std::vector<bool> large;
+    };
+
+    /** Reset the fields of output that were not seen to their value in the
+        default instance, so that parsing in place gives the same result as
+        parsing into a default constructed structure.
+    */
+    void resetUnseenFields(void * output, const SeenFields & seen) const;
+
     struct Exception: public ML::Exception {
         Exception(JsonParsingContext & context,
                   const std::string & message)
@@ -824,26 +1015,60 @@ struct StructureDescriptionBase {
 
             if (!onEntry(output, context)) return;
 
+            bool inPlace = context.reuseOutput;
+            SeenFields seen(inPlace ? fields.size() : 0);
+
             if (nullAccepted && context.isNull()) {
                 context.expectNull();
+                if (inPlace)
+                    resetUnseenFields(output, seen);
                 return;
             }
         
             if (!context.isObject())
                 context.exception("expected structure of type " + structName);
 
+            // Adds the members counted below to the statistics, even
+            // when parsing fails
+            struct MemberCounter {
+                MemberCounter(std::atomic<uint64_t> & total)
+                    : total(total), count(0)
+                {
+                }
+
+                ~MemberCounter()
+                {
+                    total.fetch_add(count, std::memory_order_relaxed);
+                }
+
+                std::atomic<uint64_t> & total;
+                uint64_t count;
+            } memberCounter(numMembers);
+
             auto onMember = [&] ()
                 {
+                    ++memberCounter.count;
+
                     try {
-                        auto n = context.fieldNamePtr();
-                        auto it = fields.find(n);
-                        if (it == fields.end()) {
+                        const FieldDescription * fd = nullptr;
+                        int num = context.memberFieldNum();
+                        if (num >= 0) {
+                            if ((size_t)num < orderedFields.size()
+                                && orderedFields[num]->second.fieldNum == num)
+                                fd = &orderedFields[num]->second;
+                        }
+                        else fd = findField(context.fieldNamePtr());
+
+                        if (!fd) {
+                            numUnknownMembers
+                                .fetch_add(1, std::memory_order_relaxed);
                             context.onUnknownField(owner);
                         }
                         else {
-                            it->second.description
-                                ->parseJson(addOffset(output,
-                                                      it->second.offset),
+                            if (inPlace)
+                                seen.insert(fd->fieldNum);
+                            fd->description
+                                ->parseJson(addOffset(output, fd->offset),
                                             context);
                         }
                     }
@@ -860,6 +1085,9 @@ struct StructureDescriptionBase {
 
             context.forEachMember(onMember);
 
+            if (inPlace)
+                resetUnseenFields(output, seen);
+
             onExit(output, context);
         }
         catch (const Exception & exc) {
@@ -883,7 +1111,7 @@ struct StructureDescriptionBase {
             auto mbr = addOffset(input, fd.offset);
             if (fd.description->isDefault(mbr))
                 continue;
-            context.startMember(it->first);
+            context.startField(it->first, fd.fieldNum);
             fd.description->printJson(mbr, context);
         }
         
@@ -957,6 +1185,13 @@ struct StructureDescription
         }
     }
 
+    virtual const void * defaultInstance() const
+    {
+        static const Struct * result
+            = makeDefaultInstance(typename Datacratic::is_default_constructible<Struct>::type());
+        return result;
+    }
+
     template<typename V, typename Base>
     void addField(std::string name,
                   V Base::* field,
@@ -992,6 +1227,7 @@ struct StructureDescription
         fd.offset = (size_t)&(p->*field);
         fd.fieldNum = fields.size() - 1;
         orderedFields.push_back(it);
+        updateFieldTable();
         //using namespace std;
         //cerr << "offset = " << fd.offset << endl;
     }
@@ -1021,10 +1257,7 @@ struct StructureDescription
     virtual const FieldDescription *
     hasField(const void * val, const std::string & field) const
     {
-        auto it = fields.find(field.c_str());
-        if (it != fields.end())
-            return &it->second;
-        return nullptr;
+        return findField(field.c_str());
     }
 
     virtual void forEachField(const void * val,
@@ -1038,9 +1271,9 @@ struct StructureDescription
     virtual const FieldDescription & 
     getField(const std::string & field) const
     {
-        auto it = fields.find(field.c_str());
-        if (it != fields.end())
-            return it->second;
+        const FieldDescription * fd = findField(field.c_str());
+        if (fd)
+            return *fd;
         throw ML::Exception("structure has no field " + field);
     }
 
@@ -1071,6 +1304,20 @@ struct StructureDescription
                 getEntry(0, obj->*member) = context.expectJson();
             };
     }
+
+private:
+    // Template parameter so not instantiated for structures that are not
+    // default constructible
+    template<typename X>
+    static const Struct * makeDefaultInstance(X)
+    {
+        return new Struct();
+    }
+
+    static const Struct * makeDefaultInstance(std::false_type)
+    {
+        return nullptr;
+    }
 };
 
 /** Base class for an implementation of a structure description.  It
@@ -1135,6 +1382,8 @@ addParent(ValueDescriptionT<V> * description_)
         fd.fieldNum = fields.size() - 1;
         orderedFields.push_back(it);
     }
+
+    updateFieldTable();
 }
 
 
@@ -1263,6 +1512,36 @@ struct ListDescriptionBase {
         context.forEachElement(onElement);
     }
 
+    /** Parse into the elements that the list already holds and only append
+        past them, so that their memory is reused.  Used when parsing with
+        JsonParsingContext::reuseOutput.
+    */
+    template<typename List>
+    void parseJsonTypedListInPlace(List * val, JsonParsingContext & context) const
+    {
+        if (!context.isArray()) {
+            val->clear();
+            context.exception("expected array of " + inner->typeName);
+        }
+
+        size_t n = 0;
+        auto onElement = [&] ()
+            {
+                if (n < val->size())
+                    inner->parseJsonTyped(&(*val)[n], context);
+                else {
+                    T el;
+                    inner->parseJsonTyped(&el, context);
+                    val->emplace_back(std::move(el));
+                }
+                ++n;
+            };
+
+        context.forEachElement(onElement);
+
+        val->erase(val->begin() + n, val->end());
+    }
+
     template<typename List>
     void parseJsonTypedSet(List * val, JsonParsingContext & context) const
     {
@@ -1325,7 +1604,9 @@ struct DefaultDescription<std::vector<T> >
 
     virtual void parseJsonTyped(std::vector<T> * val, JsonParsingContext & context) const
     {
-        this->parseJsonTypedList(val, context);
+        if (context.reuseOutput)
+            this->parseJsonTypedListInPlace(val, context);
+        else this->parseJsonTypedList(val, context);
     }
 
     virtual void printJson(const void * val, JsonPrintingContext & context) const
@@ -1788,11 +2069,53 @@ T jsonDecodeStr(const std::string & json, T * = 0,
     T result;
 
     static auto desc = getDefaultDescriptionShared<T>();
-    StreamingJsonParsingContext context(json, json.c_str(), json.c_str() + json.size());
-    desc->parseJson(&result, context);
+    parseJsonIndexed(json, json.c_str(), json.c_str() + json.size(),
+                     [&] (JsonParsingContext & context)
+                     {
+                         desc->parseJson(&result, context);
+                     },
+                     [&] ()
+                     {
+                         result = T();
+                     });
     return result;
 }
 
+/** Decodes JSON documents one after the other into the same object, reusing
+    the memory held by the previous result and by the index of the previous
+    document instead of allocating it again.  The result is the same as
+    what jsonDecodeStr() returns.  A decoder must only be used by one thread
+    at a time.
+*/
+template<typename T>
+struct JsonDecoder {
+    JsonDecoder(std::shared_ptr<const ValueDescriptionT<T> > desc
+                = getDefaultDescriptionShared((T *)0))
+        : desc(desc)
+    {
+    }
+
+    void decode(const std::string & json, T & result)
+    {
+        parseJsonIndexed(json, json.c_str(), json.c_str() + json.size(),
+                         [&] (JsonParsingContext & context)
+                         {
+                             context.reuseOutput = true;
+                             desc->parseJsonTyped(&result, context);
+                         },
+                         [&] ()
+                         {
+                             desc->setDefaultTyped(&result);
+                         },
+                         index);
+    }
+
+    std::shared_ptr<const ValueDescriptionT<T> > desc;
+
+private:
+    JsonStructuralIndex index;
+};
+
 // jsonDecode implementation for any type which:
 // 1) has a default description;
 // 2) does NOT have a fromJson() function (there is a simpler overload for this case)
@@ -1878,10 +2201,9 @@ std::string jsonEncodeStr(const T & obj,
                           typename std::enable_if<!hasToJson<T>::value>::type * = 0)
 {
     static auto desc = getDefaultDescriptionShared<T>();
-    std::ostringstream stream;
-    StreamJsonPrintingContext context(stream);
+    StringJsonPrintingContext context;
     desc->printJson(&obj, context);
-    return std::move(stream.str());
+    return context.str();
 }
 
 // jsonEncode implementation for any type which: